@@ -42,12 +42,24 @@ bool Alarm::Start(int _after) {
 
     int64_t seq = sg_seq++;
     uint64_t starttime = gettickcount();
+
+#ifdef ALARM_TIMER_SERVICE
+    uint64_t timer = TimerService::Instance().Add(_after, reg_async_.Get(), (MessageQueue::MessageTitle_t)this, boost::bind(&Alarm::__OnTimer, this, seq));
+
+    if (0 == timer) {
+        xerror2(TSF"timer service return null timer, id:%0, after:%1, seq:%2", (uintptr_t)this, _after, seq);
+        return false;
+    }
+
+    timer_ = timer;
+#else
     MessageQueue::MessagePost_t mqId = MessageQueue::BroadcastMessage(MessageQueue::GetDefMessageQueue(), MessageQueue::Message(KALARM_MESSAGETITLE, (int64_t)seq, 1), MessageQueue::MessageTiming(_after));
 
     if (MessageQueue::KNullPost == mqId) {
         xerror2(TSF"mq alarm return null post, id:%0, after:%1, seq:%2", (uintptr_t)this, _after, seq);
         return false;
     }
+#endif
 
 #ifdef ANDROID
 
@@ -64,13 +76,22 @@ bool Alarm::Start(int _after) {
     endtime_ = 0;
     after_ = _after;
     seq_ = seq;
+#ifdef ALARM_TIMER_SERVICE
+    xinfo2(TSF"alarm id:%0, after:%1, seq:%2, timer:%3", (uintptr_t)this, _after, seq, timer_);
+#else
     xinfo2(TSF"alarm id:%0, after:%1, seq:%2, po.reg.q:%3,po.reg.s:%4,po.s:%5", (uintptr_t)this, _after, seq, mqId.reg.queue, mqId.reg.seq, mqId.seq);
+#endif
 
     return true;
 }
 
 bool Alarm::Cancel() {
     ScopedLock lock(sg_lock);
+#ifdef ALARM_TIMER_SERVICE
+    // the timer goes first, one posted after CancelMessage would still run
+    if (0 != timer_) TimerService::Instance().Cancel(timer_);
+    timer_ = 0;
+#endif
     MessageQueue::CancelMessage(reg_async_.Get());
 
     if (INVAILD_SEQ == seq_) return true;
@@ -152,9 +173,28 @@ void Alarm::OnAlarm(const MessageQueue::MessagePost_t& _id, MessageQueue::Messag
 #endif
 
     xinfo2(TSF"runing") >> group;
+    __Fire(curtime);
+}
+
+// posted by TimerService to reg_async_
+void Alarm::__OnTimer(int64_t _seq) {
+    ScopedLock lock(sg_lock);
+
+    if (seq_ != _seq) return;
+
+    uint64_t curtime = gettickcount();
+    xinfo2(TSF"OnAlarm id:%_, seq:%_, elapsed:%_, after:%_", (uintptr_t)this, seq_, curtime - starttime_, after_);
+#ifdef ALARM_TIMER_SERVICE
+    timer_ = 0;
+#endif
+    __Fire(curtime);
+}
+
+// called with sg_lock held
+void Alarm::__Fire(uint64_t _curtime) {
     status_ = kOnAlarm;
     seq_ = INVAILD_SEQ;
-    endtime_ = curtime;
+    endtime_ = _curtime;
 
     if (inthread_)
         runthread_.start();
@@ -29,6 +29,13 @@
 #include "android/wakeuplock.h"
 #endif
 
+// on linux every alarm is a timer of the one TimerService thread. android keeps AlarmManager, which
+// wakes the device, and the broadcast alarm message.
+#if defined(__linux__) && !defined(ANDROID)
+#define ALARM_TIMER_SERVICE
+#include "comm/timer_service.h"
+#endif
+
 class Alarm {
   public:
     enum {
@@ -47,7 +54,11 @@ class Alarm {
         , inthread_(_inthread)
         , seq_(0), status_(kInit)
         , after_(0) , starttime_(0) , endtime_(0)
+#ifdef ALARM_TIMER_SERVICE
+        , timer_(0)
+#else
         , reg_(MessageQueue::InstallMessageHandler(boost::bind(&Alarm::OnAlarm, this, _1, _2), true))
+#endif
 #ifdef ANDROID
         , wakelock_(NULL)
 #endif
@@ -63,7 +74,11 @@ class Alarm {
         , inthread_(false)
         , seq_(0), status_(kInit)
         , after_(0) , starttime_(0) , endtime_(0)
+#ifdef ALARM_TIMER_SERVICE
+        , timer_(0)
+#else
         , reg_(MessageQueue::InstallMessageHandler(boost::bind(&Alarm::OnAlarm, this, _1, _2), true))
+#endif
 #ifdef ANDROID
         , wakelock_(NULL)
 #endif
@@ -73,7 +88,9 @@ class Alarm {
 
     virtual ~Alarm() {
         Cancel();
+#ifndef ALARM_TIMER_SERVICE
         reg_.CancelAndWait();
+#endif
         reg_async_.CancelAndWait();
         runthread_.join();
         delete target_;
@@ -97,6 +114,8 @@ class Alarm {
     Alarm& operator=(const Alarm&);
 
     void OnAlarm(const MessageQueue::MessagePost_t& _id, MessageQueue::Message& _message);
+    void __OnTimer(int64_t _seq);
+    void __Fire(uint64_t _curtime);
     virtual void    __Run();
 
   private:
@@ -112,7 +131,11 @@ class Alarm {
     uint64_t          			starttime_;
     uint64_t          			endtime_;
 
+#ifdef ALARM_TIMER_SERVICE
+    uint64_t                    timer_;
+#else
     MessageQueue::ScopeRegister reg_;
+#endif
 #ifdef ANDROID
     WakeUpLock*                 wakelock_;
 #endif
@@ -33,8 +33,8 @@ namespace mars {
     namespace comm {
         struct check_content {
             uintptr_t ptr;
-            std::string file;
-            std::string func;
+            const char* file;   // __FILE__/__func__ literals, no copy per check
+            const char* func;
             int line;
             int timeout;
             intmax_t tid;
@@ -19,6 +19,7 @@
  */
 
 #include "dns/dns.h"
+#include "dns/dns_resolver.h"
 #include "socket/unix_socket.h"
 #include "xlogger/xlogger.h"
 #include "time_utils.h"
@@ -29,6 +30,8 @@
 
 #include "network/getdnssvraddrs.h"
 
+static const uint32_t kSystemDNSTtl = 60;   // getaddrinfo says nothing of it
+
 enum {
     kGetIPDoing,
     kGetIPTimeout,
@@ -169,6 +172,30 @@ static void __GetIP() {
     }
 }
 
+// the system's name servers, on port 53 when they say none
+static void __NameServers(std::vector<socket_address>& _servers) {
+    std::vector<socket_address> found;
+    getdnssvraddrs(found);
+
+    for (std::vector<socket_address>::iterator iter = found.begin(); iter != found.end(); ++iter) {
+        if (!iter->valid()) continue;
+
+        sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, &iter->address(), iter->address_length());
+        if (AF_INET == addr.ss_family && 0 == ((sockaddr_in*)&addr)->sin_port) ((sockaddr_in*)&addr)->sin_port = htons(53);
+        if (AF_INET6 == addr.ss_family && 0 == ((sockaddr_in6*)&addr)->sin6_port) ((sockaddr_in6*)&addr)->sin6_port = htons(53);
+        _servers.push_back(socket_address((sockaddr*)&addr));
+    }
+}
+
+static DNSResolver& __Resolver() {
+    static DNSResolver& resolver = DNSResolver::Instance();
+    static bool init = (resolver.SetServerSource(&__NameServers), true);
+    (void)init;
+    return resolver;
+}
+
 ///////////////////////////////////////////////////////////////////
 DNS::DNS(DNSFunc _dnsfunc):dnsfunc_(_dnsfunc) {
 }
@@ -186,6 +213,27 @@ bool DNS::GetHostByName(const std::string& _host_name, std::vector<std::string>&
         return false;
     }
 
+    // our own queries first, getaddrinfo when they found nothing, it reads the hosts file too
+    int resolve_ret = DNSResolver::kResolveNoServer;
+    if (NULL == dnsfunc_) {
+        uint64_t time_start = gettickcount();
+        std::vector<std::string> resolved;
+        resolve_ret = __Resolver().Resolve(_host_name, resolved, millsec, this, _breaker);
+
+        if (DNSResolver::kResolveOK == resolve_ret) {
+            ips = resolved;
+            return true;
+        }
+
+        if (DNSResolver::kResolveCancel == resolve_ret || DNSResolver::kResolveNoName == resolve_ret) {
+            xinfo2(TSF"dns resolve ret:%_ host:%_", resolve_ret, _host_name);
+            return false;
+        }
+
+        millsec -= (long)(gettickcount() - time_start);
+        if (0 >= millsec) return false;
+    }
+
     ScopedLock lock(sg_mutex);
 
     if (_breaker && _breaker->isbreak) return false;
@@ -238,6 +286,7 @@ bool DNS::GetHostByName(const std::string& _host_name, std::vector<std::string>&
             if (kGetIPSuc == it->status) {
             	if (_host_name==it->host_name) {
 					ips = it->result;
+					if (!ips.empty() || DNSResolver::kResolveFail == resolve_ret) __Resolver().Store(_host_name, ips, kSystemDNSTtl);
 
 					if (_breaker) _breaker->dnsstatus = NULL;
 
@@ -260,6 +309,8 @@ bool DNS::GetHostByName(const std::string& _host_name, std::vector<std::string>&
                 if (_breaker) _breaker->dnsstatus = NULL;
 
                 xinfo2(TSF "dns get ip status:%_ host:%_, func:%_", it->status, it->host_name, it->dns_func);
+                // neither found it, not asked again for a while
+                if (kGetIPFail == it->status && DNSResolver::kResolveFail == resolve_ret) __Resolver().Store(_host_name, std::vector<std::string>(), 0);
                 sg_dnsinfo_vec.erase(it);
                 return false;
             }
@@ -278,6 +329,8 @@ bool DNS::GetHostByName(const std::string& _host_name, std::vector<std::string>&
 
 void DNS::Cancel(const std::string& _host_name) {
     xverbose_function();
+    __Resolver().Cancel(this, _host_name);
+
     ScopedLock lock(sg_mutex);
 
     for (unsigned int i = 0; i < sg_dnsinfo_vec.size(); ++i) {
@@ -296,6 +349,8 @@ void DNS::Cancel(const std::string& _host_name) {
 }
 
 void DNS::Cancel(DNSBreaker& _breaker) {
+    __Resolver().Cancel(_breaker);
+
     ScopedLock lock(sg_mutex);
     _breaker.isbreak = true;
 
@@ -303,3 +358,7 @@ void DNS::Cancel(DNSBreaker& _breaker) {
 
     sg_condition.notifyAll();
 }
+
+void DNS::ClearCache() {
+    __Resolver().Reset();
+}
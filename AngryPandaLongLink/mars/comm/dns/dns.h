@@ -44,6 +44,9 @@ class DNS {
     bool GetHostByName(const std::string& _host_name, std::vector<std::string>& ips, long millsec = 2 * 1000, DNSBreaker* _breaker = NULL);
     void Cancel(const std::string& _host_name = std::string());
     void Cancel(DNSBreaker& _breaker);
+
+    // forget the answers kept from the name servers, for a network change
+    static void ClearCache();
     
     void SetMonitorFunc(const boost::function<void (int _key)>& _monitor_func) {
     	monitor_func_ = _monitor_func;
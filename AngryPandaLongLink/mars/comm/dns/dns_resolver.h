@@ -0,0 +1,923 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * dns_resolver.h
+ *
+ * a stub resolver for DNS::GetHostByName. one thread sends the A and AAAA queries of every lookup in
+ * flight over udp to the system's name servers, over tcp when an answer comes back truncated, and
+ * lookups of a host already in flight wait for the same answer. answers are kept for their ttl, names
+ * the system did not find either for kNegativeTtlS, and an expired answer is still handed out for
+ * kStaleMs while it is asked for again. only ipv4 addresses are handed out, as getaddrinfo gave them.
+ *
+ * against forged answers every query has a random id and a socket of its own, so a port the system
+ * picked, and an answer is taken only from a server the query went to.
+ *
+ * the wire format is that of sdt/src/checkimpl/dnsquery.cc, with every read checked against the length.
+ */
+
+#ifndef COMM_DNS_DNS_RESOLVER_H_
+#define COMM_DNS_DNS_RESOLVER_H_
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <wincrypt.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "boost/bind.hpp"
+#include "boost/function.hpp"
+
+#include "comm/dns/dns.h"
+#include "comm/socket/socket_address.h"
+#include "comm/socket/socketselect.h"
+#include "comm/socket/unix_socket.h"
+#include "comm/thread/condition.h"
+#include "comm/thread/lock.h"
+#include "comm/thread/thread.h"
+#include "comm/time_utils.h"
+
+namespace dns_wire {
+
+static const uint16_t kTypeA = 1;
+static const uint16_t kTypeCNAME = 5;
+static const uint16_t kTypeAAAA = 28;
+static const uint16_t kClassIN = 1;
+static const int kRcodeNoError = 0;
+static const int kRcodeNXDomain = 3;
+static const size_t kUdpLength = 512;
+
+struct Answer {
+    Answer(): rcode(-1), ttl(0), truncated(false) {}
+
+    int                       rcode;
+    uint32_t                  ttl;        // the lowest of the records used
+    bool                      truncated;
+    std::vector<std::string>  ips;
+};
+
+// lower case and without the last dot, the way names are compared
+inline std::string Normalize(const std::string& _host) {
+    std::string host(_host);
+    if (!host.empty() && '.' == host[host.size() - 1]) host.erase(host.size() - 1);
+    for (size_t i = 0; i < host.size(); ++i) host[i] = (char)tolower((unsigned char)host[i]);
+    return host;
+}
+
+inline bool BuildQuery(uint16_t _id, const std::string& _host, uint16_t _qtype, std::string& _out) {
+    const unsigned char header[12] = {(unsigned char)(_id >> 8), (unsigned char)_id, 0x01 /* rd */, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+    _out.assign((const char*)header, sizeof(header));
+
+    std::string host = Normalize(_host);
+    if (host.empty() || 253 < host.size()) return false;
+
+    size_t start = 0;
+    while (start <= host.size()) {
+        size_t dot = host.find('.', start);
+        if (std::string::npos == dot) dot = host.size();
+        size_t length = dot - start;
+        if (0 == length || 63 < length) return false;
+
+        _out += (char)length;
+        _out.append(host, start, length);
+        start = dot + 1;
+    }
+
+    const unsigned char question[5] = {0, (unsigned char)(_qtype >> 8), (unsigned char)_qtype, 0, (unsigned char)kClassIN};
+    _out.append((const char*)question, sizeof(question));
+    return true;
+}
+
+inline uint16_t __Read16(const unsigned char* _p) { return (uint16_t)((_p[0] << 8) | _p[1]); }
+inline uint32_t __Read32(const unsigned char* _p) { return ((uint32_t)_p[0] << 24) | ((uint32_t)_p[1] << 16) | ((uint32_t)_p[2] << 8) | _p[3]; }
+
+// the name at _pos, _pos moves past it. false when it points out of the message or loops.
+inline bool __ReadName(const unsigned char* _msg, size_t _length, size_t& _pos, std::string& _name) {
+    _name.clear();
+    size_t pos = _pos;
+    bool jumped = false;
+    int jumps = 0;
+
+    while (true) {
+        if (pos >= _length) return false;
+        unsigned char label = _msg[pos];
+
+        if (0 == label) {
+            if (!jumped) _pos = pos + 1;
+            return true;
+        }
+
+        if (0xC0 == (label & 0xC0)) {
+            if (pos + 1 >= _length || 32 < ++jumps) return false;
+            if (!jumped) _pos = pos + 2;
+            jumped = true;
+            pos = ((size_t)(label & 0x3F) << 8) | _msg[pos + 1];
+            continue;
+        }
+
+        if (0 != (label & 0xC0) || pos + 1 + label > _length) return false;
+        if (!_name.empty()) _name += '.';
+        for (size_t i = 0; i < label; ++i) _name += (char)tolower(_msg[pos + 1 + i]);
+        if (255 < _name.size()) return false;
+        pos += 1 + label;
+    }
+}
+
+// the addresses of _qtype for _host in a response to query _id, through the CNAMEs in the answer.
+// false if it is not such a response or is broken.
+inline bool ParseResponse(const void* _msg, size_t _length, uint16_t _id, const std::string& _host, uint16_t _qtype, Answer& _answer) {
+    const unsigned char* msg = (const unsigned char*)_msg;
+    if (12 > _length || _id != __Read16(msg) || 0 == (msg[2] & 0x80)) return false;
+    if (1 != __Read16(msg + 4)) return false;
+
+    _answer = Answer();
+    _answer.truncated = 0 != (msg[2] & 0x02);
+    _answer.rcode = msg[3] & 0x0F;
+    size_t answer_count = __Read16(msg + 6);
+
+    size_t pos = 12;
+    std::string name;
+    if (!__ReadName(msg, _length, pos, name) || name != Normalize(_host)) return false;
+    if (pos + 4 > _length || _qtype != __Read16(msg + pos)) return false;
+    pos += 4;
+
+    if (_answer.truncated) return true;
+
+    struct Record {
+        std::string owner;
+        uint16_t    type;
+        uint32_t    ttl;
+        std::string data;   // the address, or the name a CNAME points at
+    };
+    std::vector<Record> records;
+
+    for (size_t i = 0; i < answer_count; ++i) {
+        Record record;
+        if (!__ReadName(msg, _length, pos, record.owner) || pos + 10 > _length) return false;
+        record.type = __Read16(msg + pos);
+        uint16_t klass = __Read16(msg + pos + 2);
+        record.ttl = __Read32(msg + pos + 4);
+        size_t data_length = __Read16(msg + pos + 8);
+        pos += 10;
+        if (pos + data_length > _length) return false;
+
+        if (kClassIN == klass) {
+            if (kTypeCNAME == record.type) {
+                size_t target = pos;
+                if (!__ReadName(msg, _length, target, record.data)) return false;
+                records.push_back(record);
+            } else if (_qtype == record.type && (kTypeA == _qtype ? 4 : 16) == data_length) {
+                record.data.assign((const char*)msg + pos, data_length);
+                records.push_back(record);
+            }
+        }
+        pos += data_length;
+    }
+
+    uint32_t ttl = 0xFFFFFFFF;
+    std::string owner = Normalize(_host);
+    for (int hops = 0; hops < 8; ++hops) {
+        std::string next;
+        for (std::vector<Record>::iterator it = records.begin(); it != records.end(); ++it) {
+            if (owner != it->owner) continue;
+            if (kTypeCNAME == it->type) {
+                next = it->data;
+                ttl = std::min(ttl, it->ttl);
+                continue;
+            }
+
+            // some operators answer 0.0.0.0 for names without ipv6, as getaddrinfo skips it in dns.cc
+            if (kTypeA == _qtype && std::string(4, '\0') == it->data) continue;
+
+            char ip[64] = {0};
+            if (NULL == socket_inet_ntop(kTypeA == _qtype ? AF_INET : AF_INET6, it->data.data(), ip, sizeof(ip))) continue;
+            _answer.ips.push_back(ip);
+            ttl = std::min(ttl, it->ttl);
+        }
+        if (!_answer.ips.empty() || next.empty()) break;
+        owner = next;
+    }
+
+    _answer.ttl = _answer.ips.empty() ? 0 : ttl;
+    return true;
+}
+
+}
+
+// answers by host, the least recently asked for go first when it is full
+class DNSCache {
+  public:
+    enum {
+        kMiss,
+        kFresh,
+        kStale,      // expired, still good while it is asked for again
+        kNegative,   // the name does not exist
+    };
+
+    DNSCache(size_t _capacity, uint64_t _stale_ms): capacity_(_capacity), stale_ms_(_stale_ms) {}
+
+    int Lookup(const std::string& _host, uint64_t _now, std::vector<std::string>& _ips) {
+        std::map<std::string, Entry>::iterator it = entries_.find(_host);
+        if (entries_.end() == it) return kMiss;
+
+        Entry& entry = it->second;
+        if (_now >= entry.expire + (entry.ips.empty() ? 0 : stale_ms_)) {
+            lru_.erase(entry.lru);
+            entries_.erase(it);
+            return kMiss;
+        }
+
+        lru_.splice(lru_.begin(), lru_, entry.lru);
+        if (entry.ips.empty()) return kNegative;
+
+        _ips = entry.ips;
+        return _now < entry.expire ? kFresh : kStale;
+    }
+
+    // empty _ips for a name that does not exist
+    void Put(const std::string& _host, const std::vector<std::string>& _ips, uint64_t _ttl_ms, uint64_t _now) {
+        if (0 == capacity_) return;
+
+        std::map<std::string, Entry>::iterator it = entries_.find(_host);
+        if (entries_.end() == it) {
+            if (entries_.size() >= capacity_) {
+                entries_.erase(lru_.back());
+                lru_.pop_back();
+            }
+            lru_.push_front(_host);
+            it = entries_.insert(std::make_pair(_host, Entry())).first;
+            it->second.lru = lru_.begin();
+        } else {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+        }
+
+        it->second.ips = _ips;
+        it->second.expire = _now + _ttl_ms;
+    }
+
+    void Clear() {
+        entries_.clear();
+        lru_.clear();
+    }
+
+    size_t Size() const { return entries_.size(); }
+
+  private:
+    struct Entry {
+        Entry(): expire(0) {}
+
+        std::vector<std::string>            ips;
+        uint64_t                            expire;
+        std::list<std::string>::iterator    lru;
+    };
+
+  private:
+    size_t                          capacity_;
+    uint64_t                        stale_ms_;
+    std::map<std::string, Entry>    entries_;
+    std::list<std::string>          lru_;
+};
+
+class DNSResolver {
+  public:
+    enum {
+        kResolveOK,
+        kResolveFail,        // no ipv4 address from the name servers, the system may still know one
+        kResolveTimeout,
+        kResolveCancel,
+        kResolveNoServer,    // no name server to ask, or none answered of late, ask the system
+        kResolveNoName,      // not found by the system either of late, see Store
+    };
+
+    static const size_t kCacheSize = 256;
+    static const uint64_t kStaleMs = 10 * 60 * 1000;
+    static const uint32_t kMinTtlS = 5;
+    static const uint32_t kMaxTtlS = 60 * 60;
+    static const uint32_t kNegativeTtlS = 30;
+    static const uint64_t kRetryMs = 400;
+    static const int kMaxTries = 4;             // rotating over the servers
+    static const uint64_t kAAAAGraceMs = 50;    // the A answer does not wait longer for AAAA
+    static const uint64_t kServerRefreshMs = 60 * 1000;
+    static const int kMaxTimeouts = 3;          // in a row, then kResolveNoServer for kServerRefreshMs
+
+    // never destroyed, DNS lookups may run at exit
+    static DNSResolver& Instance() {
+        static DNSResolver* resolver = new DNSResolver;
+        return *resolver;
+    }
+
+  public:
+    DNSResolver()
+    : cache_(kCacheSize, kStaleMs), servers_time_(0), timeouts_(0), timeout_time_(0), random_pos_(sizeof(random_))
+    , queries_sent_(0), stopping_(false), thread_(boost::bind(&DNSResolver::__Run, this), "dns_resolver") {}
+
+    ~DNSResolver() {
+        ScopedLock lock(mutex_);
+        stopping_ = true;
+        work_.notifyAll(lock);
+        breaker_.Break();
+        lock.unlock();
+
+        if (thread_.isruning()) thread_.join();
+
+        for (std::map<std::string, Query>::iterator it = queries_.begin(); it != queries_.end(); ++it) {
+            for (int i = 0; i < 2; ++i) __Close(it->second.lookups[i]);
+        }
+    }
+
+    // asked for the name servers when the list is older than kServerRefreshMs
+    void SetServerSource(const boost::function<void (std::vector<socket_address>&)>& _source) {
+        ScopedLock lock(mutex_);
+        server_source_ = _source;
+        servers_time_ = 0;
+    }
+
+    void SetServers(const std::vector<socket_address>& _servers) {
+        ScopedLock lock(mutex_);
+        server_source_.clear();
+        servers_ = _servers;
+        servers_time_ = 0;
+        timeouts_ = 0;
+    }
+
+    // the ipv4 addresses of _host, up to _timeout_ms unless it is in the cache.
+    int Resolve(const std::string& _host, std::vector<std::string>& _ips, long _timeout_ms, const void* _owner = NULL, DNSBreaker* _breaker = NULL) {
+        std::string host = dns_wire::Normalize(_host);
+        if (host.empty()) return kResolveFail;
+
+        if (__IsIP(host)) {
+            _ips.assign(1, host);
+            return kResolveOK;
+        }
+
+        ScopedLock lock(mutex_);
+        if (NULL != _breaker && _breaker->isbreak) return kResolveCancel;
+
+        uint64_t now = ::gettickcount();
+        std::vector<std::string> ips;
+        switch (cache_.Lookup(host, now, ips)) {
+            case DNSCache::kFresh:
+                return __Pick(ips, _ips) ? kResolveOK : kResolveFail;
+            case DNSCache::kStale:
+                if (__Servers(now)) __Start(host, now);
+                return __Pick(ips, _ips) ? kResolveOK : kResolveFail;
+            case DNSCache::kNegative:
+                return kResolveNoName;
+            default:
+                break;
+        }
+
+        if (!__Servers(now)) return kResolveNoServer;
+        __Start(host, now);
+
+        Waiter waiter(host, _owner, _breaker);
+        waiters_.push_back(&waiter);
+
+        uint64_t deadline = now + (uint64_t)std::max(_timeout_ms, 0L);
+        while (kWaiting == waiter.status) {
+            now = ::gettickcount();
+            if (now >= deadline) {
+                waiter.status = kResolveTimeout;
+                break;
+            }
+            done_.wait(lock, (long)(deadline - now));
+        }
+
+        waiters_.remove(&waiter);
+        if (kResolveOK == waiter.status) _ips = waiter.ips;
+        return waiter.status;
+    }
+
+    // an answer found some other way, kept like one of ours. empty _ips after kResolveFail when the
+    // system did not find _host either, it is kResolveNoName then for kNegativeTtlS.
+    void Store(const std::string& _host, const std::vector<std::string>& _ips, uint32_t _ttl_s) {
+        ScopedLock lock(mutex_);
+        uint64_t ttl_ms = _ips.empty() ? (uint64_t)kNegativeTtlS * 1000 : (uint64_t)__Clamp(_ttl_s) * 1000;
+        cache_.Put(dns_wire::Normalize(_host), _ips, ttl_ms, ::gettickcount());
+    }
+
+    // the waiting lookups of _owner for _host, all of them for an empty _host
+    void Cancel(const void* _owner, const std::string& _host) {
+        ScopedLock lock(mutex_);
+        std::string host = dns_wire::Normalize(_host);
+        for (std::list<Waiter*>::iterator it = waiters_.begin(); it != waiters_.end(); ++it) {
+            if (_owner == (*it)->owner && (host.empty() || host == (*it)->host)) (*it)->status = kResolveCancel;
+        }
+        done_.notifyAll(lock);
+    }
+
+    void Cancel(DNSBreaker& _breaker) {
+        ScopedLock lock(mutex_);
+        _breaker.isbreak = true;
+        for (std::list<Waiter*>::iterator it = waiters_.begin(); it != waiters_.end(); ++it) {
+            if (&_breaker == (*it)->breaker) (*it)->status = kResolveCancel;
+        }
+        done_.notifyAll(lock);
+    }
+
+    // the network changed, the answers and the servers may be of the old one
+    void Reset() {
+        ScopedLock lock(mutex_);
+        cache_.Clear();
+        servers_time_ = 0;
+        timeouts_ = 0;
+    }
+
+    size_t CacheSize() {
+        ScopedLock lock(mutex_);
+        return cache_.Size();
+    }
+
+    uint64_t QueriesSent() {
+        ScopedLock lock(mutex_);
+        return queries_sent_;
+    }
+
+  private:
+    static const int kWaiting = -1;
+
+    struct Waiter {
+        Waiter(const std::string& _host, const void* _owner, DNSBreaker* _breaker)
+        : host(_host), owner(_owner), breaker(_breaker), status(kWaiting) {}
+
+        std::string                 host;
+        const void*                 owner;
+        DNSBreaker*                 breaker;
+        int                         status;
+        std::vector<std::string>    ips;
+    };
+
+    // the A or the AAAA half of a query
+    struct Lookup {
+        Lookup(): qtype(0), id(0), done(false), answered(false), tries(0), next_send(0), udp(INVALID_SOCKET), tcp(INVALID_SOCKET), tcp_sent(0) {}
+
+        uint16_t            qtype;
+        uint16_t            id;
+        bool                done;
+        bool                answered;       // a server said something, even that there is nothing
+        int                 tries;
+        uint64_t            next_send;
+        dns_wire::Answer    answer;
+
+        SOCKET              udp;            // its own, answers to other queries never come in on it
+
+        SOCKET              tcp;            // after a truncated answer
+        std::string         tcp_out;
+        size_t              tcp_sent;
+        std::string         tcp_in;
+    };
+
+    struct Query {
+        Query(): server(0), deadline(0), finish_at(0) {}
+
+        std::string     host;
+        Lookup          lookups[2];
+        std::vector<socket_address> servers;    // as they were when it started, the list may be refreshed empty meanwhile
+        size_t          server;
+        uint64_t        deadline;
+        uint64_t        finish_at;      // 0 until A is answered and AAAA is not
+    };
+
+    static bool __IsIP(const std::string& _host) {
+        unsigned char addr[16];
+        return 1 == socket_inet_pton(AF_INET, _host.c_str(), addr) || 1 == socket_inet_pton(AF_INET6, _host.c_str(), addr);
+    }
+
+    static uint32_t __Clamp(uint32_t _ttl_s) {
+        return std::min(std::max(_ttl_s, (uint32_t)kMinTtlS), (uint32_t)kMaxTtlS);
+    }
+
+    // callers take ipv4, v4tov6_address makes it work on nat64, and ipv6 only for names without any
+    // callers take the result for ipv4, as getaddrinfo with AF_INET always gave them
+    static bool __Pick(const std::vector<std::string>& _all, std::vector<std::string>& _ips) {
+        _ips.clear();
+        for (std::vector<std::string>::const_iterator it = _all.begin(); it != _all.end(); ++it) {
+            if (std::string::npos == it->find(':')) _ips.push_back(*it);
+        }
+        return !_ips.empty();
+    }
+
+    bool __Servers(uint64_t _now) {
+        if (server_source_ && (0 == servers_time_ || _now >= servers_time_ + kServerRefreshMs)) {
+            servers_.clear();
+            server_source_(servers_);
+            servers_time_ = _now;
+        }
+
+        if (kMaxTimeouts <= timeouts_) {
+            if (_now < timeout_time_ + kServerRefreshMs) return false;
+            timeouts_ = 0;
+        }
+        return !servers_.empty();
+    }
+
+    void __Start(const std::string& _host, uint64_t _now) {
+        if (servers_.empty() || queries_.count(_host)) return;
+
+        Query& query = queries_[_host];
+        query.host = _host;
+        query.servers = servers_;
+        query.server = (size_t)__Random16() % query.servers.size();
+        query.deadline = _now + kRetryMs * kMaxTries;
+        query.lookups[0].qtype = dns_wire::kTypeA;
+        query.lookups[1].qtype = dns_wire::kTypeAAAA;
+
+        if (!thread_.isruning()) thread_.start();
+        work_.notifyAll();
+        breaker_.Break();
+    }
+
+    // from the system's random source, an id a forger can count on is half of a forged answer
+    uint16_t __Random16() {
+        if (random_pos_ + 2 > sizeof(random_)) {
+            __SystemRandom(random_, sizeof(random_));
+            random_pos_ = 0;
+        }
+        uint16_t value = dns_wire::__Read16(random_ + random_pos_);
+        random_pos_ += 2;
+        return value;
+    }
+
+    static void __SystemRandom(unsigned char* _out, size_t _length) {
+#ifdef _WIN32
+        HCRYPTPROV prov;
+        if (CryptAcquireContext(&prov, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) {
+            BOOL ok = CryptGenRandom(prov, (DWORD)_length, _out);
+            CryptReleaseContext(prov, 0);
+            if (ok) return;
+        }
+#else
+        int fd = open("/dev/urandom", O_RDONLY);
+        if (0 <= fd) {
+            size_t got = 0;
+            while (got < _length) {
+                ssize_t ret = read(fd, _out + got, _length - got);
+                if (0 < ret) got += (size_t)ret;
+                else if (!(0 > ret && EINTR == errno)) break;
+            }
+            close(fd);
+            if (got == _length) return;
+        }
+#endif
+        // no random source, better than nothing
+        for (size_t i = 0; i < _length; ++i) _out[i] = (unsigned char)(rand() ^ (int)::gettickcount());
+    }
+
+    // the one of _lookup, not bound, the system picks the port when it is first sent on
+    static bool __OpenUdp(Lookup& _lookup, int _family) {
+        if (INVALID_SOCKET != _lookup.udp) return true;
+
+        _lookup.udp = socket(_family, SOCK_DGRAM, IPPROTO_UDP);
+        if (INVALID_SOCKET == _lookup.udp) return false;
+        if (0 != socket_set_nobio(_lookup.udp)) {
+            socket_close(_lookup.udp);
+            _lookup.udp = INVALID_SOCKET;
+            return false;
+        }
+        return true;
+    }
+
+    void __Send(Query& _query, Lookup& _lookup, uint64_t _now) {
+        if (_query.servers.empty()) {
+            _lookup.done = true;
+            return;
+        }
+
+        const socket_address& server = _query.servers[(_query.server + _lookup.tries) % _query.servers.size()];
+        ++_lookup.tries;
+        _lookup.next_send = _now + kRetryMs;
+
+        while (0 == _lookup.id) _lookup.id = __Random16();
+
+        // a socket of one family can not send to the other, a server of the other family takes a new one
+        if (INVALID_SOCKET != _lookup.udp && server.address().sa_family != __Family(_lookup.udp)) __CloseUdp(_lookup);
+
+        std::string packet;
+        if (!dns_wire::BuildQuery(_lookup.id, _query.host, _lookup.qtype, packet) || !__OpenUdp(_lookup, server.address().sa_family)) {
+            _lookup.done = true;
+            return;
+        }
+
+        ++queries_sent_;
+        sendto(_lookup.udp, packet.data(), (int)packet.size(), 0, &server.address(), server.address_length());
+    }
+
+    static int __Family(SOCKET _sock) {
+        sockaddr_storage addr;
+        socklen_t length = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        if (0 != getsockname(_sock, (sockaddr*)&addr, &length)) return AF_UNSPEC;
+        return addr.ss_family;
+    }
+
+    static bool __SameAddress(const sockaddr* _from, socklen_t _from_length, const socket_address& _server) {
+        const sockaddr& server = _server.address();
+        if (_from->sa_family != server.sa_family) return false;
+
+        if (AF_INET == server.sa_family) {
+            if (_from_length < (socklen_t)sizeof(sockaddr_in)) return false;
+            const sockaddr_in& from4 = *(const sockaddr_in*)_from;
+            const sockaddr_in& server4 = *(const sockaddr_in*)&server;
+            return from4.sin_port == server4.sin_port && 0 == memcmp(&from4.sin_addr, &server4.sin_addr, sizeof(from4.sin_addr));
+        }
+
+        if (AF_INET6 == server.sa_family) {
+            if (_from_length < (socklen_t)sizeof(sockaddr_in6)) return false;
+            const sockaddr_in6& from6 = *(const sockaddr_in6*)_from;
+            const sockaddr_in6& server6 = *(const sockaddr_in6*)&server;
+            return from6.sin6_port == server6.sin6_port && 0 == memcmp(&from6.sin6_addr, &server6.sin6_addr, sizeof(from6.sin6_addr));
+        }
+        return false;
+    }
+
+    // one of the servers _lookup was sent to
+    static bool __SentTo(const Query& _query, const Lookup& _lookup, const sockaddr* _from, socklen_t _from_length) {
+        size_t count = std::min((size_t)_lookup.tries, _query.servers.size());
+        for (size_t i = 0; i < count; ++i) {
+            if (__SameAddress(_from, _from_length, _query.servers[(_query.server + i) % _query.servers.size()])) return true;
+        }
+        return false;
+    }
+
+    void __StartTcp(Query& _query, Lookup& _lookup, const sockaddr* _from, socklen_t _from_length) {
+        std::string packet;
+        dns_wire::BuildQuery(_lookup.id, _query.host, _lookup.qtype, packet);
+
+        _lookup.tcp = socket(_from->sa_family, SOCK_STREAM, IPPROTO_TCP);
+        if (INVALID_SOCKET == _lookup.tcp) {
+            _lookup.done = true;
+            return;
+        }
+
+        socket_set_nobio(_lookup.tcp);
+        if (0 != connect(_lookup.tcp, _from, _from_length) && !IS_NOBLOCK_CONNECT_ERRNO(socket_errno)) {
+            __CloseTcp(_lookup);
+            _lookup.done = true;
+            return;
+        }
+
+        _lookup.tcp_out.assign(1, (char)(packet.size() >> 8));
+        _lookup.tcp_out += (char)packet.size();
+        _lookup.tcp_out += packet;
+        _lookup.tcp_sent = 0;
+    }
+
+    static void __CloseTcp(Lookup& _lookup) {
+        if (INVALID_SOCKET == _lookup.tcp) return;
+        socket_close(_lookup.tcp);
+        _lookup.tcp = INVALID_SOCKET;
+    }
+
+    static void __CloseUdp(Lookup& _lookup) {
+        if (INVALID_SOCKET == _lookup.udp) return;
+        socket_close(_lookup.udp);
+        _lookup.udp = INVALID_SOCKET;
+    }
+
+    static void __Close(Lookup& _lookup) {
+        __CloseTcp(_lookup);
+        __CloseUdp(_lookup);
+    }
+
+    // over udp _from is checked, the tcp connection goes to a server checked already
+    void __OnAnswer(Query& _query, Lookup& _lookup, const unsigned char* _msg, size_t _length, const sockaddr* _from, socklen_t _from_length, bool _tcp) {
+        if (_lookup.done || (!_tcp && INVALID_SOCKET != _lookup.tcp)) return;
+        if (!_tcp && !__SentTo(_query, _lookup, _from, _from_length)) return;
+
+        dns_wire::Answer answer;
+        if (!dns_wire::ParseResponse(_msg, _length, _lookup.id, _query.host, _lookup.qtype, answer)) return;
+
+        if (answer.truncated && !_tcp) {
+            __StartTcp(_query, _lookup, _from, _from_length);
+            return;
+        }
+
+        _lookup.answer = answer;
+        _lookup.answered = true;
+        _lookup.done = true;
+        __CloseTcp(_lookup);
+    }
+
+    void __Finish(Query& _query) {
+        std::vector<std::string> ips;
+        uint32_t ttl = 0xFFFFFFFF;
+        bool nxdomain = false;
+        bool answered = true;
+
+        for (int i = 0; i < 2; ++i) {
+            Lookup& lookup = _query.lookups[i];
+            __Close(lookup);
+
+            if (!lookup.answered) {
+                answered = false;
+                continue;
+            }
+            if (dns_wire::kRcodeNXDomain == lookup.answer.rcode) nxdomain = true;
+            if (dns_wire::kRcodeNoError != lookup.answer.rcode && dns_wire::kRcodeNXDomain != lookup.answer.rcode) answered = false;
+            if (lookup.answer.ips.empty()) continue;
+            ips.insert(ips.end(), lookup.answer.ips.begin(), lookup.answer.ips.end());
+            ttl = std::min(ttl, lookup.answer.ttl);
+        }
+
+        uint64_t now = ::gettickcount();
+        // no address is not kept here, the system is asked before it is, see Store
+        int status = kResolveOK;
+        if (!ips.empty()) {
+            cache_.Put(_query.host, ips, (uint64_t)__Clamp(ttl) * 1000, now);
+        } else if (nxdomain || answered) {
+            status = kResolveFail;
+        } else {
+            status = kResolveTimeout;
+        }
+
+        if (_query.lookups[0].answered || _query.lookups[1].answered) {
+            timeouts_ = 0;
+        } else if (kMaxTimeouts <= ++timeouts_) {
+            timeout_time_ = now;
+        }
+
+        for (std::list<Waiter*>::iterator it = waiters_.begin(); it != waiters_.end(); ++it) {
+            if (_query.host != (*it)->host || kWaiting != (*it)->status) continue;
+            (*it)->status = status;
+            if (kResolveOK == status && !__Pick(ips, (*it)->ips)) (*it)->status = kResolveFail;
+        }
+        done_.notifyAll();
+    }
+
+    // sends what is due and finishes what is done, the time of the next thing to do
+    uint64_t __Tick(uint64_t _now) {
+        uint64_t next = _now + kRetryMs;
+
+        for (std::map<std::string, Query>::iterator it = queries_.begin(); it != queries_.end();) {
+            Query& query = it->second;
+            Lookup& a = query.lookups[0];
+            Lookup& aaaa = query.lookups[1];
+
+            for (int i = 0; i < 2; ++i) {
+                Lookup& lookup = query.lookups[i];
+                if (lookup.done || INVALID_SOCKET != lookup.tcp || _now < lookup.next_send) continue;
+                if (kMaxTries <= lookup.tries) lookup.done = true;
+                else __Send(query, lookup, _now);
+            }
+
+            if (a.done && !a.answer.ips.empty() && !aaaa.done && 0 == query.finish_at) query.finish_at = _now + kAAAAGraceMs;
+
+            if ((a.done && aaaa.done) || _now >= query.deadline || (0 != query.finish_at && _now >= query.finish_at)) {
+                __Finish(query);
+                queries_.erase(it++);
+                continue;
+            }
+
+            for (int i = 0; i < 2; ++i) {
+                if (!query.lookups[i].done && INVALID_SOCKET == query.lookups[i].tcp) next = std::min(next, query.lookups[i].next_send);
+            }
+            next = std::min(next, query.deadline);
+            if (0 != query.finish_at) next = std::min(next, query.finish_at);
+            ++it;
+        }
+        return next;
+    }
+
+    void __Run() {
+        ScopedLock lock(mutex_);
+        std::vector<unsigned char> buffer(64 * 1024);
+
+        while (!stopping_) {
+            uint64_t now = ::gettickcount();
+            uint64_t next = __Tick(now);
+
+            if (queries_.empty()) {
+                work_.wait(lock);
+                continue;
+            }
+
+            SocketSelect select(breaker_, true);
+            select.PreSelect();
+            for (std::map<std::string, Query>::iterator it = queries_.begin(); it != queries_.end(); ++it) {
+                for (int i = 0; i < 2; ++i) {
+                    Lookup& lookup = it->second.lookups[i];
+                    if (INVALID_SOCKET != lookup.udp && !lookup.done) select.Read_FD_SET(lookup.udp);
+                    if (INVALID_SOCKET == lookup.tcp) continue;
+                    if (lookup.tcp_sent < lookup.tcp_out.size()) select.Write_FD_SET(lookup.tcp);
+                    else select.Read_FD_SET(lookup.tcp);
+                    select.Exception_FD_SET(lookup.tcp);
+                }
+            }
+
+            lock.unlock();
+            select.Select((int)(next > now ? next - now : 0));
+            lock.lock();
+
+            for (std::map<std::string, Query>::iterator it = queries_.begin(); it != queries_.end(); ++it) {
+                for (int i = 0; i < 2; ++i) {
+                    __UdpIO(it->second, it->second.lookups[i], select, buffer);
+                    __TcpIO(it->second, it->second.lookups[i], select, buffer);
+                }
+            }
+        }
+    }
+
+    void __UdpIO(Query& _query, Lookup& _lookup, SocketSelect& _select, std::vector<unsigned char>& _buffer) {
+        if (INVALID_SOCKET == _lookup.udp || !_select.Read_FD_ISSET(_lookup.udp)) return;
+
+        while (!_lookup.done) {
+            sockaddr_storage from;
+            socklen_t from_length = sizeof(from);
+            int length = (int)recvfrom(_lookup.udp, (char*)&_buffer[0], (int)_buffer.size(), 0, (sockaddr*)&from, &from_length);
+            if (0 >= length) break;
+            __OnAnswer(_query, _lookup, &_buffer[0], (size_t)length, (sockaddr*)&from, from_length, false);
+        }
+    }
+
+    void __TcpIO(Query& _query, Lookup& _lookup, SocketSelect& _select, std::vector<unsigned char>& _buffer) {
+        if (INVALID_SOCKET == _lookup.tcp) return;
+
+        if (_select.Exception_FD_ISSET(_lookup.tcp)) {
+            __CloseTcp(_lookup);
+            _lookup.done = true;
+            return;
+        }
+
+        if (_lookup.tcp_sent < _lookup.tcp_out.size()) {
+            if (!_select.Write_FD_ISSET(_lookup.tcp)) return;
+            int sent = (int)send(_lookup.tcp, _lookup.tcp_out.data() + _lookup.tcp_sent, (int)(_lookup.tcp_out.size() - _lookup.tcp_sent), 0);
+            if (0 > sent && !IS_NOBLOCK_SEND_ERRNO(socket_errno)) {
+                __CloseTcp(_lookup);
+                _lookup.done = true;
+            }
+            if (0 < sent) _lookup.tcp_sent += sent;
+            return;
+        }
+
+        if (!_select.Read_FD_ISSET(_lookup.tcp)) return;
+        int length = (int)recv(_lookup.tcp, (char*)&_buffer[0], (int)_buffer.size(), 0);
+        if (0 > length && IS_NOBLOCK_RECV_ERRNO(socket_errno)) return;
+        if (0 >= length) {
+            __CloseTcp(_lookup);
+            _lookup.done = true;
+            return;
+        }
+
+        _lookup.tcp_in.append((const char*)&_buffer[0], length);
+        if (2 > _lookup.tcp_in.size()) return;
+        size_t message_length = dns_wire::__Read16((const unsigned char*)_lookup.tcp_in.data());
+        if (_lookup.tcp_in.size() < 2 + message_length) return;
+
+        __OnAnswer(_query, _lookup, (const unsigned char*)_lookup.tcp_in.data() + 2, message_length, NULL, 0, true);
+        if (!_lookup.done) {
+            // not an answer to it after all
+            __CloseTcp(_lookup);
+            _lookup.done = true;
+        }
+    }
+
+  private:
+    DNSResolver(const DNSResolver&);
+    DNSResolver& operator=(const DNSResolver&);
+
+  private:
+    Mutex                               mutex_;
+    Condition                           work_;
+    Condition                           done_;
+    SocketBreaker                       breaker_;
+
+    DNSCache                            cache_;
+    boost::function<void (std::vector<socket_address>&)> server_source_;
+    std::vector<socket_address>         servers_;
+    uint64_t                            servers_time_;
+    int                                 timeouts_;
+    uint64_t                            timeout_time_;
+
+    unsigned char                       random_[256];
+    size_t                              random_pos_;
+    std::map<std::string, Query>        queries_;
+    std::list<Waiter*>                  waiters_;
+    uint64_t                            queries_sent_;
+    bool                                stopping_;
+    Thread                              thread_;
+};
+
+#endif // COMM_DNS_DNS_RESOLVER_H_
@@ -396,6 +396,30 @@ int HeaderFields::ContentLength() {
     return contentLength;
 }
 
+bool HeaderFields::IsConnectionClose() {
+    const char* connection = HeaderField(HeaderFields::KStringConnection);
+    if (NULL == connection) return false;
+
+    std::string value(connection);
+    return std::string::npos != strutil::ToLower(value).find(KStringClose);
+}
+
+int HeaderFields::KeepAliveTimeout() {
+    const char* keepalive = HeaderField(KStringKeepalive);
+    if (NULL == keepalive) return -1;
+
+    // Keep-Alive: timeout=5, max=100
+    std::vector<std::string> params;
+    strutil::SplitToken(keepalive, ",", params);
+
+    for (std::vector<std::string>::iterator it = params.begin(); it != params.end(); ++it) {
+        strutil::Trim(*it);
+        strutil::ToLower(*it);
+        if (strutil::StartsWith(*it, std::string("timeout="))) return (int)strtol(it->c_str() + 8, NULL, 10);
+    }
+
+    return -1;
+}
 
 bool HeaderFields::ContentRange(int* start, int* end, int* total) {
     // Content-Range: bytes 0-102400/102399
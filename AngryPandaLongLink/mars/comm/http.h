@@ -164,6 +164,8 @@ class HeaderFields {
 
     bool IsTransferEncodingChunked();
     int ContentLength();
+    bool IsConnectionClose();
+    int KeepAliveTimeout();    // seconds of Keep-Alive: timeout=, -1 if not given
 
     bool ContentRange(int* start, int* end, int* total);
 
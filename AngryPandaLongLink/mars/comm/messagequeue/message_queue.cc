@@ -20,6 +20,8 @@
 
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <vector>
 #include <string>
 #include <algorithm>
 #ifndef _WIN32
@@ -30,6 +32,7 @@
 #include "boost/bind.hpp"
 
 #include "comm/thread/lock.h"
+#include "comm/thread/atomic_oper.h"
 #include "comm/anr.h"
 #include "comm/messagequeue/message_queue.h"
 #include "comm/time_utils.h"
@@ -47,23 +50,31 @@
 
 namespace MessageQueue {
 
+// atomic_inc32 returns the value before, and seq 0 is taken for broadcast
 static unsigned int __MakeSeq() {
-    static unsigned int s_seq = 0;
+    static uint32_t s_seq = 0;
 
-    return ++s_seq;
+    uint32_t seq = 0;
+    while (0 == seq) seq = atomic_inc32(&s_seq) + 1;
+    return seq;
 }
 
+static const size_t kInvalidHeapIndex = (size_t)-1;
+static const size_t kMaxPooledWrapper = 1024;
+
 struct MessageWrapper {
     MessageWrapper(const MessageHandler_t& _handlerid, const Message& _message, const MessageTiming& _timing, unsigned int _seq)
-        : message(_message), timing(_timing) {
+        : message(_message), timing(_timing), heap_index(kInvalidHeapIndex), order(0), prev(NULL), next(NULL), post_prev(NULL), post_next(NULL), title_prev(NULL), title_next(NULL) {
         postid.reg = _handlerid;
         postid.seq = _seq;
         periodstatus = kImmediately;
         record_time = 0;
+        deadline = 0;
 
         if (kImmediately != _timing.type) {
             periodstatus = kAfter;
             record_time = ::gettickcount();
+            deadline = record_time + (0 < _timing.after ? _timing.after : 0);
         }
     }
 
@@ -78,7 +89,269 @@ struct MessageWrapper {
     MessageTiming timing;
     TMessageTiming periodstatus;
     uint64_t record_time;
+    uint64_t deadline;
     boost::shared_ptr<Condition> wait_end_cond;
+
+    size_t heap_index;      // position in TimerHeap, kInvalidHeapIndex for kImmediately
+    uint64_t order;         // post order, keeps FIFO between due timers and immediate messages
+    MessageWrapper* prev;   // links of MessageList, only for kImmediately
+    MessageWrapper* next;
+    MessageWrapper* post_prev;   // links of the content's post_index
+    MessageWrapper* post_next;
+    MessageWrapper* title_prev;  // links of the content's title_index
+    MessageWrapper* title_next;
+
+    // one wrapper per post, recycled through a free list instead of malloc
+    static void* operator new(size_t _size);
+    static void operator delete(void* _ptr);
+};
+
+struct WrapperPool {
+    struct Block { Block* next; };
+
+    WrapperPool(): head(NULL), size(0) {}
+
+    SpinLock lock;
+    Block* head;
+    size_t size;
+};
+
+static WrapperPool& __WrapperPool() {
+    static WrapperPool* pool = new WrapperPool;
+    return *pool;
+}
+
+void* MessageWrapper::operator new(size_t _size) {
+    ASSERT(sizeof(MessageWrapper) == _size);
+    WrapperPool& pool = __WrapperPool();
+
+    ScopedSpinLock lock(pool.lock);
+    if (NULL == pool.head) {
+        lock.unlock();
+        return ::operator new(_size);
+    }
+
+    WrapperPool::Block* block = pool.head;
+    pool.head = block->next;
+    --pool.size;
+    return block;
+}
+
+void MessageWrapper::operator delete(void* _ptr) {
+    if (NULL == _ptr) return;
+    WrapperPool& pool = __WrapperPool();
+
+    ScopedSpinLock lock(pool.lock);
+    if (kMaxPooledWrapper <= pool.size) {
+        lock.unlock();
+        ::operator delete(_ptr);
+        return;
+    }
+
+    WrapperPool::Block* block = static_cast<WrapperPool::Block*>(_ptr);
+    block->next = pool.head;
+    pool.head = block;
+    ++pool.size;
+}
+
+// intrusive FIFO of kImmediately messages, push/pop/erase never allocate
+class MessageList {
+  public:
+    MessageList(): head_(NULL), tail_(NULL) {}
+
+    bool empty() const { return NULL == head_;}
+    MessageWrapper* front() const { return head_;}
+
+    void push_back(MessageWrapper* _wrapper) {
+        _wrapper->prev = tail_;
+        _wrapper->next = NULL;
+        if (tail_) tail_->next = _wrapper; else head_ = _wrapper;
+        tail_ = _wrapper;
+    }
+
+    void erase(MessageWrapper* _wrapper) {
+        if (_wrapper->prev) _wrapper->prev->next = _wrapper->next; else head_ = _wrapper->next;
+        if (_wrapper->next) _wrapper->next->prev = _wrapper->prev; else tail_ = _wrapper->prev;
+        _wrapper->prev = NULL;
+        _wrapper->next = NULL;
+    }
+
+    MessageWrapper* pop_front() {
+        MessageWrapper* wrapper = head_;
+        if (wrapper) erase(wrapper);
+        return wrapper;
+    }
+
+  private:
+    MessageList(const MessageList&);
+    void operator=(const MessageList&);
+
+  private:
+    MessageWrapper* head_;
+    MessageWrapper* tail_;
+};
+
+/*
+ * min-heap of kAfter/kPeriod messages ordered by (deadline, order).
+ * keys are kept inline so sifting never touches the wrappers except to update heap_index,
+ * every wrapper remembers its own index so that erasing one found through the content's
+ * indexes is O(log n).
+ */
+class TimerHeap {
+  public:
+    bool empty() const { return heap_.empty();}
+    size_t size() const { return heap_.size();}
+    MessageWrapper* top() const { return heap_.front().wrapper;}
+    MessageWrapper* at(size_t _index) const { return heap_[_index].wrapper;}
+
+    void push(MessageWrapper* _wrapper) {
+        Node node = {_wrapper->deadline, _wrapper->order, _wrapper};
+        heap_.push_back(node);
+        __SiftUp(heap_.size() - 1);
+    }
+
+    void erase(MessageWrapper* _wrapper) {
+        size_t index = _wrapper->heap_index;
+        ASSERT(index < heap_.size() && heap_[index].wrapper == _wrapper);
+        if (index >= heap_.size() || heap_[index].wrapper != _wrapper) return;
+
+        _wrapper->heap_index = kInvalidHeapIndex;
+        Node last = heap_.back();
+        heap_.pop_back();
+        if (last.wrapper == _wrapper) return;
+
+        heap_[index] = last;
+        last.wrapper->heap_index = index;
+        __SiftDown(index);
+        __SiftUp(last.wrapper->heap_index);
+    }
+
+  private:
+    struct Node {
+        uint64_t deadline;
+        uint64_t order;
+        MessageWrapper* wrapper;
+    };
+
+    static bool __Less(const Node& _lhs, const Node& _rhs) {
+        if (_lhs.deadline != _rhs.deadline) return _lhs.deadline < _rhs.deadline;
+        return _lhs.order < _rhs.order;
+    }
+
+    void __SiftUp(size_t _index) {
+        Node node = heap_[_index];
+        while (0 < _index) {
+            size_t parent = (_index - 1) / 2;
+            if (!__Less(node, heap_[parent])) break;
+            heap_[_index] = heap_[parent];
+            heap_[_index].wrapper->heap_index = _index;
+            _index = parent;
+        }
+        heap_[_index] = node;
+        node.wrapper->heap_index = _index;
+    }
+
+    void __SiftDown(size_t _index) {
+        Node node = heap_[_index];
+        while (true) {
+            size_t child = 2 * _index + 1;
+            if (child >= heap_.size()) break;
+            if (child + 1 < heap_.size() && __Less(heap_[child + 1], heap_[child])) ++child;
+            if (!__Less(heap_[child], node)) break;
+
+            heap_[_index] = heap_[child];
+            heap_[_index].wrapper->heap_index = _index;
+            _index = child;
+        }
+        heap_[_index] = node;
+        node.wrapper->heap_index = _index;
+    }
+
+  private:
+    std::vector<Node> heap_;
+};
+
+// seqs come from one counter, taken as they are they fill the buckets in turn
+static uint64_t __PostKey(const MessageWrapper* _wrapper) {
+    return _wrapper->postid.seq;
+}
+
+// handler and title mixed, messages of one key are told apart by comparing them
+static uint64_t __TitleKey(const MessageHandler_t& _handlerid, const MessageTitle_t& _title) {
+    uint64_t key = (((uint64_t)_handlerid.seq << 32) ^ (uint64_t)_title.title) * 0x9E3779B97F4A7C15ULL;
+    return key ^ (key >> 32);
+}
+
+static uint64_t __TitleKey(const MessageWrapper* _wrapper) {
+    return __TitleKey(_wrapper->postid.reg, _wrapper->message.title);
+}
+
+/*
+ * chained hash of the queued messages, linked through the wrappers themselves so a post
+ * never allocates once the buckets have grown. a chain keeps post order and holds every
+ * key that falls in its bucket, the caller walks it comparing the wrappers.
+ */
+template <uint64_t (*Key)(const MessageWrapper*), MessageWrapper* MessageWrapper::*Prev, MessageWrapper* MessageWrapper::*Next>
+class MessageIndex {
+  public:
+    MessageIndex(): size_(0) {}
+
+    MessageWrapper* chain(uint64_t _key) const { return buckets_.empty() ? NULL : buckets_[__Bucket(_key)].head;}
+    static MessageWrapper* next(const MessageWrapper* _wrapper) { return _wrapper->*Next;}
+
+    void insert(MessageWrapper* _wrapper) {
+        if (size_ >= buckets_.size()) __Grow();
+        __Link(buckets_[__Bucket(Key(_wrapper))], _wrapper);
+        ++size_;
+    }
+
+    void erase(MessageWrapper* _wrapper) {
+        Bucket& bucket = buckets_[__Bucket(Key(_wrapper))];
+        if (_wrapper->*Prev) (_wrapper->*Prev)->*Next = _wrapper->*Next; else bucket.head = _wrapper->*Next;
+        if (_wrapper->*Next) (_wrapper->*Next)->*Prev = _wrapper->*Prev; else bucket.tail = _wrapper->*Prev;
+        _wrapper->*Prev = NULL;
+        _wrapper->*Next = NULL;
+        --size_;
+    }
+
+    void clear() {
+        buckets_.assign(buckets_.size(), Bucket());
+        size_ = 0;
+    }
+
+  private:
+    struct Bucket {
+        Bucket(): head(NULL), tail(NULL) {}
+        MessageWrapper* head;
+        MessageWrapper* tail;
+    };
+
+    size_t __Bucket(uint64_t _key) const { return (size_t)_key & (buckets_.size() - 1);}
+
+    static void __Link(Bucket& _bucket, MessageWrapper* _wrapper) {
+        _wrapper->*Prev = _bucket.tail;
+        _wrapper->*Next = NULL;
+        if (_bucket.tail) _bucket.tail->*Next = _wrapper; else _bucket.head = _wrapper;
+        _bucket.tail = _wrapper;
+    }
+
+    // relinked bucket by bucket, so every key keeps its post order
+    void __Grow() {
+        std::vector<Bucket> old(buckets_.empty() ? 16 : buckets_.size() * 2);
+        old.swap(buckets_);
+
+        for (size_t i = 0; i < old.size(); ++i) {
+            for (MessageWrapper* it = old[i].head; NULL != it;) {
+                MessageWrapper* next = it->*Next;
+                __Link(buckets_[__Bucket(Key(it))], it);
+                it = next;
+            }
+        }
+    }
+
+  private:
+    std::vector<Bucket> buckets_;
+    size_t size_;
 };
 
 struct HandlerWrapper {
@@ -95,71 +368,156 @@ struct HandlerWrapper {
 
 struct RunLoopInfo {
     RunLoopInfo():runing_message(NULL) { runing_cond = boost::make_shared<Condition>();}
-    
+
     boost::shared_ptr<Condition> runing_cond;
     MessagePost_t runing_message_id;
     Message* runing_message;
-    std::list <MessageHandler_t> runing_handler;
+    std::vector<MessageHandler_t> runing_handler;   // cleared per message, capacity is kept
 };
-    
+
 class Cond : public RunloopCond {
 public:
     Cond(){}
-    
+
 public:
     const boost::typeindex::type_info& type() const {
         return boost::typeindex::type_id<Cond>().type_info();
     }
-    
+
     virtual void Wait(ScopedLock& _lock, long _millisecond) {
         cond_.wait(_lock, _millisecond);
     }
     virtual void Notify(ScopedLock& _lock) {
         cond_.notifyAll(_lock);
     }
-    
+
 private:
     Cond(const Cond&);
     void operator=(const Cond&);
-    
+
 private:
     Condition cond_;
 };
-    
-struct MessageQueueContent {
-    MessageQueueContent(): breakflag(false) {}
 
-#if defined(ANDROID)
-    MessageQueueContent(const MessageQueueContent&): breakflag(false) { /*ASSERT(false);*/ }
-#endif
+/*
+ * every messagequeue owns its lock, sg_messagequeue_map_mutex only guards the id->content map.
+ * lock order: sg_messagequeue_map_mutex may be taken while holding content.mutex, never the reverse.
+ */
+struct MessageQueueContent {
+    MessageQueueContent(): breakflag(false), released(false), post_order(0) {}
 
+    Mutex mutex;
     MessageHandler_t invoke_reg;
     bool breakflag;
+    bool released;
+    uint64_t post_order;
     boost::shared_ptr<RunloopCond> breaker;
-    std::list<MessageWrapper*> lst_message;
-    std::list<HandlerWrapper*> lst_handler;
-    
+    MessageList lst_message;                   // kImmediately messages, FIFO
+    TimerHeap timer_heap;                      // kAfter/kPeriod messages, by deadline
+    std::list<boost::shared_ptr<HandlerWrapper> > lst_handler;  // in install order, broadcasts go down it
+    std::unordered_map<unsigned int, std::list<boost::shared_ptr<HandlerWrapper> >::iterator> handler_index;  // by reg.seq
+    MessageIndex<__PostKey, &MessageWrapper::post_prev, &MessageWrapper::post_next> post_index;      // queued messages by postid.seq
+    MessageIndex<__TitleKey, &MessageWrapper::title_prev, &MessageWrapper::title_next> title_index;  // by handler and title
+
     std::list<RunLoopInfo> lst_runloop_info;
-    
+
 private:
-    void operator=(const MessageQueueContent&);
-    
-#if !defined(ANDROID)
     MessageQueueContent(const MessageQueueContent&);
-#endif
+    void operator=(const MessageQueueContent&);
 };
 
+typedef boost::shared_ptr<MessageQueueContent> MessageQueueContentPtr;
+
 #define sg_messagequeue_map_mutex messagequeue_map_mutex()
 static Mutex& messagequeue_map_mutex() {
     static Mutex* mutex = new Mutex;
     return *mutex;
 }
 #define sg_messagequeue_map messagequeue_map()
-static std::map<MessageQueue_t, MessageQueueContent>& messagequeue_map() {
-    static std::map<MessageQueue_t, MessageQueueContent>* mq_map = new std::map<MessageQueue_t, MessageQueueContent>;
+static std::map<MessageQueue_t, MessageQueueContentPtr>& messagequeue_map() {
+    static std::map<MessageQueue_t, MessageQueueContentPtr>* mq_map = new std::map<MessageQueue_t, MessageQueueContentPtr>;
     return *mq_map;
 }
 
+static MessageQueueContentPtr __FindContent(const MessageQueue_t& _id) {
+    ScopedLock lock(sg_messagequeue_map_mutex);
+
+    std::map<MessageQueue_t, MessageQueueContentPtr>::iterator pos = sg_messagequeue_map.find(_id);
+    if (sg_messagequeue_map.end() == pos) return MessageQueueContentPtr();
+
+    return pos->second;
+}
+
+static void __IndexMessage(MessageQueueContent& _content, MessageWrapper* _wrapper) {
+    _content.post_index.insert(_wrapper);
+    _content.title_index.insert(_wrapper);
+}
+
+static void __UnindexMessage(MessageQueueContent& _content, MessageWrapper* _wrapper) {
+    _content.post_index.erase(_wrapper);
+    _content.title_index.erase(_wrapper);
+}
+
+static void __AddMessage(MessageQueueContent& _content, MessageWrapper* _wrapper) {
+    _wrapper->order = ++_content.post_order;
+
+    if (kImmediately == _wrapper->timing.type) {
+        _content.lst_message.push_back(_wrapper);
+    } else {
+        _content.timer_heap.push(_wrapper);
+    }
+    __IndexMessage(_content, _wrapper);
+}
+
+static void __RemoveMessage(MessageQueueContent& _content, MessageWrapper* _wrapper) {
+    if (kImmediately == _wrapper->timing.type) {
+        _content.lst_message.erase(_wrapper);
+    } else {
+        _content.timer_heap.erase(_wrapper);
+    }
+    __UnindexMessage(_content, _wrapper);
+}
+
+// the queued message of _postid, NULL when it ran already or was never posted
+static MessageWrapper* __FindPost(MessageQueueContent& _content, const MessagePost_t& _postid) {
+    for (MessageWrapper* it = _content.post_index.chain(_postid.seq); NULL != it; it = _content.post_index.next(it)) {
+        if (_postid == it->postid) return it;
+    }
+    return NULL;
+}
+
+// the first queued message to _handlerid equal to _message, for SingletonMessage and FasterMessage
+static MessageWrapper* __FindTitle(MessageQueueContent& _content, const MessageHandler_t& _handlerid, const Message& _message) {
+    for (MessageWrapper* it = _content.title_index.chain(__TitleKey(_handlerid, _message.title)); NULL != it; it = _content.title_index.next(it)) {
+        if (_handlerid == it->postid.reg && _message == it->message) return it;
+    }
+    return NULL;
+}
+
+template <typename Pred>
+static void __DeleteMessages(MessageQueueContent& _content, const Pred& _pred) {
+    for (MessageWrapper* it = _content.lst_message.front(); NULL != it;) {
+        MessageWrapper* next = it->next;
+        if (_pred(it)) {
+            _content.lst_message.erase(it);
+            __UnindexMessage(_content, it);
+            delete it;
+        }
+        it = next;
+    }
+
+    std::vector<MessageWrapper*> matched;
+    for (size_t i = 0; i < _content.timer_heap.size(); ++i) {
+        if (_pred(_content.timer_heap.at(i))) matched.push_back(_content.timer_heap.at(i));
+    }
+
+    for (std::vector<MessageWrapper*>::iterator it = matched.begin(); it != matched.end(); ++it) {
+        _content.timer_heap.erase(*it);
+        __UnindexMessage(_content, *it);
+        delete(*it);
+    }
+}
+
 MessageQueue_t CurrentThreadMessageQueue() {
     ScopedLock lock(sg_messagequeue_map_mutex);
     MessageQueue_t id = (MessageQueue_t)ThreadUtil::currentthreadid();
@@ -177,31 +535,29 @@ MessageQueue_t TID2MessageQueue(thread_tid _tid) {
 
     return id;
 }
-    
+
 thread_tid  MessageQueue2TID(MessageQueue_t _id) {
     ScopedLock lock(sg_messagequeue_map_mutex);
     MessageQueue_t& id = _id;
-    
+
     if (sg_messagequeue_map.end() == sg_messagequeue_map.find(id)) return 0;
-    
+
     return (thread_tid)id;
 }
 
 void WaitForRunningLockEnd(const MessagePost_t&  _message) {
     if (Handler2Queue(Post2Handler(_message)) == CurrentThreadMessageQueue()) return;
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = Handler2Queue(Post2Handler(_message));
+    MessageQueueContentPtr content_ptr = __FindContent(Handler2Queue(Post2Handler(_message)));
+    if (!content_ptr) return;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
 
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return;
-    MessageQueueContent& content = pos->second;
-    
     if (content.lst_runloop_info.empty()) return;
-    
+
     auto find_it = std::find_if(content.lst_runloop_info.begin(), content.lst_runloop_info.end(),
                                 [&_message](const RunLoopInfo& _v){ return _message == _v.runing_message_id; });
-    
+
     if (find_it == content.lst_runloop_info.end()) return;
 
     boost::shared_ptr<Condition> runing_cond = find_it->runing_cond;
@@ -211,12 +567,10 @@ void WaitForRunningLockEnd(const MessagePost_t&  _message) {
 void WaitForRunningLockEnd(const MessageQueue_t&  _messagequeueid) {
     if (_messagequeueid == CurrentThreadMessageQueue()) return;
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _messagequeueid;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return;
-    MessageQueueContent& content = pos->second;
+    MessageQueueContentPtr content_ptr = __FindContent(_messagequeueid);
+    if (!content_ptr) return;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
 
     if (content.lst_runloop_info.empty()) return;
     if (KNullPost == content.lst_runloop_info.front().runing_message_id) return;
@@ -228,12 +582,10 @@ void WaitForRunningLockEnd(const MessageQueue_t&  _messagequeueid) {
 void WaitForRunningLockEnd(const MessageHandler_t&  _handler) {
     if (Handler2Queue(_handler) == CurrentThreadMessageQueue()) return;
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = Handler2Queue(_handler);
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) { return; }
-    MessageQueueContent& content = pos->second;
+    MessageQueueContentPtr content_ptr = __FindContent(Handler2Queue(_handler));
+    if (!content_ptr) return;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
     if (content.lst_runloop_info.empty()) return;
 
     for(auto& i : content.lst_runloop_info) {
@@ -250,33 +602,33 @@ void WaitForRunningLockEnd(const MessageHandler_t&  _handler) {
 void BreakMessageQueueRunloop(const MessageQueue_t&  _messagequeueid) {
     ASSERT(0 != _messagequeueid);
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _messagequeueid;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(_messagequeueid);
+    if (!content_ptr) {
         //ASSERT2(false, "%llu", (unsigned long long)id);
         return;
     }
 
-    pos->second.breakflag = true;
-    pos->second.breaker->Notify(lock);
+    ScopedLock lock(content_ptr->mutex);
+    content_ptr->breakflag = true;
+    content_ptr->breaker->Notify(lock);
 }
 
 MessageHandler_t InstallMessageHandler(const MessageHandler& _handler, bool _recvbroadcast, const MessageQueue_t& _messagequeueid) {
     ASSERT(bool(_handler));
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
     const MessageQueue_t& id = _messagequeueid;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(id);
+    if (!content_ptr) {
         ASSERT2(false, "%llu", (unsigned long long)id);
         return KNullHandler;
     }
 
-    HandlerWrapper* handler = new HandlerWrapper(_handler, _recvbroadcast, _messagequeueid, __MakeSeq());
-    pos->second.lst_handler.push_back(handler);
+    ScopedLock lock(content_ptr->mutex);
+    if (content_ptr->released) return KNullHandler;
+
+    boost::shared_ptr<HandlerWrapper> handler = boost::make_shared<HandlerWrapper>(_handler, _recvbroadcast, _messagequeueid, __MakeSeq());
+    content_ptr->lst_handler.push_back(handler);
+    content_ptr->handler_index[handler->reg.seq] = --content_ptr->lst_handler.end();
     return handler->reg;
 }
 
@@ -286,141 +638,129 @@ void UnInstallMessageHandler(const MessageHandler_t& _handlerid) {
 
     if (0 == _handlerid.queue || 0 == _handlerid.seq) return;
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _handlerid.queue;
+    MessageQueueContentPtr content_ptr = __FindContent(_handlerid.queue);
+    if (!content_ptr) return;
 
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
 
-    MessageQueueContent& content = pos->second;
+    auto it = content.handler_index.find(_handlerid.seq);
+    if (content.handler_index.end() == it || _handlerid != (*it->second)->reg) return;
 
-    for (std::list<HandlerWrapper*>::iterator it = content.lst_handler.begin(); it != content.lst_handler.end(); ++it) {
-        if (_handlerid == (*it)->reg) {
-            delete(*it);
-            content.lst_handler.erase(it);
-            break;
-        }
-    }
+    content.lst_handler.erase(it->second);
+    content.handler_index.erase(it);
 }
 
 MessagePost_t PostMessage(const MessageHandler_t& _handlerid, const Message& _message, const MessageTiming& _timing) {
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _handlerid.queue;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(_handlerid.queue);
+    if (!content_ptr) {
         //ASSERT2(false, "%" PRIu64, id);
         return KNullPost;
     }
 
-    MessageQueueContent& content = pos->second;
-
+    MessageQueueContent& content = *content_ptr;
     MessageWrapper* messagewrapper = new MessageWrapper(_handlerid, _message, _timing, __MakeSeq());
 
-    content.lst_message.push_back(messagewrapper);
+    ScopedLock lock(content.mutex);
+    if (content.released) {
+        lock.unlock();
+        delete messagewrapper;
+        return KNullPost;
+    }
+
+    __AddMessage(content, messagewrapper);
     content.breaker->Notify(lock);
     return messagewrapper->postid;
 }
 
 MessagePost_t SingletonMessage(bool _replace, const MessageHandler_t& _handlerid, const Message& _message, const MessageTiming& _timing) {
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _handlerid.queue;
+    MessageQueueContentPtr content_ptr = __FindContent(_handlerid.queue);
+    if (!content_ptr) return KNullPost;
 
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return KNullPost;
-
-    MessageQueueContent& content = pos->second;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
+    if (content.released) return KNullPost;
 
     MessagePost_t post_id;
 
-    for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end(); ++it) {
-        if ((*it)->postid.reg == _handlerid && (*it)->message == _message) {
-            if (_replace) {
-                post_id = (*it)->postid;
-                delete(*it);
-                content.lst_message.erase(it);
-                break;
-            } else {
-                return (*it)->postid;
-            }
-        }
+    MessageWrapper* exist = __FindTitle(content, _handlerid, _message);
+    if (NULL != exist) {
+        if (!_replace) return exist->postid;
+
+        post_id = exist->postid;
+        __RemoveMessage(content, exist);
+        delete exist;
     }
 
     MessageWrapper* messagewrapper = new MessageWrapper(_handlerid, _message, _timing, 0 != post_id.seq ? post_id.seq : __MakeSeq());
-    content.lst_message.push_back(messagewrapper);
+    __AddMessage(content, messagewrapper);
     content.breaker->Notify(lock);
     return messagewrapper->postid;
 }
 
 MessagePost_t BroadcastMessage(const MessageQueue_t& _messagequeueid,  const Message& _message, const MessageTiming& _timing) {
-    ScopedLock lock(sg_messagequeue_map_mutex);
     const MessageQueue_t& id = _messagequeueid;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(id);
+    if (!content_ptr) {
         ASSERT2(false, "%" PRIu64, id);
         return KNullPost;
     }
 
-    MessageQueueContent& content = pos->second;
+    MessageQueueContent& content = *content_ptr;
 
     MessageHandler_t reg;
     reg.queue = _messagequeueid;
     reg.seq = 0;
     MessageWrapper* messagewrapper = new MessageWrapper(reg, _message, _timing, __MakeSeq());
 
-    content.lst_message.push_back(messagewrapper);
+    ScopedLock lock(content.mutex);
+    if (content.released) {
+        lock.unlock();
+        delete messagewrapper;
+        return KNullPost;
+    }
+
+    __AddMessage(content, messagewrapper);
     content.breaker->Notify(lock);
     return messagewrapper->postid;
 }
 
 static int64_t __ComputerWaitTime(const MessageWrapper& _wrap) {
-    int64_t wait_time = 0;
-
-    if (kImmediately == _wrap.timing.type) {
-        wait_time = 0;
-    } else if (kAfter == _wrap.timing.type) {
-        int64_t time_cost = ::gettickspan(_wrap.record_time);
-        wait_time =  _wrap.timing.after - time_cost;
-    } else if (kPeriod == _wrap.timing.type) {
-        int64_t time_cost = ::gettickspan(_wrap.record_time);
-
-        if (kAfter == _wrap.periodstatus) {
-            wait_time =  _wrap.timing.after - time_cost;
-        } else if (kPeriod == _wrap.periodstatus) {
-            wait_time =  _wrap.timing.period - time_cost;
-        }
-    }
+    if (kImmediately == _wrap.timing.type) return 0;
 
-    return 0 < wait_time ? wait_time : 0;
+    uint64_t now = ::gettickcount();
+    return _wrap.deadline > now ? (int64_t)(_wrap.deadline - now) : 0;
 }
 
 MessagePost_t FasterMessage(const MessageHandler_t& _handlerid, const Message& _message, const MessageTiming& _timing) {
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _handlerid.queue;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return KNullPost;
-
-    MessageQueueContent& content = pos->second;
+    MessageQueueContentPtr content_ptr = __FindContent(_handlerid.queue);
+    if (!content_ptr) return KNullPost;
 
+    MessageQueueContent& content = *content_ptr;
     MessageWrapper* messagewrapper = new MessageWrapper(_handlerid, _message, _timing, __MakeSeq());
 
-    for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end(); ++it) {
-        if ((*it)->postid.reg == _handlerid && (*it)->message == _message) {
-            if (__ComputerWaitTime(**it) < __ComputerWaitTime(*messagewrapper)) {
-                delete messagewrapper;
-                return (*it)->postid;
-            }
+    ScopedLock lock(content.mutex);
+    if (content.released) {
+        lock.unlock();
+        delete messagewrapper;
+        return KNullPost;
+    }
 
-            messagewrapper->postid = (*it)->postid;
-            delete(*it);
-            content.lst_message.erase(it);
-            break;
+    MessageWrapper* exist = __FindTitle(content, _handlerid, _message);
+    if (NULL != exist) {
+        if (__ComputerWaitTime(*exist) < __ComputerWaitTime(*messagewrapper)) {
+            MessagePost_t post_id = exist->postid;
+            lock.unlock();
+            delete messagewrapper;
+            return post_id;
         }
+
+        messagewrapper->postid = exist->postid;
+        __RemoveMessage(content, exist);
+        delete exist;
     }
 
-    content.lst_message.push_back(messagewrapper);
+    __AddMessage(content, messagewrapper);
     content.breaker->Notify(lock);
     return messagewrapper->postid;
 }
@@ -428,43 +768,36 @@ MessagePost_t FasterMessage(const MessageHandler_t& _handlerid, const Message& _
 bool WaitMessage(const MessagePost_t& _message) {
     bool is_in_mq = Handler2Queue(Post2Handler(_message)) == CurrentThreadMessageQueue();
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = Handler2Queue(Post2Handler(_message));
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return false;
-    MessageQueueContent& content = pos->second;
-
-    auto find_it = std::find_if(content.lst_message.begin(), content.lst_message.end(),
-                                [&_message](const MessageWrapper * const &_v) {
-                                    return _message == _v->postid;
-                                });
-    
-    if (find_it == content.lst_message.end()) {
+    MessageQueueContentPtr content_ptr = __FindContent(Handler2Queue(Post2Handler(_message)));
+    if (!content_ptr) return false;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
+
+    MessageWrapper* found = __FindPost(content, _message);
+
+    if (NULL == found) {
         auto find_it = std::find_if(content.lst_runloop_info.begin(), content.lst_runloop_info.end(),
                      [&_message](const RunLoopInfo& _v){ return _message == _v.runing_message_id; });
-        
+
         if (find_it != content.lst_runloop_info.end()) {
             if (is_in_mq) return false;
-            
+
             boost::shared_ptr<Condition> runing_cond = find_it->runing_cond;
             runing_cond->wait(lock);
         }
     } else {
-        
+
         if (is_in_mq) {
             lock.unlock();
-            RunLoop( [&_message](){
-                        MessageQueueContent& content = sg_messagequeue_map[Handler2Queue(Post2Handler(_message))];
-                        return content.lst_message.end() == std::find_if(content.lst_message.begin(), content.lst_message.end(),
-                                                                [&_message](const MessageWrapper *  const &_v) {
-                                                                    return _message == _v->postid;
-                                                                });
+            // breaker is called by RunLoop::Run with content.mutex held
+            RunLoop( [&_message, content_ptr](){
+                        return NULL == __FindPost(*content_ptr, _message);
             }).Run();
-            
+
         } else {
-            if (!((*find_it)->wait_end_cond))(*find_it)->wait_end_cond = boost::make_shared<Condition>();
+            if (!(found->wait_end_cond)) found->wait_end_cond = boost::make_shared<Condition>();
 
-            boost::shared_ptr<Condition> wait_end_cond = (*find_it)->wait_end_cond;
+            boost::shared_ptr<Condition> wait_end_cond = found->wait_end_cond;
             wait_end_cond->wait(lock);
         }
     }
@@ -473,24 +806,18 @@ bool WaitMessage(const MessagePost_t& _message) {
 }
 
 bool FoundMessage(const MessagePost_t& _message) {
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = Handler2Queue(Post2Handler(_message));
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return false;
-    MessageQueueContent& content = pos->second;
+    MessageQueueContentPtr content_ptr = __FindContent(Handler2Queue(Post2Handler(_message)));
+    if (!content_ptr) return false;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
     if (content.lst_runloop_info.empty()) return false;
 
     auto find_it = std::find_if(content.lst_runloop_info.begin(), content.lst_runloop_info.end(),
                                 [&_message](const RunLoopInfo& _v){ return _message == _v.runing_message_id; });
-    
-    if (find_it != content.lst_runloop_info.end())  { return true; }
 
-    for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end(); ++it) {
-        if (_message == (*it)->postid) { return true;}
-    }
+    if (find_it != content.lst_runloop_info.end())  { return true; }
 
-    return false;
+    return NULL != __FindPost(content, _message);
 }
 
 bool CancelMessage(const MessagePost_t& _postid) {
@@ -500,26 +827,22 @@ bool CancelMessage(const MessagePost_t& _postid) {
     // 0==_postid.reg.seq for BroadcastMessage
     if (0 == _postid.reg.queue || 0 == _postid.seq) return false;
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
     const MessageQueue_t& id = _postid.reg.queue;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(id);
+    if (!content_ptr) {
         ASSERT2(false, "%" PRIu64, id);
         return false;
     }
 
-    MessageQueueContent& content = pos->second;
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
 
-    for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end(); ++it) {
-        if (_postid == (*it)->postid) {
-            delete(*it);
-            content.lst_message.erase(it);
-            return true;
-        }
-    }
+    MessageWrapper* found = __FindPost(content, _postid);
+    if (NULL == found) return false;
 
-    return false;
+    __RemoveMessage(content, found);
+    delete found;
+    return true;
 }
 
 void CancelMessage(const MessageHandler_t& _handlerid) {
@@ -528,25 +851,15 @@ void CancelMessage(const MessageHandler_t& _handlerid) {
     // 0==_handlerid.seq for BroadcastMessage
     if (0 == _handlerid.queue) return;
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _handlerid.queue;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(_handlerid.queue);
+    if (!content_ptr) {
         //        ASSERT2(false, "%lu", id);
         return;
     }
 
-    MessageQueueContent& content = pos->second;
-
-    for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end();) {
-        if (_handlerid == (*it)->postid.reg) {
-            delete(*it);
-            it = content.lst_message.erase(it);
-        } else {
-            ++it;
-        }
-    }
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
+    __DeleteMessages(content, [&_handlerid](const MessageWrapper* _v) { return _handlerid == _v->postid.reg;});
 }
 
 void CancelMessage(const MessageHandler_t& _handlerid, const MessageTitle_t& _title) {
@@ -555,58 +868,53 @@ void CancelMessage(const MessageHandler_t& _handlerid, const MessageTitle_t& _ti
     // 0==_handlerid.seq for BroadcastMessage
     if (0 == _handlerid.queue) return;
 
-    ScopedLock lock(sg_messagequeue_map_mutex);
     const MessageQueue_t& id = _handlerid.queue;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(id);
+    if (!content_ptr) {
         ASSERT2(false, "%" PRIu64, id);
         return;
     }
 
-    MessageQueueContent& content = pos->second;
-
-    for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end();) {
-        if (_handlerid == (*it)->postid.reg && _title == (*it)->message.title) {
-            delete(*it);
-            it = content.lst_message.erase(it);
-        } else {
-            ++it;
-        }
-    }
+    MessageQueueContent& content = *content_ptr;
+    ScopedLock lock(content.mutex);
+    __DeleteMessages(content, [&_handlerid, &_title](const MessageWrapper* _v) {
+                         return _handlerid == _v->postid.reg && _title == _v->message.title;
+                     });
 }
-    
+
 const Message& RunningMessage() {
     MessageQueue_t id = (MessageQueue_t)ThreadUtil::currentthreadid();
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(id);
+    if (!content_ptr) {
         return KNullMessage;
     }
-    
-    Message* runing_message = pos->second.lst_runloop_info.back().runing_message;
+
+    ScopedLock lock(content_ptr->mutex);
+    Message* runing_message = content_ptr->lst_runloop_info.back().runing_message;
     return runing_message? *runing_message: KNullMessage;
 }
-    
+
 MessagePost_t RunningMessageID() {
     MessageQueue_t id = (MessageQueue_t)ThreadUtil::currentthreadid();
     return RunningMessageID(id);
 }
 
 MessagePost_t RunningMessageID(const MessageQueue_t& _id) {
-    ScopedLock lock(sg_messagequeue_map_mutex);
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(_id);
-    if (sg_messagequeue_map.end() == pos) {
+    MessageQueueContentPtr content_ptr = __FindContent(_id);
+    if (!content_ptr) {
         return KNullPost;
     }
 
-    MessageQueueContent& content = pos->second;
-    return content.lst_runloop_info.back().runing_message_id;
+    ScopedLock lock(content_ptr->mutex);
+    return content_ptr->lst_runloop_info.back().runing_message_id;
 }
 
 static void __AsyncInvokeHandler(const MessagePost_t& _id, Message& _message) {
+    if (_message.invoke) {
+        _message.invoke();
+        return;
+    }
+
     (*boost::any_cast<boost::shared_ptr<AsyncInvokeFunction> >(_message.body1))();
 }
 
@@ -614,7 +922,7 @@ MessageHandler_t InstallAsyncHandler(const MessageQueue_t& id) {
     ASSERT(0 != id);
     return InstallMessageHandler(__AsyncInvokeHandler, false, id);
 }
-    
+
 
 static MessageQueue_t __CreateMessageQueueInfo(boost::shared_ptr<RunloopCond>& _breaker, thread_tid _tid) {
     ScopedLock lock(sg_messagequeue_map_mutex);
@@ -622,40 +930,41 @@ static MessageQueue_t __CreateMessageQueueInfo(boost::shared_ptr<RunloopCond>& _
     MessageQueue_t id = (MessageQueue_t)_tid;
 
     if (sg_messagequeue_map.end() == sg_messagequeue_map.find(id)) {
-        MessageQueueContent& content = sg_messagequeue_map[id];
-        HandlerWrapper* handler = new HandlerWrapper(&__AsyncInvokeHandler, false, id, __MakeSeq());
+        MessageQueueContentPtr content_ptr = boost::make_shared<MessageQueueContent>();
+        MessageQueueContent& content = *content_ptr;
+        boost::shared_ptr<HandlerWrapper> handler = boost::make_shared<HandlerWrapper>(&__AsyncInvokeHandler, false, id, __MakeSeq());
         content.lst_handler.push_back(handler);
+        content.handler_index[handler->reg.seq] = --content.lst_handler.end();
         content.invoke_reg = handler->reg;
         if (_breaker)
             content.breaker = _breaker;
         else
             content.breaker = boost::make_shared<Cond>();
+
+        sg_messagequeue_map[id] = content_ptr;
     }
 
     return id;
 }
-    
-static void __ReleaseMessageQueueInfo() {
 
-    MessageQueue_t id = (MessageQueue_t)ThreadUtil::currentthreadid();
+// called with _content.mutex held
+static void __ReleaseMessageQueueInfo(MessageQueueContent& _content) {
 
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() != pos) {
-        MessageQueueContent& content = pos->second;
+    MessageQueue_t id = (MessageQueue_t)ThreadUtil::currentthreadid();
 
-        for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end(); ++it) {
-            delete(*it);
-        }
+    _content.released = true;
+    __DeleteMessages(_content, [](const MessageWrapper*) { return true;});
 
-        for (std::list<HandlerWrapper*>::iterator it = content.lst_handler.begin(); it != content.lst_handler.end(); ++it) {
-            delete(*it);
-        }
+    _content.lst_handler.clear();
+    _content.handler_index.clear();
+    _content.post_index.clear();
+    _content.title_index.clear();
 
-        sg_messagequeue_map.erase(id);
-    }
+    ScopedLock lock(sg_messagequeue_map_mutex);
+    sg_messagequeue_map.erase(id);
 }
 
-    
+
 const static int kMQCallANRId = 110;
 const static long kWaitANRTimeout = 5 * 1000;
 static void __ANRAssert(bool _iOS_style, const mars::comm::check_content& _content, MessageHandler_t _mq_id) {
@@ -663,27 +972,27 @@ static void __ANRAssert(bool _iOS_style, const mars::comm::check_content& _conte
         xwarn2(TSF"messagequeue already destroy, handler:(%_,%_)", _mq_id.queue, _mq_id.seq);
         return;
     }
-    
-    __ASSERT2(_content.file.c_str(), _content.line, _content.func.c_str(), "anr dead lock", "timeout:%d, tid:%" PRIu64 ", runing time:%" PRIu64 ", real time:%" PRIu64 ", used_cpu_time:%" PRIu64 ", iOS_style:%d",
+
+    __ASSERT2(_content.file, _content.line, _content.func, "anr dead lock", "timeout:%d, tid:%" PRIu64 ", runing time:%" PRIu64 ", real time:%" PRIu64 ", used_cpu_time:%" PRIu64 ", iOS_style:%d",
               _content.timeout, _content.tid, clock_app_monotonic() - _content.start_time, gettickcount() - _content.start_tickcount, _content.used_cpu_time, _iOS_style);
 #ifdef ANDROID
-    __FATAL_ASSERT2(_content.file.c_str(), _content.line, _content.func.c_str(), "anr dead lock", "timeout:%d, tid:%" PRIu64 ", runing time:%" PRIu64 ", real time:%" PRIu64 ", used_cpu_time:%" PRIu64 ", iOS_style:%s",
+    __FATAL_ASSERT2(_content.file, _content.line, _content.func, "anr dead lock", "timeout:%d, tid:%" PRIu64 ", runing time:%" PRIu64 ", real time:%" PRIu64 ", used_cpu_time:%" PRIu64 ", iOS_style:%s",
                     _content.timeout, _content.tid, clock_app_monotonic() - _content.start_time, gettickcount() - _content.start_tickcount, _content.used_cpu_time, _iOS_style?"true":"false");
 #endif
 }
-    
+
 
 static void __ANRCheckCallback(bool _iOS_style, const mars::comm::check_content& _content) {
     if (kMQCallANRId != _content.call_id) {
         return;
     }
-    
+
     MessageHandler_t mq_id = *((MessageHandler_t*)_content.extra_info);
     xinfo2(TSF"anr check content:%_, handler:(%_,%_)", _content.call_id, mq_id.queue, mq_id.seq);
-    
+
     boost::shared_ptr<Thread> thread(new Thread(boost::bind(__ANRAssert, _iOS_style, _content, mq_id)));
     thread->start_after(kWaitANRTimeout);
-    
+
     MessageQueue::AsyncInvoke([=]() {
         if (thread->isruning()) {
             xinfo2(TSF"misjudge anr, timeout:%_, tid:%_, runing time:%_, real time:%_, used_cpu_time:%_, handler:(%_,%_)", _content.timeout,
@@ -700,100 +1009,102 @@ static void __RgisterANRCheckCallback() {
 static void __UnregisterANRCheckCallback() {
     GetSignalCheckHit().disconnect(5);
 }
-    
+
 BOOT_RUN_STARTUP(__RgisterANRCheckCallback);
 BOOT_RUN_EXIT(__UnregisterANRCheckCallback);
 #endif
+
+// picks the next message to run, O(1) for immediate messages and O(log n) for timers.
+// returns NULL and fills _wait_time when nothing is due.
+static MessageWrapper* __PickMessage(MessageQueueContent& _content, int64_t& _wait_time, bool& _delmessage) {
+    MessageWrapper* timer = _content.timer_heap.empty() ? NULL : _content.timer_heap.top();
+    uint64_t now = NULL == timer ? 0 : ::gettickcount();
+    bool timer_due = NULL != timer && timer->deadline <= now;
+
+    if (!_content.lst_message.empty() && (!timer_due || _content.lst_message.front()->order < timer->order)) {
+        MessageWrapper* wrapper = _content.lst_message.pop_front();
+        __UnindexMessage(_content, wrapper);
+        return wrapper;
+    }
+
+    if (!timer_due) {
+        if (NULL != timer) _wait_time = std::min(_wait_time, (int64_t)(timer->deadline - now));
+        return NULL;
+    }
+
+    _content.timer_heap.erase(timer);
+
+    if (kAfter == timer->timing.type) {
+        __UnindexMessage(_content, timer);
+        return timer;
+    }
+
+    ASSERT(kPeriod == timer->timing.type);
+    // period message stays in queue while running, same as it always did
+    timer->record_time = now;
+    timer->periodstatus = kPeriod;
+    timer->deadline = now + (0 < timer->timing.period ? timer->timing.period : 0);
+    timer->order = ++_content.post_order;
+    _content.timer_heap.push(timer);
+    _delmessage = false;
+    return timer;
+}
+
 void RunLoop::Run() {
     MessageQueue_t id = CurrentThreadMessageQueue();
     ASSERT(0 != id);
+
+    MessageQueueContentPtr content_ptr = __FindContent(id);
+    ASSERT(content_ptr);
+    if (!content_ptr) return;
+    MessageQueueContent& content = *content_ptr;
+
     {
-        ScopedLock lock(sg_messagequeue_map_mutex);
-        sg_messagequeue_map[id].lst_runloop_info.push_back(RunLoopInfo());
+        ScopedLock lock(content.mutex);
+        content.lst_runloop_info.push_back(RunLoopInfo());
     }
-    
+
     xinfo_function(TSF"messagequeue id:%_", id);
 
+    // reused by every round, the handlers are referenced rather than copied
+    std::vector<boost::shared_ptr<HandlerWrapper> > fit_handler;
+
     while (true) {
-        ScopedLock lock(sg_messagequeue_map_mutex);
-        MessageQueueContent& content = sg_messagequeue_map[id];
+        ScopedLock lock(content.mutex);
         content.lst_runloop_info.back().runing_message_id = KNullPost;
         content.lst_runloop_info.back().runing_message = NULL;
         content.lst_runloop_info.back().runing_handler.clear();
         content.lst_runloop_info.back().runing_cond->notifyAll(lock);
-        
+
         if (duty_func_) duty_func_();
 
         if ((content.breakflag || (breaker_func_ && breaker_func_()))) {
             content.lst_runloop_info.pop_back();
             if (content.lst_runloop_info.empty())
-                __ReleaseMessageQueueInfo();
+                __ReleaseMessageQueueInfo(content);
             break;
         }
 
         int64_t wait_time = 10 * 60 * 1000;
-        MessageWrapper* messagewrapper = NULL;
         bool delmessage = true;
-
-        for (std::list<MessageWrapper*>::iterator it = content.lst_message.begin(); it != content.lst_message.end(); ++it) {
-            if (kImmediately == (*it)->timing.type) {
-                messagewrapper = *it;
-                content.lst_message.erase(it);
-                break;
-            } else if (kAfter == (*it)->timing.type) {
-                int64_t time_cost = ::gettickspan((*it)->record_time);
-
-                if ((*it)->timing.after <= time_cost) {
-                    messagewrapper = *it;
-                    content.lst_message.erase(it);
-                    break;
-                } else {
-                    wait_time = std::min(wait_time, (*it)->timing.after - time_cost);
-                }
-            } else if (kPeriod == (*it)->timing.type) {
-                if (kAfter == (*it)->periodstatus) {
-                    int64_t time_cost = ::gettickspan((*it)->record_time);
-
-                    if ((*it)->timing.after <= time_cost) {
-                        messagewrapper = *it;
-                        (*it)->record_time = ::gettickcount();
-                        (*it)->periodstatus = kPeriod;
-                        delmessage = false;
-                        break;
-                    } else {
-                        wait_time = std::min(wait_time, (*it)->timing.after - time_cost);
-                    }
-                } else if (kPeriod == (*it)->periodstatus) {
-                    int64_t time_cost = ::gettickspan((*it)->record_time);
-
-                    if ((*it)->timing.period <= time_cost) {
-                        messagewrapper = *it;
-                        (*it)->record_time = ::gettickcount();
-                        delmessage = false;
-                        break;
-                    } else {
-                        wait_time = std::min(wait_time, (*it)->timing.period - time_cost);
-                    }
-                } else {
-                    ASSERT(false);
-                }
-            } else {
-                ASSERT(false);
-            }
-        }
+        MessageWrapper* messagewrapper = __PickMessage(content, wait_time, delmessage);
 
         if (NULL == messagewrapper) {
             content.breaker->Wait(lock, (long)wait_time);
             continue;
         }
 
-        std::list<HandlerWrapper> fit_handler;
-
-        for (std::list<HandlerWrapper*>::iterator it = content.lst_handler.begin(); it != content.lst_handler.end(); ++it) {
-            if (messagewrapper->postid.reg == (*it)->reg || ((*it)->recvbroadcast && messagewrapper->postid.reg.isbroadcast())) {
-                fit_handler.push_back(**it);
-                content.lst_runloop_info.back().runing_handler.push_back((*it)->reg);
+        // a message to one handler is found by its seq, only a broadcast goes down the list
+        if (messagewrapper->postid.reg.isbroadcast()) {
+            for (std::list<boost::shared_ptr<HandlerWrapper> >::iterator it = content.lst_handler.begin(); it != content.lst_handler.end(); ++it) {
+                if ((*it)->recvbroadcast) fit_handler.push_back(*it);
             }
+        } else {
+            auto it = content.handler_index.find(messagewrapper->postid.reg.seq);
+            if (content.handler_index.end() != it && messagewrapper->postid.reg == (*it->second)->reg) fit_handler.push_back(*it->second);
+        }
+        for (std::vector<boost::shared_ptr<HandlerWrapper> >::iterator it = fit_handler.begin(); it != fit_handler.end(); ++it) {
+            content.lst_runloop_info.back().runing_handler.push_back((*it)->reg);
         }
 
         content.lst_runloop_info.back().runing_message_id = messagewrapper->postid;
@@ -801,10 +1112,10 @@ void RunLoop::Run() {
         int64_t anr_timeout = messagewrapper->message.anr_timeout;
         lock.unlock();
 
-        for (std::list<HandlerWrapper>::iterator it = fit_handler.begin(); it != fit_handler.end(); ++it) {
-            SCOPE_ANR_AUTO((int)anr_timeout, kMQCallANRId, &(*it).reg);
+        for (std::vector<boost::shared_ptr<HandlerWrapper> >::iterator it = fit_handler.begin(); it != fit_handler.end(); ++it) {
+            SCOPE_ANR_AUTO((int)anr_timeout, kMQCallANRId, &(*it)->reg);
             uint64_t timestart = ::clock_app_monotonic();
-            (*it).handler(messagewrapper->postid, messagewrapper->message);
+            (*it)->handler(messagewrapper->postid, messagewrapper->message);
             uint64_t timeend = ::clock_app_monotonic();
 #if defined(DEBUG) && defined(__APPLE__)
 
@@ -813,6 +1124,8 @@ void RunLoop::Run() {
                 ASSERT2(0 >= anr_timeout || anr_timeout >= (int64_t)(timeend - timestart), "anr_timeout:%" PRId64 " < cost:%" PRIu64", timestart:%" PRIu64", timeend:%" PRIu64, anr_timeout, timeend - timestart, timestart, timeend);
         }
 
+        fit_handler.clear();
+
         if (delmessage) {
             delete messagewrapper;
         }
@@ -820,13 +1133,10 @@ void RunLoop::Run() {
 }
 
 boost::shared_ptr<RunloopCond> RunloopCond::CurrentCond() {
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    MessageQueue_t id = (MessageQueue_t)ThreadUtil::currentthreadid();
+    MessageQueueContentPtr content_ptr = __FindContent((MessageQueue_t)ThreadUtil::currentthreadid());
 
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() != pos) {
-        MessageQueueContent& content = pos->second;
-        return content.breaker;
+    if (content_ptr) {
+        return content_ptr->breaker;
     } else {
         return boost::shared_ptr<RunloopCond>();
     }
@@ -936,14 +1246,11 @@ MessageQueue_t GetDefTaskQueue() {
 }
 
 MessageHandler_t DefAsyncInvokeHandler(const MessageQueue_t& _messagequeue) {
-    ScopedLock lock(sg_messagequeue_map_mutex);
-    const MessageQueue_t& id = _messagequeue;
-
-    std::map<MessageQueue_t, MessageQueueContent>::iterator pos = sg_messagequeue_map.find(id);
-    if (sg_messagequeue_map.end() == pos) return KNullHandler;
+    MessageQueueContentPtr content_ptr = __FindContent(_messagequeue);
+    if (!content_ptr) return KNullHandler;
 
-    MessageQueueContent& content = pos->second;
-    return content.invoke_reg;
+    // invoke_reg is immutable after __CreateMessageQueueInfo
+    return content_ptr->invoke_reg;
 }
 
 ScopeRegister::ScopeRegister(const MessageHandler_t& _reg)
@@ -36,6 +36,7 @@
 #endif 
 
 #include "mars/comm/thread/thread.h"
+#include "mars/comm/messagequeue/small_function.h"
 
 namespace MessageQueue {
 
@@ -76,11 +77,10 @@ struct Message {
     Message(const MessageTitle_t& _title, const boost::any& _body1, const boost::any& _body2)
         : title(_title), body1(_body1), body2(_body2), anr_timeout(10*60*1000) {}
 
+    // the callable is kept inline in |invoke|, no heap allocation for small functors
     template <class F>
     Message(const MessageTitle_t& _title, const F& _func)
-    : title(_title), body1(boost::make_shared<AsyncInvokeFunction>()), body2(), anr_timeout(10*60*1000) {
-        *boost::any_cast<boost::shared_ptr<AsyncInvokeFunction> >(body1) = _func;
-    }
+    : title(_title), body1(), body2(), anr_timeout(10*60*1000), invoke(_func) {}
 
     bool operator == (const Message& _rhs) const {return title == _rhs.title;}
 
@@ -88,6 +88,7 @@ struct Message {
     boost::any      body1;
     boost::any      body2;
     int64_t         anr_timeout;
+    SmallFunction   invoke;     // AsyncInvoke callable, async handler falls back to body1 when empty
 };
 
     
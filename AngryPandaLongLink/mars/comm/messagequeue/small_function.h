@@ -0,0 +1,115 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * small_function.h
+ *
+ * void() callable with small buffer storage. callables up to kInplaceSize bytes
+ * (lambdas with a few captures, boost::bind results, function pointers) are stored
+ * inside the object itself, so copying a Message does not touch the heap.
+ */
+
+#ifndef MESSAGEQUEUE_SMALL_FUNCTION_H_
+#define MESSAGEQUEUE_SMALL_FUNCTION_H_
+
+#include <stddef.h>
+#include <new>
+
+#include "boost/type_traits/alignment_of.hpp"
+#include "boost/type_traits/aligned_storage.hpp"
+#include "boost/type_traits/is_same.hpp"
+#include "boost/utility/enable_if.hpp"
+
+namespace MessageQueue {
+
+class SmallFunction {
+  public:
+    static const size_t kInplaceSize = 8 * sizeof(void*);
+
+    SmallFunction(): ops_(NULL) {}
+
+    template <class F>
+    SmallFunction(const F& _func, typename boost::disable_if<boost::is_same<F, SmallFunction> >::type* = 0): ops_(NULL) { __Assign(_func); }
+
+    SmallFunction(const SmallFunction& _rhs): ops_(NULL) {
+        if (_rhs.ops_) _rhs.ops_->copy(_rhs.__Data(), this);
+        ops_ = _rhs.ops_;
+    }
+
+    ~SmallFunction() { __Reset(); }
+
+    SmallFunction& operator=(const SmallFunction& _rhs) {
+        if (this == &_rhs) return *this;
+
+        __Reset();
+        if (_rhs.ops_) _rhs.ops_->copy(_rhs.__Data(), this);
+        ops_ = _rhs.ops_;
+        return *this;
+    }
+
+    void operator()() const { ops_->invoke(__Data()); }
+    bool empty() const { return NULL == ops_;}
+    operator bool() const { return NULL != ops_;}
+
+  private:
+    struct Ops {
+        void (*invoke)(void* _data);
+        void (*copy)(const void* _data, SmallFunction* _to);
+        void (*destroy)(void* _data);
+    };
+
+    template <class F>
+    struct InplaceOps {
+        static void Invoke(void* _data) { (*static_cast<F*>(_data))(); }
+        static void Copy(const void* _data, SmallFunction* _to) { new (_to->storage_.address()) F(*static_cast<const F*>(_data)); }
+        static void Destroy(void* _data) { static_cast<F*>(_data)->~F(); }
+        static const Ops* Get() { static const Ops ops = {&Invoke, &Copy, &Destroy}; return &ops;}
+    };
+
+    // fallback for big callables, costs one allocation per copy like boost::function does
+    template <class F>
+    struct HeapOps {
+        static void Invoke(void* _data) { (**static_cast<F**>(_data))(); }
+        static void Copy(const void* _data, SmallFunction* _to) { *static_cast<F**>(_to->storage_.address()) = new F(**static_cast<F* const*>(_data)); }
+        static void Destroy(void* _data) { delete *static_cast<F**>(_data); }
+        static const Ops* Get() { static const Ops ops = {&Invoke, &Copy, &Destroy}; return &ops;}
+    };
+
+    template <class F>
+    void __Assign(const F& _func) {
+        if (sizeof(F) <= kInplaceSize && 0 == boost::alignment_of<Storage>::value % boost::alignment_of<F>::value) {
+            new (storage_.address()) F(_func);
+            ops_ = InplaceOps<F>::Get();
+        } else {
+            *static_cast<F**>(storage_.address()) = new F(_func);
+            ops_ = HeapOps<F>::Get();
+        }
+    }
+
+    void __Reset() {
+        if (ops_) ops_->destroy(storage_.address());
+        ops_ = NULL;
+    }
+
+    void* __Data() const { return const_cast<void*>(storage_.address());}
+
+  private:
+    typedef boost::aligned_storage<kInplaceSize, boost::alignment_of<void*>::value> Storage;
+
+    const Ops* ops_;
+    Storage storage_;
+};
+
+}
+
+#endif /* MESSAGEQUEUE_SMALL_FUNCTION_H_ */
@@ -26,10 +26,12 @@
 #endif
 
 
+#include <limits.h>
 #include <algorithm>
 
 #include "comm/xlogger/xlogger.h"
 #include "comm/socket/socketselect.h"
+#include "comm/socket/connect_rtt.h"
 #include "comm/socket/tcpclient_fsm.h"
 #include "comm/socket/socket_address.h"
 #include "comm/http.h"
@@ -86,18 +88,21 @@ class ConnectCheckFSM : public TcpClientFSM {
     };
 
     ConnectCheckFSM(const socket_address& _addr, unsigned int _connect_timeout, unsigned int _index, MComplexConnect* _observer)
-        : TcpClientFSM(_addr.address()), connect_timeout_(_connect_timeout), index_(_index), observer_(_observer), checkfintime_(0) {
+        : TcpClientFSM(_addr.address()), connect_timeout_(_connect_timeout), index_(_index), observer_(_observer), checkfintime_(0), record_rtt_(true) {
         check_status_ = (_observer && _observer->OnShouldVerify(_index, addr_)) ? ECheckInit : ECheckOK;
     }
 
     TCheckStatus CheckStatus() const { return check_status_;}
     int TotalRtt() const { return int(checkfintime_ - start_connecttime_);}
+    bool RecordRtt() const { return record_rtt_;}
+    int ConnectingTime() const { return int(::gettickcount() - start_connecttime_);}
 
   protected:
     virtual void _OnCreate() { if (observer_) observer_->OnCreated(index_, addr_, sock_);}
     virtual void _OnConnect() { if (observer_) observer_->OnConnect(index_, addr_, sock_);}
     virtual void _OnConnected(int _rtt) {
         checkfintime_ = ::gettickcount();
+        ConnectRttTable::Instance().OnConnected(addr_, _rtt);
 
         if (!observer_) return;
 
@@ -125,6 +130,7 @@ class ConnectCheckFSM : public TcpClientFSM {
 
     virtual void _OnClose(TSocketStatus _status, int _error, bool _userclose) {
         checkfintime_ = gettickcount();
+        if (record_rtt_ && EConnecting == _status && 0 != _error) ConnectRttTable::Instance().OnFailed(addr_);
 
         if (observer_ && !_userclose) {
             if (EConnecting == _status) {
@@ -148,6 +154,7 @@ class ConnectCheckFSM : public TcpClientFSM {
     MComplexConnect* observer_;
     TCheckStatus check_status_;
     uint64_t checkfintime_;
+    bool record_rtt_;  // the rtt of a proxy is not the rtt of the address
 };
     
     
@@ -157,6 +164,7 @@ public:
                              const std::string& _proxy_pwd, unsigned int _connect_timeout, unsigned int _index, MComplexConnect* _observer)
     : ConnectCheckFSM(_proxy_addr, _connect_timeout,_index,_observer), destaddr_(_destaddr), username_(_proxy_username), password_(_proxy_pwd){
         check_status_ = ECheckInit;
+        record_rtt_ = false;
         xinfo2(TSF"http tunel proxy info:%_:%_ username:%_", _proxy_addr.ip(), _proxy_addr.port(), username_);
     }
     
@@ -262,6 +270,7 @@ public:
                           const std::string& _proxy_pwd, unsigned int _connect_timeout, unsigned int _index, MComplexConnect* _observer)
     : ConnectCheckFSM(_proxy_addr, _connect_timeout,_index,_observer), destaddr_(_destaddr), username_(_proxy_username), password_(_proxy_pwd){
         check_status_ = ECheckInit;
+        record_rtt_ = false;
         xinfo2(TSF"socks5 proxy info:%_:%_ username:%_", _proxy_addr.ip(), _proxy_addr.port(), username_);
     }
     
@@ -470,22 +479,32 @@ SOCKET ComplexConnect::ConnectImpatient(const std::vector<socket_address>& _veca
         vecsocketfsm.push_back(ic);
     }
 
+    // through a proxy every address is the proxy, there is nothing to learn of them
+    ConnectRttTable& rtt_table = ConnectRttTable::Instance();
+    std::vector<unsigned int> order;
+    if (mars::comm::kProxyNone == _proxy_type) {
+        rtt_table.Order(_vecaddr, order);
+    } else {
+        for (unsigned int i = 0; i < _vecaddr.size(); ++i) order.push_back(i);
+    }
+
     uint64_t  curtime = gettickcount();
     uint64_t  laststart_connecttime = curtime - std::max(interval_, error_interval_);
+    unsigned int connect_delay = interval_;
 
     xdebug2(TSF"curtime:%_, laststart_connecttime:%_, @%_", curtime, laststart_connecttime, this);
 
     int lasterror = 0;
     unsigned int index = 0;
     SOCKET retsocket = INVALID_SOCKET;
+    SocketSelect sel(_breaker);
 
     do {
         curtime = gettickcount();
         // timeout and connect
-        SocketSelect sel(_breaker);
         sel.PreSelect();
 
-        int next_connect_timeout = int(((0 == lasterror) ? interval_ : error_interval_) - (curtime - laststart_connecttime));
+        int next_connect_timeout = int(((0 == lasterror) ? connect_delay : std::min(connect_delay, error_interval_)) - (curtime - laststart_connecttime));
 
         int timeout = (int)timeout_;
         unsigned int runing_count = (unsigned int)std::count_if(vecsocketfsm.begin(), vecsocketfsm.end(), &__isconnecting);
@@ -500,7 +519,9 @@ SOCKET ComplexConnect::ConnectImpatient(const std::vector<socket_address>& _veca
         if (index < vecsocketfsm.size()
                 && 0 >= next_connect_timeout
                 && runing_count < max_connect_) {
-            if (runing_count + 1 < max_connect_) timeout = std::min(timeout, (int)interval_);
+            // a known address gets twice its rtt before the next one starts, an unknown one the whole interval
+            connect_delay = mars::comm::kProxyNone == _proxy_type ? rtt_table.ConnectDelay(_vecaddr[order[index]], interval_) : interval_;
+            if (runing_count + 1 < max_connect_) timeout = std::min(timeout, (int)connect_delay);
 
             laststart_connecttime = gettickcount();
             lasterror = 0;
@@ -509,7 +530,8 @@ SOCKET ComplexConnect::ConnectImpatient(const std::vector<socket_address>& _veca
             ++index;
         }
 
-        for (unsigned int i = 0; i < index; ++i) {
+        for (unsigned int k = 0; k < index; ++k) {
+            unsigned int i = order[k];
             if (NULL == vecsocketfsm[i]) continue;
 
             xgroup2_define(group);
@@ -546,7 +568,8 @@ SOCKET ComplexConnect::ConnectImpatient(const std::vector<socket_address>& _veca
         }
 
         // socket
-        for (unsigned int i = 0; i < index; ++i) {
+        for (unsigned int k = 0; k < index; ++k) {
+            unsigned int i = order[k];
             if (NULL == vecsocketfsm[i]) continue;
 
             xgroup2_define(group);
@@ -607,6 +630,10 @@ SOCKET ComplexConnect::ConnectImpatient(const std::vector<socket_address>& _veca
 
     for (unsigned int i = 0; i < vecsocketfsm.size(); ++i) {
         if (NULL != vecsocketfsm[i]) {
+            // lost to a faster one, next time it does not go first
+            if (INVALID_SOCKET != retsocket && TcpClientFSM::EConnecting == vecsocketfsm[i]->Status() && vecsocketfsm[i]->RecordRtt())
+                rtt_table.OnCancelled(_vecaddr[i], vecsocketfsm[i]->ConnectingTime());
+
             vecsocketfsm[i]->Close(false);
             delete vecsocketfsm[i];
             vecsocketfsm[i] = NULL;
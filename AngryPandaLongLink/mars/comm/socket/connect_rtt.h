@@ -0,0 +1,250 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * connect_rtt.h
+ *
+ * connect rtts of the addresses ComplexConnect went to, smoothed as tcp does (rfc 6298) and kept by
+ * network. ComplexConnect tries the addresses it knows to be fast first, alternating ipv6 and ipv4
+ * as rfc 8305 does, and gives each a head start of twice its rtt instead of the whole interval.
+ */
+
+#ifndef COMM_SOCKET_CONNECT_RTT_H_
+#define COMM_SOCKET_CONNECT_RTT_H_
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "comm/socket/socket_address.h"
+#include "comm/thread/lock.h"
+
+class ConnectRttTable {
+  public:
+    static const size_t kMaxEntries = 512;
+    static const time_t kExpireS = 7 * 24 * 60 * 60;
+    static const unsigned int kMinDelayMs = 100;     // rfc 8305 section 5
+
+    // never destroyed, connects may run at exit
+    static ConnectRttTable& Instance() {
+        static ConnectRttTable* table = new ConnectRttTable;
+        return *table;
+    }
+
+  public:
+    ConnectRttTable(): network_("-") {}
+
+    // the rtts that follow are of the network called _network
+    void SetNetwork(const std::string& _network) {
+        ScopedLock lock(mutex_);
+        network_ = _network.empty() ? "-" : _network;
+        // a word of its own in the saved file, ssids may have spaces
+        for (size_t i = 0; i < network_.size(); ++i) {
+            if (isspace((unsigned char)network_[i])) network_[i] = '_';
+        }
+    }
+
+    void OnConnected(const socket_address& _addr, int _rtt) {
+        if (0 > _rtt) return;
+
+        ScopedLock lock(mutex_);
+        Entry& entry = __Entry(_addr);
+        if (0 == entry.samples) {
+            entry.srtt = _rtt;
+            entry.rttvar = _rtt / 2;
+        } else {
+            entry.rttvar = (3 * entry.rttvar + abs(entry.srtt - _rtt)) / 4;
+            entry.srtt = (7 * entry.srtt + _rtt) / 8;
+        }
+        ++entry.samples;
+        entry.fails = 0;
+        entry.updated = time(NULL);
+    }
+
+    void OnFailed(const socket_address& _addr) {
+        ScopedLock lock(mutex_);
+        Entry& entry = __Entry(_addr);
+        ++entry.fails;
+        entry.updated = time(NULL);
+    }
+
+    // given up on after _elapsed ms because another address won, its rtt is at least that
+    void OnCancelled(const socket_address& _addr, int _elapsed) {
+        ScopedLock lock(mutex_);
+        std::map<std::string, Entry>::iterator it = entries_.find(__Key(_addr));
+        if (entries_.end() == it || 0 == it->second.samples || _elapsed <= it->second.srtt) return;
+        it->second.srtt = _elapsed;
+        it->second.updated = time(NULL);
+    }
+
+    // false if it was never connected to on this network
+    bool Srtt(const socket_address& _addr, int& _srtt) {
+        ScopedLock lock(mutex_);
+        std::map<std::string, Entry>::iterator it = entries_.find(__Key(_addr));
+        if (entries_.end() == it || 0 == it->second.samples) return false;
+        _srtt = it->second.srtt;
+        return true;
+    }
+
+    // how long to wait for _addr before the next address starts, at most _interval
+    unsigned int ConnectDelay(const socket_address& _addr, unsigned int _interval) {
+        int srtt = 0;
+        if (!Srtt(_addr, srtt)) return _interval;
+        return std::min(_interval, std::max((unsigned int)kMinDelayMs, (unsigned int)(2 * srtt)));
+    }
+
+    // the indexes of _addrs in the order to try them: the ones known fastest first, then the unknown ones
+    // as given, then the ones that failed last time, with ipv6 and ipv4 taking turns
+    void Order(const std::vector<socket_address>& _addrs, std::vector<unsigned int>& _order) {
+        std::vector<std::pair<int64_t, unsigned int> > ranked;
+
+        ScopedLock lock(mutex_);
+        for (unsigned int i = 0; i < _addrs.size(); ++i) {
+            int64_t rank = 0x7FFFFFFF;
+            std::map<std::string, Entry>::iterator it = entries_.find(__Key(_addrs[i]));
+            if (entries_.end() != it && 0 < it->second.fails) rank = 0xFFFFFFFFLL + it->second.fails;
+            else if (entries_.end() != it && 0 < it->second.samples) rank = it->second.srtt;
+            ranked.push_back(std::make_pair(rank, i));
+        }
+        lock.unlock();
+
+        std::stable_sort(ranked.begin(), ranked.end());
+
+        std::vector<unsigned int> families[2];
+        int first = 0;
+        for (size_t i = 0; i < ranked.size(); ++i) {
+            int family = AF_INET6 == _addrs[ranked[i].second].address().sa_family ? 1 : 0;
+            if (0 == i) first = family;
+            families[family].push_back(ranked[i].second);
+        }
+
+        _order.clear();
+        for (size_t i = 0; i < std::max(families[0].size(), families[1].size()); ++i) {
+            if (i < families[first].size()) _order.push_back(families[first][i]);
+            if (i < families[1 - first].size()) _order.push_back(families[1 - first][i]);
+        }
+    }
+
+    // one line an address: network ip port srtt rttvar samples fails updated
+    bool Save(const std::string& _path) {
+        FILE* file = fopen(_path.c_str(), "w");
+        if (NULL == file) return false;
+
+        ScopedLock lock(mutex_);
+        for (std::map<std::string, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+            const Entry& entry = it->second;
+            fprintf(file, "%s %s %u %d %d %d %d %lld\n", entry.network.c_str(), entry.ip.c_str(), (unsigned int)entry.port,
+                    entry.srtt, entry.rttvar, entry.samples, entry.fails, (long long)entry.updated);
+        }
+        lock.unlock();
+
+        return 0 == fclose(file);
+    }
+
+    bool Load(const std::string& _path) {
+        FILE* file = fopen(_path.c_str(), "r");
+        if (NULL == file) return false;
+
+        time_t now = time(NULL);
+        char line[512];
+        ScopedLock lock(mutex_);
+        while (NULL != fgets(line, sizeof(line), file)) {
+            char network[256] = {0};
+            char ip[64] = {0};
+            unsigned int port = 0;
+            long long updated = 0;
+            Entry entry;
+            if (8 != sscanf(line, "%255s %63s %u %d %d %d %d %lld", network, ip, &port, &entry.srtt, &entry.rttvar, &entry.samples, &entry.fails, &updated)) continue;
+            if (65535 < port || 0 > entry.srtt || now > (time_t)updated + kExpireS) continue;
+
+            entry.network = network;
+            entry.ip = ip;
+            entry.port = (uint16_t)port;
+            entry.updated = (time_t)updated;
+            entries_[__Key(entry.network, entry.ip, entry.port)] = entry;
+        }
+        __Trim();
+        lock.unlock();
+
+        fclose(file);
+        return true;
+    }
+
+    void Clear() {
+        ScopedLock lock(mutex_);
+        entries_.clear();
+    }
+
+  private:
+    struct Entry {
+        Entry(): port(0), srtt(0), rttvar(0), samples(0), fails(0), updated(0) {}
+
+        std::string network;
+        std::string ip;
+        uint16_t    port;
+        int         srtt;
+        int         rttvar;
+        int         samples;
+        int         fails;      // in a row
+        time_t      updated;
+    };
+
+    static std::string __Key(const std::string& _network, const std::string& _ip, uint16_t _port) {
+        char port[8];
+        snprintf(port, sizeof(port), "%u", (unsigned int)_port);
+        return _network + "/" + _ip + "/" + port;
+    }
+
+    std::string __Key(const socket_address& _addr) const { return __Key(network_, _addr.ipv6(), _addr.port()); }
+
+    Entry& __Entry(const socket_address& _addr) {
+        std::string key = __Key(_addr);
+        std::map<std::string, Entry>::iterator it = entries_.find(key);
+        if (entries_.end() != it) return it->second;
+
+        __Trim();
+        Entry& entry = entries_[key];
+        entry.network = network_;
+        entry.ip = _addr.ipv6();
+        entry.port = _addr.port();
+        return entry;
+    }
+
+    // the least recently updated go when there are too many
+    void __Trim() {
+        while (entries_.size() >= kMaxEntries) {
+            std::map<std::string, Entry>::iterator oldest = entries_.begin();
+            for (std::map<std::string, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+                if (it->second.updated < oldest->second.updated) oldest = it;
+            }
+            entries_.erase(oldest);
+        }
+    }
+
+  private:
+    ConnectRttTable(const ConnectRttTable&);
+    ConnectRttTable& operator=(const ConnectRttTable&);
+
+  private:
+    Mutex                           mutex_;
+    std::string                     network_;
+    std::map<std::string, Entry>    entries_;
+};
+
+#endif // COMM_SOCKET_CONNECT_RTT_H_
@@ -0,0 +1,233 @@
+/*
+* Alarm_benchmark.cpp
+*
+* 100k alarms pending at once, all timers of the one TimerService thread and fired to one message
+* queue. against them alarms as they were before: a broadcast handler each and the message queue's
+* own timer, so every alarm message went to every alarm. the old way is measured with fewer alarms,
+* its cost grows with the square of them.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+
+#include "../alarm.h"
+#include "../timer_service.h"
+#include "../messagequeue/message_queue.h"
+#include "../thread/atomic_oper.h"
+#include "../time_utils.h"
+
+namespace
+{
+
+static const int kAlarmCount = 100 * 1000;
+static const int kBroadcastCount = 5000;
+static const int kAfter = 1000;
+static const int kSpread = 1000;
+
+static volatile uint32_t sg_fired = 0;
+static std::vector<uint64_t> sg_due;
+static std::vector<uint64_t> sg_late;
+
+static void __OnAlarm(int _index)
+{
+	uint64_t now = gettickcount();
+	sg_late[_index] = now > sg_due[_index] ? now - sg_due[_index] : 0;
+	atomic_inc32(&sg_fired);
+}
+
+static int __Threads()
+{
+	FILE* file = fopen("/proc/self/status", "r");
+	if (NULL == file) return -1;
+
+	char line[256];
+	int threads = -1;
+	while (NULL != fgets(line, sizeof(line), file)) {
+		if (1 == sscanf(line, "Threads: %d", &threads)) break;
+	}
+	fclose(file);
+	return threads;
+}
+
+static bool __WaitFired(uint32_t _count, int64_t _timeout)
+{
+	uint64_t start = gettickcount();
+	while (atomic_read32(&sg_fired) < _count) {
+		if (gettickspan(start) > _timeout) return false;
+		ThreadUtil::usleep(1000);
+	}
+	return true;
+}
+
+static uint64_t __MaxLate(int _count)
+{
+	uint64_t late = 0;
+	for (int i = 0; i < _count; ++i) late = std::max(late, sg_late[i]);
+	return late;
+}
+
+static void __Reset(int _count)
+{
+	atomic_write32(&sg_fired, 0);
+	sg_due.assign(_count, 0);
+	sg_late.assign(_count, 0);
+}
+
+// an alarm as it was before TimerService
+class BroadcastAlarm
+{
+  public:
+	BroadcastAlarm(int _index, MessageQueue::MessageQueue_t _queue)
+	: index_(_index), queue_(_queue), seq_(0)
+	, reg_(MessageQueue::InstallMessageHandler(boost::bind(&BroadcastAlarm::OnAlarm, this, _1, _2), true, _queue)) {}
+
+	void Start(int _after, int64_t _seq) {
+		seq_ = _seq;
+		MessageQueue::BroadcastMessage(queue_, MessageQueue::Message((uintptr_t)kTitle, _seq, 1), MessageQueue::MessageTiming(_after));
+	}
+
+	void OnAlarm(const MessageQueue::MessagePost_t& _id, MessageQueue::Message& _message) {
+		if (MessageQueue::MessageTitle_t((uintptr_t)kTitle) != _message.title) return;
+		if (seq_ != boost::any_cast<int64_t>(_message.body1)) return;
+		seq_ = 0;
+		__OnAlarm(index_);
+	}
+
+  private:
+	static const uintptr_t kTitle = 0x1F1FF;
+
+	int                         index_;
+	MessageQueue::MessageQueue_t queue_;
+	int64_t                     seq_;
+	MessageQueue::ScopeRegister reg_;
+};
+
+}
+
+TEST(Alarm_benchmark, TimerServiceOrderAndCancel)
+{
+	MessageQueue::MessageQueueCreater creater(true, "timer_service_test");
+	MessageQueue::MessageHandler_t handler = MessageQueue::DefAsyncInvokeHandler(creater.GetMessageQueue());
+	__Reset(4);
+
+	uint64_t start = gettickcount();
+	int afters[] = {60, 10, 30, 0};
+	uint64_t ids[4];
+	for (int i = 0; i < 4; ++i) {
+		sg_due[i] = start + afters[i];
+		ids[i] = TimerService::Instance().Add(afters[i], handler, 0, boost::bind(&__OnAlarm, i));
+		ASSERT_NE(0u, ids[i]);
+	}
+
+	EXPECT_TRUE(TimerService::Instance().Cancel(ids[2]));
+	EXPECT_FALSE(TimerService::Instance().Cancel(ids[2]));
+
+	ASSERT_TRUE(__WaitFired(3, 2000));
+	ThreadUtil::usleep(100 * 1000);
+	EXPECT_EQ(3u, atomic_read32(&sg_fired));
+	EXPECT_EQ(0u, sg_late[2]);
+	EXPECT_GT(50u, __MaxLate(4));
+	EXPECT_FALSE(TimerService::Instance().Cancel(ids[0]));
+	EXPECT_EQ(0u, TimerService::Instance().Size());
+}
+
+TEST(Alarm_benchmark, ConcurrentAlarms)
+{
+	MessageQueue::MessageQueueCreater creater(true, "alarm_benchmark");
+	MessageQueue::MessageQueue_t queue = creater.GetMessageQueue();
+
+	// warms the timer service up, its thread is started once
+	{
+		__Reset(1);
+		Alarm alarm(boost::bind(&__OnAlarm, 0), queue);
+		alarm.Start(0);
+		ASSERT_TRUE(__WaitFired(1, 2000));
+	}
+
+	__Reset(kAlarmCount);
+	int threads = __Threads();
+
+	uint64_t create_start = gettickcount();
+	std::vector<Alarm*> alarms;
+	alarms.reserve(kAlarmCount);
+	for (int i = 0; i < kAlarmCount; ++i) alarms.push_back(new Alarm(boost::bind(&__OnAlarm, i), queue));
+	uint64_t create_cost = gettickspan(create_start);
+
+	uint64_t start = gettickcount();
+	for (int i = 0; i < kAlarmCount; ++i) {
+		sg_due[i] = gettickcount() + kAfter + i % kSpread;
+		ASSERT_TRUE(alarms[i]->Start(kAfter + i % kSpread));
+	}
+	uint64_t start_cost = gettickspan(start);
+	int pending_threads = __Threads();
+	EXPECT_EQ(threads, pending_threads);
+
+	// every other one is cancelled and started again, as the noop alarms of a long link are
+	uint64_t restart = gettickcount();
+	for (int i = 0; i < kAlarmCount; i += 2) {
+		alarms[i]->Cancel();
+		sg_due[i] = gettickcount() + kAfter + i % kSpread;
+		ASSERT_TRUE(alarms[i]->Start(kAfter + i % kSpread));
+	}
+	uint64_t restart_cost = gettickspan(restart);
+
+	ASSERT_TRUE(__WaitFired(kAlarmCount, 30 * 1000));
+	uint64_t total_cost = gettickspan(start);
+	ThreadUtil::usleep(100 * 1000);
+	EXPECT_EQ((uint32_t)kAlarmCount, atomic_read32(&sg_fired));
+
+	uint64_t destroy_start = gettickcount();
+	for (int i = 0; i < kAlarmCount; ++i) delete alarms[i];
+	uint64_t destroy_cost = gettickspan(destroy_start);
+
+	printf("%d alarms on the timer service: created %llu ms, started %llu ms, %d restarted %llu ms, all fired %llu ms after the first start, "
+		"latest %llu ms late, destroyed %llu ms, threads %d before and %d while pending\n",
+		kAlarmCount, (unsigned long long)create_cost, (unsigned long long)start_cost, kAlarmCount / 2, (unsigned long long)restart_cost,
+		(unsigned long long)total_cost, (unsigned long long)__MaxLate(kAlarmCount), (unsigned long long)destroy_cost, threads, pending_threads);
+	EXPECT_GT(500u, __MaxLate(kAlarmCount));
+}
+
+TEST(Alarm_benchmark, BroadcastAgainstTimerService)
+{
+	MessageQueue::MessageQueueCreater creater(true, "alarm_broadcast_benchmark");
+	MessageQueue::MessageQueue_t queue = creater.GetMessageQueue();
+
+	__Reset(kBroadcastCount);
+	std::vector<BroadcastAlarm*> broadcasts;
+	for (int i = 0; i < kBroadcastCount; ++i) broadcasts.push_back(new BroadcastAlarm(i, queue));
+
+	uint64_t start = gettickcount();
+	for (int i = 0; i < kBroadcastCount; ++i) {
+		sg_due[i] = gettickcount() + kAfter + i % kSpread;
+		broadcasts[i]->Start(kAfter + i % kSpread, i + 1);
+	}
+	ASSERT_TRUE(__WaitFired(kBroadcastCount, 60 * 1000));
+	uint64_t broadcast_cost = gettickspan(start);
+	uint64_t broadcast_late = __MaxLate(kBroadcastCount);
+	for (int i = 0; i < kBroadcastCount; ++i) delete broadcasts[i];
+
+	__Reset(kBroadcastCount);
+	std::vector<Alarm*> alarms;
+	for (int i = 0; i < kBroadcastCount; ++i) alarms.push_back(new Alarm(boost::bind(&__OnAlarm, i), queue));
+
+	start = gettickcount();
+	for (int i = 0; i < kBroadcastCount; ++i) {
+		sg_due[i] = gettickcount() + kAfter + i % kSpread;
+		alarms[i]->Start(kAfter + i % kSpread);
+	}
+	ASSERT_TRUE(__WaitFired(kBroadcastCount, 60 * 1000));
+	uint64_t service_cost = gettickspan(start);
+	uint64_t service_late = __MaxLate(kBroadcastCount);
+	for (int i = 0; i < kBroadcastCount; ++i) delete alarms[i];
+
+	printf("%d alarms due over %d ms: broadcast to every alarm all fired in %llu ms, latest %llu ms late; "
+		"timer service all fired in %llu ms, latest %llu ms late\n",
+		kBroadcastCount, kSpread, (unsigned long long)broadcast_cost, (unsigned long long)broadcast_late,
+		(unsigned long long)service_cost, (unsigned long long)service_late);
+	EXPECT_GT(broadcast_late, service_late);
+}
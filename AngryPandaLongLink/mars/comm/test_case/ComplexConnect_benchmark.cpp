@@ -0,0 +1,168 @@
+/*
+* ComplexConnect_benchmark.cpp
+*
+* ComplexConnect over loopback with one listener that answers and one whose accept queue is full, so
+* its syns are dropped as on a lossy path and nothing is accepted. without a known rtt the next address
+* waits the whole interval, with one it waits twice the rtt, and once the slow one lost it is not tried
+* first again.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../socket/complexconnect.h"
+#include "../socket/connect_rtt.h"
+#include "../socket/socketselect.h"
+#include "../time_utils.h"
+
+namespace
+{
+
+static const unsigned int kInterval = 2000;
+static const unsigned int kTimeout = 8000;
+
+class Listener
+{
+  public:
+	// _lossy: the accept queue is filled and nothing is accepted until the destructor
+	Listener(bool _lossy): listen_(INVALID_SOCKET), port_(0) {
+		listen_ = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(listen_, (sockaddr*)&addr, sizeof(addr));
+		listen(listen_, _lossy ? 0 : 128);
+
+		socklen_t len = sizeof(addr);
+		getsockname(listen_, (sockaddr*)&addr, &len);
+		port_ = ntohs(addr.sin_port);
+
+		for (int i = 0; _lossy && i < 4; ++i) {
+			SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+			fcntl(sock, F_SETFL, O_NONBLOCK);
+			connect(sock, (sockaddr*)&addr, sizeof(addr));
+			fillers_.push_back(sock);
+		}
+		if (_lossy) usleep(50 * 1000);
+	}
+
+	~Listener() {
+		for (size_t i = 0; i < fillers_.size(); ++i) socket_close(fillers_[i]);
+		socket_close(listen_);
+	}
+
+	socket_address Address() const { return socket_address("127.0.0.1", port_); }
+
+  private:
+	SOCKET                  listen_;
+	uint16_t                port_;
+	std::vector<SOCKET>     fillers_;
+};
+
+// the time to the first connected socket, and which address it was
+static int __Connect(const std::vector<socket_address>& _addrs, int& _index)
+{
+	SocketBreaker breaker;
+	ComplexConnect connect(kTimeout, kInterval, kInterval, 3);
+	SOCKET sock = connect.ConnectImpatient(_addrs, breaker);
+	_index = connect.Index();
+	if (INVALID_SOCKET != sock) socket_close(sock);
+	return connect.TotalCost();
+}
+
+}
+
+TEST(ComplexConnect_benchmark, Order)
+{
+	ConnectRttTable table;
+	std::vector<socket_address> addrs;
+	addrs.push_back(socket_address("10.0.0.1", 80));
+	addrs.push_back(socket_address("10.0.0.2", 80));
+	addrs.push_back(socket_address("10.0.0.3", 80));
+	addrs.push_back(socket_address("2001:db8::1", 80));
+	addrs.push_back(socket_address("2001:db8::2", 80));
+
+	// nothing known, as given with the families taking turns
+	std::vector<unsigned int> order;
+	table.Order(addrs, order);
+	unsigned int interleaved[] = {0, 3, 1, 4, 2};
+	EXPECT_EQ(std::vector<unsigned int>(interleaved, interleaved + 5), order);
+
+	// the fastest known first, the failed last
+	table.OnConnected(addrs[4], 30);
+	table.OnConnected(addrs[2], 80);
+	table.OnConnected(addrs[0], 50);
+	table.OnFailed(addrs[0]);
+	table.Order(addrs, order);
+	unsigned int ranked[] = {4, 2, 3, 1, 0};
+	EXPECT_EQ(std::vector<unsigned int>(ranked, ranked + 5), order);
+
+	EXPECT_EQ(kInterval, table.ConnectDelay(addrs[1], kInterval));
+	EXPECT_EQ((unsigned int)ConnectRttTable::kMinDelayMs, table.ConnectDelay(addrs[4], kInterval));
+	EXPECT_EQ(160u, table.ConnectDelay(addrs[2], kInterval));
+	EXPECT_EQ(100u, table.ConnectDelay(addrs[2], 100));
+
+	// smoothed, and a cancelled attempt raises it to what it took at least
+	int srtt = 0;
+	table.OnConnected(addrs[2], 160);
+	ASSERT_TRUE(table.Srtt(addrs[2], srtt));
+	EXPECT_EQ(90, srtt);
+	table.OnCancelled(addrs[2], 500);
+	ASSERT_TRUE(table.Srtt(addrs[2], srtt));
+	EXPECT_EQ(500, srtt);
+
+	// kept by network, and across a restart
+	std::string path = "/tmp/ComplexConnect_benchmark_rtt.txt";
+	ASSERT_TRUE(table.Save(path));
+	table.SetNetwork("other wifi");
+	EXPECT_FALSE(table.Srtt(addrs[2], srtt));
+
+	ConnectRttTable loaded;
+	ASSERT_TRUE(loaded.Load(path));
+	ASSERT_TRUE(loaded.Srtt(addrs[4], srtt));
+	EXPECT_EQ(30, srtt);
+	loaded.Order(addrs, order);
+	EXPECT_EQ(std::vector<unsigned int>(ranked, ranked + 5), order);
+	unlink(path.c_str());
+}
+
+TEST(ComplexConnect_benchmark, LossyFirstAddress)
+{
+	ConnectRttTable& table = ConnectRttTable::Instance();
+	table.Clear();
+
+	Listener lossy(true), good(false);
+	std::vector<socket_address> addrs;
+	addrs.push_back(lossy.Address());
+	addrs.push_back(good.Address());
+
+	// nothing known: the good one starts after the whole interval, as every connect did before
+	int index = -1;
+	int unknown_cost = __Connect(addrs, index);
+	EXPECT_EQ(1, index);
+	EXPECT_LE((int)kInterval, unknown_cost);
+
+	// the lossy one was fast before: the good one starts after twice that
+	table.Clear();
+	table.OnConnected(lossy.Address(), 20);
+	int known_cost = __Connect(addrs, index);
+	EXPECT_EQ(1, index);
+	EXPECT_LE((int)ConnectRttTable::kMinDelayMs, known_cost);
+	EXPECT_GT((int)kInterval / 2, known_cost);
+
+	// it lost, the good one goes first now
+	int learnt_cost = __Connect(addrs, index);
+	EXPECT_EQ(1, index);
+	EXPECT_GT((int)ConnectRttTable::kMinDelayMs, learnt_cost);
+
+	printf("time to connect with the first address dropping syns: no rtt known %d ms, rtt known %d ms, after it lost %d ms\n",
+		unknown_cost, known_cost, learnt_cost);
+	table.Clear();
+}
@@ -0,0 +1,501 @@
+/*
+* DNSResolver_benchmark.cpp
+*
+* DNSResolver against a name server on loopback: the wire format, CNAMEs, NXDOMAIN, truncated answers
+* asked again over tcp, lookups of one host sharing a query, forged answers from another port, and
+* lookups of 100 hosts done as DNS::GetHostByName did, a thread and a query each, and through the
+* resolver and its cache.
+*/
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../dns/dns_resolver.h"
+
+namespace
+{
+
+static const int kHostCount = 100;
+static const int kLookupCount = 10 * 1000;
+static const int kLookupThreads = 8;
+
+static std::string __Host(int _index)
+{
+	char host[32];
+	snprintf(host, sizeof(host), "host%d.test", _index);
+	return host;
+}
+
+static std::string __Name(const std::string& _name)
+{
+	std::string query;
+	dns_wire::BuildQuery(0, _name, dns_wire::kTypeA, query);
+	return query.substr(12, query.size() - 12 - 4);
+}
+
+// the question of a query and the answer records after it, names uncompressed
+class NameServer
+{
+  public:
+	NameServer(): stop_(false), udp_(INVALID_SOCKET), tcp_(INVALID_SOCKET), forger_(INVALID_SOCKET), thread_(boost::bind(&NameServer::__Run, this), "name_server") {
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		udp_ = socket(AF_INET, SOCK_DGRAM, 0);
+		bind(udp_, (sockaddr*)&addr, sizeof(addr));
+		socklen_t len = sizeof(addr);
+		getsockname(udp_, (sockaddr*)&addr, &len);
+
+		tcp_ = socket(AF_INET, SOCK_STREAM, 0);
+		bind(tcp_, (sockaddr*)&addr, sizeof(addr));
+		listen(tcp_, 16);
+		address_ = addr;
+
+		addr.sin_port = 0;
+		forger_ = socket(AF_INET, SOCK_DGRAM, 0);
+		bind(forger_, (sockaddr*)&addr, sizeof(addr));
+
+		thread_.start();
+	}
+
+	~NameServer() {
+		ScopedLock lock(mutex_);
+		stop_ = true;
+		lock.unlock();
+		thread_.join();
+		socket_close(udp_);
+		socket_close(tcp_);
+		socket_close(forger_);
+	}
+
+	socket_address Address() const { return socket_address(address_); }
+
+	int Queries(const std::string& _host, uint16_t _qtype) {
+		ScopedLock lock(mutex_);
+		return counts_[_host + (dns_wire::kTypeA == _qtype ? "/A" : "/AAAA")];
+	}
+
+	int Queries() {
+		ScopedLock lock(mutex_);
+		int total = 0;
+		for (std::map<std::string, int>::iterator it = counts_.begin(); it != counts_.end(); ++it) total += it->second;
+		return total;
+	}
+
+	// the answer to _query, what a blocking client of the old kind reads too
+	std::string Answer(const std::string& _query, bool _tcp) {
+		if (12 > _query.size()) return "";
+		const unsigned char* msg = (const unsigned char*)_query.data();
+
+		size_t pos = 12;
+		std::string host;
+		if (!dns_wire::__ReadName(msg, _query.size(), pos, host) || pos + 4 > _query.size()) return "";
+		uint16_t qtype = dns_wire::__Read16(msg + pos);
+
+		ScopedLock lock(mutex_);
+		++counts_[host + (dns_wire::kTypeA == qtype ? "/A" : "/AAAA")];
+		lock.unlock();
+
+		std::string answer;
+		int count = 0;
+		int rcode = 0;
+		bool truncated = false;
+
+		if ("silent.test" == host) return "";
+		if ("forged.test" == host) {
+			answer += __Record(host, qtype, 300, dns_wire::kTypeA == qtype ? std::string("\x06\x06\x06\x06", 4) : std::string(16, '\x06'));
+			++count;
+		}
+
+		if ("nx.test" == host) {
+			rcode = dns_wire::kRcodeNXDomain;
+		} else if ("alias.test" == host) {
+			answer += __Record(host, dns_wire::kTypeCNAME, 600, __Name("host1.test"));
+			++count;
+			if (dns_wire::kTypeA == qtype) {
+				answer += __Record("host1.test", dns_wire::kTypeA, 100, std::string("\x0a\x00\x00\x01", 4));
+				++count;
+			}
+		} else if ("big.test" == host && dns_wire::kTypeA == qtype) {
+			if (!_tcp) {
+				truncated = true;
+			} else {
+				for (int i = 1; i <= 40; ++i) {
+					answer += __Record(host, dns_wire::kTypeA, 300, std::string("\x0a\x01\x00", 3) + (char)i);
+					++count;
+				}
+			}
+		} else if ("v6.test" == host && dns_wire::kTypeAAAA == qtype) {
+			answer += __Record(host, dns_wire::kTypeAAAA, 300, std::string("\x20\x01\x0d\xb8\0\0\0\0\0\0\0\0\0\0\0\x01", 16));
+			++count;
+		} else if (0 == host.find("host") && dns_wire::kTypeA == qtype) {
+			int index = atoi(host.c_str() + 4);
+			answer += __Record(host, dns_wire::kTypeA, 300, std::string("\x0a\x02", 2) + (char)(index / 256) + (char)(index % 256));
+			++count;
+		}
+
+		std::string response = _query.substr(0, pos + 4);
+		response[2] = (char)(0x81 | (truncated ? 0x02 : 0));
+		response[3] = (char)(0x80 | rcode);
+		response[6] = (char)(count >> 8);
+		response[7] = (char)count;
+		return response + answer;
+	}
+
+  private:
+	static std::string __Record(const std::string& _owner, uint16_t _type, uint32_t _ttl, const std::string& _data) {
+		const unsigned char fixed[10] = {(unsigned char)(_type >> 8), (unsigned char)_type, 0, 1,
+			(unsigned char)(_ttl >> 24), (unsigned char)(_ttl >> 16), (unsigned char)(_ttl >> 8), (unsigned char)_ttl,
+			(unsigned char)(_data.size() >> 8), (unsigned char)_data.size()};
+		return __Name(_owner) + std::string((const char*)fixed, sizeof(fixed)) + _data;
+	}
+
+	void __Run() {
+		char buffer[4096];
+		while (true) {
+			ScopedLock lock(mutex_);
+			if (stop_) return;
+			lock.unlock();
+
+			pollfd fds[2] = {{udp_, POLLIN, 0}, {tcp_, POLLIN, 0}};
+			if (0 >= poll(fds, 2, 20)) continue;
+
+			if (fds[0].revents & POLLIN) {
+				sockaddr_in from;
+				socklen_t from_len = sizeof(from);
+				ssize_t n = recvfrom(udp_, buffer, sizeof(buffer), 0, (sockaddr*)&from, &from_len);
+				std::string response = 0 < n ? Answer(std::string(buffer, n), false) : "";
+
+				// the right id and question, from a port the query did not go to
+				size_t pos = 12;
+				std::string host;
+				bool forged = 0 < n && dns_wire::__ReadName((const unsigned char*)buffer, n, pos, host) && "forged.test" == host;
+				if (!response.empty()) sendto(forged ? forger_ : udp_, response.data(), response.size(), 0, (sockaddr*)&from, from_len);
+			}
+
+			if (fds[1].revents & POLLIN) {
+				SOCKET sock = accept(tcp_, NULL, NULL);
+				std::string query;
+				while (INVALID_SOCKET != sock) {
+					ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+					if (0 >= n) break;
+					query.append(buffer, n);
+					if (2 > query.size() || query.size() < 2 + (size_t)dns_wire::__Read16((const unsigned char*)query.data())) continue;
+
+					std::string response = Answer(query.substr(2), true);
+					std::string framed(1, (char)(response.size() >> 8));
+					framed += (char)response.size();
+					framed += response;
+					send(sock, framed.data(), framed.size(), 0);
+					break;
+				}
+				if (INVALID_SOCKET != sock) socket_close(sock);
+			}
+		}
+	}
+
+  private:
+	Mutex                       mutex_;
+	bool                        stop_;
+	SOCKET                      udp_;
+	SOCKET                      tcp_;
+	SOCKET                      forger_;
+	sockaddr_in                 address_;
+	std::map<std::string, int>  counts_;
+	Thread                      thread_;
+};
+
+struct Lookups
+{
+	Lookups(DNSResolver* _resolver, const socket_address* _server, int _begin, int _end)
+	: resolver(_resolver), server(_server), begin(_begin), end(_end), ok(0) {}
+
+	DNSResolver*            resolver;
+	const socket_address*   server;
+	int                     begin;
+	int                     end;
+	int                     ok;
+};
+
+// an A query and its answer on a blocking socket, the way getaddrinfo asks
+static void __BlockingQuery(const socket_address* _server, std::string _host, int* _ok)
+{
+	std::string query;
+	dns_wire::BuildQuery(0x1234, _host, dns_wire::kTypeA, query);
+
+	SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+	timeval timeout = {1, 0};
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	sendto(sock, query.data(), query.size(), 0, &_server->address(), _server->address_length());
+
+	char buffer[512];
+	ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+	dns_wire::Answer answer;
+	if (0 < n && dns_wire::ParseResponse(buffer, n, 0x1234, _host, dns_wire::kTypeA, answer) && !answer.ips.empty()) *_ok = 1;
+	socket_close(sock);
+}
+
+// as DNS::GetHostByName did: a new thread for every lookup, nothing kept
+static void __ThreadPerLookup(Lookups* _lookups)
+{
+	for (int i = _lookups->begin; i < _lookups->end; ++i) {
+		int ok = 0;
+		Thread thread(boost::bind(&__BlockingQuery, _lookups->server, __Host(i % kHostCount), &ok), "dns", true);
+		thread.start();
+		thread.join();
+		_lookups->ok += ok;
+	}
+}
+
+static void __Resolve(Lookups* _lookups)
+{
+	for (int i = _lookups->begin; i < _lookups->end; ++i) {
+		std::vector<std::string> ips;
+		if (DNSResolver::kResolveOK == _lookups->resolver->Resolve(__Host(i % kHostCount), ips, 2000)) ++_lookups->ok;
+	}
+}
+
+static int __RunLookups(void (*_run)(Lookups*), DNSResolver* _resolver, const socket_address* _server)
+{
+	std::vector<Lookups> lookups;
+	for (int i = 0; i < kLookupThreads; ++i) {
+		lookups.push_back(Lookups(_resolver, _server, kLookupCount * i / kLookupThreads, kLookupCount * (i + 1) / kLookupThreads));
+	}
+
+	std::vector<Thread*> threads;
+	for (int i = 0; i < kLookupThreads; ++i) {
+		threads.push_back(new Thread(boost::bind(_run, &lookups[i]), "lookups", true));
+		threads.back()->start();
+	}
+
+	int ok = 0;
+	for (int i = 0; i < kLookupThreads; ++i) {
+		threads[i]->join();
+		delete threads[i];
+		ok += lookups[i].ok;
+	}
+	return ok;
+}
+
+static void __Coalesce(DNSResolver* _resolver, int* _ret)
+{
+	std::vector<std::string> ips;
+	*_ret = _resolver->Resolve("host7.test", ips, 2000);
+}
+
+static void __Silent(DNSResolver* _resolver, int* _ret)
+{
+	std::vector<std::string> ips;
+	*_ret = _resolver->Resolve("silent.test", ips, 1500);
+}
+
+// the server at first, none once the network changed
+static void __ServersOnce(const socket_address* _server, int* _asked, std::vector<socket_address>& _servers)
+{
+	if (0 == (*_asked)++) _servers.push_back(*_server);
+}
+
+}
+
+TEST(DNSResolver_benchmark, Wire)
+{
+	std::string query;
+	ASSERT_TRUE(dns_wire::BuildQuery(0xabcd, "Www.Example.com.", dns_wire::kTypeAAAA, query));
+	EXPECT_EQ(12u + 17 + 4, query.size());
+	EXPECT_EQ(std::string("\x03www\x07" "example\x03" "com\x00", 17), query.substr(12, 17));
+
+	EXPECT_FALSE(dns_wire::BuildQuery(1, "", dns_wire::kTypeA, query));
+	EXPECT_FALSE(dns_wire::BuildQuery(1, "a..b", dns_wire::kTypeA, query));
+	EXPECT_FALSE(dns_wire::BuildQuery(1, std::string(64, 'a') + ".com", dns_wire::kTypeA, query));
+
+	// an answer whose name points at itself
+	std::string loop = query.substr(0, 12);
+	loop[2] = (char)0x81;
+	loop[5] = 1;
+	loop += std::string("\xc0\x0c\x00\x01\x00\x01", 6);
+	dns_wire::Answer answer;
+	EXPECT_FALSE(dns_wire::ParseResponse(loop.data(), loop.size(), 1, "a.com", dns_wire::kTypeA, answer));
+
+	// cut short at every byte, never read past the end
+	NameServer server;
+	ASSERT_TRUE(dns_wire::BuildQuery(7, "alias.test", dns_wire::kTypeA, query));
+	std::string response = server.Answer(query, false);
+	ASSERT_TRUE(dns_wire::ParseResponse(response.data(), response.size(), 7, "alias.test", dns_wire::kTypeA, answer));
+	ASSERT_EQ(1u, answer.ips.size());
+	EXPECT_EQ("10.0.0.1", answer.ips[0]);
+	EXPECT_EQ(100u, answer.ttl);
+	for (size_t len = 0; len < response.size(); ++len) {
+		EXPECT_FALSE(dns_wire::ParseResponse(response.data(), len, 7, "alias.test", dns_wire::kTypeA, answer));
+	}
+	EXPECT_FALSE(dns_wire::ParseResponse(response.data(), response.size(), 8, "alias.test", dns_wire::kTypeA, answer));
+	EXPECT_FALSE(dns_wire::ParseResponse(response.data(), response.size(), 7, "other.test", dns_wire::kTypeA, answer));
+}
+
+TEST(DNSResolver_benchmark, Cache)
+{
+	DNSCache cache(2, 1000);
+	std::vector<std::string> ips(1, "10.0.0.1");
+	std::vector<std::string> out;
+
+	cache.Put("a", ips, 100, 0);
+	cache.Put("b", std::vector<std::string>(), 100, 0);
+	EXPECT_EQ(DNSCache::kFresh, cache.Lookup("a", 50, out));
+	EXPECT_EQ(DNSCache::kNegative, cache.Lookup("b", 50, out));
+	EXPECT_EQ(DNSCache::kStale, cache.Lookup("a", 500, out));
+	EXPECT_EQ(DNSCache::kMiss, cache.Lookup("b", 500, out));
+	EXPECT_EQ(DNSCache::kMiss, cache.Lookup("a", 1100, out));
+
+	// the least recently asked for goes
+	cache.Put("a", ips, 100, 0);
+	cache.Put("b", ips, 100, 0);
+	cache.Lookup("a", 10, out);
+	cache.Put("c", ips, 100, 0);
+	EXPECT_EQ(2u, cache.Size());
+	EXPECT_EQ(DNSCache::kFresh, cache.Lookup("a", 10, out));
+	EXPECT_EQ(DNSCache::kMiss, cache.Lookup("b", 10, out));
+}
+
+TEST(DNSResolver_benchmark, Resolve)
+{
+	NameServer server;
+	DNSResolver resolver;
+	std::vector<std::string> ips;
+
+	EXPECT_EQ(DNSResolver::kResolveNoServer, resolver.Resolve("host1.test", ips, 500));
+	resolver.SetServers(std::vector<socket_address>(1, server.Address()));
+
+	EXPECT_EQ(DNSResolver::kResolveOK, resolver.Resolve("10.9.8.7", ips, 500));
+	ASSERT_EQ(1u, ips.size());
+	EXPECT_EQ("10.9.8.7", ips[0]);
+	EXPECT_EQ(0, server.Queries());
+
+	EXPECT_EQ(DNSResolver::kResolveOK, resolver.Resolve("host258.test", ips, 500));
+	ASSERT_EQ(1u, ips.size());
+	EXPECT_EQ("10.2.1.2", ips[0]);
+
+	EXPECT_EQ(DNSResolver::kResolveOK, resolver.Resolve("alias.test", ips, 500));
+	ASSERT_EQ(1u, ips.size());
+	EXPECT_EQ("10.0.0.1", ips[0]);
+
+	// ipv4 only, as getaddrinfo gave them
+	EXPECT_EQ(DNSResolver::kResolveFail, resolver.Resolve("v6.test", ips, 500));
+	EXPECT_EQ(DNSResolver::kResolveFail, resolver.Resolve("v6.test", ips, 500));
+	EXPECT_EQ(1, server.Queries("v6.test", dns_wire::kTypeAAAA));
+
+	// truncated over udp, the whole answer over tcp
+	EXPECT_EQ(DNSResolver::kResolveOK, resolver.Resolve("big.test", ips, 1000));
+	EXPECT_EQ(40u, ips.size());
+
+	// the name does not exist, kept only once the system did not find it either
+	EXPECT_EQ(DNSResolver::kResolveFail, resolver.Resolve("nx.test", ips, 500));
+	EXPECT_EQ(DNSResolver::kResolveFail, resolver.Resolve("nx.test", ips, 500));
+	EXPECT_EQ(2, server.Queries("nx.test", dns_wire::kTypeA));
+	resolver.Store("nx.test", std::vector<std::string>(), 0);
+	EXPECT_EQ(DNSResolver::kResolveNoName, resolver.Resolve("NX.test.", ips, 500));
+	EXPECT_EQ(2, server.Queries("nx.test", dns_wire::kTypeA));
+
+	EXPECT_EQ(DNSResolver::kResolveOK, resolver.Resolve("host258.test", ips, 500));
+	EXPECT_EQ(1, server.Queries("host258.test", dns_wire::kTypeA));
+
+	EXPECT_EQ(DNSResolver::kResolveTimeout, resolver.Resolve("silent.test", ips, 200));
+
+	DNSBreaker breaker;
+	resolver.Cancel(breaker);
+	EXPECT_EQ(DNSResolver::kResolveCancel, resolver.Resolve("host3.test", ips, 500, NULL, &breaker));
+
+	resolver.Reset();
+	EXPECT_EQ(0u, resolver.CacheSize());
+}
+
+TEST(DNSResolver_benchmark, Forged)
+{
+	NameServer server;
+	DNSResolver resolver;
+	resolver.SetServers(std::vector<socket_address>(1, server.Address()));
+
+	std::vector<std::string> ips;
+	EXPECT_EQ(DNSResolver::kResolveTimeout, resolver.Resolve("forged.test", ips, 500));
+	EXPECT_LE(2, server.Queries("forged.test", dns_wire::kTypeA));
+	EXPECT_EQ(0u, resolver.CacheSize());
+}
+
+TEST(DNSResolver_benchmark, ServersGone)
+{
+	NameServer server;
+	socket_address address = server.Address();
+	int asked = 0;
+	DNSResolver resolver;
+	resolver.SetServerSource(boost::bind(&__ServersOnce, &address, &asked, _1));
+
+	// retried to the servers it started with while the list is empty
+	int ret = DNSResolver::kResolveOK;
+	Thread thread(boost::bind(&__Silent, &resolver, &ret), "silent", true);
+	thread.start();
+	ThreadUtil::usleep(100 * 1000);
+
+	resolver.Reset();
+	std::vector<std::string> ips;
+	EXPECT_EQ(DNSResolver::kResolveNoServer, resolver.Resolve("host1.test", ips, 500));
+	EXPECT_EQ(2, asked);
+
+	thread.join();
+	EXPECT_EQ(DNSResolver::kResolveTimeout, ret);
+	EXPECT_LE(2, server.Queries("silent.test", dns_wire::kTypeA));
+}
+
+TEST(DNSResolver_benchmark, Coalesce)
+{
+	NameServer server;
+	DNSResolver resolver;
+	resolver.SetServers(std::vector<socket_address>(1, server.Address()));
+
+	const int kThreads = 16;
+	int rets[kThreads];
+	std::vector<Thread*> threads;
+	for (int i = 0; i < kThreads; ++i) {
+		threads.push_back(new Thread(boost::bind(&__Coalesce, &resolver, &rets[i]), "coalesce", true));
+		threads.back()->start();
+	}
+	for (int i = 0; i < kThreads; ++i) {
+		threads[i]->join();
+		delete threads[i];
+		EXPECT_EQ(DNSResolver::kResolveOK, rets[i]);
+	}
+
+	EXPECT_EQ(1, server.Queries("host7.test", dns_wire::kTypeA));
+	EXPECT_EQ(1, server.Queries("host7.test", dns_wire::kTypeAAAA));
+}
+
+TEST(DNSResolver_benchmark, Lookups10k)
+{
+	{
+		NameServer server;
+		socket_address address = server.Address();
+		uint64_t start = gettickcount();
+		int ok = __RunLookups(&__ThreadPerLookup, NULL, &address);
+		uint64_t cost = gettickcount() - start;
+		printf("thread per lookup: %d lookups of %d hosts, %d ok, %llu ms, %d queries\n", kLookupCount, kHostCount, ok, (unsigned long long)cost, server.Queries());
+		EXPECT_EQ(kLookupCount, ok);
+	}
+
+	NameServer server;
+	socket_address address = server.Address();
+	DNSResolver resolver;
+	resolver.SetServers(std::vector<socket_address>(1, address));
+	uint64_t start = gettickcount();
+	int ok = __RunLookups(&__Resolve, &resolver, &address);
+	uint64_t cost = gettickcount() - start;
+	printf("DNSResolver: %d lookups of %d hosts, %d ok, %llu ms, %d queries\n", kLookupCount, kHostCount, ok, (unsigned long long)cost, server.Queries());
+
+	EXPECT_EQ(kLookupCount, ok);
+	EXPECT_GE(2 * kHostCount, server.Queries());
+	EXPECT_EQ((size_t)kHostCount, resolver.CacheSize());
+}
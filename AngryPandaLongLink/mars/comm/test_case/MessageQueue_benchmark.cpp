@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+#include "../messagequeue/message_queue.h"
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+#include "thread/thread.h"
+#include "thread/atomic_oper.h"
+#include "time_utils.h"
+
+
+namespace
+{
+
+static const int kProducerCount = 8;
+static const int kTotalMessage = 1000 * 1000;
+static const int kMessagePerProducer = kTotalMessage / kProducerCount;
+
+static const int kDelayedMessage = kTotalMessage / 4;
+static const int kImmediateMessage = kTotalMessage - kDelayedMessage;
+
+static volatile uint32_t sg_count_alloc = 0;
+static volatile uint32_t sg_alloc_count = 0;
+
+static volatile uint32_t sg_immediate_handled = 0;
+static volatile uint32_t sg_delayed_handled = 0;
+static volatile uint32_t sg_faster_handled = 0;
+
+static void __OnImmediate()
+{
+	atomic_inc32(&sg_immediate_handled);
+}
+
+static void __OnDelayed()
+{
+	atomic_inc32(&sg_delayed_handled);
+}
+
+static void __OnFaster()
+{
+	atomic_inc32(&sg_faster_handled);
+}
+
+// every 4th message is delayed long enough that the immediate ones are dispatched
+// while a few hundred thousand timers are still pending
+static void __Produce(MessageQueue::MessageHandler_t _handler)
+{
+	for (int i = 0; i < kMessagePerProducer; ++i) {
+		if (0 == i % 4)
+			MessageQueue::AsyncInvokeAfter(2000 + i % 1000, &__OnDelayed, _handler);
+		else
+			MessageQueue::AsyncInvoke(&__OnImmediate, _handler);
+	}
+}
+
+}
+
+// counts every operator new in the process while sg_count_alloc is set
+void* operator new(size_t _size)
+{
+	if (atomic_read32(&sg_count_alloc)) atomic_inc32(&sg_alloc_count);
+
+	void* p = malloc(_size ? _size : 1);
+	if (NULL == p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* _p) throw()
+{
+	free(_p);
+}
+
+TEST(MessageQueue_benchmark, PostImmediateAndDelayed_8Producer)
+{
+	MessageQueue::MessageQueueCreater creater(true, "mq_benchmark");
+	MessageQueue::MessageHandler_t handler = MessageQueue::DefAsyncInvokeHandler(creater.GetMessageQueue());
+	ASSERT_NE(MessageQueue::KNullHandler, handler);
+
+	atomic_write32(&sg_immediate_handled, 0);
+	atomic_write32(&sg_delayed_handled, 0);
+	uint64_t start = ::gettickcount();
+
+	Thread* producers[kProducerCount];
+	for (int i = 0; i < kProducerCount; ++i) {
+		producers[i] = new Thread(boost::bind(&__Produce, handler));
+		producers[i]->start();
+	}
+
+	for (int i = 0; i < kProducerCount; ++i) {
+		producers[i]->join();
+		delete producers[i];
+	}
+
+	uint64_t post_cost = ::gettickspan(start);
+
+	while (atomic_read32(&sg_immediate_handled) < (uint32_t)kImmediateMessage) {
+		ThreadUtil::usleep(1000);
+	}
+
+	uint64_t immediate_cost = ::gettickspan(start);
+
+	while (atomic_read32(&sg_delayed_handled) < (uint32_t)kDelayedMessage) {
+		ThreadUtil::usleep(1000);
+	}
+
+	uint64_t total_cost = ::gettickspan(start);
+	printf("post %d messages by %d producers: post %llu ms, %d immediate dispatched in %llu ms (%.0f msg/s) with %d timers pending, all done in %llu ms\n",
+		kTotalMessage, kProducerCount, (unsigned long long)post_cost, kImmediateMessage, (unsigned long long)immediate_cost,
+		kImmediateMessage * 1000.0 / (immediate_cost ? immediate_cost : 1), kDelayedMessage, (unsigned long long)total_cost);
+
+	EXPECT_EQ((uint32_t)kImmediateMessage, atomic_read32(&sg_immediate_handled));
+	EXPECT_EQ((uint32_t)kDelayedMessage, atomic_read32(&sg_delayed_handled));
+}
+
+TEST(MessageQueue_benchmark, AsyncInvokeAllocations)
+{
+	static const int kRound = 1000;
+	static const int kBatch = 512;  // backlog stays under the wrapper pool size
+
+	MessageQueue::MessageQueueCreater creater(true, "mq_alloc_benchmark");
+	MessageQueue::MessageHandler_t handler = MessageQueue::DefAsyncInvokeHandler(creater.GetMessageQueue());
+	ASSERT_NE(MessageQueue::KNullHandler, handler);
+
+	volatile uint32_t handled = 0;
+	volatile uint32_t* handled_ptr = &handled;
+	uint32_t expected = 0;
+
+	for (int round = 0; round < kRound; ++round) {
+		// first round warms up the wrapper pool and the runloop buffers
+		if (1 == round) {
+			atomic_write32(&sg_alloc_count, 0);
+			atomic_write32(&sg_count_alloc, 1);
+		}
+
+		for (int i = 0; i < kBatch; ++i) {
+			MessageQueue::AsyncInvoke([handled_ptr]() { atomic_inc32(handled_ptr); }, handler);
+		}
+		expected += kBatch;
+
+		while (atomic_read32(&handled) < expected) {
+			ThreadUtil::yield();
+		}
+	}
+
+	atomic_write32(&sg_count_alloc, 0);
+	uint32_t posted = (kRound - 1) * kBatch;
+	printf("AsyncInvoke %u times, %u allocations, %.4f allocations per AsyncInvoke\n",
+		posted, atomic_read32(&sg_alloc_count), (double)atomic_read32(&sg_alloc_count) / posted);
+
+	EXPECT_EQ(0u, atomic_read32(&sg_alloc_count));
+}
+
+TEST(MessageQueue_benchmark, FasterAndCancel_TimersPending)
+{
+	static const int kPending = 50 * 1000;
+
+	MessageQueue::MessageQueueCreater creater(true, "mq_faster_benchmark");
+	MessageQueue::MessageHandler_t handler = MessageQueue::DefAsyncInvokeHandler(creater.GetMessageQueue());
+	ASSERT_NE(MessageQueue::KNullHandler, handler);
+
+	atomic_write32(&sg_faster_handled, 0);
+
+	// one title per timer, all far out so none runs on its own
+	std::vector<MessageQueue::MessagePost_t> posts;
+	for (int i = 0; i < kPending; ++i) {
+		posts.push_back(MessageQueue::AsyncInvokeAfter(60 * 1000, &__OnFaster, i + 1, handler));
+	}
+
+	// every even one is brought forward, every odd one cancelled
+	uint64_t start = ::gettickcount();
+	for (int i = 0; i < kPending; ++i) {
+		if (0 == i % 2) {
+			MessageQueue::MessagePost_t post = MessageQueue::FasterMessage(handler, MessageQueue::Message(i + 1, &__OnFaster), MessageQueue::MessageTiming(MessageQueue::kAfter, 100, 0));
+			ASSERT_EQ(posts[i], post);
+		} else {
+			ASSERT_TRUE(MessageQueue::CancelMessage(posts[i]));
+			ASSERT_FALSE(MessageQueue::FoundMessage(posts[i]));
+		}
+	}
+	uint64_t cost = ::gettickspan(start);
+
+	printf("%d FasterMessage/CancelMessage with %d timers pending in %llu ms\n", kPending, kPending, (unsigned long long)cost);
+
+	while (atomic_read32(&sg_faster_handled) < (uint32_t)kPending / 2) {
+		ThreadUtil::usleep(1000);
+	}
+	ThreadUtil::usleep(200 * 1000);
+	EXPECT_EQ((uint32_t)kPending / 2, atomic_read32(&sg_faster_handled));
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <list>
+#include <vector>
+
+#include "../timing_wheel.h"
+#include "gtest/gtest.h"
+
+
+namespace
+{
+
+static const int kTaskCount = 10 * 1000;
+static const uint64_t kSimulateMs = 10 * 60 * 1000;
+
+static uint64_t __ThreadCpuNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t __RandomTimeout()
+{
+	return 1000 + (uint64_t)(rand() % (60 * 1000));
+}
+
+struct SimTask
+{
+	uint64_t deadline;
+};
+
+// the task managers as they were: every task looked at once a second
+static void __RunScan(std::vector<SimTask>& _tasks, uint64_t& _late_total, uint64_t& _fired, uint64_t& _checks, uint64_t& _wakeups)
+{
+	for (uint64_t now = 1000; now <= kSimulateMs; now += 1000) {
+		++_wakeups;
+		for (size_t i = 0; i < _tasks.size(); ++i) {
+			++_checks;
+			if (now < _tasks[i].deadline) continue;
+
+			_late_total += now - _tasks[i].deadline;
+			++_fired;
+			_tasks[i].deadline = now + __RandomTimeout();
+		}
+	}
+}
+
+// woken at the next deadline, only the due tasks are looked at
+static void __RunWheel(std::vector<SimTask>& _tasks, uint64_t& _late_total, uint64_t& _fired, uint64_t& _checks, uint64_t& _wakeups)
+{
+	TimingWheel<uint32_t> wheel(0);
+	for (size_t i = 0; i < _tasks.size(); ++i) wheel.Add(_tasks[i].deadline, (uint32_t)i);
+
+	std::vector<uint32_t> expired;
+	uint64_t now = wheel.NextTime();
+	while (now <= kSimulateMs) {
+		++_wakeups;
+		expired.clear();
+		wheel.Expire(now, expired);
+
+		for (size_t i = 0; i < expired.size(); ++i) {
+			++_checks;
+			SimTask& task = _tasks[expired[i]];
+			_late_total += now - task.deadline;
+			++_fired;
+			task.deadline = now + __RandomTimeout();
+			wheel.Add(task.deadline, expired[i]);
+		}
+
+		now = wheel.NextTime();
+	}
+}
+
+}
+
+TEST(TimingWheel, ExpiresInOrderAcrossLevels)
+{
+	srand(1);
+	TimingWheel<int> wheel(12345);
+	std::list<std::pair<uint64_t, int> > expect;
+
+	const uint64_t spans[] = {10, 500, 70 * 1000, 20 * 60 * 1000, 3 * 24 * 3600 * 1000ULL, 200ULL * 24 * 3600 * 1000 * 365};
+	for (int i = 0; i < 3000; ++i) {
+		uint64_t time = 12345 + (uint64_t)rand() % spans[i % 6];
+		wheel.Add(time, i);
+		expect.push_back(std::make_pair(time, i));
+	}
+	EXPECT_EQ(3000u, wheel.Size());
+
+	uint64_t now = 12345;
+	std::vector<int> expired;
+	while (!wheel.Empty()) {
+		uint64_t next = wheel.NextTime();
+		ASSERT_NE(TimingWheel<int>::kNever, next);
+		ASSERT_GE(next, now);
+		now = next;
+
+		expired.clear();
+		wheel.Expire(now, expired);
+
+		for (size_t i = 0; i < expired.size(); ++i) {
+			std::list<std::pair<uint64_t, int> >::iterator it = expect.begin();
+			while (it != expect.end() && it->second != expired[i]) ++it;
+			ASSERT_TRUE(it != expect.end());
+			EXPECT_EQ(it->first, now);  // not late, not early
+			expect.erase(it);
+		}
+
+		for (std::list<std::pair<uint64_t, int> >::iterator it = expect.begin(); it != expect.end(); ++it) {
+			ASSERT_GT(it->first, now);
+		}
+	}
+
+	EXPECT_TRUE(expect.empty());
+	EXPECT_EQ(TimingWheel<int>::kNever, wheel.NextTime());
+}
+
+TEST(TimingWheel, PastAndBigSteps)
+{
+	TimingWheel<int> wheel(1000);
+	wheel.Add(900, 1);
+	wheel.Add(1000, 2);
+	wheel.Add(1000 + 64 * 64 + 5, 3);
+	EXPECT_EQ(1000u, wheel.NextTime());
+
+	std::vector<int> expired;
+	wheel.Expire(1000, expired);
+	ASSERT_EQ(2u, expired.size());
+
+	// one step far past the deadline hands it out at once
+	expired.clear();
+	wheel.Expire(1000 + 3600 * 1000, expired);
+	ASSERT_EQ(1u, expired.size());
+	EXPECT_EQ(3, expired[0]);
+	EXPECT_TRUE(wheel.Empty());
+
+	wheel.Add(5000, 4);
+	wheel.Clear();
+	EXPECT_TRUE(wheel.Empty());
+	EXPECT_EQ(TimingWheel<int>::kNever, wheel.NextTime());
+}
+
+TEST(TimingWheel, Benchmark10kTimeouts)
+{
+	srand(2);
+	std::vector<SimTask> tasks(kTaskCount);
+	for (int i = 0; i < kTaskCount; ++i) tasks[i].deadline = __RandomTimeout();
+	std::vector<SimTask> tasks2 = tasks;
+
+	uint64_t scan_late = 0, scan_fired = 0, scan_checks = 0, scan_wakeups = 0;
+	uint64_t begin = __ThreadCpuNs();
+	__RunScan(tasks, scan_late, scan_fired, scan_checks, scan_wakeups);
+	uint64_t scan_ns = __ThreadCpuNs() - begin;
+
+	srand(2);
+	uint64_t wheel_late = 0, wheel_fired = 0, wheel_checks = 0, wheel_wakeups = 0;
+	begin = __ThreadCpuNs();
+	__RunWheel(tasks2, wheel_late, wheel_fired, wheel_checks, wheel_wakeups);
+	uint64_t wheel_ns = __ThreadCpuNs() - begin;
+
+	printf("%d tasks, %llu min simulated\n", kTaskCount, (unsigned long long)(kSimulateMs / 60 / 1000));
+	printf("%-22s %8llu timeouts, %.1f ms late on average, %llu wakeups, %llu checks, %.1f ms cpu\n", "scan every 1000ms",
+		(unsigned long long)scan_fired, (double)scan_late / scan_fired, (unsigned long long)scan_wakeups, (unsigned long long)scan_checks, scan_ns / 1000000.0);
+	printf("%-22s %8llu timeouts, %.1f ms late on average, %llu wakeups, %llu checks, %.1f ms cpu\n", "TimingWheel",
+		(unsigned long long)wheel_fired, (double)wheel_late / wheel_fired, (unsigned long long)wheel_wakeups, (unsigned long long)wheel_checks, wheel_ns / 1000000.0);
+
+	EXPECT_EQ(0u, wheel_late);
+	EXPECT_LT(wheel_checks, scan_checks);
+}
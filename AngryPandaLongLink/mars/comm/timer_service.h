@@ -0,0 +1,200 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * timer_service.h
+ *
+ * one thread for every timer of the process: a TimingWheel of the pending ones and a timerfd armed
+ * for the earliest, waited on with epoll. a timer that is due is posted as a message to the handler
+ * it was added for, the callback runs on that message queue. the thread starts with the first timer.
+ */
+
+#ifndef COMM_TIMER_SERVICE_H_
+#define COMM_TIMER_SERVICE_H_
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/bind.hpp"
+
+#include "comm/messagequeue/message_queue.h"
+#include "comm/thread/lock.h"
+#include "comm/thread/thread.h"
+#include "comm/time_utils.h"
+#include "comm/timing_wheel.h"
+#include "comm/xlogger/xlogger.h"
+
+class TimerService {
+  public:
+    // never destroyed, timers may be cancelled at exit
+    static TimerService& Instance() {
+        static TimerService* service = new TimerService;
+        return *service;
+    }
+
+  public:
+    // posts _func titled _title to _handler in _after ms. 0 if the timer thread could not be started.
+    uint64_t Add(int64_t _after, const MessageQueue::MessageHandler_t& _handler, const MessageQueue::MessageTitle_t& _title, const MessageQueue::SmallFunction& _func) {
+        ScopedLock lock(mutex_);
+        if (!__Start()) return 0;
+
+        uint64_t time = gettickcount() + (0 < _after ? _after : 0);
+        uint64_t id = ++seq_;
+        Timer& timer = timers_[id];
+        timer.handler = _handler;
+        timer.title = _title;
+        timer.func = _func;
+        wheel_.Add(time, id);
+
+        if (time < armed_) __Arm(time);
+        return id;
+    }
+
+    // false if it was posted already or never added
+    bool Cancel(uint64_t _id) {
+        ScopedLock lock(mutex_);
+        if (0 == timers_.erase(_id)) return false;
+
+        // what is left in the wheel is stale, no need to wake for it
+        if (timers_.empty()) {
+            wheel_.Clear();
+            __Arm(TimingWheel<uint64_t>::kNever);
+        }
+        return true;
+    }
+
+    size_t Size() {
+        ScopedLock lock(mutex_);
+        return timers_.size();
+    }
+
+  private:
+    struct Timer {
+        MessageQueue::MessageHandler_t handler;
+        MessageQueue::MessageTitle_t   title;
+        MessageQueue::SmallFunction    func;
+    };
+
+    TimerService()
+    : wheel_(gettickcount()), seq_(0), epfd_(-1), timerfd_(-1), armed_(TimingWheel<uint64_t>::kNever)
+    , thread_(boost::bind(&TimerService::__Run, this), "timer_service") {}
+
+    // called with mutex_ held
+    bool __Start() {
+        if (0 <= timerfd_) return true;
+
+        int epfd = epoll_create(1);
+        int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (0 <= epfd) fcntl(epfd, F_SETFD, FD_CLOEXEC);
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = timerfd;
+        if (0 > epfd || 0 > timerfd || 0 != epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev)) {
+            xerror2(TSF"timer service not started, errno:%_", errno);
+            if (0 <= epfd) close(epfd);
+            if (0 <= timerfd) close(timerfd);
+            return false;
+        }
+
+        epfd_ = epfd;
+        timerfd_ = timerfd;
+        if (0 != thread_.start()) {
+            xerror2(TSF"timer service thread not started");
+            close(epfd_);
+            close(timerfd_);
+            epfd_ = timerfd_ = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // called with mutex_ held. the timerfd is armed relative to now, kNever disarms it.
+    void __Arm(uint64_t _time) {
+        armed_ = _time;
+
+        itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (TimingWheel<uint64_t>::kNever != _time) {
+            uint64_t now = gettickcount();
+            uint64_t after = _time > now ? _time - now : 0;
+            spec.it_value.tv_sec = (time_t)(after / 1000);
+            spec.it_value.tv_nsec = (long)(after % 1000) * 1000 * 1000;
+            if (0 == after) spec.it_value.tv_nsec = 1;  // zero would disarm
+        }
+
+        if (0 != timerfd_settime(timerfd_, 0, &spec, NULL)) {
+            xerror2(TSF"timerfd_settime errno:%_", errno);
+        }
+    }
+
+    void __Run() {
+        std::vector<uint64_t> expired;
+
+        while (true) {
+            epoll_event ev;
+            int ret = epoll_wait(epfd_, &ev, 1, -1);
+            if (0 > ret && EINTR != errno) {
+                xerror2(TSF"epoll_wait errno:%_", errno);
+                usleep(10 * 1000);
+            }
+            if (0 >= ret) continue;
+
+            uint64_t count = 0;
+            while (0 > read(timerfd_, &count, sizeof(count)) && EINTR == errno) {}
+
+            ScopedLock lock(mutex_);
+            wheel_.Expire(gettickcount(), expired);
+
+            // posted under the lock, a timer Cancel returned true for is never posted
+            for (std::vector<uint64_t>::iterator it = expired.begin(); it != expired.end(); ++it) {
+                std::unordered_map<uint64_t, Timer>::iterator timer = timers_.find(*it);
+                if (timers_.end() == timer) continue;
+
+                MessageQueue::PostMessage(timer->second.handler, MessageQueue::Message(timer->second.title, timer->second.func));
+                timers_.erase(timer);
+            }
+            expired.clear();
+
+            if (timers_.empty()) wheel_.Clear();
+            __Arm(wheel_.NextTime());
+        }
+    }
+
+  private:
+    TimerService(const TimerService&);
+    TimerService& operator=(const TimerService&);
+
+  private:
+    Mutex                                   mutex_;
+    TimingWheel<uint64_t>                   wheel_;
+    std::unordered_map<uint64_t, Timer>     timers_;
+    uint64_t                                seq_;
+    int                                     epfd_;
+    int                                     timerfd_;
+    uint64_t                                armed_;     // when the timerfd goes off next
+    Thread                                  thread_;
+};
+
+#endif
+#endif // COMM_TIMER_SERVICE_H_
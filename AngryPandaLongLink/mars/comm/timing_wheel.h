@@ -0,0 +1,164 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * timing_wheel.h
+ *
+ * hierarchical timing wheel with 1ms ticks: 6 levels of 64 slots, level n holds what is due within
+ * 64^(n+1) ms. adding is O(1), an entry is moved down at most once per level before it expires.
+ * entries can not be removed, the owner drops stale ones when they come out.
+ */
+
+#ifndef COMM_TIMING_WHEEL_H_
+#define COMM_TIMING_WHEEL_H_
+
+#include <stdint.h>
+#include <vector>
+
+template <class T>
+class TimingWheel {
+  public:
+    static const int kSlotBits = 6;
+    static const int kSlots = 1 << kSlotBits;
+    static const int kLevels = 6;
+    static const uint64_t kNever = ~(uint64_t)0;
+
+  public:
+    explicit TimingWheel(uint64_t _now): now_(_now), size_(0) {
+        for (int i = 0; i < kLevels; ++i) occupied_[i] = 0;
+    }
+
+    void Add(uint64_t _time, const T& _value) {
+        Entry entry = {_time, _value};
+        __Insert(entry);
+        ++size_;
+    }
+
+    size_t Size() const { return size_; }
+    bool Empty() const { return 0 == size_; }
+
+    void Clear() {
+        for (int l = 0; l < kLevels; ++l) {
+            for (int s = 0; s < kSlots; ++s) slots_[l][s].clear();
+            occupied_[l] = 0;
+        }
+        due_.clear();
+        overflow_.clear();
+        size_ = 0;
+    }
+
+    // when Expire has something to hand out at the earliest, exact for what is due within 64ms.
+    // kNever when empty.
+    uint64_t NextTime() const {
+        if (!due_.empty()) return now_;
+
+        for (int l = 0; l < kLevels; ++l) {
+            int shift = l * kSlotBits;
+            int digit = (int)((now_ >> shift) & (kSlots - 1));
+            for (int s = digit + 1; s < kSlots; ++s) {
+                if (occupied_[l] & ((uint64_t)1 << s)) return ((now_ >> (shift + kSlotBits)) << (shift + kSlotBits)) | ((uint64_t)s << shift);
+            }
+        }
+
+        if (!overflow_.empty()) return ((now_ >> (kLevels * kSlotBits)) + 1) << (kLevels * kSlotBits);
+        return kNever;
+    }
+
+    // moves the wheel to _now and appends the values due by then to _expired
+    void Expire(uint64_t _now, std::vector<T>& _expired) {
+        if (_now < now_) _now = now_;
+
+        cascade_.swap(due_);
+
+        for (int l = 0; l < kLevels; ++l) {
+            int shift = l * kSlotBits;
+            int from = (int)((now_ >> shift) & (kSlots - 1));
+            int to = (int)((_now >> shift) & (kSlots - 1));
+            bool wrapped = (_now >> (shift + kSlotBits)) != (now_ >> (shift + kSlotBits));
+
+            if (wrapped) from = -1, to = kSlots - 1;
+            for (int s = from + 1; s <= to; ++s) __Collect(l, s);
+            if (!wrapped) break;
+        }
+
+        if ((_now >> (kLevels * kSlotBits)) != (now_ >> (kLevels * kSlotBits))) {
+            cascade_.insert(cascade_.end(), overflow_.begin(), overflow_.end());
+            overflow_.clear();
+        }
+
+        now_ = _now;
+
+        for (typename std::vector<Entry>::iterator it = cascade_.begin(); it != cascade_.end(); ++it) {
+            if (it->time <= now_) {
+                _expired.push_back(it->value);
+                --size_;
+            } else {
+                __Insert(*it);
+            }
+        }
+        cascade_.clear();
+    }
+
+  private:
+    struct Entry {
+        uint64_t time;
+        T        value;
+    };
+
+    void __Insert(const Entry& _entry) {
+        if (_entry.time <= now_) {
+            due_.push_back(_entry);
+            return;
+        }
+
+        uint64_t diff = _entry.time ^ now_;
+        for (int l = 0; l < kLevels; ++l) {
+            int shift = l * kSlotBits;
+            if (0 != (diff >> (shift + kSlotBits))) continue;
+
+            int s = (int)((_entry.time >> shift) & (kSlots - 1));
+            slots_[l][s].push_back(_entry);
+            occupied_[l] |= (uint64_t)1 << s;
+            return;
+        }
+
+        overflow_.push_back(_entry);
+    }
+
+    void __Collect(int _level, int _slot) {
+        if (!(occupied_[_level] & ((uint64_t)1 << _slot))) return;
+
+        std::vector<Entry>& slot = slots_[_level][_slot];
+        cascade_.insert(cascade_.end(), slot.begin(), slot.end());
+        slot.clear();
+        occupied_[_level] &= ~((uint64_t)1 << _slot);
+    }
+
+  private:
+    TimingWheel(const TimingWheel&);
+    TimingWheel& operator=(const TimingWheel&);
+
+  private:
+    uint64_t           now_;
+    size_t             size_;
+
+    std::vector<Entry> slots_[kLevels][kSlots];
+    uint64_t           occupied_[kLevels];
+    std::vector<Entry> due_;       // added at or before now_
+    std::vector<Entry> overflow_;  // beyond the last level
+    std::vector<Entry> cascade_;
+};
+
+template <class T> const uint64_t TimingWheel<T>::kNever;
+
+#endif // COMM_TIMING_WHEEL_H_
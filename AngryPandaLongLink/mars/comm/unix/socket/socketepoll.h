@@ -0,0 +1,190 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * socketepoll.h
+ *
+ * edge-triggered epoll over one socket and the breaker pipe. both are registered once, only the
+ * write interest of the socket is changed afterwards. with edge trigger a readable or writable
+ * socket is reported once per change, the caller keeps it readable until recv would block and
+ * writable until send would block.
+ */
+
+#ifndef _SOCKSTEPOLL_
+#define _SOCKSTEPOLL_
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "comm/socket/unix_socket.h"
+#include "comm/socket/socketbreaker.h"
+
+#ifndef EPOLLRDHUP
+#define EPOLLRDHUP 0x2000
+#endif
+
+class SocketEpoll {
+  public:
+    SocketEpoll(SocketBreaker& _breaker, bool _autoclear = false)
+    : breaker_(_breaker), autoclear_(_autoclear), epfd_(-1), breaker_fd_(-1), fd_(INVALID_SOCKET), write_(false)
+    , ret_(0), errno_(0), break_(false), readable_(false), writable_(false), exception_(false) {
+        epfd_ = epoll_create(2);
+        if (0 > epfd_) {
+            errno_ = errno;
+            return;
+        }
+        fcntl(epfd_, F_SETFD, FD_CLOEXEC);
+
+        if (!__AddBreaker()) {
+            close(epfd_);
+            epfd_ = -1;
+        }
+    }
+
+    ~SocketEpoll() {
+        if (0 <= epfd_) close(epfd_);
+        if (0 <= breaker_fd_) close(breaker_fd_);
+    }
+
+    bool IsCreateSuc() const { return 0 <= epfd_; }
+
+    // only one socket is watched besides the breaker
+    bool AddSocket(SOCKET _fd, bool _write) {
+        if (0 > epfd_ || INVALID_SOCKET != fd_) return false;
+
+        epoll_event ev = {0};
+        ev.events = __Events(_write);
+        ev.data.fd = _fd;
+        if (0 != epoll_ctl(epfd_, EPOLL_CTL_ADD, _fd, &ev)) {
+            errno_ = errno;
+            return false;
+        }
+
+        fd_ = _fd;
+        write_ = _write;
+        return true;
+    }
+
+    // no syscall when the interest does not change. arming reports a socket that is already writable.
+    bool WriteEvent(bool _active) {
+        if (INVALID_SOCKET == fd_) return false;
+        if (_active == write_) return true;
+
+        epoll_event ev = {0};
+        ev.events = __Events(_active);
+        ev.data.fd = fd_;
+        if (0 != epoll_ctl(epfd_, EPOLL_CTL_MOD, fd_, &ev)) {
+            errno_ = errno;
+            return false;
+        }
+
+        write_ = _active;
+        return true;
+    }
+
+    bool IsWriteActive() const { return write_; }
+
+    // -1 error, 0 timeout, else the number of fds with events
+    int Wait(int _msec) {
+        break_ = false;
+        readable_ = false;
+        writable_ = false;
+        exception_ = false;
+
+        epoll_event evs[2];
+        do {
+            ret_ = epoll_wait(epfd_, evs, 2, _msec);
+        } while (0 > ret_ && EINTR == errno);
+
+        if (0 > ret_) {
+            errno_ = errno;
+            return ret_;
+        }
+        errno_ = 0;
+
+        for (int i = 0; i < ret_; ++i) {
+            if (evs[i].data.fd == breaker_fd_) {
+                break_ = true;
+                if (autoclear_) breaker_.Clear();
+                continue;
+            }
+
+            if (evs[i].events & EPOLLERR) exception_ = true;
+            // a closed or reset peer is left to recv, which tells shutdown from error
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) readable_ = true;
+            if (evs[i].events & EPOLLOUT) writable_ = true;
+        }
+
+        return ret_;
+    }
+
+    int  Ret() const { return ret_; }
+    int  Errno() const { return errno_; }
+
+    bool IsBreak() const { return break_; }
+    bool Readable() const { return readable_; }
+    bool Writable() const { return writable_; }
+    bool IsException() const { return exception_; }
+
+    SocketBreaker& Breaker() { return breaker_; }
+
+  private:
+    // a dup of the pipe is registered, a breaker closed under Wait still wakes it with a hang up
+    // instead of silently leaving the set
+    bool __AddBreaker() {
+        breaker_fd_ = fcntl(breaker_.BreakerFD(), F_DUPFD_CLOEXEC, 0);
+        if (0 > breaker_fd_) {
+            errno_ = errno;
+            return false;
+        }
+
+        epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = breaker_fd_;
+        if (0 != epoll_ctl(epfd_, EPOLL_CTL_ADD, breaker_fd_, &ev)) {
+            errno_ = errno;
+            close(breaker_fd_);
+            breaker_fd_ = -1;
+            return false;
+        }
+
+        return true;
+    }
+
+    static uint32_t __Events(bool _write) { return EPOLLIN | EPOLLRDHUP | EPOLLET | (_write ? EPOLLOUT : 0); }
+
+  private:
+    SocketEpoll(const SocketEpoll&);
+    SocketEpoll& operator=(const SocketEpoll&);
+
+  private:
+    SocketBreaker& breaker_;
+    const bool     autoclear_;
+    int            epfd_;
+    int            breaker_fd_;
+    SOCKET         fd_;
+    bool           write_;
+
+    int            ret_;
+    int            errno_;
+    bool           break_;
+    bool           readable_;
+    bool           writable_;
+    bool           exception_;
+};
+
+#endif
+#endif
@@ -702,5 +702,7 @@ __inline void  __xlogger_c_write(const XLoggerInfo* _info, const char* _log, ...
 #define XENDL "\n"
 #define XTHIS "@%p, ", this
 
+#include "xlogger_binlog.h"
+
 #endif
 #endif /* XLOGGER_H_ */
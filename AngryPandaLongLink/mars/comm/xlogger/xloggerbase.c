@@ -14,6 +14,8 @@ WEAK_FUNC  void        __xlogger_SetLevel_impl(TLogLevel _level);
 WEAK_FUNC  int         __xlogger_IsEnabledFor_impl(TLogLevel _level);
 WEAK_FUNC xlogger_appender_t __xlogger_SetAppender_impl(xlogger_appender_t _appender);
 WEAK_FUNC void __xlogger_Write_impl(const XLoggerInfo* _info, const char* _log);
+WEAK_FUNC xlogger_bin_appender_t __xlogger_SetBinAppender_impl(xlogger_bin_appender_t _appender);
+WEAK_FUNC void __xlogger_WriteBin_impl(const XLoggerInfo* _info, const void* _data, size_t _len);
 WEAK_FUNC void __xlogger_VPrint_impl(const XLoggerInfo* _info, const char* _format, va_list _list);
 
 WEAK_FUNC void __xlogger_AssertP_impl(const XLoggerInfo* _info, const char* _expression, const char* _format, va_list _list);
@@ -49,6 +51,16 @@ void xlogger_Write(const XLoggerInfo* _info, const char* _log) {
 		__xlogger_Write_impl(_info, _log);
 }
 
+xlogger_bin_appender_t xlogger_SetBinAppender(xlogger_bin_appender_t _appender) {
+    if (NULL == &__xlogger_SetBinAppender_impl) { return NULL;}
+    return __xlogger_SetBinAppender_impl(_appender);
+}
+
+void xlogger_WriteBin(const XLoggerInfo* _info, const void* _data, size_t _len) {
+	if (NULL != &__xlogger_WriteBin_impl)
+		__xlogger_WriteBin_impl(_info, _data, _len);
+}
+
 void xlogger_VPrint(const XLoggerInfo* _info, const char* _format, va_list _list) {
 	if (NULL != &__xlogger_VPrint_impl)
 		__xlogger_VPrint_impl(_info, _format, _list);
@@ -82,6 +94,7 @@ void xlogger_Assert(const XLoggerInfo* _info, const char* _expression, const cha
 #ifndef USING_XLOG_WEAK_FUNC
 static TLogLevel gs_level = kLevelNone;
 static xlogger_appender_t gs_appender = NULL;
+static xlogger_bin_appender_t gs_bin_appender = NULL;
 
 TLogLevel   __xlogger_Level_impl() {return gs_level;}
 void        __xlogger_SetLevel_impl(TLogLevel _level){ gs_level = _level;}
@@ -93,6 +106,12 @@ xlogger_appender_t __xlogger_SetAppender_impl(xlogger_appender_t _appender)  {
     return old_appender;
 }
 
+xlogger_bin_appender_t __xlogger_SetBinAppender_impl(xlogger_bin_appender_t _appender)  {
+    xlogger_bin_appender_t old_appender = gs_bin_appender;
+    gs_bin_appender = _appender;
+    return old_appender;
+}
+
 void __xlogger_Write_impl(const XLoggerInfo* _info, const char* _log) {
     
     if (!gs_appender) return;
@@ -116,6 +135,21 @@ void __xlogger_Write_impl(const XLoggerInfo* _info, const char* _log) {
     }
 }
 
+void __xlogger_WriteBin_impl(const XLoggerInfo* _info, const void* _data, size_t _len) {
+
+    if (!gs_bin_appender || NULL == _info || NULL == _data) return;
+
+    if (-1==_info->pid && -1==_info->tid && -1==_info->maintid)
+    {
+        XLoggerInfo* info = (XLoggerInfo*)_info;
+        info->pid = xlogger_pid();
+        info->tid = xlogger_tid();
+        info->maintid = xlogger_maintid();
+    }
+
+    gs_bin_appender(_info, _data, _len);
+}
+
 void __xlogger_VPrint_impl(const XLoggerInfo* _info, const char* _format, va_list _list) {
     if (NULL == _format) {
         XLoggerInfo* info = (XLoggerInfo*)_info;
@@ -23,6 +23,7 @@
 #include <time.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -56,12 +57,14 @@ extern intmax_t xlogger_pid();
 extern intmax_t xlogger_tid();
 extern intmax_t xlogger_maintid();
 typedef void (*xlogger_appender_t)(const XLoggerInfo* _info, const char* _log);
+typedef void (*xlogger_bin_appender_t)(const XLoggerInfo* _info, const void* _data, size_t _len);
 extern const char* xlogger_dump(const void* _dumpbuffer, size_t _len);
 
 TLogLevel   xlogger_Level();
 void xlogger_SetLevel(TLogLevel _level);
 int  xlogger_IsEnabledFor(TLogLevel _level);
 xlogger_appender_t xlogger_SetAppender(xlogger_appender_t _appender);
+xlogger_bin_appender_t xlogger_SetBinAppender(xlogger_bin_appender_t _appender);
 
 // no level filter
 #ifdef __GNUC__
@@ -78,6 +81,8 @@ __attribute__((__format__(printf, 2, 3)))
 #endif
 void        xlogger_Print(const XLoggerInfo* _info, const char* _format, ...);
 void        xlogger_Write(const XLoggerInfo* _info, const char* _log);
+// binlog record, see xlogger_binlog.h
+void        xlogger_WriteBin(const XLoggerInfo* _info, const void* _data, size_t _len);
 
 #ifdef __cplusplus
 }
@@ -42,8 +42,18 @@ struct __STNetMsgXpHeader {
     uint32_t    seq;
     uint32_t	body_length;
 };
+
+// head_length tells it from the plain header
+struct __STNetMsgXpFrameHeader {
+    __STNetMsgXpHeader  xp;
+    uint32_t            flags;
+    uint32_t            window;
+};
 #pragma pack(pop)
 
+#define FRAME_FLAG_MORE 0x1
+#define FRAME_FLAG_WINDOW 0x2
+
 namespace mars {
 namespace stn {
 longlink_tracker* (*longlink_tracker::Create)()
@@ -56,7 +66,7 @@ void SetClientVersion(uint32_t _client_version)  {
 }
 
 
-static int __unpack_test(const void* _packed, size_t _packed_len, uint32_t& _cmdid, uint32_t& _seq, size_t& _package_len, size_t& _body_len) {
+static int __unpack_test(const void* _packed, size_t _packed_len, uint32_t& _cmdid, uint32_t& _seq, size_t& _package_len, size_t& _body_len, uint32_t& _flags, uint32_t& _window) {
     __STNetMsgXpHeader st = {0};
     if (_packed_len < sizeof(__STNetMsgXpHeader)) {
         _package_len = 0;
@@ -81,6 +91,15 @@ static int __unpack_test(const void* _packed, size_t _packed_len, uint32_t& _cmd
     if (_package_len > 1024*1024) { return LONGLINK_UNPACK_FALSE; }
     if (_package_len > _packed_len) { return LONGLINK_UNPACK_CONTINUE; }
     
+    _flags = 0;
+    _window = 0;
+    if (sizeof(__STNetMsgXpFrameHeader) == head_len) {
+        __STNetMsgXpFrameHeader frame;
+        memcpy(&frame, _packed, sizeof(frame));
+        _flags = ntohl(frame.flags);
+        _window = ntohl(frame.window);
+    }
+    
     return LONGLINK_UNPACK_OK;
 }
 
@@ -105,18 +124,58 @@ void (*longlink_pack)(uint32_t _cmdid, uint32_t _seq, const AutoBuffer& _body, c
 int (*longlink_unpack)(const AutoBuffer& _packed, uint32_t& _cmdid, uint32_t& _seq, size_t& _package_len, AutoBuffer& _body, AutoBuffer& _extension, longlink_tracker* _tracker)
 = [](const AutoBuffer& _packed, uint32_t& _cmdid, uint32_t& _seq, size_t& _package_len, AutoBuffer& _body, AutoBuffer& _extension, longlink_tracker* _tracker) {
    size_t body_len = 0;
-   int ret = __unpack_test(_packed.Ptr(), _packed.Length(), _cmdid,  _seq, _package_len, body_len);
+   uint32_t flags = 0;
+   uint32_t window = 0;
+   int ret = __unpack_test(_packed.Ptr(), _packed.Length(), _cmdid,  _seq, _package_len, body_len, flags, window);
     
     if (LONGLINK_UNPACK_OK != ret) return ret;
     
+    if (flags & FRAME_FLAG_WINDOW) {
+        _body.Write(AutoBuffer::ESeekCur, &window, sizeof(window));
+        return LONGLINK_UNPACK_STREAM_WINDOW;
+    }
+    
     _body.Write(AutoBuffer::ESeekCur, _packed.Ptr(_package_len-body_len), body_len);
     
-    return ret;
+    return (flags & FRAME_FLAG_MORE) ? LONGLINK_UNPACK_STREAM_PACKAGE : ret;
+};
+
+void (*longlink_pack_frame)(uint32_t _cmdid, uint32_t _seq, const void* _data, size_t _length, bool _more, const AutoBuffer& _extension, AutoBuffer& _packed, longlink_tracker* _tracker)
+= [](uint32_t _cmdid, uint32_t _seq, const void* _data, size_t _length, bool _more, const AutoBuffer& _extension, AutoBuffer& _packed, longlink_tracker* _tracker) {
+    __STNetMsgXpFrameHeader st = {{0}};
+    st.xp.head_length = htonl(sizeof(__STNetMsgXpFrameHeader));
+    st.xp.client_version = htonl(sg_client_version);
+    st.xp.cmdid = htonl(_cmdid);
+    st.xp.seq = htonl(_seq);
+    st.xp.body_length = htonl(_length);
+    st.flags = htonl(_more ? FRAME_FLAG_MORE : 0);
+
+    _packed.AllocWrite(sizeof(__STNetMsgXpFrameHeader) + _length);
+    _packed.Write(&st, sizeof(st));
+    
+    if (NULL != _data) _packed.Write(_data, _length);
+    
+    _packed.Seek(0, AutoBuffer::ESeekStart);
+};
+
+void (*longlink_pack_window)(uint32_t _seq, uint32_t _window, AutoBuffer& _packed, longlink_tracker* _tracker)
+= [](uint32_t _seq, uint32_t _window, AutoBuffer& _packed, longlink_tracker* _tracker) {
+    __STNetMsgXpFrameHeader st = {{0}};
+    st.xp.head_length = htonl(sizeof(__STNetMsgXpFrameHeader));
+    st.xp.client_version = htonl(sg_client_version);
+    st.xp.seq = htonl(_seq);
+    st.flags = htonl(FRAME_FLAG_WINDOW);
+    st.window = htonl(_window);
+
+    _packed.AllocWrite(sizeof(__STNetMsgXpFrameHeader));
+    _packed.Write(&st, sizeof(st));
+    _packed.Seek(0, AutoBuffer::ESeekStart);
 };
 
 
 #define NOOP_CMDID 6
 #define SIGNALKEEP_CMDID 243
+#define COMPRESS_CMDID 244
 #define PUSH_DATA_TASKID 0
 
 uint32_t (*longlink_noop_cmdid)()
@@ -134,6 +193,11 @@ uint32_t (*signal_keep_cmdid)()
     return SIGNALKEEP_CMDID;
 };
 
+uint32_t (*longlink_compress_cmdid)()
+= []() -> uint32_t {
+    return COMPRESS_CMDID;
+};
+
 void (*longlink_noop_req_body)(AutoBuffer& _body, AutoBuffer& _extend)
 = [](AutoBuffer& _body, AutoBuffer& _extend) {
     
@@ -31,6 +31,8 @@
 //for HTTP2
 #define LONGLINK_UNPACK_STREAM_END LONGLINK_UNPACK_OK
 #define LONGLINK_UNPACK_STREAM_PACKAGE (1)
+// a window update for _seq, _body holds the uint32_t credit in host order
+#define LONGLINK_UNPACK_STREAM_WINDOW (2)
 
 #ifndef __cplusplus
 #error "support cpp only"
@@ -58,6 +60,18 @@ public:
  */
 extern void (*longlink_pack)(uint32_t _cmdid, uint32_t _seq, const AutoBuffer& _body, const AutoBuffer& _extension, AutoBuffer& _packed, longlink_tracker* _tracker);
 
+/**
+ * package one frame of a body sent in pieces, see SetLonglinkStreamFrame
+ * _data, _length: the piece of the body in this frame
+ * _more: frames of _seq follow, the last one ends the request
+ */
+extern void (*longlink_pack_frame)(uint32_t _cmdid, uint32_t _seq, const void* _data, size_t _length, bool _more, const AutoBuffer& _extension, AutoBuffer& _packed, longlink_tracker* _tracker);
+
+/**
+ * package a window update, the peer may send _window more body bytes of _seq
+ */
+extern void (*longlink_pack_window)(uint32_t _seq, uint32_t _window, AutoBuffer& _packed, longlink_tracker* _tracker);
+
 /**
  * unpackage the response data
  * _packed: data received from server
@@ -65,7 +79,7 @@ extern void (*longlink_pack)(uint32_t _cmdid, uint32_t _seq, const AutoBuffer& _
  * _seq: task id
  * _package_len:
  * _body: business receive buffer
- * return: 0 if unpackage succ
+ * return: 0 if unpackage succ, LONGLINK_UNPACK_STREAM_PACKAGE for a frame more of _seq follows
  */
 extern int  (*longlink_unpack)(const AutoBuffer& _packed, uint32_t& _cmdid, uint32_t& _seq, size_t& _package_len, AutoBuffer& _body, AutoBuffer& _extension, longlink_tracker* _tracker);
 
@@ -73,6 +87,8 @@ extern int  (*longlink_unpack)(const AutoBuffer& _packed, uint32_t& _cmdid, uint
 extern uint32_t (*longlink_noop_cmdid)();
 extern bool  (*longlink_noop_isresp)(uint32_t _taskid, uint32_t _cmdid, uint32_t _recv_seq, const AutoBuffer& _body, const AutoBuffer& _extend);
 extern uint32_t (*signal_keep_cmdid)();
+// the payload compression offer of a new connection, the answer to it and the confirm of the answer, see SetPayloadCompress
+extern uint32_t (*longlink_compress_cmdid)();
 extern void (*longlink_noop_req_body)(AutoBuffer& _body, AutoBuffer& _extend);
 extern void (*longlink_noop_resp_body)(const AutoBuffer& _body, const AutoBuffer& _extend);
 
@@ -31,8 +31,50 @@ enum TAppenderMode
     kAppednerSync,
 };
 
-void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefix, const char* _pub_key);
-void appender_open_with_cache(TAppenderMode _mode, const std::string& _cachedir, const std::string& _logdir, const char* _nameprefix, const char* _pub_key);
+enum TCompressMode
+{
+    kZlib,
+    kZstd,  // needs XLOG_WITH_ZSTD, falls back to zlib without it
+};
+
+enum TCipherMode
+{
+    kTea,
+    kChaCha20,
+};
+
+// what an async log call does when the log thread falls behind and the staging ring is full
+enum TOverflowPolicy
+{
+    kOverflowBlock,             // waits a bounded time for the log thread to make room, then drops
+    kOverflowDropOldest,        // never waits for the mutex of the log thread. the oldest records in the ring make room,
+                                // but while the log thread is draining the ring the new record is dropped
+    kOverflowDropBelowWarn,     // drops debug and info records at once, warn and above wait like kOverflowBlock
+};
+
+struct AppenderStats
+{
+    uint64_t dropped_records;   // lost by the overflow policy or a full buffer
+    uint64_t dropped_bytes;
+    uint64_t blocked_count;     // async log calls that waited for room
+    uint64_t blocked_ms;
+    uint32_t max_queue_bytes;   // staging ring high water mark
+    uint32_t max_queue_records;
+    uint32_t max_buffer_length; // mmap buffer high water mark, of 150k
+    uint64_t flush_count;
+    uint64_t flush_total_ms;    // buffer to file, compression excluded
+    uint64_t flush_max_ms;
+};
+
+/*
+ * @param _compress_mode    Codec of the async log buffer, recorded in every log block header.
+ * @param _compress_level   zlib 0-9, zstd 1-19 or negative for the fast levels. Lower costs less cpu per MB.
+ * @param _cipher_mode      Cipher of the async log buffer when _pub_key is set, recorded in every log block header.
+ */
+void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefix, const char* _pub_key,
+                   TCompressMode _compress_mode = kZlib, int _compress_level = 9, TCipherMode _cipher_mode = kTea);
+void appender_open_with_cache(TAppenderMode _mode, const std::string& _cachedir, const std::string& _logdir, const char* _nameprefix, const char* _pub_key,
+                              TCompressMode _compress_mode = kZlib, int _compress_level = 9, TCipherMode _cipher_mode = kTea);
 void appender_flush();
 void appender_flush_sync();
 void appender_close();
@@ -50,6 +92,17 @@ void appender_set_console_log(bool _is_open);
  */
 void appender_set_max_file_size(uint64_t _max_byte_size);
 
+/*
+ * @param _policy           What an async log call does when the staging ring is full, kOverflowBlock by default.
+ * @param _max_block_ms     Longest wait of kOverflowBlock and kOverflowDropBelowWarn, 10ms by default.
+ */
+void appender_set_overflow_policy(TOverflowPolicy _policy, long _max_block_ms = 10);
+
+/*
+ * Counters since appender_open or the last reset. _reset also starts the high water marks over.
+ */
+void appender_get_stats(AppenderStats& _stats, bool _reset = false);
+
 /* 获取当天最新的文件 */
 std::string appender_getLastFilepath();
 
@@ -0,0 +1,151 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+//
+//  chacha20.h
+//  mars-ext
+//
+//  ChaCha20 of RFC 7539 (32 bit block counter, 96 bit nonce).
+//  with gcc/clang the key stream is made 4 blocks at a time in vector lanes (sse2/neon), one block otherwise.
+//  Xor takes any byte position of the stream and reuses the cached blocks across small calls.
+//
+
+#ifndef CHACHA20_H_
+#define CHACHA20_H_
+
+#include <stdint.h>
+#include <string.h>
+
+class ChaCha20 {
+  public:
+    static const size_t kKeyLen = 32;
+    static const size_t kNonceLen = 12;
+
+    ChaCha20() { memset(this, 0, sizeof(*this)); }
+
+    void Init(const uint8_t _key[kKeyLen], const uint8_t _nonce[kNonceLen]) {
+        input_[0] = 0x61707865;
+        input_[1] = 0x3320646e;
+        input_[2] = 0x79622d32;
+        input_[3] = 0x6b206574;
+        for (int i = 0; i < 8; ++i) input_[4 + i] = __Load32(_key + i * 4);
+        input_[12] = 0;
+        for (int i = 0; i < 3; ++i) input_[13 + i] = __Load32(_nonce + i * 4);
+
+        stream_pos_ = 0;
+        stream_len_ = 0;
+    }
+
+    // xors _data with the key stream bytes [_pos, _pos + _len)
+    void Xor(uint64_t _pos, uint8_t* _data, size_t _len) {
+        while (_len > 0) {
+            if (_pos < stream_pos_ || _pos >= stream_pos_ + stream_len_) {
+                stream_pos_ = _pos & ~(uint64_t)(kBlockLen - 1);
+                __Blocks((uint32_t)(stream_pos_ / kBlockLen));
+                stream_len_ = sizeof(stream_);
+            }
+
+            size_t offset = (size_t)(_pos - stream_pos_);
+            size_t n = stream_len_ - offset < _len ? stream_len_ - offset : _len;
+            const uint8_t* stream = stream_ + offset;
+
+            size_t i = 0;
+            for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+                uint64_t d, k;
+                memcpy(&d, _data + i, sizeof(d));
+                memcpy(&k, stream + i, sizeof(k));
+                d ^= k;
+                memcpy(_data + i, &d, sizeof(d));
+            }
+            for (; i < n; ++i) _data[i] ^= stream[i];
+
+            _data += n;
+            _pos += n;
+            _len -= n;
+        }
+    }
+
+  private:
+    static const size_t kBlockLen = 64;
+
+#if defined(__GNUC__) || defined(__clang__)
+    // one block per vector lane, sse2 on x86 and neon on arm
+    typedef uint32_t Lane __attribute__((vector_size(16)));
+    static const int kLane = 4;
+
+    static Lane __Splat(uint32_t _v) { Lane lane = {_v, _v, _v, _v}; return lane; }
+    static Lane __Counter(uint32_t _v) { Lane lane = {_v, _v + 1, _v + 2, _v + 3}; return lane; }
+#else
+    typedef uint32_t Lane;
+    static const int kLane = 1;
+
+    static Lane __Splat(uint32_t _v) { return _v; }
+    static Lane __Counter(uint32_t _v) { return _v; }
+#endif
+
+    static uint32_t __Load32(const uint8_t* _p) {
+        return (uint32_t)_p[0] | ((uint32_t)_p[1] << 8) | ((uint32_t)_p[2] << 16) | ((uint32_t)_p[3] << 24);
+    }
+
+    void __Blocks(uint32_t _counter) {
+        Lane x[16];
+        Lane init[16];
+
+        for (int i = 0; i < 16; ++i) init[i] = __Splat(input_[i]);
+        init[12] = __Counter(_counter);
+        for (int i = 0; i < 16; ++i) x[i] = init[i];
+
+#define CHACHA20_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA20_QR(a, b, c, d) \
+        x[a] += x[b]; x[d] ^= x[a]; x[d] = CHACHA20_ROTL(x[d], 16); \
+        x[c] += x[d]; x[b] ^= x[c]; x[b] = CHACHA20_ROTL(x[b], 12); \
+        x[a] += x[b]; x[d] ^= x[a]; x[d] = CHACHA20_ROTL(x[d], 8); \
+        x[c] += x[d]; x[b] ^= x[c]; x[b] = CHACHA20_ROTL(x[b], 7);
+
+        for (int r = 0; r < 10; ++r) {
+            CHACHA20_QR(0, 4, 8, 12)
+            CHACHA20_QR(1, 5, 9, 13)
+            CHACHA20_QR(2, 6, 10, 14)
+            CHACHA20_QR(3, 7, 11, 15)
+            CHACHA20_QR(0, 5, 10, 15)
+            CHACHA20_QR(1, 6, 11, 12)
+            CHACHA20_QR(2, 7, 8, 13)
+            CHACHA20_QR(3, 4, 9, 14)
+        }
+
+#undef CHACHA20_QR
+#undef CHACHA20_ROTL
+
+        uint32_t words[16][kLane];
+        for (int i = 0; i < 16; ++i) x[i] += init[i];
+        memcpy(words, x, sizeof(words));
+
+        for (int l = 0; l < kLane; ++l) {
+            uint8_t* out = stream_ + l * kBlockLen;
+            for (int i = 0; i < 16; ++i) {
+                uint32_t v = words[i][l];
+                out[i * 4] = (uint8_t)v;
+                out[i * 4 + 1] = (uint8_t)(v >> 8);
+                out[i * 4 + 2] = (uint8_t)(v >> 16);
+                out[i * 4 + 3] = (uint8_t)(v >> 24);
+            }
+        }
+    }
+
+  private:
+    uint32_t input_[16];
+    uint8_t stream_[kBlockLen * kLane];
+    uint64_t stream_pos_;
+    size_t stream_len_;
+};
+
+#endif /* CHACHA20_H_ */
@@ -0,0 +1,148 @@
+#!/usr/bin/python
+
+# renders the binlog frames (xinfo_bin and friends) in decompressed xlog text.
+# frame: '\0', type, uint16 length, payload. definitions are repeated in every log block,
+# so a BinlogRender is used for one block only.
+
+import struct
+import time
+
+
+LEVEL_STRINGS = "VDIWEF"
+
+FRAME_ZONE = 'Z'
+FRAME_DEFINE = 'D'
+FRAME_RECORD = 'R'
+
+
+def _ReadCString(_payload, _offset):
+    end = _payload.find(b'\0', _offset)
+    if -1 == end: end = len(_payload)
+    return (_payload[_offset:end], end + 1)
+
+
+def _ParseArgs(_payload, _offset):
+    args = []
+    while _offset < len(_payload):
+        arg_type = chr(bytearray(_payload[_offset:_offset+1])[0])
+        _offset += 1
+        if 'b' == arg_type:
+            args.append(b'true' if bytearray(_payload[_offset:_offset+1])[0] else b'false')
+            _offset += 1
+        elif 'c' == arg_type:
+            args.append(_payload[_offset:_offset+1])
+            _offset += 1
+        elif 'i' == arg_type:
+            args.append(str(struct.unpack_from("<q", _payload, _offset)[0]).encode())
+            _offset += 8
+        elif 'u' == arg_type:
+            args.append(str(struct.unpack_from("<Q", _payload, _offset)[0]).encode())
+            _offset += 8
+        elif 'f' == arg_type:
+            args.append(("%E" % struct.unpack_from("<d", _payload, _offset)[0]).encode())
+            _offset += 8
+        elif 'p' == arg_type:
+            args.append(("0x%X" % struct.unpack_from("<Q", _payload, _offset)[0]).encode())
+            _offset += 8
+        elif 's' == arg_type:
+            length = struct.unpack_from("<H", _payload, _offset)[0]
+            args.append(_payload[_offset+2:_offset+2+length])
+            _offset += 2 + length
+        else:
+            break
+    return args
+
+
+def _TypeSafeFormat(_format, _args):
+    out = bytearray()
+    index = 0
+    pos = 0
+    while pos < len(_format):
+        ch = _format[pos:pos+1]
+        nextch = _format[pos+1:pos+2]
+        if b'%' != ch:
+            out.extend(ch)
+            pos += 1
+        elif nextch.isdigit() or b'_' == nextch:
+            arg_index = index if b'_' == nextch else int(nextch)
+            out.extend(_args[arg_index] if arg_index < len(_args) else b'(null)')
+            index += 1
+            pos += 2
+        elif b'%' == nextch:
+            out.extend(b'%')
+            pos += 2
+        else:
+            pos += 1
+    return out
+
+
+class BinlogRender(object):
+
+    def __init__(self):
+        self.gmtoff = 0
+        self.sites = {}
+
+    def Render(self, _buffer):
+        _buffer = bytes(_buffer)
+        out = bytearray()
+        offset = 0
+
+        while True:
+            pos = _buffer.find(b'\0', offset)
+            if -1 == pos:
+                out.extend(_buffer[offset:])
+                break
+
+            out.extend(_buffer[offset:pos])
+            if pos + 4 > len(_buffer):
+                break
+
+            frame_type = chr(bytearray(_buffer[pos+1:pos+2])[0])
+            length = struct.unpack_from("<H", _buffer, pos + 2)[0]
+            payload = _buffer[pos+4:pos+4+length]
+            if len(payload) < length:
+                out.extend(b"[F]decode_mars_binlog.py frame truncated\n")
+                break
+
+            try:
+                self.__Frame(frame_type, payload, out)
+            except Exception as e:
+                out.extend(("[F]decode_mars_binlog.py frame error, %s\n" % str(e)).encode())
+
+            offset = pos + 4 + length
+
+        return out
+
+    def __Frame(self, _type, _payload, _out):
+        if FRAME_ZONE == _type:
+            self.gmtoff = struct.unpack_from("<i", _payload, 0)[0]
+        elif FRAME_DEFINE == _type:
+            site_id, line = struct.unpack_from("<Hi", _payload, 0)
+            tag, offset = _ReadCString(_payload, 6)
+            filename, offset = _ReadCString(_payload, offset)
+            funcname, offset = _ReadCString(_payload, offset)
+            fmt, offset = _ReadCString(_payload, offset)
+            self.sites[site_id] = (tag, filename, funcname, line, fmt)
+        elif FRAME_RECORD == _type:
+            site_id, level, is_main, sec, ms, pid, tid = struct.unpack_from("<HBBqHqq", _payload, 0)
+            if site_id not in self.sites:
+                _out.extend(("[F]decode_mars_binlog.py site %d is not defined\n" % site_id).encode())
+                return
+            tag, filename, funcname, line, fmt = self.sites[site_id]
+
+            tm = time.gmtime(sec + self.gmtoff)
+            header = "[%s][%d-%02d-%02d %+.1f %02d:%02d:%02d.%.3d][%d, %d%s][" % (LEVEL_STRINGS[level] if level < len(LEVEL_STRINGS) else 'F',
+                     tm.tm_year, tm.tm_mon, tm.tm_mday, self.gmtoff / 3600.0, tm.tm_hour, tm.tm_min, tm.tm_sec, ms,
+                     pid, tid, '*' if is_main else '')
+            _out.extend(header.encode())
+            _out.extend(tag + b'][' + filename + b', ' + funcname + (", %d][" % line).encode())
+
+            body = _TypeSafeFormat(fmt, _ParseArgs(_payload, 30))
+            _out.extend(body)
+            if 0 == len(body) or body[-1:] != b'\n':
+                _out.extend(b'\n')
+
+
+def RenderBinlog(_buffer):
+    if -1 == bytes(_buffer).find(b'\0'): return _buffer
+    return BinlogRender().Render(_buffer)
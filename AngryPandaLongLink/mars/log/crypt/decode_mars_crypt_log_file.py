@@ -9,6 +9,8 @@ import binascii
 import pyelliptic
 import traceback
 
+from decode_mars_binlog import RenderBinlog
+
 
 MAGIC_NO_COMPRESS_START = 0x03
 MAGIC_NO_COMPRESS_START1 = 0x06
@@ -17,6 +19,10 @@ MAGIC_COMPRESS_START = 0x04
 MAGIC_COMPRESS_START1 = 0x05
 MAGIC_COMPRESS_START2 = 0x07
 MAGIC_COMPRESS_NO_CRYPT_START = 0x09
+MAGIC_ZSTD_COMPRESS_START = 0x0A
+MAGIC_ZSTD_COMPRESS_NO_CRYPT_START = 0x0B
+MAGIC_CHACHA_COMPRESS_START = 0x0C
+MAGIC_CHACHA_ZSTD_COMPRESS_START = 0x0D
 
 MAGIC_END = 0x00
 
@@ -49,6 +55,40 @@ def tea_decrypt(v, k):
     return ret
 
 
+def chacha20_block(k, counter, nonce):
+    op = 0xffffffff
+    x = [0x61707865, 0x3320646e, 0x79622d32, 0x6b206574] + list(struct.unpack('<8L', k[0:32])) + [counter] + list(struct.unpack('<3L', nonce))
+    init = list(x)
+
+    def qr(a, b, c, d):
+        x[a] = (x[a] + x[b]) & op; x[d] ^= x[a]; x[d] = ((x[d] << 16) | (x[d] >> 16)) & op
+        x[c] = (x[c] + x[d]) & op; x[b] ^= x[c]; x[b] = ((x[b] << 12) | (x[b] >> 20)) & op
+        x[a] = (x[a] + x[b]) & op; x[d] ^= x[a]; x[d] = ((x[d] << 8) | (x[d] >> 24)) & op
+        x[c] = (x[c] + x[d]) & op; x[b] ^= x[c]; x[b] = ((x[b] << 7) | (x[b] >> 25)) & op
+
+    for i in xrange(10):
+        qr(0, 4, 8, 12); qr(1, 5, 9, 13); qr(2, 6, 10, 14); qr(3, 7, 11, 15)
+        qr(0, 5, 10, 15); qr(1, 6, 11, 12); qr(2, 7, 8, 13); qr(3, 4, 9, 14)
+
+    return struct.pack('<16L', *[(x[i] + init[i]) & op for i in xrange(16)])
+
+
+def chacha20_decrypt(v, k, seq):
+    nonce = struct.pack('<H', seq) + '\0' * 10
+    try:
+        from Crypto.Cipher import ChaCha20
+        return bytearray(ChaCha20.new(key=str(k[0:32]), nonce=nonce).decrypt(str(v)))
+    except ImportError:
+        pass
+
+    ret = bytearray(v)
+    for i in xrange(0, len(ret), 64):
+        stream = bytearray(chacha20_block(k, i / 64, nonce))
+        for j in xrange(min(64, len(ret) - i)):
+            ret[i + j] ^= stream[j]
+    return ret
+
+
 def IsGoodLogBuffer(_buffer, _offset, count):
 
     if _offset == len(_buffer): return (True, '')
@@ -56,7 +96,9 @@ def IsGoodLogBuffer(_buffer, _offset, count):
     magic_start = _buffer[_offset] 
     if MAGIC_NO_COMPRESS_START==magic_start or MAGIC_COMPRESS_START==magic_start or MAGIC_COMPRESS_START1==magic_start:
         crypt_key_len = 4
-    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start:
+    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_ZSTD_COMPRESS_START==magic_start or MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_CHACHA_COMPRESS_START==magic_start or MAGIC_CHACHA_ZSTD_COMPRESS_START==magic_start:
         crypt_key_len = 64
     else:
         return (False, '_buffer[%d]:%d != MAGIC_NUM_START'%(_offset, _buffer[_offset]))
@@ -78,12 +120,20 @@ def GetLogStartPos(_buffer, _count):
     while True:
         if offset >= len(_buffer): break
         
-        if MAGIC_NO_COMPRESS_START==_buffer[offset] or MAGIC_NO_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START==_buffer[offset] or MAGIC_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START2==_buffer[offset] or MAGIC_COMPRESS_NO_CRYPT_START==_buffer[offset] or MAGIC_NO_COMPRESS_NO_CRYPT_START==_buffer[offset]:
+        if MAGIC_NO_COMPRESS_START==_buffer[offset] or MAGIC_NO_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START==_buffer[offset] or MAGIC_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START2==_buffer[offset] or MAGIC_COMPRESS_NO_CRYPT_START==_buffer[offset] or MAGIC_NO_COMPRESS_NO_CRYPT_START==_buffer[offset] \
+            or MAGIC_ZSTD_COMPRESS_START==_buffer[offset] or MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==_buffer[offset] \
+            or MAGIC_CHACHA_COMPRESS_START==_buffer[offset] or MAGIC_CHACHA_ZSTD_COMPRESS_START==_buffer[offset]:
             if IsGoodLogBuffer(_buffer, offset, _count)[0]: return offset
         offset+=1
         
     return -1    
     
+def ZstdDecompress(_data):
+    # every block is one unfinished zstd frame flushed after each log
+    import zstandard
+    return zstandard.ZstdDecompressor().decompressobj().decompress(_data)
+
+
 def DecodeBuffer(_buffer, _offset, _outbuffer):
     
     if _offset >= len(_buffer): return -1
@@ -100,7 +150,9 @@ def DecodeBuffer(_buffer, _offset, _outbuffer):
     magic_start = _buffer[_offset]
     if MAGIC_NO_COMPRESS_START==magic_start or MAGIC_COMPRESS_START==magic_start or MAGIC_COMPRESS_START1==magic_start:
         crypt_key_len = 4
-    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start:
+    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_ZSTD_COMPRESS_START==magic_start or MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_CHACHA_COMPRESS_START==magic_start or MAGIC_CHACHA_ZSTD_COMPRESS_START==magic_start:
         crypt_key_len = 64
     else:
         _outbuffer.extend('in DecodeBuffer _buffer[%d]:%d != MAGIC_NUM_START'%(_offset, magic_start))
@@ -140,8 +192,35 @@ def DecodeBuffer(_buffer, _offset, _outbuffer):
 
             tmpbuffer = tea_decrypt(tmpbuffer, tea_key)
             tmpbuffer = decompressor.decompress(str(tmpbuffer))
+        elif MAGIC_CHACHA_COMPRESS_START==_buffer[_offset] or MAGIC_CHACHA_ZSTD_COMPRESS_START==_buffer[_offset]:
+            svr = pyelliptic.ECC(curve='secp256k1')
+            client = pyelliptic.ECC(curve='secp256k1')
+            client.pubkey_x = str(buffer(_buffer, _offset+headerLen-crypt_key_len, crypt_key_len/2))
+            client.pubkey_y = str(buffer(_buffer, _offset+headerLen-crypt_key_len/2, crypt_key_len/2))
+
+            svr.privkey = binascii.unhexlify(PRIV_KEY)
+            chacha_key = svr.get_ecdh_key(client.get_pubkey())
+
+            tmpbuffer = chacha20_decrypt(tmpbuffer, chacha_key, seq)
+            if MAGIC_CHACHA_ZSTD_COMPRESS_START==_buffer[_offset]:
+                tmpbuffer = ZstdDecompress(str(tmpbuffer))
+            else:
+                tmpbuffer = decompressor.decompress(str(tmpbuffer))
+        elif MAGIC_ZSTD_COMPRESS_START==_buffer[_offset]:
+            svr = pyelliptic.ECC(curve='secp256k1')
+            client = pyelliptic.ECC(curve='secp256k1')
+            client.pubkey_x = str(buffer(_buffer, _offset+headerLen-crypt_key_len, crypt_key_len/2))
+            client.pubkey_y = str(buffer(_buffer, _offset+headerLen-crypt_key_len/2, crypt_key_len/2))
+
+            svr.privkey = binascii.unhexlify(PRIV_KEY)
+            tea_key = svr.get_ecdh_key(client.get_pubkey())
+
+            tmpbuffer = tea_decrypt(tmpbuffer, tea_key)
+            tmpbuffer = ZstdDecompress(str(tmpbuffer))
         elif MAGIC_COMPRESS_START==_buffer[_offset] or MAGIC_COMPRESS_NO_CRYPT_START==_buffer[_offset]:
             tmpbuffer = decompressor.decompress(str(tmpbuffer))
+        elif MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==_buffer[_offset]:
+            tmpbuffer = ZstdDecompress(str(tmpbuffer))
         elif MAGIC_COMPRESS_START1==_buffer[_offset]:
             decompress_data = bytearray()
             while len(tmpbuffer) > 0:
@@ -160,7 +239,7 @@ def DecodeBuffer(_buffer, _offset, _outbuffer):
         _outbuffer.extend("[F]decode_log_file.py decompress err, " + str(e) + "\n")
         return _offset+headerLen+length+1
 
-    _outbuffer.extend(tmpbuffer)
+    _outbuffer.extend(RenderBinlog(tmpbuffer))
     
     return _offset+headerLen+length+1
 
@@ -8,6 +8,8 @@ import struct
 import binascii
 import traceback
 
+from decode_mars_binlog import RenderBinlog
+
 
 MAGIC_NO_COMPRESS_START = 0x03
 MAGIC_NO_COMPRESS_START1 = 0x06
@@ -16,6 +18,10 @@ MAGIC_COMPRESS_START = 0x04
 MAGIC_COMPRESS_START1 = 0x05
 MAGIC_COMPRESS_START2 = 0x07
 MAGIC_COMPRESS_NO_CRYPT_START = 0x09
+MAGIC_ZSTD_COMPRESS_START = 0x0A
+MAGIC_ZSTD_COMPRESS_NO_CRYPT_START = 0x0B
+MAGIC_CHACHA_COMPRESS_START = 0x0C
+MAGIC_CHACHA_ZSTD_COMPRESS_START = 0x0D
 
 MAGIC_END = 0x00
 
@@ -29,7 +35,9 @@ def IsGoodLogBuffer(_buffer, _offset, count):
     magic_start = _buffer[_offset] 
     if MAGIC_NO_COMPRESS_START==magic_start or MAGIC_COMPRESS_START==magic_start or MAGIC_COMPRESS_START1==magic_start:
         crypt_key_len = 4
-    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start:
+    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_ZSTD_COMPRESS_START==magic_start or MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_CHACHA_COMPRESS_START==magic_start or MAGIC_CHACHA_ZSTD_COMPRESS_START==magic_start:
         crypt_key_len = 64
     else:
         return (False, '_buffer[%d]:%d != MAGIC_NUM_START'%(_offset, _buffer[_offset]))
@@ -51,12 +59,20 @@ def GetLogStartPos(_buffer, _count):
     while True:
         if offset >= len(_buffer): break
         
-        if MAGIC_NO_COMPRESS_START==_buffer[offset] or MAGIC_NO_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START==_buffer[offset] or MAGIC_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START2==_buffer[offset] or MAGIC_COMPRESS_NO_CRYPT_START==_buffer[offset] or MAGIC_NO_COMPRESS_NO_CRYPT_START==_buffer[offset]:
+        if MAGIC_NO_COMPRESS_START==_buffer[offset] or MAGIC_NO_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START==_buffer[offset] or MAGIC_COMPRESS_START1==_buffer[offset] or MAGIC_COMPRESS_START2==_buffer[offset] or MAGIC_COMPRESS_NO_CRYPT_START==_buffer[offset] or MAGIC_NO_COMPRESS_NO_CRYPT_START==_buffer[offset] \
+            or MAGIC_ZSTD_COMPRESS_START==_buffer[offset] or MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==_buffer[offset] \
+            or MAGIC_CHACHA_COMPRESS_START==_buffer[offset] or MAGIC_CHACHA_ZSTD_COMPRESS_START==_buffer[offset]:
             if IsGoodLogBuffer(_buffer, offset, _count)[0]: return offset
         offset+=1
         
     return -1    
     
+def ZstdDecompress(_data):
+    # every block is one unfinished zstd frame flushed after each log
+    import zstandard
+    return zstandard.ZstdDecompressor().decompressobj().decompress(_data)
+
+
 def DecodeBuffer(_buffer, _offset, _outbuffer):
     
     if _offset >= len(_buffer): return -1
@@ -73,7 +89,9 @@ def DecodeBuffer(_buffer, _offset, _outbuffer):
     magic_start = _buffer[_offset]
     if MAGIC_NO_COMPRESS_START==magic_start or MAGIC_COMPRESS_START==magic_start or MAGIC_COMPRESS_START1==magic_start:
         crypt_key_len = 4
-    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start:
+    elif MAGIC_COMPRESS_START2==magic_start or MAGIC_NO_COMPRESS_START1==magic_start or MAGIC_NO_COMPRESS_NO_CRYPT_START==magic_start or MAGIC_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_ZSTD_COMPRESS_START==magic_start or MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==magic_start \
+            or MAGIC_CHACHA_COMPRESS_START==magic_start or MAGIC_CHACHA_ZSTD_COMPRESS_START==magic_start:
         crypt_key_len = 64
     else:
         _outbuffer.extend('in DecodeBuffer _buffer[%d]:%d != MAGIC_NUM_START'%(_offset, magic_start))
@@ -99,10 +117,13 @@ def DecodeBuffer(_buffer, _offset, _outbuffer):
     try:
         decompressor = zlib.decompressobj(-zlib.MAX_WBITS)
 
-        if MAGIC_NO_COMPRESS_START1==_buffer[_offset] or MAGIC_COMPRESS_START2==_buffer[_offset]:
+        if MAGIC_NO_COMPRESS_START1==_buffer[_offset] or MAGIC_COMPRESS_START2==_buffer[_offset] or MAGIC_ZSTD_COMPRESS_START==_buffer[_offset] \
+            or MAGIC_CHACHA_COMPRESS_START==_buffer[_offset] or MAGIC_CHACHA_ZSTD_COMPRESS_START==_buffer[_offset]:
             print("use wrong decode script")
         elif MAGIC_COMPRESS_START==_buffer[_offset] or MAGIC_COMPRESS_NO_CRYPT_START==_buffer[_offset]:
             tmpbuffer = decompressor.decompress(str(tmpbuffer))
+        elif MAGIC_ZSTD_COMPRESS_NO_CRYPT_START==_buffer[_offset]:
+            tmpbuffer = ZstdDecompress(str(tmpbuffer))
         elif MAGIC_COMPRESS_START1==_buffer[_offset]:
             decompress_data = bytearray()
             while len(tmpbuffer) > 0:
@@ -121,7 +142,7 @@ def DecodeBuffer(_buffer, _offset, _outbuffer):
         _outbuffer.extend("[F]decode_log_file.py decompress err, " + str(e) + "\n")
         return _offset+headerLen+length+1
 
-    _outbuffer.extend(tmpbuffer)
+    _outbuffer.extend(RenderBinlog(tmpbuffer))
     
     return _offset+headerLen+length+1
 
@@ -37,6 +37,10 @@ static const char kMagicSyncStart = '\x06';
 static const char kMagicSyncNoCryptStart ='\x08';
 static const char kMagicAsyncStart ='\x07';
 static const char kMagicAsyncNoCryptStart ='\x09';
+static const char kMagicAsyncZstdStart ='\x0A';
+static const char kMagicAsyncNoCryptZstdStart ='\x0B';
+static const char kMagicAsyncChaChaStart ='\x0C';
+static const char kMagicAsyncChaChaZstdStart ='\x0D';
 
 static const char kMagicEnd  = '\0';
 
@@ -54,6 +58,13 @@ static void __TeaEncrypt (uint32_t* v, uint32_t* k) {
     v[0]=v0; v[1]=v1;
 }
 
+static bool __IsMagicStart(char _start) {
+    return kMagicAsyncStart == _start || kMagicSyncStart == _start
+        || kMagicAsyncNoCryptStart == _start || kMagicSyncNoCryptStart == _start
+        || kMagicAsyncZstdStart == _start || kMagicAsyncNoCryptZstdStart == _start
+        || kMagicAsyncChaChaStart == _start || kMagicAsyncChaChaZstdStart == _start;
+}
+
 static uint16_t __GetSeq(bool _is_async) {
     
     if (!_is_async) {
@@ -97,7 +108,11 @@ static bool Hex2Buffer(const char* _str, size_t _len, unsigned char* _buffer) {
 }
 #endif
 
-LogCrypt::LogCrypt(const char* _pubkey): seq_(0), is_crypt_(false) {
+LogCrypt::LogCrypt(const char* _pubkey, bool _is_chacha20): seq_(0), is_crypt_(false), is_chacha20_(false), key_blocks_(0) {
+    memset(tea_key_, 0, sizeof(tea_key_));
+    memset(ecdh_key_, 0, sizeof(ecdh_key_));
+    memset(client_pubkey_, 0, sizeof(client_pubkey_));
+    memset(svr_pubkey_, 0, sizeof(svr_pubkey_));
     
 #ifndef XLOG_NO_CRYPT
     const static size_t PUB_KEY_LEN = 64;
@@ -106,28 +121,37 @@ LogCrypt::LogCrypt(const char* _pubkey): seq_(0), is_crypt_(false) {
         return;
     }
     
-    unsigned char svr_pubkey[PUB_KEY_LEN] = {0};
+    if (!Hex2Buffer(_pubkey, PUB_KEY_LEN * 2, svr_pubkey_)) {
+        return;
+    }
     
-    if (!Hex2Buffer(_pubkey, PUB_KEY_LEN * 2, svr_pubkey)) {
+    if (!__MakeKey()) {
         return;
     }
+
+    is_crypt_ = true;
+    is_chacha20_ = _is_chacha20;
+
+#endif
     
+}
+
+bool LogCrypt::__MakeKey() {
+#ifndef XLOG_NO_CRYPT
     uint8_t client_pri[32] = {0};
     if (0 == uECC_make_key((uint8_t*)client_pubkey_, client_pri, uECC_secp256k1())) {
-        return;
+        return false;
     }
     
-    uint8_t ecdh_key[32] = {0};
-    if (0 == uECC_shared_secret(svr_pubkey, client_pri, ecdh_key, uECC_secp256k1())) {
-        return;
+    if (0 == uECC_shared_secret(svr_pubkey_, client_pri, ecdh_key_, uECC_secp256k1())) {
+        return false;
     }
     
-    memcpy(tea_key_, ecdh_key, sizeof(tea_key_));
-
-    is_crypt_ = true;
-
+    memcpy(tea_key_, ecdh_key_, sizeof(tea_key_));
+    return true;
+#else
+    return false;
 #endif
-    
 }
 
 /*
@@ -147,7 +171,8 @@ bool LogCrypt::GetLogHour(const char* const _data, size_t _len, int& _begin_hour
     if (_len < GetHeaderLen()) return false;
     
     char start = _data[0];
-    if (kMagicAsyncStart != start && kMagicSyncStart != start) return false;
+    if (kMagicAsyncStart != start && kMagicSyncStart != start && kMagicAsyncZstdStart != start
+        && kMagicAsyncChaChaStart != start && kMagicAsyncChaChaZstdStart != start) return false;
     
     char begin_hour = _data[sizeof(char)+sizeof(uint16_t)];
     char end_hour = _data[sizeof(char)+sizeof(uint16_t)+sizeof(char)];
@@ -172,8 +197,7 @@ uint32_t LogCrypt::GetLogLen(const char*  const _data, size_t _len) {
     if (_len < GetHeaderLen()) return 0;
     
     char start = _data[0];
-    if (kMagicAsyncStart != start && kMagicSyncStart != start
-        && kMagicAsyncNoCryptStart != start && kMagicSyncNoCryptStart != start) {
+    if (!__IsMagicStart(start)) {
         return 0;
     }
     
@@ -182,14 +206,34 @@ uint32_t LogCrypt::GetLogLen(const char*  const _data, size_t _len) {
     return len;
 }
 
+uint16_t LogCrypt::GetSeq(const char* const _data, size_t _len) {
+    if (_len < GetHeaderLen() || !__IsMagicStart(_data[0])) return 0;
+
+    uint16_t seq = 0;
+    memcpy(&seq, _data + sizeof(char), sizeof(seq));
+    return seq;
+}
+
 void LogCrypt::UpdateLogLen(char* _data, uint32_t _add_len) {
     
     uint32_t currentlen = (uint32_t)(GetLogLen(_data, GetHeaderLen()) + _add_len);
     memcpy(_data + GetHeaderLen() - sizeof(uint32_t) - sizeof(char) * 64, &currentlen, sizeof(currentlen));
 }
 
-void LogCrypt::SetHeaderInfo(char* _data, bool _is_async) {
-    if (_is_async) {
+void LogCrypt::SetHeaderInfo(char* _data, bool _is_async, bool _is_zstd) {
+    if (_is_async && is_chacha20_) {
+        if (_is_zstd) {
+            memcpy(_data, &kMagicAsyncChaChaZstdStart, sizeof(kMagicAsyncChaChaZstdStart));
+        } else {
+            memcpy(_data, &kMagicAsyncChaChaStart, sizeof(kMagicAsyncChaChaStart));
+        }
+    } else if (_is_async && _is_zstd) {
+        if (is_crypt_) {
+            memcpy(_data, &kMagicAsyncZstdStart, sizeof(kMagicAsyncZstdStart));
+        } else {
+            memcpy(_data, &kMagicAsyncNoCryptZstdStart, sizeof(kMagicAsyncNoCryptZstdStart));
+        }
+    } else if (_is_async) {
         if (is_crypt_) {
             memcpy(_data, &kMagicAsyncStart, sizeof(kMagicAsyncStart));
         } else {
@@ -206,6 +250,18 @@ void LogCrypt::SetHeaderInfo(char* _data, bool _is_async) {
     seq_ = __GetSeq(_is_async);
     memcpy(_data + sizeof(kMagicAsyncStart), &seq_, sizeof(seq_));
 
+    if (_is_async && is_chacha20_) {
+        // the nonce is the seq, a new key is made before any seq comes again
+        if (++key_blocks_ >= 0xFFFF) {
+            __MakeKey();
+            key_blocks_ = 0;
+        }
+
+        uint8_t nonce[ChaCha20::kNonceLen] = {0};
+        memcpy(nonce, &seq_, sizeof(seq_));
+        chacha20_.Init(ecdh_key_, nonce);
+    }
+
     
     struct timeval tv;
     gettimeofday(&tv, 0);
@@ -284,8 +340,7 @@ bool LogCrypt::GetPeriodLogs(const char* const _log_path, int _begin_hour, int _
         bool fix = false;
         
         char start = *header_buff;
-        if (start != kMagicSyncStart && start != kMagicSyncNoCryptStart
-                && start != kMagicAsyncStart && start != kMagicAsyncNoCryptStart) {
+        if (!__IsMagicStart(start)) {
             fix = true;
         } else {
             uint32_t len = GetLogLen(header_buff, GetHeaderLen());
@@ -405,27 +460,29 @@ void LogCrypt::CryptSyncLog(const char* const _log_data, size_t _input_len, Auto
 
 }
 
-void LogCrypt::CryptAsyncLog(const char* const _log_data, size_t _input_len, AutoBuffer& _out_buff, size_t& _remain_nocrypt_len) {
-    
-	_out_buff.AllocWrite(_input_len);
+void LogCrypt::CryptAsyncLog(char* _log_data, size_t _offset, size_t _input_len, size_t& _remain_nocrypt_len) {
     
+    _remain_nocrypt_len = 0;
+
     if (!is_crypt_) {
-        memcpy(_out_buff.Ptr(), _log_data, _input_len);
-        _remain_nocrypt_len = 0;
         return;
     }
 #ifndef XLOG_NO_CRYPT
+    if (is_chacha20_) {
+        chacha20_.Xor(_offset, (uint8_t*)_log_data + _offset, _input_len);
+        return;
+    }
+
+    char* data = _log_data + _offset;
     uint32_t tmp[2] = {0};
     size_t cnt = _input_len / TEA_BLOCK_LEN;
 	_remain_nocrypt_len = _input_len % TEA_BLOCK_LEN;
     
     for (size_t i = 0; i < cnt; ++i) {
-        memcpy(tmp, _log_data + i * TEA_BLOCK_LEN, TEA_BLOCK_LEN);
+        memcpy(tmp, data + i * TEA_BLOCK_LEN, TEA_BLOCK_LEN);
         __TeaEncrypt(tmp, tea_key_);
-        memcpy((char*)_out_buff.Ptr() + i * TEA_BLOCK_LEN, tmp, TEA_BLOCK_LEN);
+        memcpy(data + i * TEA_BLOCK_LEN, tmp, TEA_BLOCK_LEN);
     }
-    
-    memcpy((char*)_out_buff.Ptr() + _input_len - _remain_nocrypt_len, _log_data + _input_len - _remain_nocrypt_len, _remain_nocrypt_len);
 #endif
 }
 
@@ -435,8 +492,7 @@ bool LogCrypt::Fix(char* _data, size_t _data_len, bool& _is_async, uint32_t& _ra
     }
     
     char start = _data[0];
-    if (kMagicAsyncStart != start && kMagicSyncStart != start
-        && kMagicAsyncNoCryptStart != start && kMagicSyncNoCryptStart != start) {
+    if (!__IsMagicStart(start)) {
         return false;
     }
     
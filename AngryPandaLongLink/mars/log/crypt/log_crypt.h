@@ -24,11 +24,13 @@
 #include <string>
 
 #include "mars/comm/autobuffer.h"
+#include "chacha20.h"
 
 
 class LogCrypt {
 public:
-    LogCrypt(const char* _pubkey);
+    // _is_chacha20: async logs are crypted by ChaCha20 instead of TEA, needs a valid _pubkey as well
+    LogCrypt(const char* _pubkey, bool _is_chacha20 = false);
     virtual ~LogCrypt() {}
     
 private:
@@ -44,23 +46,36 @@ public:
     
     static uint32_t GetLogLen(const char* const _data, size_t _len);
     static void UpdateLogLen(char* _data, uint32_t _add_len);
+    static uint16_t GetSeq(const char* const _data, size_t _len);
     static bool GetPeriodLogs(const char* const _log_path, int _begin_hour, int _end_hour, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg);
 
 public:
     
-    void SetHeaderInfo(char* _data, bool _is_async);
+    // _is_zstd picks the zstd magic, the block is compressed by zstd instead of zlib
+    void SetHeaderInfo(char* _data, bool _is_async, bool _is_zstd = false);
     void SetTailerInfo(char* _data);
 
     void CryptSyncLog(const char* const _log_data, size_t _input_len, AutoBuffer& _out_buff);
-    void CryptAsyncLog(const char* const _log_data, size_t _input_len, AutoBuffer& _out_buff, size_t& _remain_nocrypt_len);
+    // crypts _log_data[_offset, _offset + _input_len) in place, _log_data is the start of the block body.
+    // TEA leaves the tail shorter than a TEA block as is, it is passed in again with the next write.
+    void CryptAsyncLog(char* _log_data, size_t _offset, size_t _input_len, size_t& _remain_nocrypt_len);
     
     bool Fix(char* _data, size_t _data_len, bool& _is_async, uint32_t& _raw_log_len);
     
+private:
+    bool __MakeKey();
+
 private:
     uint16_t seq_;
     uint32_t tea_key_[4];
+    uint8_t ecdh_key_[32];
     char client_pubkey_[64];
+    unsigned char svr_pubkey_[64];
     bool is_crypt_;
+    bool is_chacha20_;
+
+    ChaCha20 chacha20_;
+    uint32_t key_blocks_;
 
 };
 
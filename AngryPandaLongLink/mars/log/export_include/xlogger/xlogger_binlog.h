@@ -0,0 +1,200 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * xlogger_binlog.h
+ *
+ * binlog: for high frequency logs. nothing is formatted at the call site, the format string
+ * is interned once per call site as a static XLoggerBinSite and the arguments are written as
+ * raw typed values. the text is rendered offline by decode_mars_*_log_file.py.
+ *
+ * format uses the type safe placeholders: %0-%9, %_ for the next argument, %% for '%'.
+ *
+ *   xinfo_bin("send seq:%_, len:%_, host:%_", seq, len, host);
+ *
+ * XLOGGER_HOOK is not applied to binlog records.
+ */
+
+#ifndef XLOGGER_BINLOG_H_
+#define XLOGGER_BINLOG_H_
+
+#include <string.h>
+#include <string>
+
+#include "xloggerbase.h"
+#include "preprocessor.h"
+
+struct XLoggerBinSite {
+    const char* format;
+};
+
+// argument types on the wire, each followed by its raw value
+enum {
+    kBinArgBool = 'b',      // uint8_t
+    kBinArgChar = 'c',      // char
+    kBinArgInt = 'i',       // int64_t
+    kBinArgUInt = 'u',      // uint64_t
+    kBinArgDouble = 'f',    // double
+    kBinArgPointer = 'p',   // uint64_t
+    kBinArgString = 's',    // uint16_t length + bytes
+};
+
+class XLoggerBinArg {
+public:
+	XLoggerBinArg(bool _value): m_type(kBinArgBool), m_str(NULL), m_strlen(0) { m_value.u = _value ? 1 : 0;}
+	XLoggerBinArg(char _value): m_type(kBinArgChar), m_str(NULL), m_strlen(0) { m_value.i = _value;}
+
+	XLoggerBinArg(short _value): m_type(kBinArgInt), m_str(NULL), m_strlen(0) { m_value.i = _value;}
+	XLoggerBinArg(int _value): m_type(kBinArgInt), m_str(NULL), m_strlen(0) { m_value.i = _value;}
+	XLoggerBinArg(long _value): m_type(kBinArgInt), m_str(NULL), m_strlen(0) { m_value.i = _value;}
+	XLoggerBinArg(long long _value): m_type(kBinArgInt), m_str(NULL), m_strlen(0) { m_value.i = _value;}
+
+	XLoggerBinArg(unsigned short _value): m_type(kBinArgUInt), m_str(NULL), m_strlen(0) { m_value.u = _value;}
+	XLoggerBinArg(unsigned int _value): m_type(kBinArgUInt), m_str(NULL), m_strlen(0) { m_value.u = _value;}
+	XLoggerBinArg(unsigned long _value): m_type(kBinArgUInt), m_str(NULL), m_strlen(0) { m_value.u = _value;}
+	XLoggerBinArg(unsigned long long _value): m_type(kBinArgUInt), m_str(NULL), m_strlen(0) { m_value.u = _value;}
+
+	XLoggerBinArg(float _value): m_type(kBinArgDouble), m_str(NULL), m_strlen(0) { m_value.d = _value;}
+	XLoggerBinArg(double _value): m_type(kBinArgDouble), m_str(NULL), m_strlen(0) { m_value.d = _value;}
+
+	XLoggerBinArg(const void* _value): m_type(kBinArgPointer), m_str(NULL), m_strlen(0) { m_value.u = (uintptr_t)_value;}
+
+	XLoggerBinArg(const char* _value): m_type(kBinArgString), m_str(NULL != _value ? _value : "(null)"), m_strlen(strnlen(m_str, kMaxStringLength)) { m_value.u = 0;}
+	XLoggerBinArg(const std::string& _value): m_type(kBinArgString), m_str(_value.data()), m_strlen(_value.size() < kMaxStringLength ? _value.size() : kMaxStringLength) { m_value.u = 0;}
+
+	// returns 0 if it does not fit in _len
+	size_t Encode(char* _buf, size_t _len) const {
+		size_t value_len = kBinArgString == m_type ? sizeof(uint16_t) + m_strlen
+						 : kBinArgBool == m_type || kBinArgChar == m_type ? 1 : 8;
+
+		if (_len < 1 + value_len) return 0;
+
+		_buf[0] = m_type;
+
+		switch (m_type) {
+			case kBinArgBool:
+			case kBinArgChar:
+				_buf[1] = (char)m_value.i;
+				break;
+			case kBinArgString: {
+				uint16_t len = (uint16_t)m_strlen;
+				memcpy(_buf + 1, &len, sizeof(len));
+				memcpy(_buf + 1 + sizeof(len), m_str, m_strlen);
+				break;
+			}
+			default:
+				memcpy(_buf + 1, &m_value, 8);
+				break;
+		}
+
+		return 1 + value_len;
+	}
+
+private:
+	static const size_t kMaxStringLength = 1024;
+
+	char m_type;
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+	} m_value;
+	const char* m_str;
+	size_t m_strlen;
+};
+
+class XLoggerBin {
+public:
+	XLoggerBin(TLogLevel _level, const char* _tag, const char* _file, const char* _func, int _line, const XLoggerBinSite* _site)
+	:m_info(), m_site(_site) {
+		m_info.level = _level;
+		m_info.tag = _tag;
+		m_info.filename = _file;
+		m_info.func_name = _func;
+		m_info.line = _line;
+		m_info.timeval.tv_sec = 0;
+		m_info.timeval.tv_usec = 0;
+		m_info.pid = -1;
+		m_info.tid = -1;
+		m_info.maintid = -1;
+	}
+
+#define XLOGGER_BIN_ARGS(n) PP_ENUM_PARAMS(n, const XLoggerBinArg& a)
+#define XLOGGER_BIN_ARGS_PTR(n) PP_ENUM_PARAMS(n, &a)
+#define XLOGGER_BIN_WRITE_IMPLEMENT(n) \
+	void operator()(XLOGGER_BIN_ARGS(n)) { \
+		const XLoggerBinArg* args[17] = { XLOGGER_BIN_ARGS_PTR(n) }; \
+		__Write(args, n); \
+	}
+
+	XLOGGER_BIN_WRITE_IMPLEMENT(0)
+	XLOGGER_BIN_WRITE_IMPLEMENT(1)
+	XLOGGER_BIN_WRITE_IMPLEMENT(2)
+	XLOGGER_BIN_WRITE_IMPLEMENT(3)
+	XLOGGER_BIN_WRITE_IMPLEMENT(4)
+	XLOGGER_BIN_WRITE_IMPLEMENT(5)
+	XLOGGER_BIN_WRITE_IMPLEMENT(6)
+	XLOGGER_BIN_WRITE_IMPLEMENT(7)
+	XLOGGER_BIN_WRITE_IMPLEMENT(8)
+	XLOGGER_BIN_WRITE_IMPLEMENT(9)
+	XLOGGER_BIN_WRITE_IMPLEMENT(10)
+	XLOGGER_BIN_WRITE_IMPLEMENT(11)
+	XLOGGER_BIN_WRITE_IMPLEMENT(12)
+	XLOGGER_BIN_WRITE_IMPLEMENT(13)
+	XLOGGER_BIN_WRITE_IMPLEMENT(14)
+	XLOGGER_BIN_WRITE_IMPLEMENT(15)
+	XLOGGER_BIN_WRITE_IMPLEMENT(16)
+
+#undef XLOGGER_BIN_ARGS
+#undef XLOGGER_BIN_ARGS_PTR
+#undef XLOGGER_BIN_WRITE_IMPLEMENT
+
+private:
+	// record: site pointer, then the encoded arguments. arguments that do not fit are dropped.
+	void __Write(const XLoggerBinArg** _args, int _count) {
+		char buffer[4096];
+		size_t len = sizeof(m_site);
+		memcpy(buffer, &m_site, sizeof(m_site));
+
+		for (int i = 0; i < _count; ++i) {
+			size_t ret = _args[i]->Encode(buffer + len, sizeof(buffer) - len);
+			if (0 == ret) break;
+			len += ret;
+		}
+
+		gettimeofday(&m_info.timeval, NULL);
+		xlogger_WriteBin(&m_info, buffer, len);
+	}
+
+private:
+	XLoggerBin(const XLoggerBin&);
+	XLoggerBin& operator=(const XLoggerBin&);
+
+private:
+	XLoggerInfo m_info;
+	const XLoggerBinSite* m_site;
+};
+
+// "" _format "" only accepts a string literal, the site must outlive the async appender
+#define __xlogger_bin_impl(level, _format, ...)  do { if (xlogger_IsEnabledFor(level)) {\
+													static const XLoggerBinSite __xlogger_bin_site__ = {"" _format ""};\
+													XLoggerBin(level, XLOGGER_TAG, __XFILE__, __XFUNCTION__, __LINE__, &__xlogger_bin_site__)(__VA_ARGS__);\
+												 }} while (0)
+
+#define xverbose_bin(...)		   __xlogger_bin_impl(kLevelVerbose, __VA_ARGS__)
+#define xdebug_bin(...)			   __xlogger_bin_impl(kLevelDebug, __VA_ARGS__)
+#define xinfo_bin(...)			   __xlogger_bin_impl(kLevelInfo, __VA_ARGS__)
+#define xwarn_bin(...)			   __xlogger_bin_impl(kLevelWarn, __VA_ARGS__)
+#define xerror_bin(...)			   __xlogger_bin_impl(kLevelError, __VA_ARGS__)
+
+#endif /* XLOGGER_BINLOG_H_ */
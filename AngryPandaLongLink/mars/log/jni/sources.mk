@@ -38,6 +38,11 @@ LOCAL_ARM_MODE := arm
 
 endif
 
+ifeq ($(XLOG_WITH_ZSTD),1)
+LOCAL_CFLAGS += -DXLOG_WITH_ZSTD
+LOCAL_LDLIBS += -lzstd
+endif
+
 LOCAL_C_INCLUDES += $(TEMP_LOCAL_PATH)/../ $(TEMP_LOCAL_PATH)/../src $(TEMP_LOCAL_PATH)/../../ $(TEMP_LOCAL_PATH)/../../../
 LOCAL_LDFLAGS += -Wl,--version-script=$(TEMP_LOCAL_PATH)/export.exp
 
@@ -47,7 +47,9 @@
 
 #include <string>
 #include <algorithm>
+#include <map>
 
+#include "boost/atomic.hpp"
 #include "boost/bind.hpp"
 #include "boost/iostreams/device/mapped_file.hpp"
 #include "boost/filesystem.hpp"
@@ -61,6 +63,8 @@
 #include "mars/comm/autobuffer.h"
 #include "mars/comm/ptrbuffer.h"
 #include "mars/comm/xlogger/xloggerbase.h"
+#include "mars/comm/xlogger/xlogger_binlog.h"
+#include "mars/comm/xlogger/loginfo_extract.h"
 #include "mars/comm/time_utils.h"
 #include "mars/comm/strutil.h"
 #include "mars/comm/mmap_util.h"
@@ -68,10 +72,13 @@
 #include "mars/comm/verinfo.h"
 
 #include "log_buffer.h"
+#include "log_file_writer.h"
+#include "log_staging_ring.h"
 
 #define LOG_EXT "xlog"
 
 extern void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log);
+extern void log_formater_bin(const void* _data, size_t _len, char* _body, size_t _body_len);
 extern void ConsoleLog(const XLoggerInfo* _info, const char* _log);
 
 static TAppenderMode sg_mode = kAppednerAsync;
@@ -81,20 +88,24 @@ static std::string sg_cache_logdir;
 static std::string sg_logfileprefix;
 
 static Mutex sg_mutex_log_file;
-static FILE* sg_logfile = NULL;
+static LogFileWriter sg_logfile;
 static time_t sg_openfiletime = 0;
+static uint64_t sg_checkfile_tick = 0;
 static std::string sg_current_dir;
 
 static Mutex sg_mutex_buffer_async;
 #ifdef _WIN32
 static Condition& sg_cond_buffer_async = *(new Condition());  // 改成引用, 避免在全局释放时执行析构导致crash
+static Condition& sg_cond_buffer_room = *(new Condition());
 #else
 static Condition sg_cond_buffer_async;
+static Condition sg_cond_buffer_room;   // a flush emptied the buffer
 #endif
 
 static LogBuffer* sg_log_buff = NULL;
 
 static volatile bool sg_log_close = true;
+static volatile bool sg_flush_request = false;
 
 static Tss sg_tss_dumpfile(&free);
 
@@ -106,15 +117,41 @@ static bool sg_consolelog_open = false;
 
 static uint64_t sg_max_file_size = 0; // 0, will not split log file.
 
+static TOverflowPolicy sg_overflow_policy = kOverflowBlock;
+static long sg_overflow_block_ms = 10;
+
+static AppenderStats sg_stats;  // guarded by sg_mutex_buffer_async, but the two dropped counters below
+static boost::atomic<uint64_t> sg_dropped_records(0);   // callers drop without the mutex
+static boost::atomic<uint64_t> sg_dropped_bytes(0);
+
 static void __async_log_thread();
 static Thread sg_thread_async(&__async_log_thread);
 
 static const unsigned int kBufferBlockLength = 150 * 1024;
+static const unsigned int kBufferSegmentCount = 2;     // one segment takes the logs while the other one is written out
+static const unsigned int kMmapLength = kBufferBlockLength * kBufferSegmentCount;
+static const uint32_t kStagingRingLength = 256 * 1024;
+static const unsigned int kLogCompressRatio = 3;       // at least, LogCompress_benchmark sees 3.6 to 6.4 on log text
+// above it a drained staging ring may not fit in the segment, the ring's text is written compressed
+static const unsigned int kBufferHighWater = kBufferBlockLength - kStagingRingLength / kLogCompressRatio;
 static const long kMaxLogAliveTime = 10 * 24 * 60 * 60;	// 10 days in second
+static const long kFlushInterval = 15 * 60 * 1000;  // ms
+static const long kStagingRetryInterval = 2;  // ms, the drain stopped at a record still being written
+static const long kCheckFileInterval = 10 * 1000;  // ms, how often an open log file is checked for being removed
+
+static LogStagingRing& sg_staging_ring = *(new LogStagingRing(kStagingRingLength));  // never released, threads may still log during exit
 
 static std::string sg_log_extra_msg;
 
 static boost::iostreams::mapped_file sg_mmmap_file;
+static char* sg_heap_buffer = NULL;    // takes the place of the mmap file when it can not be opened
+
+// binlog frames in the log text: '\0', type, uint16 length, payload. see log/crypt/decode_mars_binlog.py
+static const char kBinlogFrameZone = 'Z';      // int32 gmtoff
+static const char kBinlogFrameDefine = 'D';    // uint16 id, int32 line, tag, file, func, format
+static const char kBinlogFrameRecord = 'R';    // uint16 id, uint8 level, uint8 is_main, int64 sec, uint16 ms, int64 pid, int64 tid, args
+
+static std::map<const void*, uint16_t> sg_binlog_sites;   // call site -> id in the current buffer block, guarded by sg_mutex_buffer_async
 
 namespace {
 class ScopeErrno {
@@ -349,6 +386,24 @@ static bool __append_file(const std::string& _src_file, const std::string& _dst_
     return true;
 }
 
+// renames when the destination is new and on the same file system, appends and removes otherwise
+static bool __move_file(const std::string& _src_file, const std::string& _dst_file) {
+    if (_src_file == _dst_file) {
+        return false;
+    }
+
+    if (!boost::filesystem::exists(_dst_file) && 0 == rename(_src_file.c_str(), _dst_file.c_str())) {
+        return true;
+    }
+
+    if (!__append_file(_src_file, _dst_file)) {
+        return false;
+    }
+
+    remove(_src_file.c_str());
+    return true;
+}
+
 static void __move_old_files(const std::string& _src_path, const std::string& _dest_path, const std::string& _nameprefix) {
     if (_src_path == _dest_path) {
         return;
@@ -374,11 +429,10 @@ static void __move_old_files(const std::string& _src_path, const std::string& _d
         
         __make_logfilename(tv, _dest_path, sg_logfileprefix.c_str(), LOG_EXT, logfilepath , 1024);
         
-        if (!__append_file(iter->path().string(), logfilepath)) {
+        if (!__move_file(iter->path().string(), logfilepath)) {
             break;
         }
         
-        boost::filesystem::remove(iter->path());
         memset(logfilepath, 0, sizeof(logfilepath));
     }
 }
@@ -400,31 +454,24 @@ static void __writetips2console(const char* _tips_format, ...) {
     ConsoleLog(&info, tips_info);
 }
 
-static bool __writefile(const void* _data, size_t _len, FILE* _file) {
-    if (NULL == _file) {
+static bool __writefile(const LogFileWriter::Piece* _pieces, int _count) {
+    if (!sg_logfile.IsOpen()) {
         assert(false);
         return false;
     }
 
-    long before_len = ftell(_file);
-    if (before_len < 0) return false;
-
-    if (1 != fwrite(_data, _len, 1, _file)) {
-        int err = ferror(_file);
+    if (!sg_logfile.Write(_pieces, _count)) {
+        int err = errno;
 
         __writetips2console("write file error:%d", err);
 
-
-        ftruncate(fileno(_file), before_len);
-        fseek(_file, 0, SEEK_END);
-
         char err_log[256] = {0};
         snprintf(err_log, sizeof(err_log), "\nwrite file error:%d\n", err);
 
         AutoBuffer tmp_buff;
         sg_log_buff->Write(err_log, strnlen(err_log, sizeof(err_log)), tmp_buff);
 
-        fwrite(tmp_buff.Ptr(), tmp_buff.Length(), 1, _file);
+        sg_logfile.Write(tmp_buff.Ptr(), tmp_buff.Length());
 
         return false;
     }
@@ -432,21 +479,34 @@ static bool __writefile(const void* _data, size_t _len, FILE* _file) {
     return true;
 }
 
+static bool __writefile(const void* _data, size_t _len) {
+    LogFileWriter::Piece piece = {_data, _len};
+    return __writefile(&piece, 1);
+}
+
 static bool __openlogfile(const std::string& _log_dir) {
     if (sg_logdir.empty()) return false;
 
     struct timeval tv;
     gettimeofday(&tv, NULL);
 
-    if (NULL != sg_logfile) {
+    if (sg_logfile.IsOpen()) {
         time_t sec = tv.tv_sec;
         tm tcur = *localtime((const time_t*)&sec);
         tm filetm = *localtime(&sg_openfiletime);
 
-        if (filetm.tm_year == tcur.tm_year && filetm.tm_mon == tcur.tm_mon && filetm.tm_mday == tcur.tm_mday && sg_current_dir == _log_dir) return true;
+        // the file stays open between writes, so a split by size or a file removed under us is noticed here
+        bool keep = filetm.tm_year == tcur.tm_year && filetm.tm_mon == tcur.tm_mon && filetm.tm_mday == tcur.tm_mday && sg_current_dir == _log_dir;
+        if (keep && sg_max_file_size > 0 && sg_logfile.Size() > sg_max_file_size) keep = false;
+        if (keep && gettickspan(sg_checkfile_tick) >= kCheckFileInterval) {
+            sg_checkfile_tick = gettickcount();
+            keep = sg_logfile.IsSameFile();
+        }
 
-        fclose(sg_logfile);
-        sg_logfile = NULL;
+        if (keep) return true;
+
+        sg_logfile.Sync();
+        sg_logfile.Close();
     }
 
     static time_t s_last_time = 0;
@@ -457,32 +517,33 @@ static bool __openlogfile(const std::string& _log_dir) {
     time_t now_time = tv.tv_sec;
 
     sg_openfiletime = tv.tv_sec;
+    sg_checkfile_tick = now_tick;
     sg_current_dir = _log_dir;
 
     char logfilepath[1024] = {0};
     __make_logfilename(tv, _log_dir, sg_logfileprefix.c_str(), LOG_EXT, logfilepath , 1024);
 
     if (now_time < s_last_time) {
-        sg_logfile = fopen(s_last_file_path, "ab");
+        bool is_open = sg_logfile.Open(s_last_file_path);
 
-		if (NULL == sg_logfile) {
+		if (!is_open) {
             __writetips2console("open file error:%d %s, path:%s", errno, strerror(errno), s_last_file_path);
         }
 
 #ifdef __APPLE__
-        assert(sg_logfile);
+        assert(is_open);
 #endif
-        return NULL != sg_logfile;
+        return is_open;
     }
 
-    sg_logfile = fopen(logfilepath, "ab");
+    bool is_open = sg_logfile.Open(logfilepath);
 
-	if (NULL == sg_logfile) {
+	if (!is_open) {
         __writetips2console("open file error:%d %s, path:%s", errno, strerror(errno), logfilepath);
     }
 
 
-    if (0 != s_last_time && (now_time - s_last_time) > (time_t)((now_tick - s_last_tick) / 1000 + 300)) {
+    if (is_open && 0 != s_last_time && (now_time - s_last_time) > (time_t)((now_tick - s_last_tick) / 1000 + 300)) {
 
         struct tm tm_tmp = *localtime((const time_t*)&s_last_time);
         char last_time_str[64] = {0};
@@ -497,7 +558,7 @@ static bool __openlogfile(const std::string& _log_dir) {
 
         AutoBuffer tmp_buff;
         sg_log_buff->Write(log, strnlen(log, sizeof(log)), tmp_buff);
-        __writefile(tmp_buff.Ptr(), tmp_buff.Length(), sg_logfile);
+        __writefile(tmp_buff.Ptr(), tmp_buff.Length());
     }
 
     memcpy(s_last_file_path, logfilepath, sizeof(s_last_file_path));
@@ -505,21 +566,21 @@ static bool __openlogfile(const std::string& _log_dir) {
     s_last_time = now_time;
 
 #ifdef __APPLE__
-    assert(sg_logfile);
+    assert(is_open);
 #endif
-    return NULL != sg_logfile;
+    return is_open;
 }
 
 static void __closelogfile() {
-    if (NULL == sg_logfile) return;
+    if (!sg_logfile.IsOpen()) return;
 
     sg_openfiletime = 0;
-    fclose(sg_logfile);
-    sg_logfile = NULL;
+    sg_logfile.Close();
 }
 
-static void __log2file(const void* _data, size_t _len) {
-	if (NULL == _data || 0 == _len || sg_logdir.empty()) {
+// the pieces go to the file in one write. the log file is kept open, only a cache file is closed after each write to be moved
+static void __log2file(const LogFileWriter::Piece* _pieces, int _count) {
+	if (NULL == _pieces || 0 >= _count || sg_logdir.empty()) {
 		return;
 	}
 
@@ -527,10 +588,7 @@ static void __log2file(const void* _data, size_t _len) {
 
 	if (sg_cache_logdir.empty()) {
         if (__openlogfile(sg_logdir)) {
-            __writefile(_data, _len, sg_logfile);
-            if (kAppednerAsync == sg_mode) {
-                __closelogfile();
-            }
+            __writefile(_pieces, _count);
         }
         return;
 	}
@@ -542,46 +600,42 @@ static void __log2file(const void* _data, size_t _len) {
     __make_logfilename(tv, sg_cache_logdir, sg_logfileprefix.c_str(), LOG_EXT, logcachefilepath , 1024);
     
     if (boost::filesystem::exists(logcachefilepath) && __openlogfile(sg_cache_logdir)) {
-        __writefile(_data, _len, sg_logfile);
-        if (kAppednerAsync == sg_mode) {
-            __closelogfile();
-        }
-
+        __writefile(_pieces, _count);
+        __closelogfile();
 
         char logfilepath[1024] = {0};
         __make_logfilename(tv, sg_logdir, sg_logfileprefix.c_str(), LOG_EXT, logfilepath , 1024);
-        if (__append_file(logcachefilepath, logfilepath)) {
-            if (kAppednerSync == sg_mode) {
-                __closelogfile();
-            }
-            remove(logcachefilepath);
-        }
+        __move_file(logcachefilepath, logfilepath);
     } else {
         bool write_sucess = false;
         bool open_success = __openlogfile(sg_logdir);
         if (open_success) {
-            write_sucess = __writefile(_data, _len, sg_logfile);
-            if (kAppednerAsync == sg_mode) {
-                __closelogfile();
-            }
+            write_sucess = __writefile(_pieces, _count);
         }
 
         if (!write_sucess) {
-            if (open_success && kAppednerSync == sg_mode) {
+            if (open_success) {
                 __closelogfile();
             }
 
             if (__openlogfile(sg_cache_logdir)) {
-                __writefile(_data, _len, sg_logfile);
-                if (kAppednerAsync == sg_mode) {
-                    __closelogfile();
-                }
+                __writefile(_pieces, _count);
+                __closelogfile();
             }
         }
     }
 
 }
 
+static void __log2file(const void* _data, size_t _len) {
+    if (NULL == _data || 0 == _len) {
+        return;
+    }
+
+    LogFileWriter::Piece piece = {_data, _len};
+    __log2file(&piece, 1);
+}
+
 
 static void __writetips2file(const char* _tips_format, ...) {
 
@@ -601,22 +655,195 @@ static void __writetips2file(const char* _tips_format, ...) {
     __log2file(tmp_buff.Ptr(), tmp_buff.Length());
 }
 
+static void __count_dropped(size_t _records, size_t _bytes) {
+    sg_dropped_records.fetch_add(_records, boost::memory_order_relaxed);
+    sg_dropped_bytes.fetch_add(_bytes, boost::memory_order_relaxed);
+}
+
+static void __update_buffer_stats() {
+    // sg_mutex_buffer_async must be held
+    uint32_t length = (uint32_t)sg_log_buff->GetData().Length();
+    if (length > sg_stats.max_buffer_length) sg_stats.max_buffer_length = length;
+}
+
+static void __write2buffer(const XLoggerInfo* _info, const char* _log) {
+    // sg_mutex_buffer_async must be held
+    if (0 == sg_log_buff->GetData().Length()) sg_binlog_sites.clear();
+
+    char temp[16*1024] = {0};       //tell perry,ray if you want modify size.
+    PtrBuffer log_buff(temp, 0, sizeof(temp));
+    log_formater(_info, _log, log_buff);
+
+    if (sg_log_buff->GetData().Length() >= kBufferBlockLength*4/5) {
+       __count_dropped(1, log_buff.Length());
+       int ret = snprintf(temp, sizeof(temp), "[F][ sg_buffer_async.Length() >= BUFFER_BLOCK_LENTH*4/5, len: %d\n", (int)sg_log_buff->GetData().Length());
+       log_buff.Length(ret, ret);
+       sg_log_buff->Write(log_buff.Ptr(), (unsigned int)log_buff.Length());
+       return;
+    }
+
+    if (!sg_log_buff->Write(log_buff.Ptr(), (unsigned int)log_buff.Length())) __count_dropped(1, log_buff.Length());
+    __update_buffer_stats();
+}
+
+static size_t __binlog_begin_frame(char _type, PtrBuffer& _frames) {
+    size_t start = _frames.Length();
+    char head[4] = {'\0', _type, 0, 0};
+    _frames.Write(head, sizeof(head));
+    return start;
+}
+
+static void __binlog_end_frame(size_t _start, PtrBuffer& _frames) {
+    uint16_t len = (uint16_t)(_frames.Length() - _start - 4);
+    _frames.Write(&len, sizeof(len), (off_t)(_start + 2));
+}
+
+static void __binlog_write_string(const char* _str, PtrBuffer& _frames) {
+    _frames.Write(_str, strnlen(_str, 1024));
+    _frames.Write("", 1);
+}
+
+// zone and call site definitions go once into every buffer block, so each block decodes on its own.
+// with _standalone they are written with every record, for the sync mode.
+static void __binlog_make_frames(const XLoggerInfo* _info, const void* _data, size_t _len, bool _standalone, PtrBuffer& _frames) {
+    const XLoggerBinSite* site = NULL;
+    memcpy(&site, _data, sizeof(site));
+
+    if (!_standalone && sg_binlog_sites.size() >= 0xFFFF) sg_binlog_sites.clear();
+
+    if (_standalone || sg_binlog_sites.empty()) {
+#ifdef _WIN32
+        int32_t gmtoff = (int32_t)-_timezone;
+#else
+        time_t now = _info->timeval.tv_sec;
+        int32_t gmtoff = (int32_t)localtime((const time_t*)&now)->tm_gmtoff;
+#endif
+
+        size_t start = __binlog_begin_frame(kBinlogFrameZone, _frames);
+        _frames.Write(&gmtoff, sizeof(gmtoff));
+        __binlog_end_frame(start, _frames);
+    }
+
+    uint16_t id = 0;
+    std::map<const void*, uint16_t>::iterator iter = sg_binlog_sites.end();
+    if (!_standalone) iter = sg_binlog_sites.find(site);
+
+    if (sg_binlog_sites.end() != iter) {
+        id = iter->second;
+    } else {
+        if (!_standalone) {
+            id = (uint16_t)sg_binlog_sites.size();
+            sg_binlog_sites[site] = id;
+        }
+
+        char func_name[128] = {0};
+        ExtractFunctionName(_info->func_name, func_name, sizeof(func_name));
+        int32_t line = _info->line;
+
+        size_t start = __binlog_begin_frame(kBinlogFrameDefine, _frames);
+        _frames.Write(&id, sizeof(id));
+        _frames.Write(&line, sizeof(line));
+        __binlog_write_string(NULL != _info->tag ? _info->tag : "", _frames);
+        __binlog_write_string(ExtractFileName(_info->filename), _frames);
+        __binlog_write_string(func_name, _frames);
+        __binlog_write_string(site->format, _frames);
+        __binlog_end_frame(start, _frames);
+    }
+
+    uint8_t level = (uint8_t)_info->level;
+    uint8_t is_main = _info->tid == _info->maintid ? 1 : 0;
+    int64_t sec = _info->timeval.tv_sec;
+    uint16_t millisecond = (uint16_t)(_info->timeval.tv_usec / 1000);
+    int64_t pid = _info->pid;
+    int64_t tid = _info->tid;
+
+    size_t start = __binlog_begin_frame(kBinlogFrameRecord, _frames);
+    _frames.Write(&id, sizeof(id));
+    _frames.Write(&level, sizeof(level));
+    _frames.Write(&is_main, sizeof(is_main));
+    _frames.Write(&sec, sizeof(sec));
+    _frames.Write(&millisecond, sizeof(millisecond));
+    _frames.Write(&pid, sizeof(pid));
+    _frames.Write(&tid, sizeof(tid));
+    _frames.Write((const char*)_data + sizeof(site), _len - sizeof(site));
+    __binlog_end_frame(start, _frames);
+}
+
+static void __write2buffer_bin(const XLoggerInfo* _info, const void* _data, size_t _len) {
+    // sg_mutex_buffer_async must be held
+    if (NULL == _info || NULL == _data || _len < sizeof(const XLoggerBinSite*)) return;
+
+    // this write starts a new block, the definitions of the last one are gone with it
+    if (0 == sg_log_buff->GetData().Length()) sg_binlog_sites.clear();
+
+    char temp[16*1024];
+    PtrBuffer frames(temp, 0, sizeof(temp));
+    __binlog_make_frames(_info, _data, _len, false, frames);
+
+    if (!sg_log_buff->Write(frames.Ptr(), (unsigned int)frames.Length())) __count_dropped(1, frames.Length());
+    __update_buffer_stats();
+}
+
+static void __drain_staging_ring() {
+    // sg_mutex_buffer_async must be held, it keeps the ring single consumer
+    uint32_t queue_bytes = sg_staging_ring.Size();
+    uint32_t queue_records = (uint32_t)sg_staging_ring.Drain(&__write2buffer, &__write2buffer_bin);
+
+    if (queue_bytes > sg_stats.max_queue_bytes) sg_stats.max_queue_bytes = queue_bytes;
+    if (queue_records > sg_stats.max_queue_records) sg_stats.max_queue_records = queue_records;
+}
+
 static void __async_log_thread() {
+    uint64_t last_flush_tick = gettickcount();
+
     while (true) {
 
         ScopedLock lock_buffer(sg_mutex_buffer_async);
 
         if (NULL == sg_log_buff) break;
 
-        AutoBuffer tmp;
-        sg_log_buff->Flush(tmp);
-        lock_buffer.unlock();
+        __drain_staging_ring();
 
-		if (NULL != tmp.Ptr())  __log2file(tmp.Ptr(), tmp.Length());
+        if (sg_flush_request || sg_log_close || sg_log_buff->GetData().Length() >= kBufferBlockLength*1/3
+                || gettickspan(last_flush_tick) >= kFlushInterval) {
+            sg_flush_request = false;
+            last_flush_tick = gettickcount();
+
+            // a full segment goes to the file straight from the buffer, the logs go on in the next one meanwhile
+            PtrBuffer segment;
+            AutoBuffer tmp;
+            bool is_sealed = sg_log_buff->Seal() && sg_log_buff->TakeSealed(segment);
+            if (!is_sealed) {
+                sg_log_buff->Flush(tmp);
+                segment.Attach(tmp.Ptr(), tmp.Length());
+            }
+            sg_cond_buffer_room.notifyAll();
+            lock_buffer.unlock();
+
+            if (NULL != segment.Ptr() && 0 < segment.Length()) {
+                uint64_t flush_tick = gettickcount();
+                __log2file(segment.Ptr(), segment.Length());
+                uint64_t flush_ms = (uint64_t)gettickspan(flush_tick);
+
+                lock_buffer.lock();
+                if (is_sealed) {
+                    sg_log_buff->Release(segment);
+                    sg_cond_buffer_room.notifyAll();
+                }
+                ++sg_stats.flush_count;
+                sg_stats.flush_total_ms += flush_ms;
+                if (flush_ms > sg_stats.flush_max_ms) sg_stats.flush_max_ms = flush_ms;
+                lock_buffer.unlock();
+            }
+        } else {
+            lock_buffer.unlock();
+        }
 
         if (sg_log_close) break;
 
-        sg_cond_buffer_async.wait(15 * 60 *1000);
+        // left over after the drain means a record still being written stopped it. the producers that
+        // commit after it saw the ring not empty and do not notify, so do not sleep a whole flush interval.
+        sg_cond_buffer_async.wait(sg_staging_ring.Empty() ? kFlushInterval : kStagingRetryInterval);
     }
 }
 
@@ -632,29 +859,135 @@ static void __appender_sync(const XLoggerInfo* _info, const char* _log) {
     __log2file(tmp_buff.Ptr(), tmp_buff.Length());
 }
 
-static void __appender_async(const XLoggerInfo* _info, const char* _log) {
-    ScopedLock lock(sg_mutex_buffer_async);
-    if (NULL == sg_log_buff) return;
+// the staging ring is full, or the record is fatal and must be in the mmap buffer before returning.
+// the record is text with _data NULL, binlog otherwise
+static void __appender_async_overflow(const XLoggerInfo* _info, const char* _log, const void* _data, size_t _len) {
+    bool is_fatal = (NULL != _info && kLevelFatal == _info->level);
+    size_t record_len = NULL != _data ? _len : (NULL == _log ? 0 : strnlen(_log, LogStagingRing::kMaxBodyLength));
+    bool was_empty = false;
 
-    char temp[16*1024] = {0};       //tell perry,ray if you want modify size.
-    PtrBuffer log_buff(temp, 0, sizeof(temp));
-    log_formater(_info, _log, log_buff);
+    if (!is_fatal && kOverflowDropBelowWarn == sg_overflow_policy && NULL != _info && _info->level < kLevelWarn) {
+        __count_dropped(1, record_len);
+        sg_cond_buffer_async.notifyAll(true);
+        return;
+    }
 
-    if (sg_log_buff->GetData().Length() >= kBufferBlockLength*4/5) {
-       int ret = snprintf(temp, sizeof(temp), "[F][ sg_buffer_async.Length() >= BUFFER_BLOCK_LENTH*4/5, len: %d\n", (int)sg_log_buff->GetData().Length());
-       log_buff.Length(ret, ret);
+    ScopedLock lock(sg_mutex_buffer_async, false);
+
+    if (!is_fatal && kOverflowDropOldest == sg_overflow_policy) {
+        // the log thread holds the mutex only while it drains the ring, so there is room for one more try
+        if (!lock.trylock()) {
+            bool pushed = NULL != _data ? sg_staging_ring.PushBinary(_info, _data, _len, was_empty) : sg_staging_ring.Push(_info, _log, was_empty);
+            if (!pushed) __count_dropped(1, record_len);
+            sg_cond_buffer_async.notifyAll(true);
+            return;
+        }
+
+        if (NULL == sg_log_buff) return;
+
+        // the log thread is busy with the file and the buffer can not take the ring, give up the oldest records
+        if (sg_log_buff->GetData().Length() >= kBufferHighWater) {
+            uint32_t dropped_len = 0;
+            while (!(NULL != _data ? sg_staging_ring.PushBinary(_info, _data, _len, was_empty) : sg_staging_ring.Push(_info, _log, was_empty))) {
+                if (!sg_staging_ring.DropOldest(dropped_len)) {
+                    __count_dropped(1, record_len);
+                    break;
+                }
+                __count_dropped(1, dropped_len);
+            }
+            sg_cond_buffer_async.notifyAll(true);
+            return;
+        }
+    } else {
+        lock.lock();
+        if (NULL == sg_log_buff) return;
+
+        if (sg_log_buff->GetData().Length() >= kBufferHighWater) {
+            uint64_t block_tick = gettickcount();
+            ++sg_stats.blocked_count;
+
+            while (NULL != sg_log_buff && sg_log_buff->GetData().Length() >= kBufferHighWater) {
+                long left = sg_overflow_block_ms - (long)gettickspan(block_tick);
+                if (left <= 0) break;
+
+                sg_cond_buffer_async.notifyAll(true);
+                sg_cond_buffer_room.wait(lock, left);
+            }
+            sg_stats.blocked_ms += (uint64_t)gettickspan(block_tick);
+
+            if (NULL == sg_log_buff) return;
+        }
+    }
+
+    __drain_staging_ring();
+
+    if (NULL != _data) __write2buffer_bin(_info, _data, _len);
+    else __write2buffer(_info, _log);
+
+    if (is_fatal) sg_flush_request = true;
+
+    if (is_fatal || sg_log_buff->GetData().Length() >= kBufferBlockLength*1/3) {
+       sg_cond_buffer_async.notifyAll(true);
     }
+}
 
-    if (!sg_log_buff->Write(log_buff.Ptr(), (unsigned int)log_buff.Length())) return;
+static void __appender_async(const XLoggerInfo* _info, const char* _log) {
+    bool is_fatal = (NULL != _info && kLevelFatal == _info->level);
+    bool was_empty = false;
 
-    if (sg_log_buff->GetData().Length() >= kBufferBlockLength*1/3 || (NULL!=_info && kLevelFatal == _info->level)) {
-       sg_cond_buffer_async.notifyAll();
+    if (!is_fatal && sg_staging_ring.Push(_info, _log, was_empty)) {
+        // anyway notify, the async thread may be draining and miss a plain notify
+        if (was_empty) sg_cond_buffer_async.notifyAll(true);
+        return;
     }
 
+    __appender_async_overflow(_info, _log, NULL, 0);
+}
+
+static void __appender_bin_sync(const XLoggerInfo* _info, const void* _data, size_t _len) {
+    if (NULL == _info || _len < sizeof(const XLoggerBinSite*)) return;
+
+    char temp[16*1024];
+    PtrBuffer frames(temp, 0, sizeof(temp));
+    __binlog_make_frames(_info, _data, _len, true, frames);
+
+    AutoBuffer tmp_buff;
+    if (!sg_log_buff->Write(frames.Ptr(), frames.Length(), tmp_buff))   return;
+
+    __log2file(tmp_buff.Ptr(), tmp_buff.Length());
+}
+
+static void __appender_bin_async(const XLoggerInfo* _info, const void* _data, size_t _len) {
+    bool was_empty = false;
+
+    if (sg_staging_ring.PushBinary(_info, _data, _len, was_empty)) {
+        if (was_empty) sg_cond_buffer_async.notifyAll(true);
+        return;
+    }
+
+    if (NULL == _info || NULL == _data) return;
+    __appender_async_overflow(_info, NULL, _data, _len);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
 
+void xlogger_appender_bin(const XLoggerInfo* _info, const void* _data, size_t _len) {
+    if (sg_log_close) return;
+
+    SCOPE_ERRNO();
+
+    if (sg_consolelog_open) {
+        char body[4096] = {0};
+        log_formater_bin(_data, _len, body, sizeof(body));
+        ConsoleLog(_info, body);
+    }
+
+    if (kAppednerSync == sg_mode)
+        __appender_bin_sync(_info, _data, _len);
+    else
+        __appender_bin_async(_info, _data, _len);
+}
+
 void xlogger_appender(const XLoggerInfo* _info, const char* _log) {
     if (sg_log_close) return;
 
@@ -796,7 +1129,8 @@ static void get_mark_info(char* _info, size_t _infoLen) {
 	snprintf(_info, _infoLen, "[%" PRIdMAX ",%" PRIdMAX "][%s]", xlogger_pid(), xlogger_tid(), tmp_time);
 }
 
-void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefix, const char* _pub_key) {
+void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefix, const char* _pub_key,
+                   TCompressMode _compress_mode, int _compress_level, TCipherMode _cipher_mode) {
 	assert(_dir);
 	assert(_nameprefix);
     
@@ -806,6 +1140,7 @@ void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefi
     }
 
     xlogger_SetAppender(&xlogger_appender);
+    xlogger_SetBinAppender(&xlogger_appender_bin);
     
 	//mkdir(_dir, S_IRWXU|S_IRWXG|S_IRWXO);
 	boost::filesystem::create_directories(_dir);
@@ -820,14 +1155,25 @@ void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefi
     char mmap_file_path[512] = {0};
     snprintf(mmap_file_path, sizeof(mmap_file_path), "%s/%s.mmap2", sg_cache_logdir.empty()?_dir:sg_cache_logdir.c_str(), _nameprefix);
 
-    bool use_mmap = false;
-    if (OpenMmapFile(mmap_file_path, kBufferBlockLength, sg_mmmap_file))  {
-        sg_log_buff = new LogBuffer(sg_mmmap_file.data(), kBufferBlockLength, true, _pub_key);
-        use_mmap = true;
+    AutoBuffer buffer;
+    bool use_mmap = OpenMmapFile(mmap_file_path, kMmapLength, sg_mmmap_file);
+
+    if (use_mmap && kMmapLength != sg_mmmap_file.size()) {
+        // left by a build with other segments, its logs are taken out before the file is made again
+        LogBuffer old_buff(sg_mmmap_file.data(), sg_mmmap_file.size(), true, _pub_key, _compress_mode, _compress_level, _cipher_mode,
+                           std::max<size_t>(1, sg_mmmap_file.size() / kBufferBlockLength));
+        old_buff.Flush(buffer);
+        CloseMmapFile(sg_mmmap_file);
+        remove(mmap_file_path);
+        use_mmap = OpenMmapFile(mmap_file_path, kMmapLength, sg_mmmap_file);
+    }
+
+    if (use_mmap)  {
+        sg_log_buff = new LogBuffer(sg_mmmap_file.data(), kMmapLength, true, _pub_key, _compress_mode, _compress_level, _cipher_mode, kBufferSegmentCount);
     } else {
-        char* buffer = new char[kBufferBlockLength];
-        sg_log_buff = new LogBuffer(buffer, kBufferBlockLength, true, _pub_key);
-        use_mmap = false;
+        sg_heap_buffer = new char[kMmapLength];
+        memset(sg_heap_buffer, 0, kMmapLength);
+        sg_log_buff = new LogBuffer(sg_heap_buffer, kMmapLength, true, _pub_key, _compress_mode, _compress_level, _cipher_mode, kBufferSegmentCount);
     }
 
     if (NULL == sg_log_buff->GetData().Ptr()) {
@@ -836,7 +1182,6 @@ void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefi
     }
 
 
-    AutoBuffer buffer;
     sg_log_buff->Flush(buffer);
 
 	ScopedLock lock(sg_mutex_log_file);
@@ -850,9 +1195,16 @@ void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefi
     get_mark_info(mark_info, sizeof(mark_info));
 
     if (buffer.Ptr()) {
-        __writetips2file("~~~~~ begin of mmap ~~~~~\n");
-        __log2file(buffer.Ptr(), buffer.Length());
-        __writetips2file("~~~~~ end of mmap ~~~~~%s\n", mark_info);
+        char end_tips[600] = {0};
+        snprintf(end_tips, sizeof(end_tips), "~~~~~ end of mmap ~~~~~%s\n", mark_info);
+
+        AutoBuffer begin_buff;
+        AutoBuffer end_buff;
+        sg_log_buff->Write("~~~~~ begin of mmap ~~~~~\n", strlen("~~~~~ begin of mmap ~~~~~\n"), begin_buff);
+        sg_log_buff->Write(end_tips, strnlen(end_tips, sizeof(end_tips)), end_buff);
+
+        LogFileWriter::Piece pieces[] = {{begin_buff.Ptr(), begin_buff.Length()}, {buffer.Ptr(), buffer.Length()}, {end_buff.Ptr(), end_buff.Length()}};
+        __log2file(pieces, 3);
     }
 
     tickcountdiff_t get_mmap_time = tickcount_t().gettickcount() - tick;
@@ -875,14 +1227,15 @@ void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefi
     xlogger_appender(NULL, "MARS_BUILD_TIME: " MARS_BUILD_TIME);
     xlogger_appender(NULL, "MARS_BUILD_JOB: " MARS_TAG);
 
-    snprintf(logmsg, sizeof(logmsg), "log appender mode:%d, use mmap:%d", (int)_mode, use_mmap);
+    snprintf(logmsg, sizeof(logmsg), "log appender mode:%d, use mmap:%d, compress mode:%d, level:%d, cipher mode:%d", (int)_mode, use_mmap, (int)_compress_mode, _compress_level, (int)_cipher_mode);
     xlogger_appender(NULL, logmsg);
 
 	BOOT_RUN_EXIT(appender_close);
 
 }
 
-void appender_open_with_cache(TAppenderMode _mode, const std::string& _cachedir, const std::string& _logdir, const char* _nameprefix, const char* _pub_key) {
+void appender_open_with_cache(TAppenderMode _mode, const std::string& _cachedir, const std::string& _logdir, const char* _nameprefix, const char* _pub_key,
+                              TCompressMode _compress_mode, int _compress_level, TCipherMode _cipher_mode) {
     assert(!_cachedir.empty());
     assert(!_logdir.empty());
     assert(_nameprefix);
@@ -897,30 +1250,40 @@ void appender_open_with_cache(TAppenderMode _mode, const std::string& _cachedir,
         Thread(boost::bind(&__move_old_files, _cachedir, _logdir, std::string(_nameprefix))).start_after(3 * 60 * 1000);
     }
 
-    appender_open(_mode, _logdir.c_str(), _nameprefix, _pub_key);
+    appender_open(_mode, _logdir.c_str(), _nameprefix, _pub_key, _compress_mode, _compress_level, _cipher_mode);
 
 }
 
 void appender_flush() {
-    sg_cond_buffer_async.notifyAll();
+    sg_flush_request = true;
+    sg_cond_buffer_async.notifyAll(true);
 }
 
 void appender_flush_sync() {
-    if (kAppednerSync == sg_mode) {
-        return;
-    }
+    if (kAppednerAsync == sg_mode) {
+        ScopedLock lock_buffer(sg_mutex_buffer_async);
 
-    ScopedLock lock_buffer(sg_mutex_buffer_async);
-    
-    if (NULL == sg_log_buff) return;
+        // a segment on its way to the file goes first, the logs after it must not overtake it
+        while (NULL != sg_log_buff && sg_log_buff->HasTaken()) {
+            sg_cond_buffer_room.wait(lock_buffer, 1000);
+        }
 
-    AutoBuffer tmp;
-    sg_log_buff->Flush(tmp);
+        if (NULL == sg_log_buff) return;
+
+        __drain_staging_ring();
+
+        AutoBuffer tmp;
+        sg_log_buff->Flush(tmp);
+        sg_cond_buffer_room.notifyAll();
 
-    lock_buffer.unlock();
+        lock_buffer.unlock();
 
-	if (tmp.Ptr())  __log2file(tmp.Ptr(), tmp.Length());
+        if (tmp.Ptr())  __log2file(tmp.Ptr(), tmp.Length());
+    }
 
+    // the only place besides close and a file switch that waits for the disk
+    ScopedLock lock_file(sg_mutex_log_file);
+    sg_logfile.Sync();
 }
 
 void appender_close() {
@@ -940,20 +1303,37 @@ void appender_close() {
         sg_thread_async.join();
 
 	
+    // the logs that came in after the last flush of the async thread, or all of them in sync mode
     ScopedLock buffer_lock(sg_mutex_buffer_async);
+    AutoBuffer tmp;
+    if (NULL != sg_log_buff) {
+        __drain_staging_ring();
+        sg_log_buff->Flush(tmp);
+    }
+    buffer_lock.unlock();
+
+    if (tmp.Ptr()) __log2file(tmp.Ptr(), tmp.Length());
+
+    buffer_lock.lock();
     if (sg_mmmap_file.is_open()) {
-        if (!sg_mmmap_file.operator !()) memset(sg_mmmap_file.data(), 0, kBufferBlockLength);
+        // a log written meanwhile stays in the mmap, the next open recovers it
+        if (!sg_mmmap_file.operator !() && NULL != sg_log_buff && sg_log_buff->Empty() && sg_staging_ring.Empty()) {
+            memset(sg_mmmap_file.data(), 0, kMmapLength);
+        }
 
 		CloseMmapFile(sg_mmmap_file);
     } else {
-        delete[] (char*)((sg_log_buff->GetData()).Ptr());
+        delete[] sg_heap_buffer;
+        sg_heap_buffer = NULL;
     }
 
     delete sg_log_buff;
     sg_log_buff = NULL;
+    sg_cond_buffer_room.notifyAll();
     buffer_lock.unlock();
 
     ScopedLock lock(sg_mutex_log_file);
+    sg_logfile.Sync();
 	__closelogfile();
 }
 
@@ -994,6 +1374,25 @@ void appender_set_max_file_size(uint64_t _max_byte_size) {
     sg_max_file_size = _max_byte_size;
 }
 
+void appender_set_overflow_policy(TOverflowPolicy _policy, long _max_block_ms) {
+    sg_overflow_policy = _policy;
+    sg_overflow_block_ms = _max_block_ms < 0 ? 0 : _max_block_ms;
+}
+
+void appender_get_stats(AppenderStats& _stats, bool _reset) {
+    ScopedLock lock_buffer(sg_mutex_buffer_async);
+    _stats = sg_stats;
+
+    if (_reset) {
+        memset(&sg_stats, 0, sizeof(sg_stats));
+        _stats.dropped_records = sg_dropped_records.exchange(0, boost::memory_order_relaxed);
+        _stats.dropped_bytes = sg_dropped_bytes.exchange(0, boost::memory_order_relaxed);
+    } else {
+        _stats.dropped_records = sg_dropped_records.load(boost::memory_order_relaxed);
+        _stats.dropped_bytes = sg_dropped_bytes.load(boost::memory_order_relaxed);
+    }
+}
+
 void appender_setExtraMSg(const char* _msg, unsigned int _len) {
     sg_log_extra_msg = std::string(_msg, _len);
 }
@@ -25,8 +25,10 @@
 #include <algorithm>
 
 #include "mars/comm/xlogger/xloggerbase.h"
+#include "mars/comm/xlogger/xlogger_binlog.h"
 #include "mars/comm/xlogger/loginfo_extract.h"
 #include "mars/comm/ptrbuffer.h"
+#include "mars/comm/thread/tss.h"
 
 #ifdef _WIN32
 #define PRIdMAX "lld"
@@ -36,6 +38,114 @@
 #include <inttypes.h>
 #endif
 
+namespace {
+struct TimeCache {
+    time_t sec;
+    int len;
+    char prefix[64];    // "2016-03-08 +8.0 10:01:02", milliseconds are appended per line
+};
+}
+
+static Tss sg_tss_time_cache(&free);
+
+static int __format_time_prefix(time_t _sec, char* _prefix, size_t _len) {
+    tm tm = *localtime((const time_t*)&_sec);
+#ifdef _WIN32
+    int ret = snprintf(_prefix, _len, "%d-%02d-%02d %+.1f %02d:%02d:%02d", 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
+                       (-_timezone) / 3600.0, tm.tm_hour, tm.tm_min, tm.tm_sec);
+#else
+    int ret = snprintf(_prefix, _len, "%d-%02d-%02d %+.1f %02d:%02d:%02d", 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
+                       tm.tm_gmtoff / 3600.0, tm.tm_hour, tm.tm_min, tm.tm_sec);
+#endif
+    return (0 > ret || (size_t)ret >= _len) ? 0 : ret;
+}
+
+// localtime and the date snprintf run once per second per thread
+static const TimeCache* __time_cache(time_t _sec, TimeCache& _fallback) {
+    TimeCache* cache = (TimeCache*)sg_tss_time_cache.get();
+
+    if (NULL == cache) {
+        cache = (TimeCache*)calloc(1, sizeof(TimeCache));
+        if (NULL == cache) cache = &_fallback;
+        else sg_tss_time_cache.set(cache);
+    }
+
+    if (0 == cache->len || cache->sec != _sec) {
+        cache->sec = _sec;
+        cache->len = __format_time_prefix(_sec, cache->prefix, sizeof(cache->prefix));
+    }
+
+    return cache;
+}
+
+static char* __append_str(char* _pos, const char* _end, const char* _str, size_t _len) {
+    if (_len > (size_t)(_end - _pos)) _len = _end - _pos;
+    memcpy(_pos, _str, _len);
+    return _pos + _len;
+}
+
+static char* __append_str(char* _pos, const char* _end, const char* _str) {
+    while (_pos < _end && '\0' != *_str) *_pos++ = *_str++;
+    return _pos;
+}
+
+static char* __append_int(char* _pos, const char* _end, intmax_t _value) {
+    char digits[24];
+    int n = 0;
+    uintmax_t value = 0 > _value ? 0 - (uintmax_t)_value : (uintmax_t)_value;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (0 != value);
+
+    if (0 > _value) digits[n++] = '-';
+
+    while (0 < n && _pos < _end) *_pos++ = digits[--n];
+    return _pos;
+}
+
+// same output as "[%s][%s][%" PRIdMAX ", %" PRIdMAX "%s][%s][%s, %s, %d][", without snprintf
+static size_t __format_header(const XLoggerInfo* _info, const char* _level, const char* _filename, const char* _funcname, char* _out, size_t _len) {
+    char* pos = _out;
+    const char* end = _out + _len;
+
+    pos = __append_str(pos, end, "[", 1);
+    pos = __append_str(pos, end, _level);
+    pos = __append_str(pos, end, "][", 2);
+
+    if (0 != _info->timeval.tv_sec) {
+        TimeCache fallback;
+        memset(&fallback, 0, sizeof(fallback));
+        const TimeCache* cache = __time_cache(_info->timeval.tv_sec, fallback);
+
+        if (0 < cache->len) {
+            int millisecond = (int)(_info->timeval.tv_usec / 1000);
+            char ms[4] = {'.', (char)('0' + millisecond / 100 % 10), (char)('0' + millisecond / 10 % 10), (char)('0' + millisecond % 10)};
+
+            pos = __append_str(pos, end, cache->prefix, cache->len);
+            pos = __append_str(pos, end, ms, sizeof(ms));
+        }
+    }
+
+    pos = __append_str(pos, end, "][", 2);
+    pos = __append_int(pos, end, _info->pid);
+    pos = __append_str(pos, end, ", ", 2);
+    pos = __append_int(pos, end, _info->tid);
+    if (_info->tid == _info->maintid) pos = __append_str(pos, end, "*", 1);
+    pos = __append_str(pos, end, "][", 2);
+    pos = __append_str(pos, end, _info->tag ? _info->tag : "");
+    pos = __append_str(pos, end, "][", 2);
+    pos = __append_str(pos, end, _filename);
+    pos = __append_str(pos, end, ", ", 2);
+    pos = __append_str(pos, end, _funcname);
+    pos = __append_str(pos, end, ", ", 2);
+    pos = __append_int(pos, end, _info->line);
+    pos = __append_str(pos, end, "][", 2);
+
+    return pos - _out;
+}
+
 void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log) {
     static const char* levelStrings[] = {
         "V",
@@ -73,32 +183,12 @@ void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _lo
         char strFuncName [128] = {0};
         ExtractFunctionName(_info->func_name, strFuncName, sizeof(strFuncName));
 
-        char temp_time[64] = {0};
-
-        if (0 != _info->timeval.tv_sec) {
-            time_t sec = _info->timeval.tv_sec;
-            tm tm = *localtime((const time_t*)&sec);
-#ifdef ANDROID
-            snprintf(temp_time, sizeof(temp_time), "%d-%02d-%02d %+.1f %02d:%02d:%02d.%.3ld", 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
-                     tm.tm_gmtoff / 3600.0, tm.tm_hour, tm.tm_min, tm.tm_sec, _info->timeval.tv_usec / 1000);
-#elif _WIN32
-            snprintf(temp_time, sizeof(temp_time), "%d-%02d-%02d %+.1f %02d:%02d:%02d.%.3d", 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
-                     (-_timezone) / 3600.0, tm.tm_hour, tm.tm_min, tm.tm_sec, _info->timeval.tv_usec / 1000);
-#else
-            snprintf(temp_time, sizeof(temp_time), "%d-%02d-%02d %+.1f %02d:%02d:%02d.%.3d", 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
-                     tm.tm_gmtoff / 3600.0, tm.tm_hour, tm.tm_min, tm.tm_sec, _info->timeval.tv_usec / 1000);
-#endif
-        }
-
-        // _log.AllocWrite(30*1024, false);
-        int ret = snprintf((char*)_log.PosPtr(), 1024, "[%s][%s][%" PRIdMAX ", %" PRIdMAX "%s][%s][%s, %s, %d][",  // **CPPLINT SKIP**
-                           _logbody ? levelStrings[_info->level] : levelStrings[kLevelFatal], temp_time,
-                           _info->pid, _info->tid, _info->tid == _info->maintid ? "*" : "", _info->tag ? _info->tag : "",
-                           filename, strFuncName, _info->line);
+        // header stays within 1023 bytes like the snprintf it replaces
+        size_t ret = __format_header(_info, _logbody ? levelStrings[_info->level] : levelStrings[kLevelFatal],
+                                     filename, strFuncName, (char*)_log.PosPtr(), 1023);
+        ((char*)_log.PosPtr())[ret] = '\0';
 
-        assert(0 <= ret);
         _log.Length(_log.Pos() + ret, _log.Length() + ret);
-        //      memcpy((char*)_log.PosPtr() + 1, "\0", 1);
 
         assert((unsigned int)_log.Pos() == _log.Length());
     }
@@ -120,3 +210,117 @@ void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _lo
     if (*((char*)_log.PosPtr() - 1) != nextline) _log.Write(&nextline, 1);
 }
 
+
+// appends one encoded binlog argument as text (only measures it if _pos is NULL),
+// returns the encoded length or 0 if it is broken
+static size_t __render_bin_arg(const char* _arg, size_t _len, char*& _pos, const char* _end) {
+    if (1 > _len) return 0;
+
+    char temp[64] = {0};
+    const char* str = temp;
+    size_t str_len = 0;
+    size_t arg_len = 0;
+
+    switch (_arg[0]) {
+        case kBinArgBool:
+        case kBinArgChar:
+            if (2 > _len) return 0;
+            if (kBinArgBool == _arg[0]) str = _arg[1] ? "true" : "false";
+            else temp[0] = _arg[1];
+            str_len = strlen(str);
+            arg_len = 2;
+            break;
+        case kBinArgString: {
+            uint16_t len = 0;
+            if (1 + sizeof(len) > _len) return 0;
+            memcpy(&len, _arg + 1, sizeof(len));
+            if (1 + sizeof(len) + len > _len) return 0;
+            str = _arg + 1 + sizeof(len);
+            str_len = len;
+            arg_len = 1 + sizeof(len) + len;
+            break;
+        }
+        default: {
+            if (9 > _len) return 0;
+            char value[8];
+            memcpy(value, _arg + 1, sizeof(value));
+
+            if (kBinArgInt == _arg[0]) {
+                int64_t v; memcpy(&v, value, sizeof(v));
+                str_len = __append_int(temp, temp + sizeof(temp), (intmax_t)v) - temp;
+            } else if (kBinArgUInt == _arg[0]) {
+                uint64_t v; memcpy(&v, value, sizeof(v));
+                str_len = snprintf(temp, sizeof(temp), "%llu", (unsigned long long)v);
+            } else if (kBinArgDouble == _arg[0]) {
+                double v; memcpy(&v, value, sizeof(v));
+                str_len = snprintf(temp, sizeof(temp), "%E", v);
+            } else if (kBinArgPointer == _arg[0]) {
+                uint64_t v; memcpy(&v, value, sizeof(v));
+                str_len = snprintf(temp, sizeof(temp), "0x%llX", (unsigned long long)v);
+            } else {
+                return 0;
+            }
+            arg_len = 9;
+            break;
+        }
+    }
+
+    if (NULL != _pos) _pos = __append_str(_pos, _end, str, str_len);
+    return arg_len;
+}
+
+// renders a binlog record the way the type safe XLogger would have, used for the console
+void log_formater_bin(const void* _data, size_t _len, char* _body, size_t _body_len) {
+    if (NULL == _body || 0 == _body_len) return;
+    _body[0] = '\0';
+
+    const XLoggerBinSite* site = NULL;
+    if (NULL == _data || _len < sizeof(site)) return;
+    memcpy(&site, _data, sizeof(site));
+
+    const char* args[16] = {NULL};
+    size_t args_len[16] = {0};
+    int count = 0;
+
+    const char* arg = (const char*)_data + sizeof(site);
+    const char* args_end = (const char*)_data + _len;
+
+    while (arg < args_end && count < 16) {
+        char* measure = NULL;
+        size_t arg_len = __render_bin_arg(arg, args_end - arg, measure, NULL);
+        if (0 == arg_len) break;
+
+        args[count] = arg;
+        args_len[count] = arg_len;
+        ++count;
+        arg += arg_len;
+    }
+
+    char* pos = _body;
+    const char* end = _body + _body_len - 1;
+    const char* current = site->format;
+    int index = 0;
+
+    while ('\0' != *current && pos < end) {
+        if ('%' != *current) {
+            *pos++ = *current++;
+            continue;
+        }
+
+        char nextch = *(current + 1);
+        if (('0' <= nextch && nextch <= '9') || '_' == nextch) {
+            int arg_index = '_' == nextch ? index : nextch - '0';
+            if (arg_index < count) __render_bin_arg(args[arg_index], args_len[arg_index], pos, end);
+            else pos = __append_str(pos, end, "(null)");
+            ++index;
+            current += 2;
+        } else if ('%' == nextch) {
+            *pos++ = '%';
+            current += 2;
+        } else {
+            ++current;
+        }
+    }
+
+    *pos = '\0';
+}
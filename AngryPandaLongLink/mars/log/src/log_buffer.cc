@@ -28,6 +28,7 @@
 #include <assert.h>
 
 #include "log/crypt/log_crypt.h"
+#include "log_compress.h"
 
 
 #ifdef WIN32
@@ -39,21 +40,63 @@ bool LogBuffer::GetPeriodLogs(const char* _log_path, int _begin_hour, int _end_h
     return LogCrypt::GetPeriodLogs(_log_path, _begin_hour, _end_hour, _begin_pos, _end_pos, _err_msg);
 }
 
-LogBuffer::LogBuffer(void* _pbuffer, size_t _len, bool _isCompress, const char* _pubkey)
-: is_compress_(_isCompress), log_crypt_(new LogCrypt(_pubkey)), remain_nocrypt_len_(0) {
-    buff_.Attach(_pbuffer, _len);
-    __Fix();
+LogBuffer::LogBuffer(void* _pbuffer, size_t _len, bool _isCompress, const char* _pubkey, TCompressMode _compress_mode, int _compress_level,
+                     TCipherMode _cipher_mode, size_t _segment_count)
+: is_compress_(_isCompress), compress_(NULL), log_crypt_(new LogCrypt(_pubkey, kChaCha20 == _cipher_mode)), remain_nocrypt_len_(0)
+, active_(0), seal_count_(0) {
+    if (0 == _segment_count) _segment_count = 1;
+    size_t segment_len = _len / _segment_count;
+
+    // every segment holding a block is recovered and sealed, oldest seq first
+    std::vector<size_t> recovered;
+    for (size_t i = 0; i < _segment_count; ++i) {
+        Segment segment = {(char*)_pbuffer + i * segment_len, segment_len, 0, kSegmentFree, 0};
+        segments_.push_back(segment);
+
+        buff_.Attach(segment.ptr, segment.max_len);
+        bool is_fixed = __Fix();
+        // bytes behind a block are zero from here on, a half written record of the crash is gone
+        memset(segment.ptr + buff_.Length(), 0, segment.max_len - buff_.Length());
+        if (!is_fixed) continue;
+
+        segments_[i].len = buff_.Length();
+        std::vector<size_t>::iterator it = recovered.begin();
+        uint16_t seq = LogCrypt::GetSeq(segment.ptr, segments_[i].len);
+        while (it != recovered.end() && (int16_t)(LogCrypt::GetSeq(segments_[*it].ptr, segments_[*it].len) - seq) <= 0) ++it;
+        recovered.insert(it, i);
+    }
+
+    for (size_t i = 0; i < recovered.size(); ++i) {
+        segments_[recovered[i]].state = kSegmentSealed;
+        segments_[recovered[i]].order = ++seal_count_;
+    }
+
+    // writes go to a free segment, or the newest block goes on taking them as it did with a single segment
+    size_t active = recovered.empty() ? 0 : recovered.back();
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (kSegmentFree == segments_[i].state) {
+            active = i;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < recovered.size(); ++i) {
+        Segment& segment = segments_[recovered[i]];
+        if (active == recovered[i]) continue;
+
+        buff_.Attach(segment.ptr, segment.len, segment.max_len);
+        __Flush();
+        segment.len = buff_.Length();
+    }
+    __Activate(active);
 
     if (is_compress_) {
-        memset(&cstream_, 0, sizeof(cstream_));
+        compress_ = LogCompress::Create(_compress_mode, _compress_level);
     }
 }
 
 LogBuffer::~LogBuffer() {
-    if (is_compress_ && Z_NULL != cstream_.state) {
-        deflateEnd(&cstream_);
-    }
-    
+    delete compress_;
     delete log_crypt_;
 }
 
@@ -63,9 +106,17 @@ PtrBuffer& LogBuffer::GetData() {
 
 
 void LogBuffer::Flush(AutoBuffer& _buff) {
+
+    for (int i = __OldestSealed(); i >= 0; i = __OldestSealed()) {
+        Segment& segment = segments_[i];
+        _buff.Write(segment.ptr, segment.len);
+        memset(segment.ptr, 0, segment.len);
+        segment.len = 0;
+        segment.state = kSegmentFree;
+    }
     
-    if (is_compress_ && Z_NULL != cstream_.state) {
-        deflateEnd(&cstream_);
+    if (is_compress_) {
+        compress_->End();
     }
 
     if (log_crypt_->GetLogLen((char*)buff_.Ptr(), buff_.Length()) == 0){
@@ -102,34 +153,23 @@ bool LogBuffer::Write(const void* _data, size_t _length) {
     size_t write_len = _length;
     
     if (is_compress_) {
-        cstream_.avail_in = (uInt)_length;
-        cstream_.next_in = (Bytef*)_data;
-
-        uInt avail_out = (uInt)(buff_.MaxLength() - buff_.Length());
-        cstream_.next_out = (Bytef*)buff_.PosPtr();
-        cstream_.avail_out = avail_out;
-
-        if (Z_OK != deflate(&cstream_, Z_SYNC_FLUSH)) {
+        if (!compress_->Compress(_data, _length, buff_.PosPtr(), buff_.MaxLength() - buff_.Length(), write_len)) {
             return false;
         }
-
-        write_len = avail_out - cstream_.avail_out;
     } else {
         buff_.Write(_data, _length);
     }
     
     before_len -= remain_nocrypt_len_;
     
-    AutoBuffer out_buffer;
-    size_t last_remain_len = remain_nocrypt_len_;
-    log_crypt_->CryptAsyncLog((char*)buff_.Ptr() + before_len, write_len + remain_nocrypt_len_, out_buffer, remain_nocrypt_len_);
-    
-    buff_.Write(out_buffer.Ptr(), out_buffer.Length(), before_len);
+    size_t header_len = log_crypt_->GetHeaderLen();
+    size_t crypt_len = write_len + remain_nocrypt_len_;
+    log_crypt_->CryptAsyncLog((char*)buff_.Ptr() + header_len, before_len - header_len, crypt_len, remain_nocrypt_len_);
     
-    before_len += out_buffer.Length();
+    before_len += crypt_len;
     buff_.Length(before_len, before_len);
    
-    log_crypt_->UpdateLogLen((char*)buff_.Ptr(), (uint32_t)(out_buffer.Length() - last_remain_len));
+    log_crypt_->UpdateLogLen((char*)buff_.Ptr(), (uint32_t)write_len);
 
     return true;
 }
@@ -139,17 +179,12 @@ bool LogBuffer::__Reset() {
     __Clear();
     
     if (is_compress_) {
-        cstream_.zalloc = Z_NULL;
-        cstream_.zfree = Z_NULL;
-        cstream_.opaque = Z_NULL;
-        
-        if (Z_OK != deflateInit2(&cstream_, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY)) {
+        if (!compress_->Init()) {
             return false;
         }
-        
     }
     
-    log_crypt_->SetHeaderInfo((char*)buff_.Ptr(), is_compress_);
+    log_crypt_->SetHeaderInfo((char*)buff_.Ptr(), is_compress_, is_compress_ && kZstd == compress_->Mode());
     buff_.Length(log_crypt_->GetHeaderLen(), log_crypt_->GetHeaderLen());
 
     return true;
@@ -164,21 +199,109 @@ void LogBuffer::__Flush() {
 
 }
 
+// the bytes behind the block are zero already
 void LogBuffer::__Clear() {
-    memset(buff_.Ptr(), 0, buff_.MaxLength());
+    memset(buff_.Ptr(), 0, buff_.Length());
     buff_.Length(0, 0);
     remain_nocrypt_len_ = 0;
 }
 
 
-void LogBuffer::__Fix() {
+bool LogBuffer::__Fix() {
     uint32_t raw_log_len = 0;
     bool is_compress = false;
-    if (log_crypt_->Fix((char*)buff_.Ptr(), buff_.Length(), is_compress, raw_log_len)) {
+    if (log_crypt_->Fix((char*)buff_.Ptr(), buff_.Length(), is_compress, raw_log_len)
+            && raw_log_len + log_crypt_->GetHeaderLen() + log_crypt_->GetTailerLen() <= buff_.MaxLength()) {
         buff_.Length(raw_log_len + log_crypt_->GetHeaderLen(), raw_log_len + log_crypt_->GetHeaderLen());
-    } else {
-        buff_.Length(0, 0);
+        return true;
+    }
+
+    buff_.Length(0, 0);
+    return false;
+}
+
+void LogBuffer::__Activate(size_t _index) {
+    Segment& segment = segments_[_index];
+    segment.state = kSegmentActive;
+    active_ = _index;
+
+    buff_.Attach(segment.ptr, segment.len, segment.max_len);
+    buff_.Length(segment.len, segment.len);
+    segment.len = 0;
+    remain_nocrypt_len_ = 0;
+}
+
+int LogBuffer::__OldestSealed() const {
+    int oldest = -1;
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (kSegmentSealed != segments_[i].state) continue;
+        if (oldest < 0 || segments_[i].order < segments_[oldest].order) oldest = (int)i;
+    }
+    return oldest;
+}
+
+bool LogBuffer::Seal() {
+    if (log_crypt_->GetLogLen((char*)buff_.Ptr(), buff_.Length()) == 0) return false;
+
+    size_t next = active_;
+    for (size_t i = 1; i < segments_.size(); ++i) {
+        size_t index = (active_ + i) % segments_.size();
+        if (kSegmentFree == segments_[index].state) {
+            next = index;
+            break;
+        }
+    }
+    if (next == active_) return false;
+
+    if (is_compress_) {
+        compress_->End();
     }
 
+    __Flush();
+
+    Segment& segment = segments_[active_];
+    segment.len = buff_.Length();
+    segment.state = kSegmentSealed;
+    segment.order = ++seal_count_;
+
+    __Activate(next);
+    return true;
+}
+
+bool LogBuffer::TakeSealed(PtrBuffer& _segment) {
+    int oldest = __OldestSealed();
+    if (oldest < 0) return false;
+
+    Segment& segment = segments_[oldest];
+    segment.state = kSegmentTaken;
+    _segment.Attach(segment.ptr, segment.len);
+    return true;
+}
+
+void LogBuffer::Release(PtrBuffer& _segment) {
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        Segment& segment = segments_[i];
+        if (kSegmentTaken != segment.state || segment.ptr != _segment.Ptr()) continue;
+
+        memset(segment.ptr, 0, segment.len);
+        segment.len = 0;
+        segment.state = kSegmentFree;
+        break;
+    }
+    _segment.Reset();
+}
+
+bool LogBuffer::HasTaken() const {
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (kSegmentTaken == segments_[i].state) return true;
+    }
+    return false;
+}
+
+bool LogBuffer::Empty() const {
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (kSegmentSealed == segments_[i].state || kSegmentTaken == segments_[i].state) return false;
+    }
+    return 0 == log_crypt_->GetLogLen((char*)buff_.Ptr(), buff_.Length());
 }
 
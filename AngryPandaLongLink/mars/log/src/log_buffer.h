@@ -20,46 +20,85 @@
 #ifndef LOGBUFFER_H_
 #define LOGBUFFER_H_
 
-#include <zlib.h>
 #include <string>
+#include <vector>
 #include <stdint.h>
 
 #include "mars/comm/ptrbuffer.h"
 #include "mars/comm/autobuffer.h"
+#include "mars/log/appender.h"
 
 class LogCrypt;
+class LogCompress;
 
 class LogBuffer {
 public:
-    LogBuffer(void* _pbuffer, size_t _len, bool _is_compress, const char* _pubkey);
+    /*
+     * _pbuffer is split into _segment_count segments, each holds one log block. writes go to one segment while the
+     * sealed ones wait to be written out, so a flush does not keep the writers waiting. all of them are recovered
+     * after a crash.
+     */
+    LogBuffer(void* _pbuffer, size_t _len, bool _is_compress, const char* _pubkey, TCompressMode _compress_mode = kZlib, int _compress_level = 9,
+              TCipherMode _cipher_mode = kTea, size_t _segment_count = 1);
     ~LogBuffer();
     
 public:
     static bool GetPeriodLogs(const char* _log_path, int _begin_hour, int _end_hour, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg);
 
 public:
+    // the segment taking writes
     PtrBuffer& GetData();
     
+    // copies the sealed segments oldest first and then the one taking writes, and clears them. taken segments are left alone.
     void Flush(AutoBuffer& _buff);
     bool Write(const void* _data, size_t _inputlen, AutoBuffer& _out_buff);
     bool Write(const void* _data, size_t _length);
 
+    // finishes the block being written and moves the writes to a free segment. false if there is nothing to seal or no free segment.
+    bool Seal();
+    // hands out the oldest sealed segment to be written to the file, it stays in the buffer until Release
+    bool TakeSealed(PtrBuffer& _segment);
+    void Release(PtrBuffer& _segment);
+    bool HasTaken() const;
+    // nothing sealed, taken or written to the segment taking writes
+    bool Empty() const;
+
 private:
-    
+    enum TSegmentState {
+        kSegmentFree,
+        kSegmentActive,
+        kSegmentSealed,
+        kSegmentTaken,
+    };
+
+    struct Segment {
+        char* ptr;
+        size_t max_len;
+        size_t len;             // of a sealed block, the active one is in buff_
+        TSegmentState state;
+        uint64_t order;         // seal order
+    };
+
     bool __Reset();
     void __Flush();
     void __Clear();
     
-    void __Fix();
+    bool __Fix();
+    void __Activate(size_t _index);
+    int __OldestSealed() const;
 
 private:
     PtrBuffer buff_;
     bool is_compress_;
-    z_stream cstream_;
+    LogCompress* compress_;
     
     class LogCrypt* log_crypt_;
     size_t remain_nocrypt_len_;
 
+    std::vector<Segment> segments_;
+    size_t active_;
+    uint64_t seal_count_;
+
 };
 
 
@@ -0,0 +1,166 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * log_compress.h
+ *
+ * streaming compressors of LogBuffer. one stream per buffer block: Init when the block starts,
+ * Compress flushes every write so the block can be decoded after a crash, End when the block is flushed.
+ *
+ * zstd needs libzstd and is built with XLOG_WITH_ZSTD, otherwise Create falls back to zlib.
+ */
+
+#ifndef LOG_COMPRESS_H_
+#define LOG_COMPRESS_H_
+
+#include <string.h>
+#include <zlib.h>
+
+#ifdef XLOG_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "mars/log/appender.h"
+
+class LogCompress {
+  public:
+    virtual ~LogCompress() {}
+
+    static LogCompress* Create(TCompressMode _mode, int _level);
+
+  public:
+    virtual TCompressMode Mode() const = 0;
+    virtual bool Init() = 0;
+    // compresses all of _src into _dst and flushes, _written is the compressed length
+    virtual bool Compress(const void* _src, size_t _src_len, void* _dst, size_t _dst_len, size_t& _written) = 0;
+    virtual void End() = 0;
+};
+
+
+class LogZlibCompress : public LogCompress {
+  public:
+    explicit LogZlibCompress(int _level): level_(_level), in_stream_(false) {
+        memset(&cstream_, 0, sizeof(cstream_));
+    }
+
+    virtual ~LogZlibCompress() {
+        if (Z_NULL != cstream_.state) deflateEnd(&cstream_);
+    }
+
+  public:
+    virtual TCompressMode Mode() const { return kZlib; }
+
+    virtual bool Init() {
+        // the deflate state is kept across blocks, a free and a new allocation of it costs more than the flush itself
+        if (Z_NULL != cstream_.state) {
+            in_stream_ = Z_OK == deflateReset(&cstream_);
+            return in_stream_;
+        }
+
+        cstream_.zalloc = Z_NULL;
+        cstream_.zfree = Z_NULL;
+        cstream_.opaque = Z_NULL;
+
+        in_stream_ = Z_OK == deflateInit2(&cstream_, level_, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+        return in_stream_;
+    }
+
+    virtual bool Compress(const void* _src, size_t _src_len, void* _dst, size_t _dst_len, size_t& _written) {
+        if (!in_stream_) return false;
+
+        cstream_.avail_in = (uInt)_src_len;
+        cstream_.next_in = (Bytef*)_src;
+        cstream_.next_out = (Bytef*)_dst;
+        cstream_.avail_out = (uInt)_dst_len;
+
+        if (Z_OK != deflate(&cstream_, Z_SYNC_FLUSH)) {
+            return false;
+        }
+
+        _written = _dst_len - cstream_.avail_out;
+        return true;
+    }
+
+    virtual void End() {
+        in_stream_ = false;
+    }
+
+  private:
+    int level_;
+    z_stream cstream_;
+    bool in_stream_;
+};
+
+
+#ifdef XLOG_WITH_ZSTD
+class LogZstdCompress : public LogCompress {
+  public:
+    explicit LogZstdCompress(int _level): level_(_level), cctx_(ZSTD_createCCtx()), in_frame_(false) {}
+
+    virtual ~LogZstdCompress() {
+        if (NULL != cctx_) ZSTD_freeCCtx(cctx_);
+    }
+
+  public:
+    virtual TCompressMode Mode() const { return kZstd; }
+
+    virtual bool Init() {
+        if (NULL == cctx_) return false;
+
+        // the context is kept across blocks, only the frame starts over
+        ZSTD_CCtx_reset(cctx_, ZSTD_reset_session_only);
+        if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level_))) return false;
+
+        in_frame_ = true;
+        return true;
+    }
+
+    virtual bool Compress(const void* _src, size_t _src_len, void* _dst, size_t _dst_len, size_t& _written) {
+        if (!in_frame_) return false;
+
+        ZSTD_inBuffer input = {_src, _src_len, 0};
+        ZSTD_outBuffer output = {_dst, _dst_len, 0};
+
+        while (true) {
+            size_t remain = ZSTD_compressStream2(cctx_, &output, &input, ZSTD_e_flush);
+            if (ZSTD_isError(remain)) return false;
+            if (0 == remain) break;
+            if (output.pos == output.size) return false;
+        }
+
+        _written = output.pos;
+        return true;
+    }
+
+    virtual void End() {
+        in_frame_ = false;
+    }
+
+  private:
+    int level_;
+    ZSTD_CCtx* cctx_;
+    bool in_frame_;
+};
+#endif
+
+
+inline LogCompress* LogCompress::Create(TCompressMode _mode, int _level) {
+#ifdef XLOG_WITH_ZSTD
+    if (kZstd == _mode) return new LogZstdCompress(_level);
+#endif
+
+    if (kZstd == _mode || _level < Z_NO_COMPRESSION || _level > Z_BEST_COMPRESSION) _level = Z_BEST_COMPRESSION;
+    return new LogZlibCompress(_level);
+}
+
+#endif /* LOG_COMPRESS_H_ */
@@ -0,0 +1,252 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * log_file_writer.h
+ *
+ * the xlog file: a raw fd opened with O_APPEND and kept open between flushes. the space ahead is
+ * preallocated without changing the file size, so appends do not grow the file extent by extent.
+ * a batch of buffers goes out in one writev and is either written entirely or truncated away.
+ */
+
+#ifndef LOG_FILE_WRITER_H_
+#define LOG_FILE_WRITER_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && !defined(FALLOC_FL_KEEP_SIZE)
+#include <linux/falloc.h>
+#endif
+
+class LogFileWriter {
+  public:
+    struct Piece {
+        const void* data;
+        size_t len;
+    };
+
+    static const int kMaxPieces = 16;
+    static const uint64_t kPreallocateLength = 1024 * 1024;
+
+  public:
+    LogFileWriter(): fd_(-1), size_(0), prealloc_end_(0), can_preallocate_(true), dev_(0), ino_(0) {}
+    ~LogFileWriter() { Close(); }
+
+    bool Open(const char* _path) {
+        Close();
+
+#ifdef _WIN32
+        fd_ = _open(_path, _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        fd_ = open(_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+#endif
+        if (fd_ < 0) return false;
+
+        struct stat st;
+        if (0 != fstat(fd_, &st)) {
+            Close();
+            return false;
+        }
+
+        path_ = _path;
+        size_ = (uint64_t)st.st_size;
+        prealloc_end_ = size_;
+        can_preallocate_ = true;
+        dev_ = (uint64_t)st.st_dev;
+        ino_ = (uint64_t)st.st_ino;
+        return true;
+    }
+
+    void Close() {
+        if (fd_ < 0) return;
+
+        // gives back the preallocated space behind the data
+        if (prealloc_end_ > size_) {
+            struct stat st;
+            if (0 == fstat(fd_, &st)) __Truncate((uint64_t)st.st_size);
+        }
+
+#ifdef _WIN32
+        _close(fd_);
+#else
+        close(fd_);
+#endif
+        fd_ = -1;
+        path_.clear();
+        size_ = 0;
+        prealloc_end_ = 0;
+    }
+
+    bool IsOpen() const { return fd_ >= 0; }
+    const std::string& Path() const { return path_; }
+    uint64_t Size() const { return size_; }
+
+    // false if the path no longer leads to the open file, e.g. it was removed or moved away
+    bool IsSameFile() const {
+        if (fd_ < 0) return false;
+
+        struct stat st;
+        if (0 != stat(path_.c_str(), &st)) return false;
+        return dev_ == (uint64_t)st.st_dev && ino_ == (uint64_t)st.st_ino;
+    }
+
+    bool Write(const void* _data, size_t _len) {
+        Piece piece = {_data, _len};
+        return Write(&piece, 1);
+    }
+
+    // all or nothing, a partly written batch is truncated and errno is kept
+    bool Write(const Piece* _pieces, int _count) {
+        if (fd_ < 0) return false;
+        if (_count <= 0 || _count > kMaxPieces) {
+            errno = EINVAL;
+            return false;
+        }
+
+        uint64_t total = 0;
+        for (int i = 0; i < _count; ++i) total += _pieces[i].len;
+        if (0 == total) return true;
+
+        // where this batch starts, another process appending to the file moves the end under size_
+        struct stat st;
+        bool start_known = 0 == fstat(fd_, &st);
+        if (start_known) size_ = (uint64_t)st.st_size;
+
+        __Preallocate(size_ + total);
+
+        uint64_t written = 0;
+        int err = 0;
+
+#ifdef _WIN32
+        for (int i = 0; i < _count && 0 == err; ++i) {
+            const char* data = (const char*)_pieces[i].data;
+            size_t left = _pieces[i].len;
+            while (left > 0) {
+                int ret = _write(fd_, data, (unsigned int)left);
+                if (ret <= 0) { err = errno; break; }
+                data += ret;
+                left -= ret;
+                written += ret;
+            }
+        }
+#else
+        struct iovec iov[kMaxPieces];
+        int iovcnt = 0;
+        for (int i = 0; i < _count; ++i) {
+            if (0 == _pieces[i].len) continue;
+            iov[iovcnt].iov_base = (void*)_pieces[i].data;
+            iov[iovcnt].iov_len = _pieces[i].len;
+            ++iovcnt;
+        }
+
+        struct iovec* cur = iov;
+        while (iovcnt > 0) {
+            ssize_t ret = writev(fd_, cur, iovcnt);
+            if (ret < 0 && EINTR == errno) continue;
+            if (ret <= 0) { err = 0 == ret ? EIO : errno; break; }
+
+            written += ret;
+            while (iovcnt > 0 && (size_t)ret >= cur->iov_len) {
+                ret -= cur->iov_len;
+                ++cur;
+                --iovcnt;
+            }
+            if (iovcnt > 0) {
+                cur->iov_base = (char*)cur->iov_base + ret;
+                cur->iov_len -= ret;
+            }
+        }
+#endif
+
+        if (0 == err) {
+            size_ += written;
+            return true;
+        }
+
+        if (0 < written && start_known) __Truncate(size_);
+        errno = err;
+        return false;
+    }
+
+    void Sync() {
+        if (fd_ < 0) return;
+#if defined(_WIN32)
+        _commit(fd_);
+#elif defined(__APPLE__)
+        fsync(fd_);
+#else
+        fdatasync(fd_);
+#endif
+    }
+
+  private:
+    void __Truncate(uint64_t _size) {
+#ifdef _WIN32
+        _chsize(fd_, (long)_size);
+#else
+        ftruncate(fd_, (off_t)_size);
+#endif
+    }
+
+    // a file system without preallocation is not asked again
+    void __Preallocate(uint64_t _end) {
+        if (!can_preallocate_ || _end <= prealloc_end_) return;
+
+        uint64_t end = (_end + kPreallocateLength - 1) / kPreallocateLength * kPreallocateLength;
+
+#if defined(__linux__) && (!defined(__ANDROID__) || __ANDROID_API__ >= 21)
+        if (0 != fallocate(fd_, FALLOC_FL_KEEP_SIZE, (off_t)size_, (off_t)(end - size_))) {
+            can_preallocate_ = false;
+            return;
+        }
+#elif defined(__APPLE__)
+        fstore_t store = {F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t)(end - prealloc_end_), 0};
+        if (-1 == fcntl(fd_, F_PREALLOCATE, &store)) {
+            can_preallocate_ = false;
+            return;
+        }
+#else
+        can_preallocate_ = false;
+        return;
+#endif
+        prealloc_end_ = end;
+    }
+
+  private:
+    LogFileWriter(const LogFileWriter&);
+    LogFileWriter& operator=(const LogFileWriter&);
+
+  private:
+    int fd_;
+    std::string path_;
+    uint64_t size_;
+    uint64_t prealloc_end_;
+    bool can_preallocate_;
+    uint64_t dev_;
+    uint64_t ino_;
+};
+
+#endif /* LOG_FILE_WRITER_H_ */
@@ -0,0 +1,274 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * log_staging_ring.h
+ *
+ * multi-producer single-consumer ring of raw log records. logging threads reserve room with a
+ * cas on the write cursor and copy XLoggerInfo and the strings in without any lock, the async log
+ * thread drains the records in reservation order and does formatting, compression and crypt.
+ */
+
+#ifndef LOG_STAGING_RING_H_
+#define LOG_STAGING_RING_H_
+
+#include <string.h>
+#include <stdint.h>
+
+#include "boost/atomic.hpp"
+
+#include "mars/comm/xlogger/xloggerbase.h"
+
+class LogStagingRing {
+  public:
+    static const uint32_t kMaxStringLength = 1024;
+    static const uint32_t kMaxBodyLength = 16 * 1024;
+
+    // _capacity must be power of 2
+    explicit LogStagingRing(uint32_t _capacity)
+        : buffer_(new char[_capacity]), capacity_(_capacity), head_(0), tail_(0) {
+        memset(buffer_, 0, capacity_);
+    }
+
+    ~LogStagingRing() { delete[] buffer_; }
+
+    // any thread. returns false and writes nothing when there is no room.
+    // _was_empty tells whether the consumer may be waiting for this record.
+    bool Push(const XLoggerInfo* _info, const char* _log, bool& _was_empty) {
+        size_t len = NULL == _log ? 0 : strnlen(_log, kMaxBodyLength);
+        return __Push(_info, _log, len, false, _was_empty);
+    }
+
+    // binlog record, _data is copied as is
+    bool PushBinary(const XLoggerInfo* _info, const void* _data, size_t _len, bool& _was_empty) {
+        if (NULL == _data || _len > kMaxBodyLength) return false;
+        return __Push(_info, (const char*)_data, _len, true, _was_empty);
+    }
+
+    // single consumer. hands every committed record to _func or _bin_func in reservation order and stops at
+    // the first one still being written. returns the number of records handed out.
+    size_t Drain(xlogger_appender_t _func, xlogger_bin_appender_t _bin_func) {
+        uint32_t head = head_.load(boost::memory_order_relaxed);
+        uint32_t tail = tail_.load(boost::memory_order_acquire);
+        size_t count = 0;
+
+        while (head != tail) {
+            Header* header = __HeaderAt(head);
+            uint32_t state = __State(header).load(boost::memory_order_acquire);
+
+            if (kEmpty == state) break;
+
+            uint32_t length = header->length;
+
+            if (kCommitted == state) {
+                __Dispatch(header, _func, _bin_func);
+                ++count;
+            }
+
+            // a consumed record may hold a header position of the next round, it must read as empty
+            __State(header).store(kEmpty, boost::memory_order_relaxed);
+            memset((char*)header + sizeof(uint32_t), 0, length - sizeof(uint32_t));
+
+            head += length;
+            head_.store(head, boost::memory_order_release);
+        }
+
+        return count;
+    }
+
+    // single consumer. throws away the oldest committed record, and the padding before it, to make room without
+    // formatting anything. returns false when the oldest record is still being written or the ring is empty.
+    bool DropOldest(uint32_t& _dropped_len) {
+        uint32_t head = head_.load(boost::memory_order_relaxed);
+        uint32_t tail = tail_.load(boost::memory_order_acquire);
+        _dropped_len = 0;
+
+        while (head != tail) {
+            Header* header = __HeaderAt(head);
+            uint32_t state = __State(header).load(boost::memory_order_acquire);
+
+            if (kEmpty == state) return false;
+
+            uint32_t length = header->length;
+            __State(header).store(kEmpty, boost::memory_order_relaxed);
+            memset((char*)header + sizeof(uint32_t), 0, length - sizeof(uint32_t));
+
+            head += length;
+            head_.store(head, boost::memory_order_release);
+
+            if (kCommitted == state) {
+                _dropped_len = length;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool Empty() const { return head_.load(boost::memory_order_acquire) == tail_.load(boost::memory_order_acquire); }
+    uint32_t Size() const { return tail_.load(boost::memory_order_acquire) - head_.load(boost::memory_order_acquire); }
+    uint32_t Capacity() const { return capacity_; }
+
+  private:
+    enum { kTag, kFileName, kFuncName, kBodyString, kStringCount };
+    enum { kEmpty = 0, kCommitted, kPadding };
+
+    static const uint32_t kAlign = 8;
+    static const uint16_t kNullString = 0xFFFF;
+
+    struct Header {
+        uint32_t state;
+        uint32_t length;
+    };
+
+    struct Payload {
+        int64_t tv_sec;
+        int64_t tv_usec;
+        int64_t pid;
+        int64_t tid;
+        int64_t maintid;
+        int32_t level;
+        int32_t line;
+        uint16_t length[kStringCount];
+        uint32_t has_info;
+        uint32_t is_binary;
+    };
+
+    bool __Push(const XLoggerInfo* _info, const char* _body, size_t _body_len, bool _is_binary, bool& _was_empty) {
+        const char* strs[kStringCount] = {NULL, NULL, NULL, _body};
+        if (NULL != _info) {
+            strs[kTag] = _info->tag;
+            strs[kFileName] = _info->filename;
+            strs[kFuncName] = _info->func_name;
+        }
+
+        Payload payload;
+        memset(&payload, 0, sizeof(payload));
+        payload.is_binary = _is_binary ? 1 : 0;
+        uint32_t size = sizeof(Header) + sizeof(Payload);
+
+        for (int i = 0; i < kStringCount; ++i) {
+            if (NULL == strs[i]) {
+                payload.length[i] = kNullString;
+                continue;
+            }
+            payload.length[i] = (uint16_t)(kBodyString == i ? _body_len : strnlen(strs[i], kMaxStringLength));
+            size += payload.length[i] + 1;
+        }
+        size = (size + kAlign - 1) & ~(kAlign - 1);
+
+        if (size > capacity_ / 2) return false;
+
+        uint32_t tail = tail_.load(boost::memory_order_relaxed);
+        uint32_t pad = 0;
+
+        while (true) {
+            uint32_t head = head_.load(boost::memory_order_acquire);
+            uint32_t offset = tail & (capacity_ - 1);
+            pad = offset + size > capacity_ ? capacity_ - offset : 0;
+
+            if (tail - head + pad + size > capacity_) return false;
+
+            if (tail_.compare_exchange_weak(tail, tail + pad + size, boost::memory_order_relaxed)) {
+                _was_empty = (tail == head);
+                break;
+            }
+        }
+
+        // record would cross the end, the tail of the buffer is skipped by the consumer
+        if (0 != pad) {
+            Header* header = __HeaderAt(tail);
+            header->length = pad;
+            __State(header).store(kPadding, boost::memory_order_release);
+            tail += pad;
+        }
+
+        if (NULL != _info) {
+            payload.has_info = 1;
+            payload.level = _info->level;
+            payload.line = _info->line;
+            payload.tv_sec = _info->timeval.tv_sec;
+            payload.tv_usec = _info->timeval.tv_usec;
+            payload.pid = _info->pid;
+            payload.tid = _info->tid;
+            payload.maintid = _info->maintid;
+        }
+
+        Header* header = __HeaderAt(tail);
+        memcpy(header + 1, &payload, sizeof(payload));
+
+        char* str = (char*)(header + 1) + sizeof(payload);
+        for (int i = 0; i < kStringCount; ++i) {
+            if (kNullString == payload.length[i]) continue;
+            memcpy(str, strs[i], payload.length[i]);
+            str[payload.length[i]] = '\0';
+            str += payload.length[i] + 1;
+        }
+
+        header->length = size;
+        __State(header).store(kCommitted, boost::memory_order_release);
+        return true;
+    }
+
+    Header* __HeaderAt(uint32_t _pos) const { return (Header*)(buffer_ + (_pos & (capacity_ - 1))); }
+    static boost::atomic<uint32_t>& __State(Header* _header) { return *reinterpret_cast<boost::atomic<uint32_t>*>(&_header->state); }
+
+    static void __Dispatch(const Header* _header, xlogger_appender_t _func, xlogger_bin_appender_t _bin_func) {
+        Payload payload;
+        memcpy(&payload, _header + 1, sizeof(payload));
+
+        const char* strs[kStringCount] = {NULL, NULL, NULL, NULL};
+        const char* str = (const char*)(_header + 1) + sizeof(payload);
+
+        for (int i = 0; i < kStringCount; ++i) {
+            if (kNullString == payload.length[i]) continue;
+            strs[i] = str;
+            str += payload.length[i] + 1;
+        }
+
+        if (0 == payload.has_info) {
+            if (0 == payload.is_binary) _func(NULL, strs[kBodyString]);
+            return;
+        }
+
+        XLoggerInfo info;
+        memset(&info, 0, sizeof(info));
+        info.level = (TLogLevel)payload.level;
+        info.tag = strs[kTag];
+        info.filename = strs[kFileName];
+        info.func_name = strs[kFuncName];
+        info.line = payload.line;
+        info.timeval.tv_sec = (time_t)payload.tv_sec;
+        info.timeval.tv_usec = (long)payload.tv_usec;
+        info.pid = (intmax_t)payload.pid;
+        info.tid = (intmax_t)payload.tid;
+        info.maintid = (intmax_t)payload.maintid;
+
+        if (0 == payload.is_binary) _func(&info, strs[kBodyString]);
+        else _bin_func(&info, strs[kBodyString], payload.length[kBodyString]);
+    }
+
+  private:
+    LogStagingRing(const LogStagingRing&);
+    LogStagingRing& operator=(const LogStagingRing&);
+
+  private:
+    char* buffer_;
+    const uint32_t capacity_;
+
+    boost::atomic<uint32_t> head_;
+    char padding_[64];  // keep the consumer cursor off the producers' cache line
+    boost::atomic<uint32_t> tail_;
+};
+
+#endif /* LOG_STAGING_RING_H_ */
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/xlogger/xloggerbase.h"
+#include "mars/comm/xlogger/loginfo_extract.h"
+#include "mars/comm/ptrbuffer.h"
+#include "mars/comm/time_utils.h"
+
+extern void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log);
+
+
+namespace
+{
+
+static const int kLineCount = 1000 * 1000;
+
+static XLoggerInfo __MakeInfo(const timeval& _tv)
+{
+	XLoggerInfo info;
+	memset(&info, 0, sizeof(info));
+	info.level = kLevelInfo;
+	info.tag = "mars::stn";
+	info.filename = "/home/mars/stn/src/longlink.cc";
+	info.func_name = "void LongLink::__RunReadWrite(SOCKET, SOCKET&, ErrCmdType&, int&, ConnectProfile&)";
+	info.line = 512;
+	info.timeval = _tv;
+	info.pid = 1234;
+	info.tid = 5678;
+	info.maintid = 1234;
+	return info;
+}
+
+// the header as log_formater rendered it with localtime and snprintf on every line
+static void __SnprintfFormater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log)
+{
+	const char* filename = ExtractFileName(_info->filename);
+	char strFuncName [128] = {0};
+	ExtractFunctionName(_info->func_name, strFuncName, sizeof(strFuncName));
+
+	char temp_time[64] = {0};
+	time_t sec = _info->timeval.tv_sec;
+	tm tm = *localtime((const time_t*)&sec);
+	snprintf(temp_time, sizeof(temp_time), "%d-%02d-%02d %+.1f %02d:%02d:%02d.%.3d", 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
+			 tm.tm_gmtoff / 3600.0, tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(_info->timeval.tv_usec / 1000));
+
+	int ret = snprintf((char*)_log.PosPtr(), 1024, "[%s][%s][%" PRIdMAX ", %" PRIdMAX "%s][%s][%s, %s, %d][",
+					   "I", temp_time, _info->pid, _info->tid, _info->tid == _info->maintid ? "*" : "", _info->tag ? _info->tag : "",
+					   filename, strFuncName, _info->line);
+	_log.Length(_log.Pos() + ret, _log.Length() + ret);
+	_log.Write(_logbody, strlen(_logbody));
+	_log.Write("\n", 1);
+}
+
+}
+
+TEST(Formater_benchmark, SameOutputAsSnprintf)
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+
+	for (int i = 0; i < 3000; ++i) {
+		tv.tv_usec = (tv.tv_usec + 7919) % 1000000;
+		if (0 == i % 100) ++tv.tv_sec;
+
+		XLoggerInfo info = __MakeInfo(tv);
+		info.tid = i % 2 ? info.maintid : -i;
+		info.line = i * 37;
+
+		char expect_buf[16 * 1024] = {0};
+		PtrBuffer expect(expect_buf, 0, sizeof(expect_buf));
+		__SnprintfFormater(&info, "onResp, taskid:42", expect);
+
+		char actual_buf[16 * 1024] = {0};
+		PtrBuffer actual(actual_buf, 0, sizeof(actual_buf));
+		log_formater(&info, "onResp, taskid:42", actual);
+
+		ASSERT_EQ(std::string((const char*)expect.Ptr(), expect.Length()), std::string((const char*)actual.Ptr(), actual.Length()));
+	}
+}
+
+TEST(Formater_benchmark, FormatedLinesPerSecond)
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	XLoggerInfo info = __MakeInfo(tv);
+	char buf[16 * 1024];
+
+	uint64_t start = ::gettickcount();
+	for (int i = 0; i < kLineCount; ++i) {
+		info.timeval.tv_usec = (i * 13) % 1000000;
+		PtrBuffer log(buf, 0, sizeof(buf));
+		__SnprintfFormater(&info, "onResp, taskid:42", log);
+	}
+	uint64_t snprintf_cost = ::gettickspan(start);
+
+	start = ::gettickcount();
+	for (int i = 0; i < kLineCount; ++i) {
+		info.timeval.tv_usec = (i * 13) % 1000000;
+		PtrBuffer log(buf, 0, sizeof(buf));
+		log_formater(&info, "onResp, taskid:42", log);
+	}
+	uint64_t cached_cost = ::gettickspan(start);
+
+	printf("format %d lines: localtime+snprintf %llu ms (%.0f lines/s), cached %llu ms (%.0f lines/s)\n", kLineCount,
+		(unsigned long long)snprintf_cost, kLineCount * 1000.0 / (snprintf_cost ? snprintf_cost : 1),
+		(unsigned long long)cached_cost, kLineCount * 1000.0 / (cached_cost ? cached_cost : 1));
+
+	EXPECT_LE(cached_cost, snprintf_cost);
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/ptrbuffer.h"
+#include "mars/comm/autobuffer.h"
+#include "../src/log_buffer.h"
+#include "../crypt/log_crypt.h"
+
+
+namespace
+{
+
+static const size_t kBufferBlockLength = 150 * 1024;
+static const int kFlushCount = 2000;
+
+static uint64_t __NowNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void __FillThird(LogBuffer& _log_buff, unsigned int& _seed)
+{
+	char line[256];
+	while (_log_buff.GetData().Length() < kBufferBlockLength / 3) {
+		_seed = _seed * 1103515245 + 12345;
+		int len = snprintf(line, sizeof(line), "[I][2017-11-02 +8.0 17:54:02.%03u][4123, 4127][mars::stn][longlink.cc, __RunReadWrite, 512][task socket send sock:%u, nread:%u, seq:%u\n",
+			_seed % 1000, (_seed >> 8) % 100, (_seed >> 12) % 4096, _seed);
+		ASSERT_TRUE(_log_buff.Write(line, len));
+	}
+}
+
+static void __Report(const char* _name, std::vector<uint64_t>& _ns)
+{
+	std::sort(_ns.begin(), _ns.end());
+	printf("%-34s p50 %6.1f us, p99 %6.1f us, max %6.1f us\n", _name, _ns[_ns.size() / 2] / 1000.0, _ns[_ns.size() * 99 / 100] / 1000.0, _ns.back() / 1000.0);
+}
+
+}
+
+TEST(LogBuffer_benchmark, RecoversEverySegment)
+{
+	std::vector<char> memory(kBufferBlockLength * 2, 0);
+	const char* line = "a line\n";
+
+	{
+		LogBuffer log_buff(&memory[0], memory.size(), true, NULL, kZlib, 6, kTea, 2);
+
+		// the second segment gets the older block, recovery goes by seq and not by place
+		ASSERT_TRUE(log_buff.Write(line, strlen(line)));
+		ASSERT_TRUE(log_buff.Seal());
+		PtrBuffer segment;
+		ASSERT_TRUE(log_buff.TakeSealed(segment));
+		log_buff.Release(segment);
+
+		ASSERT_TRUE(log_buff.Write(line, strlen(line)));
+		ASSERT_TRUE(log_buff.Seal());
+		ASSERT_TRUE(log_buff.Write(line, strlen(line)));
+		EXPECT_FALSE(log_buff.Seal());  // the sealed block is still waiting, no segment is free
+		// crash: nothing is written out
+	}
+
+	LogBuffer recovered(&memory[0], memory.size(), true, NULL, kZlib, 6, kTea, 2);
+	AutoBuffer out;
+	recovered.Flush(out);
+
+	const char* data = (const char*)out.Ptr();
+	ASSERT_GT(out.Length(), (size_t)LogCrypt::GetHeaderLen());
+	size_t first_len = LogCrypt::GetHeaderLen() + LogCrypt::GetLogLen(data, out.Length()) + LogCrypt::GetTailerLen();
+	ASSERT_LT(first_len + LogCrypt::GetHeaderLen(), out.Length());
+	size_t second_len = LogCrypt::GetHeaderLen() + LogCrypt::GetLogLen(data + first_len, out.Length() - first_len) + LogCrypt::GetTailerLen();
+	EXPECT_EQ(out.Length(), first_len + second_len);
+	EXPECT_EQ(1, (int16_t)(LogCrypt::GetSeq(data + first_len, second_len) - LogCrypt::GetSeq(data, first_len)));
+
+	// everything is free again and nothing comes out twice
+	AutoBuffer again;
+	recovered.Flush(again);
+	EXPECT_EQ(0u, again.Length());
+	EXPECT_FALSE(recovered.HasTaken());
+}
+
+TEST(LogBuffer_benchmark, TakenSegmentStaysUntilRelease)
+{
+	std::vector<char> memory(kBufferBlockLength * 2, 0);
+	LogBuffer log_buff(&memory[0], memory.size(), true, NULL, kZlib, 6, kTea, 2);
+
+	const char* line = "a line\n";
+	EXPECT_TRUE(log_buff.Empty());
+	ASSERT_TRUE(log_buff.Write(line, strlen(line)));
+	EXPECT_FALSE(log_buff.Empty());
+	ASSERT_TRUE(log_buff.Seal());
+
+	PtrBuffer segment;
+	ASSERT_TRUE(log_buff.TakeSealed(segment));
+	EXPECT_TRUE(log_buff.HasTaken());
+	EXPECT_FALSE(log_buff.TakeSealed(segment));
+
+	// a flush of the rest leaves the taken segment alone
+	ASSERT_TRUE(log_buff.Write(line, strlen(line)));
+	AutoBuffer out;
+	log_buff.Flush(out);
+	EXPECT_GT(out.Length(), 0u);
+	EXPECT_TRUE(log_buff.HasTaken());
+	EXPECT_FALSE(log_buff.Empty());
+
+	ASSERT_TRUE(NULL != segment.Ptr());
+	log_buff.Release(segment);
+	EXPECT_FALSE(log_buff.HasTaken());
+	EXPECT_TRUE(NULL == segment.Ptr());
+	EXPECT_TRUE(log_buff.Empty());
+}
+
+// the part of a flush done under sg_mutex_buffer_async, where the writers wait
+TEST(LogBuffer_benchmark, FlushStallUnderLock)
+{
+	std::vector<char> memory(kBufferBlockLength * 2, 0);
+	unsigned int seed = 7919;
+
+	std::vector<uint64_t> single_ns;
+	{
+		LogBuffer log_buff(&memory[0], kBufferBlockLength, true, NULL, kZlib, 6);
+		for (int i = 0; i < kFlushCount; ++i) {
+			__FillThird(log_buff, seed);
+
+			uint64_t begin = __NowNs();
+			AutoBuffer tmp;
+			log_buff.Flush(tmp);
+			single_ns.push_back(__NowNs() - begin);
+		}
+	}
+
+	std::vector<uint64_t> seal_ns;
+	std::vector<uint64_t> release_ns;
+	{
+		LogBuffer log_buff(&memory[0], memory.size(), true, NULL, kZlib, 6, kTea, 2);
+		for (int i = 0; i < kFlushCount; ++i) {
+			__FillThird(log_buff, seed);
+
+			uint64_t begin = __NowNs();
+			PtrBuffer segment;
+			ASSERT_TRUE(log_buff.Seal());
+			ASSERT_TRUE(log_buff.TakeSealed(segment));
+			seal_ns.push_back(__NowNs() - begin);
+
+			begin = __NowNs();
+			log_buff.Release(segment);
+			release_ns.push_back(__NowNs() - begin);
+		}
+	}
+
+	__Report("1 segment, Flush (copy + memset)", single_ns);
+	__Report("2 segments, Seal + TakeSealed", seal_ns);
+	__Report("2 segments, Release", release_ns);
+
+	EXPECT_LT(seal_ns[seal_ns.size() * 99 / 100], single_ns[single_ns.size() * 99 / 100]);
+}
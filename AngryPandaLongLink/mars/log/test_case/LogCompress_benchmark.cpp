@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/xlogger/xloggerbase.h"
+#include "mars/comm/ptrbuffer.h"
+#include "mars/comm/autobuffer.h"
+#include "../src/log_buffer.h"
+
+extern void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log);
+
+
+namespace
+{
+
+static const size_t kBufferBlockLength = 150 * 1024;
+static const int kLineCount = 300 * 1000;
+
+struct LineTemplate {
+	const char* tag;
+	const char* filename;
+	const char* func_name;
+	int line;
+	const char* format;
+};
+
+static const LineTemplate kTemplates[] = {
+	{"mars::stn", "/home/mars/stn/src/longlink.cc", "void LongLink::__RunReadWrite(SOCKET, SOCKET&, ErrCmdType&, int&, ConnectProfile&)", 512,
+		"task socket send sock:%d, nread:%d, seq:%u, len:%d, cmdid:%d, hang:%d"},
+	{"mars::stn", "/home/mars/stn/src/longlink_task_manager.cc", "void LongLinkTaskManager::__OnResponse(ErrCmdType, int, uint32_t, uint32_t, AutoBuffer&, AutoBuffer&, const ConnectProfile&)", 733,
+		"task end callback long cmdid:%d, err(%d, %d), taskid:%u, cost:%dms, svr:%d.%d.%d.%d:%d"},
+	{"mars::stn", "/home/mars/stn/src/net_core.cc", "void NetCore::StartTask(const Task&)", 254,
+		"task start long short taskid:%u, cmdid:%d, need_authed:%d, cgi:/cgi-bin/micromsg-bin/newsync, channel_select:%d"},
+	{"mars::comm", "/home/mars/comm/socket/complexconnect.cc", "SOCKET ComplexConnect::ConnectImpatient(const std::vector<socket_address>&, SocketBreaker&, MComplexConnect*)", 388,
+		"index:%d, sock:%d, nonblock connect ret:%d, errno:%d, ip:%d.%d.%d.%d, port:%d"},
+	{"app", "/home/app/src/session.cpp", "void Session::OnHeartbeat()", 91,
+		"heartbeat interval:%dms, last recv %u ms ago, noop seq:%u"},
+};
+
+static std::vector<std::string> __MakeTraffic()
+{
+	std::vector<std::string> lines;
+	lines.reserve(kLineCount);
+
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	unsigned int seed = 7919;
+	char body[512];
+	char buf[16 * 1024];
+
+	for (int i = 0; i < kLineCount; ++i) {
+		seed = seed * 1103515245 + 12345;
+		const LineTemplate& t = kTemplates[(seed >> 16) % (sizeof(kTemplates) / sizeof(kTemplates[0]))];
+
+		tv.tv_usec += 50 + (seed >> 20) % 3000;
+		if (tv.tv_usec >= 1000000) { tv.tv_usec -= 1000000; ++tv.tv_sec; }
+
+		snprintf(body, sizeof(body), t.format, (int)(seed % 100), (int)(seed >> 8) % 1000 - 500, (unsigned int)i, (int)(seed >> 12) % 4096,
+				 (int)(seed % 7), (int)(seed >> 3) % 2, 10, 16, (int)(seed >> 24), 80, 8080);
+
+		XLoggerInfo info;
+		memset(&info, 0, sizeof(info));
+		info.level = (TLogLevel)(kLevelDebug + (seed >> 4) % 3);
+		info.tag = t.tag;
+		info.filename = t.filename;
+		info.func_name = t.func_name;
+		info.line = t.line;
+		info.timeval = tv;
+		info.pid = 4123;
+		info.tid = 0 == (seed >> 5) % 3 ? 4123 : 4123 + (int)(seed >> 6) % 8;
+		info.maintid = 4123;
+
+		PtrBuffer log(buf, 0, sizeof(buf));
+		log_formater(&info, body, log);
+		lines.push_back(std::string((const char*)log.Ptr(), log.Length()));
+	}
+
+	return lines;
+}
+
+// writes the traffic the way the async appender does: one Write per line, flushed at 1/3 of the block
+static void __Run(const std::vector<std::string>& _lines, TCompressMode _mode, int _level, const char* _name)
+{
+	char* block = new char[kBufferBlockLength];
+	memset(block, 0, kBufferBlockLength);
+	LogBuffer* log_buff = new LogBuffer(block, kBufferBlockLength, true, NULL, _mode, _level);
+
+	size_t raw_len = 0;
+	size_t compressed_len = 0;
+	AutoBuffer out;
+
+	clock_t start = clock();
+	for (size_t i = 0; i < _lines.size(); ++i) {
+		ASSERT_TRUE(log_buff->Write(_lines[i].data(), _lines[i].size()));
+		raw_len += _lines[i].size();
+
+		if (log_buff->GetData().Length() >= kBufferBlockLength / 3) {
+			log_buff->Flush(out);
+			compressed_len += out.Length();
+			out.Reset();
+		}
+	}
+	log_buff->Flush(out);
+	compressed_len += out.Length();
+	double cpu_ms = (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+	double raw_mb = raw_len / 1024.0 / 1024.0;
+	printf("%-8s level %3d: %.1f MB -> %.2f MB, ratio %.2f, cpu %.1f ms/MB (%.0f MB/s)\n", _name, _level, raw_mb,
+		compressed_len / 1024.0 / 1024.0, (double)raw_len / compressed_len, cpu_ms / raw_mb, raw_mb * 1000.0 / (cpu_ms > 0 ? cpu_ms : 1));
+
+	delete log_buff;
+	delete[] block;
+
+	EXPECT_LT(compressed_len, raw_len);
+}
+
+}
+
+TEST(LogCompress_benchmark, CpuPerMBAndRatio)
+{
+	std::vector<std::string> lines = __MakeTraffic();
+
+	__Run(lines, kZlib, 9, "zlib");
+	__Run(lines, kZlib, 6, "zlib");
+	__Run(lines, kZlib, 1, "zlib");
+#ifdef XLOG_WITH_ZSTD
+	__Run(lines, kZstd, 3, "zstd");
+	__Run(lines, kZstd, 1, "zstd");
+	__Run(lines, kZstd, -1, "zstd");
+	__Run(lines, kZstd, -5, "zstd");
+#endif
+}
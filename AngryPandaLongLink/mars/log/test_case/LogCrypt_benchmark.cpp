@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/autobuffer.h"
+#include "../crypt/log_crypt.h"
+#include "../crypt/chacha20.h"
+
+
+namespace
+{
+
+static const char* kPubKey = "572d1e2710ae5fbca54c76a382fdd44050b3a675cb2bf39feebe85ef63d947aff0fa4943f1112e8b6af34bebebbaefa1a0aae055d9259b89a1858f7cc9af9df1";
+
+static const size_t kBlockBodyLength = 50 * 1024;
+static const size_t kTotalLength = 64 * 1024 * 1024;
+
+static void __TeaEncrypt(uint32_t* v, uint32_t* k)
+{
+	uint32_t v0=v[0], v1=v[1], sum=0, i;
+	const static uint32_t delta=0x9e3779b9;
+	uint32_t k0=k[0], k1=k[1], k2=k[2], k3=k[3];
+	for (i=0; i < 16; i++) {
+		sum += delta;
+		v0 += ((v1<<4) + k0) ^ (v1 + sum) ^ ((v1>>5) + k1);
+		v1 += ((v0<<4) + k2) ^ (v0 + sum) ^ ((v0>>5) + k3);
+	}
+	v[0]=v0; v[1]=v1;
+}
+
+// CryptAsyncLog as it was: crypt into a new AutoBuffer and copy it back over the block
+static void __OldCryptAsyncLog(char* _block, size_t _before_len, size_t _input_len, size_t& _remain_nocrypt_len, uint32_t* _key)
+{
+	AutoBuffer out_buffer;
+	out_buffer.AllocWrite(_input_len);
+
+	uint32_t tmp[2] = {0};
+	size_t cnt = _input_len / 8;
+	_remain_nocrypt_len = _input_len % 8;
+
+	for (size_t i = 0; i < cnt; ++i) {
+		memcpy(tmp, _block + _before_len + i * 8, 8);
+		__TeaEncrypt(tmp, _key);
+		memcpy((char*)out_buffer.Ptr() + i * 8, tmp, 8);
+	}
+	memcpy((char*)out_buffer.Ptr() + _input_len - _remain_nocrypt_len, _block + _before_len + _input_len - _remain_nocrypt_len, _remain_nocrypt_len);
+
+	memcpy(_block + _before_len, out_buffer.Ptr(), out_buffer.Length());
+}
+
+// compressed lines are a few dozen bytes each
+static size_t __NextWriteLength(unsigned int& _seed)
+{
+	_seed = _seed * 1103515245 + 12345;
+	return 20 + (_seed >> 16) % 80;
+}
+
+static double __CostMsPerMB(clock_t _start)
+{
+	return (clock() - _start) * 1000.0 / CLOCKS_PER_SEC / (kTotalLength / 1024.0 / 1024.0);
+}
+
+static double __RunLogCrypt(bool _is_chacha20, char* _block)
+{
+	LogCrypt crypt(kPubKey, _is_chacha20);
+	unsigned int seed = 7919;
+	size_t total = 0;
+
+	clock_t start = clock();
+	while (total < kTotalLength) {
+		crypt.SetHeaderInfo(_block, true);
+		char* body = _block + LogCrypt::GetHeaderLen();
+		size_t len = 0;
+		size_t remain = 0;
+
+		while (len < kBlockBodyLength) {
+			size_t write_len = __NextWriteLength(seed);
+			size_t before_len = len - remain;
+			size_t crypt_len = write_len + remain;
+			crypt.CryptAsyncLog(body, before_len, crypt_len, remain);
+			len = before_len + crypt_len;
+		}
+		total += len;
+	}
+	return __CostMsPerMB(start);
+}
+
+}
+
+TEST(LogCrypt_benchmark, ChaCha20Rfc7539)
+{
+	uint8_t key[32];
+	for (int i = 0; i < 32; ++i) key[i] = (uint8_t)i;
+	uint8_t nonce[12] = {0, 0, 0, 0, 0, 0, 0, 0x4a, 0, 0, 0, 0};
+
+	const char* plain = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+	const uint8_t expect[] = {
+		0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+		0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+		0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+		0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+		0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+		0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+		0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+		0x87, 0x4d,
+	};
+	size_t len = strlen(plain);
+	ASSERT_EQ(sizeof(expect), len);
+
+	// block counter 1 is stream position 64, fed in uneven pieces
+	uint8_t data[128];
+	memcpy(data, plain, len);
+	ChaCha20 chacha20;
+	chacha20.Init(key, nonce);
+	chacha20.Xor(64, data, 3);
+	chacha20.Xor(64 + 3, data + 3, 61);
+	chacha20.Xor(64 + 64, data + 64, len - 64);
+	EXPECT_EQ(0, memcmp(expect, data, len));
+
+	// and back, out of order
+	chacha20.Xor(64 + 100, data + 100, len - 100);
+	chacha20.Xor(64, data, 100);
+	EXPECT_EQ(0, memcmp(plain, data, len));
+}
+
+TEST(LogCrypt_benchmark, CryptCpuPerMB)
+{
+	char* block = new char[LogCrypt::GetHeaderLen() + kBlockBodyLength + 1024];
+	memset(block, 'x', LogCrypt::GetHeaderLen() + kBlockBodyLength + 1024);
+
+	uint32_t key[4] = {0x01234567, 0x89abcdef, 0xfedcba98, 0x76543210};
+	unsigned int seed = 7919;
+	size_t total = 0;
+
+	clock_t start = clock();
+	while (total < kTotalLength) {
+		size_t len = 0;
+		size_t remain = 0;
+		while (len < kBlockBodyLength) {
+			size_t write_len = __NextWriteLength(seed);
+			size_t before_len = len - remain;
+			size_t crypt_len = write_len + remain;
+			__OldCryptAsyncLog(block, before_len, crypt_len, remain, key);
+			len = before_len + crypt_len;
+		}
+		total += len;
+	}
+	double old_cost = __CostMsPerMB(start);
+
+	double tea_cost = __RunLogCrypt(false, block);
+	double chacha20_cost = __RunLogCrypt(true, block);
+
+	printf("crypt %u MB in writes of 20-100 bytes: tea+copy %.2f ms/MB, tea in place %.2f ms/MB, chacha20 in place %.2f ms/MB (%.1fx)\n",
+		(unsigned int)(kTotalLength / 1024 / 1024), old_cost, tea_cost, chacha20_cost, old_cost / (chacha20_cost > 0 ? chacha20_cost : 0.01));
+
+	delete[] block;
+
+	EXPECT_LT(chacha20_cost, old_cost);
+}
@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../src/log_file_writer.h"
+
+
+namespace
+{
+
+static const char* kFilePath = "./LogFileWriter_benchmark.xlog";
+
+// a flush of the async appender is a third of the 150k buffer block
+static const size_t kFlushLength = 50 * 1024;
+static const int kFlushCount = 4 * 1024;
+
+static uint64_t __NowUs()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void __Report(const char* _name, std::vector<uint64_t>& _latency_us, uint64_t _total_us)
+{
+	std::sort(_latency_us.begin(), _latency_us.end());
+	double mb = (double)kFlushLength * kFlushCount / 1024 / 1024;
+
+	printf("%-28s %.0f MB: %.0f MB/s, flush p50 %u us, p99 %u us, max %u us\n", _name, mb, mb * 1000000 / (_total_us > 0 ? _total_us : 1),
+		(unsigned int)_latency_us[_latency_us.size() / 2], (unsigned int)_latency_us[_latency_us.size() * 99 / 100], (unsigned int)_latency_us.back());
+}
+
+// __log2file as it was in async mode: open, write and close for every flush
+static double __RunFopen(const char* _block)
+{
+	remove(kFilePath);
+	std::vector<uint64_t> latency_us;
+	latency_us.reserve(kFlushCount);
+
+	uint64_t start = __NowUs();
+	for (int i = 0; i < kFlushCount; ++i) {
+		uint64_t begin = __NowUs();
+		FILE* file = fopen(kFilePath, "ab");
+		EXPECT_TRUE(NULL != file);
+		if (NULL == file) return 0;
+		EXPECT_EQ(1u, fwrite(_block, kFlushLength, 1, file));
+		fclose(file);
+		latency_us.push_back(__NowUs() - begin);
+	}
+	uint64_t total_us = __NowUs() - start;
+
+	__Report("fopen/fwrite/fclose", latency_us, total_us);
+	return (double)total_us;
+}
+
+// the file kept open, _batch flushes per writev
+static double __RunWriter(const char* _block, int _batch, const char* _name)
+{
+	remove(kFilePath);
+	std::vector<uint64_t> latency_us;
+	latency_us.reserve(kFlushCount);
+
+	LogFileWriter writer;
+	EXPECT_TRUE(writer.Open(kFilePath));
+
+	LogFileWriter::Piece pieces[LogFileWriter::kMaxPieces];
+	for (int i = 0; i < _batch; ++i) {
+		pieces[i].data = _block;
+		pieces[i].len = kFlushLength;
+	}
+
+	uint64_t start = __NowUs();
+	for (int i = 0; i < kFlushCount; i += _batch) {
+		uint64_t begin = __NowUs();
+		EXPECT_TRUE(writer.Write(pieces, _batch));
+		uint64_t cost = __NowUs() - begin;
+		for (int j = 0; j < _batch; ++j) latency_us.push_back(cost / _batch);
+	}
+	writer.Close();
+	uint64_t total_us = __NowUs() - start;
+
+	FILE* file = fopen(kFilePath, "rb");
+	EXPECT_TRUE(NULL != file);
+	if (NULL != file) {
+		fseek(file, 0, SEEK_END);
+		EXPECT_EQ((long)(kFlushLength * kFlushCount), ftell(file));
+		fclose(file);
+	}
+
+	__Report(_name, latency_us, total_us);
+	return (double)total_us;
+}
+
+}
+
+TEST(LogFileWriter_benchmark, WriteAllOrNothing)
+{
+	remove(kFilePath);
+	LogFileWriter writer;
+	ASSERT_TRUE(writer.Open(kFilePath));
+
+	char data[64];
+	memset(data, 'a', sizeof(data));
+	LogFileWriter::Piece pieces[] = {{data, 10}, {data, 0}, {data, 20}};
+	EXPECT_TRUE(writer.Write(pieces, 3));
+	EXPECT_EQ(30u, writer.Size());
+	EXPECT_FALSE(writer.Write(pieces, LogFileWriter::kMaxPieces + 1));
+	EXPECT_EQ(EINVAL, errno);
+	EXPECT_TRUE(writer.IsSameFile());
+
+	// reopen appends behind the data, not behind the preallocated space
+	writer.Close();
+	ASSERT_TRUE(writer.Open(kFilePath));
+	EXPECT_EQ(30u, writer.Size());
+	EXPECT_TRUE(writer.Write(data, 5));
+	EXPECT_EQ(35u, writer.Size());
+
+	remove(kFilePath);
+	EXPECT_FALSE(writer.IsSameFile());
+	writer.Close();
+}
+
+TEST(LogFileWriter_benchmark, PartialWriteKeepsOtherAppends)
+{
+	remove(kFilePath);
+	LogFileWriter writer;
+	ASSERT_TRUE(writer.Open(kFilePath));
+
+	char data[64];
+	memset(data, 'a', sizeof(data));
+	ASSERT_TRUE(writer.Write(data, 10));
+
+	// another process appends behind the writer's back
+	FILE* other = fopen(kFilePath, "ab");
+	ASSERT_TRUE(NULL != other);
+	EXPECT_EQ(1u, fwrite(data, 20, 1, other));
+	fclose(other);
+
+	// a file size limit cuts the next batch short
+	signal(SIGXFSZ, SIG_IGN);
+	rlimit old_limit;
+	ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &old_limit));
+	rlimit limit = old_limit;
+	limit.rlim_cur = 40;
+	ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limit));
+
+	LogFileWriter::Piece pieces[] = {{data, 20}, {data, 20}};
+	EXPECT_FALSE(writer.Write(pieces, 2));
+	EXPECT_EQ(EFBIG, errno);
+	ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &old_limit));
+
+	// the batch is gone, the other append is not
+	FILE* file = fopen(kFilePath, "rb");
+	ASSERT_TRUE(NULL != file);
+	fseek(file, 0, SEEK_END);
+	EXPECT_EQ(30, ftell(file));
+	fclose(file);
+
+	EXPECT_TRUE(writer.Write(data, 5));
+	EXPECT_EQ(35u, writer.Size());
+
+	writer.Close();
+	remove(kFilePath);
+}
+
+TEST(LogFileWriter_benchmark, MBPerSecondAndP99)
+{
+	char* block = new char[kFlushLength];
+	for (size_t i = 0; i < kFlushLength; ++i) block[i] = (char)(i * 7919);
+
+	double old_us = __RunFopen(block);
+	double new_us = __RunWriter(block, 1, "kept open, 1 flush/write");
+	__RunWriter(block, 4, "kept open, 4 flushes/writev");
+
+	remove(kFilePath);
+	delete[] block;
+
+	EXPECT_LT(new_us, old_us);
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../src/log_staging_ring.h"
+
+
+namespace
+{
+
+static std::vector<std::string> sg_drained;
+
+static void __Collect(const XLoggerInfo* _info, const char* _log)
+{
+	sg_drained.push_back(NULL == _log ? "" : _log);
+}
+
+static void __CollectBin(const XLoggerInfo* _info, const void* _data, size_t _len)
+{
+	sg_drained.push_back(std::string((const char*)_data, _len));
+}
+
+}
+
+TEST(LogStagingRing_test, DropOldestMakesRoom)
+{
+	LogStagingRing ring(4096);
+	bool was_empty = false;
+	char log[64];
+
+	int pushed = 0;
+	while (true) {
+		snprintf(log, sizeof(log), "record %d", pushed);
+		if (!ring.Push(NULL, log, was_empty)) break;
+		++pushed;
+	}
+	ASSERT_GT(pushed, 2);
+
+	uint32_t dropped_len = 0;
+	EXPECT_TRUE(ring.DropOldest(dropped_len));
+	EXPECT_GT(dropped_len, 0u);
+	EXPECT_TRUE(ring.DropOldest(dropped_len));
+
+	snprintf(log, sizeof(log), "record %d", pushed);
+	EXPECT_TRUE(ring.Push(NULL, log, was_empty));
+
+	sg_drained.clear();
+	EXPECT_EQ((size_t)pushed - 1, ring.Drain(&__Collect, &__CollectBin));
+	ASSERT_EQ((size_t)pushed - 1, sg_drained.size());
+	EXPECT_EQ("record 2", sg_drained.front());
+	snprintf(log, sizeof(log), "record %d", pushed);
+	EXPECT_EQ(log, sg_drained.back());
+
+	EXPECT_TRUE(ring.Empty());
+	EXPECT_FALSE(ring.DropOldest(dropped_len));
+}
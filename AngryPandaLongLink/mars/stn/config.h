@@ -100,6 +100,7 @@ const static unsigned int kFastSendUseLonglinkTaskCntLimit = 0;
 const static unsigned int kLonglinkConnTimeout = 10 * 1000;
 const static unsigned int kLonglinkConnInteral = 4 * 1000;
 const static unsigned int kLonglinkConnMax = 3;
+const static unsigned int kLonglinkCompressAnswerTimeout = 15 * 1000;   // bodies stay untagged when the answer comes later
 
 //shortlink connect params
 const static unsigned int kShortlinkConnTimeout = 10 * 1000;
@@ -0,0 +1,330 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * ipport_history.h
+ *
+ * the connect results SimpleIPPortSort keeps by network, ip and port, in a mmaped file of fixed size
+ * records. an update appends one record, the newest record of an address is the one that counts and
+ * a hash index finds it. when the file is full, or on Compact, the newest records of the addresses
+ * seen in the last kRecordTimeoutS are moved to the front. with no file it all stays in memory.
+ */
+
+#ifndef STN_SRC_IPPORT_HISTORY_H_
+#define STN_SRC_IPPORT_HISTORY_H_
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "mars/comm/mmap_util.h"
+#include "mars/comm/tinyxml2.h"
+
+namespace mars {
+namespace stn {
+
+class IPPortHistory {
+  public:
+    static const uint32_t kCapacity = 2048;                  // records in the file
+    static const time_t kRecordTimeoutS = 60 * 60 * 24;
+    static const time_t kScoreHalfLifeS = 30 * 60;
+
+    struct Item {
+        Item(): port(0), history(0), score(0), time(0) {}
+
+        std::string ip;
+        uint16_t    port;
+        uint64_t    history;    // a bit a result, 1 a failure, the newest lowest
+        float       score;      // from -1 all failed to 1 all succeeded, as of time
+        time_t      time;
+    };
+
+    // _score as of _time looked at _now, half as sure every kScoreHalfLifeS
+    static float Decay(float _score, time_t _time, time_t _now) {
+        if (_now <= _time) return _score;
+        return _score * (float)pow(0.5, (double)(_now - _time) / kScoreHalfLifeS);
+    }
+
+    // _item with one more result at _now
+    static void Add(Item& _item, bool _success, time_t _now) {
+        static const float kWeight = 0.25f;
+        _item.history = (_item.history << 1) | (_success ? 0 : 1);
+        _item.score = Decay(_item.score, _item.time, _now) * (1 - kWeight) + (_success ? kWeight : -kWeight);
+        _item.time = _now;
+    }
+
+  public:
+    IPPortHistory(): base_(NULL), count_(0) {}
+    ~IPPortHistory() { Close(); }
+
+    // a file of another size or version is started over. false if it could not be mapped, it is kept in memory then.
+    bool Open(const std::string& _path) {
+        Close();
+
+        const size_t size = sizeof(Header) + kCapacity * sizeof(Record);
+        if (boost::filesystem::exists(_path) && boost::filesystem::file_size(_path) != size) boost::filesystem::remove(_path);
+
+        bool mapped = OpenMmapFile(_path.c_str(), (unsigned int)size, mmap_file_);
+        if (mapped) {
+            base_ = mmap_file_.data();
+        } else {
+            memory_.assign(size, 0);
+            base_ = &memory_[0];
+        }
+
+        Header header;
+        memcpy(&header, base_, sizeof(header));
+        if (kMagic != header.magic || kVersion != header.version || kCapacity < header.count) {
+            memset(base_, 0, size);
+            header.magic = kMagic;
+            header.version = kVersion;
+            header.count = 0;
+            memcpy(base_, &header, sizeof(header));
+        }
+
+        count_ = header.count;
+        __Index();
+        Compact(time(NULL));
+        return mapped;
+    }
+
+    void Close() {
+        CloseMmapFile(mmap_file_);
+        memory_.clear();
+        base_ = NULL;
+        count_ = 0;
+        index_.clear();
+    }
+
+    bool Get(const std::string& _net, const std::string& _ip, uint16_t _port, Item& _item) const {
+        std::unordered_map<std::string, uint32_t>::const_iterator it = index_.find(__Key(__Hash(_net), _ip, _port));
+        if (index_.end() == it) return false;
+
+        Record record;
+        __Read(it->second, record);
+        __ToItem(record, _item);
+        return true;
+    }
+
+    // every address of _net
+    void Items(const std::string& _net, std::vector<Item>& _items) const {
+        uint32_t net = __Hash(_net);
+        for (std::unordered_map<std::string, uint32_t>::const_iterator it = index_.begin(); it != index_.end(); ++it) {
+            Record record;
+            __Read(it->second, record);
+            if (net != record.net) continue;
+
+            _items.push_back(Item());
+            __ToItem(record, _items.back());
+        }
+    }
+
+    // appends _item as the newest record of its address
+    void Put(const std::string& _net, const Item& _item) {
+        if (NULL == base_ || sizeof(((Record*)0)->ip) <= _item.ip.size()) return;
+        if (kCapacity <= count_) Compact(time(NULL));
+        if (kCapacity <= count_) __Evict();
+
+        Record record;
+        memset(&record, 0, sizeof(record));
+        record.net = __Hash(_net);
+        record.time = (uint32_t)_item.time;
+        record.history = _item.history;
+        record.score = _item.score;
+        record.port = _item.port;
+        memcpy(record.ip, _item.ip.data(), _item.ip.size());
+
+        // valid goes last, a record cut short by a crash is not read back
+        __Write(count_, record);
+        record.valid = 1;
+        __Write(count_, record);
+
+        index_[__Key(record.net, _item.ip, _item.port)] = count_;
+        __SetCount(count_ + 1);
+    }
+
+    // the addresses of ipportrecords2.xml, what was kept before this file. a net's time there is that
+    // of its first result, the nets older than kRecordTimeoutS are left out. it had no score.
+    int ImportXml(const std::string& _path, time_t _now) {
+        tinyxml2::XMLDocument doc;
+        if (tinyxml2::XML_SUCCESS != doc.LoadFile(_path.c_str())) return 0;
+
+        int count = 0;
+        for (const tinyxml2::XMLElement* record = doc.FirstChildElement("record"); NULL != record; record = record->NextSiblingElement("record")) {
+            const char* net = record->Attribute("netinfo");
+            const char* time_chr = record->Attribute("time");
+            if (NULL == net || NULL == time_chr) continue;
+
+            time_t time = (time_t)strtoul(time_chr, NULL, 10);
+            if (_now < time || _now - time >= kRecordTimeoutS) continue;
+
+            for (const tinyxml2::XMLElement* element = record->FirstChildElement("item"); NULL != element; element = element->NextSiblingElement("item")) {
+                const char* ip = element->Attribute("ip");
+                if (NULL == ip) continue;
+
+                Item item;
+                uint16_t port = (uint16_t)element->UnsignedAttribute("port");
+                if (Get(net, ip, port, item)) continue;    // a result of its own is newer
+
+                item.ip = ip;
+                item.port = port;
+                item.history = (uint64_t)element->Int64Attribute("historyresult");
+                item.time = time;
+                Put(net, item);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    // keeps the newest record of every address seen since _now - kRecordTimeoutS, in the order written
+    void Compact(time_t _now) {
+        if (NULL == base_) return;
+
+        std::vector<uint32_t> live;
+        for (std::unordered_map<std::string, uint32_t>::iterator it = index_.begin(); it != index_.end(); ++it) {
+            Record record;
+            __Read(it->second, record);
+            if (_now < (time_t)record.time || _now - (time_t)record.time >= kRecordTimeoutS) continue;
+            live.push_back(it->second);
+        }
+        std::sort(live.begin(), live.end());
+
+        index_.clear();
+        for (uint32_t i = 0; i < live.size(); ++i) {
+            Record record;
+            __Read(live[i], record);
+            if (i != live[i]) __Write(i, record);
+            index_[__Key(record.net, record.ip, record.port)] = i;
+        }
+
+        if (live.size() < count_) memset(base_ + sizeof(Header) + live.size() * sizeof(Record), 0, (count_ - live.size()) * sizeof(Record));
+        __SetCount((uint32_t)live.size());
+    }
+
+    size_t Size() const { return index_.size(); }
+    uint32_t Appended() const { return count_; }
+
+  private:
+    static const uint32_t kMagic = 0x49505448;   // IPTH
+    static const uint32_t kVersion = 1;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;         // records written
+        uint32_t reserved;
+    };
+
+    struct Record {
+        uint32_t net;           // __Hash of the network label
+        uint32_t time;
+        uint64_t history;
+        float    score;
+        uint16_t port;
+        uint8_t  valid;
+        uint8_t  reserved;
+        char     ip[40];
+    };
+
+    typedef char __RecordIs64Bytes[sizeof(Record) == 64 ? 1 : -1];
+
+    // fnv-1a
+    static uint32_t __Hash(const std::string& _net) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < _net.size(); ++i) hash = (hash ^ (uint8_t)_net[i]) * 16777619u;
+        return hash;
+    }
+
+    static std::string __Key(uint32_t _net, const std::string& _ip, uint16_t _port) {
+        char key[80];
+        snprintf(key, sizeof(key), "%08x/%s:%u", _net, _ip.c_str(), (unsigned int)_port);
+        return key;
+    }
+
+    static void __ToItem(const Record& _record, Item& _item) {
+        _item.ip.assign(_record.ip, strnlen(_record.ip, sizeof(_record.ip)));
+        _item.port = _record.port;
+        _item.history = _record.history;
+        _item.score = _record.score;
+        _item.time = (time_t)_record.time;
+    }
+
+    void __Read(uint32_t _slot, Record& _record) const {
+        memcpy(&_record, base_ + sizeof(Header) + _slot * sizeof(Record), sizeof(Record));
+        _record.ip[sizeof(_record.ip) - 1] = '\0';
+    }
+
+    void __Write(uint32_t _slot, const Record& _record) {
+        memcpy(base_ + sizeof(Header) + _slot * sizeof(Record), &_record, sizeof(Record));
+    }
+
+    void __SetCount(uint32_t _count) {
+        count_ = _count;
+        memcpy(base_ + offsetof(Header, count), &count_, sizeof(count_));
+    }
+
+    // the newest record of each address wins, a later one replaces it in the index
+    void __Index() {
+        index_.clear();
+        for (uint32_t i = 0; i < count_; ++i) {
+            Record record;
+            __Read(i, record);
+            if (!record.valid) continue;
+            index_[__Key(record.net, record.ip, record.port)] = i;
+        }
+    }
+
+    // still full after Compact: every address is live, the ones updated longest ago go
+    void __Evict() {
+        std::vector<std::pair<uint32_t, uint32_t> > by_time;
+        for (std::unordered_map<std::string, uint32_t>::iterator it = index_.begin(); it != index_.end(); ++it) {
+            Record record;
+            __Read(it->second, record);
+            by_time.push_back(std::make_pair(record.time, it->second));
+        }
+        std::sort(by_time.begin(), by_time.end());
+
+        for (size_t i = 0; i < by_time.size() / 4; ++i) {
+            Record record;
+            __Read(by_time[i].second, record);
+            index_.erase(__Key(record.net, record.ip, record.port));
+        }
+        Compact(time(NULL));
+    }
+
+  private:
+    IPPortHistory(const IPPortHistory&);
+    IPPortHistory& operator=(const IPPortHistory&);
+
+  private:
+    boost::iostreams::mapped_file                   mmap_file_;
+    std::vector<char>                               memory_;
+    char*                                           base_;
+    uint32_t                                        count_;
+    std::unordered_map<std::string, uint32_t>       index_;
+};
+
+}}
+
+#endif // STN_SRC_IPPORT_HISTORY_H_
@@ -34,6 +34,7 @@
 #include "mars/comm/socket/complexconnect.h"
 #include "mars/comm/socket/unix_socket.h"
 #include "mars/comm/socket/socket_address.h"
+#include "mars/comm/socket/socketepoll.h"
 #include "mars/comm/platform_comm.h"
 #include "mars/comm/messagequeue/message_queue.h"
 #include "mars/baseevent/baseprjevent.h"
@@ -45,6 +46,8 @@
 #include "mars/stn/config.h"
 
 #include "proto/longlink_packer.h"
+#include "longlink_recv_buffer.h"
+#include "payload_compress.h"
 #include "smart_heartbeat.h"
 
 #define AYNC_HANDLER  asyncreg_.Get()
@@ -53,6 +56,11 @@
 using namespace mars::stn;
 using namespace mars::app;
 
+static size_t sg_send_coalesce_length = 0;
+static uint32_t sg_send_coalesce_ms = 0;
+static size_t sg_stream_frame_length = 0;
+static uint32_t sg_stream_window = 0;
+
 namespace {
 class LongLinkConnectObserver : public MComplexConnect {
   public:
@@ -136,6 +144,12 @@ LongLink::LongLink(const mq::MessageQueue_t& _messagequeueid, NetSource& _netsou
     , thread_(boost::bind(&LongLink::__Run, this), XLOGGER_TAG "::lonklink")
 	, connectstatus_(kConnectIdle)
 	, disconnectinternalcode_(kNone)
+    , compress_offered_(0)
+    , compress_agreed_(false)
+    , compress_tagged_(false)
+    , compress_mode_(kPayloadCompressNone)
+    , compress_dict_id_(0)
+    , compress_connection_(0)
 #ifdef ANDROID
     , smartheartbeat_(new SmartHeartbeat)
     , wakelock_(new WakeUpLock)
@@ -162,10 +176,34 @@ bool LongLink::Send(const AutoBuffer& _body, const AutoBuffer& _extension, const
     if (kConnected != connectstatus_) return false;
 
     xassert2(tracker_.get());
+    __ConfirmCompress();
+    
+    // compressed out of the lock, the read/write loop would wait for it. again if the connection changed meanwhile.
+    AutoBuffer tagged;
+    while (compress_tagged_) {
+        int mode = compress_mode_;
+        uint32_t dict_id = compress_dict_id_;
+        uint32_t connection = compress_connection_;
+        lock.unlock();
+        
+        tagged.Reset();
+        PayloadCompress::Instance().Encode(mode, dict_id, _task.cmdid, _body.Ptr(), _body.Length(), tagged);
+        
+        lock.lock();
+        if (kConnected != connectstatus_) return false;
+        if (connection == compress_connection_) break;
+    }
+    const AutoBuffer& body = compress_tagged_ ? tagged : _body;
     
-    lstsenddata_.push_back(std::make_pair(_task, move_wrapper<AutoBuffer>(AutoBuffer())));
-    longlink_pack(_task.cmdid, _task.taskid, _body, _extension, lstsenddata_.back().second, tracker_.get());
-    lstsenddata_.back().second->Seek(0, AutoBuffer::ESeekStart);
+    lstsenddata_.SetCoalesce(sg_send_coalesce_length, sg_send_coalesce_ms);
+    
+    if (lststreams_.Split(body.Length())) {
+        lststreams_.Push(LongLinkSendTask(_task), body, _extension);
+        __FeedStreams();
+    } else {
+        longlink_pack(_task.cmdid, _task.taskid, body, _extension, lstsenddata_.PackBuffer(), tracker_.get());
+        lstsenddata_.PushPacked(LongLinkSendTask(_task), ::gettickcount());
+    }
 
     readwritebreak_.Break();
     return true;
@@ -175,15 +213,19 @@ bool LongLink::SendWhenNoData(const AutoBuffer& _body, const AutoBuffer& _extens
     ScopedLock lock(mutex_);
 
     if (kConnected != connectstatus_) return false;
-    if (!lstsenddata_.empty()) return false;
+    if (!lstsenddata_.Empty()) return false;
 
     xassert2(tracker_.get());
     
-    Task task(_taskid);
+    LongLinkSendTask task;
+    task.taskid = _taskid;
     task.send_only = true;
-    lstsenddata_.push_back(std::make_pair(task, move_wrapper<AutoBuffer>(AutoBuffer())));
-    longlink_pack(_cmdid, _taskid, _body, _extension, lstsenddata_.back().second, tracker_.get());
-    lstsenddata_.back().second->Seek(0, AutoBuffer::ESeekStart);
+    
+    AutoBuffer tagged;
+    if (compress_tagged_) PayloadCompress::Instance().Encode(compress_mode_, compress_dict_id_, _cmdid, _body.Ptr(), _body.Length(), tagged);
+    
+    longlink_pack(_cmdid, _taskid, compress_tagged_ ? tagged : _body, _extension, lstsenddata_.PackBuffer(), tracker_.get());
+    lstsenddata_.PushPacked(task, ::gettickcount());
     
     readwritebreak_.Break();
     return true;
@@ -198,15 +240,97 @@ bool LongLink::__SendNoopWhenNoData() {
 
 bool LongLink::Stop(uint32_t _taskid) {
     ScopedLock lock(mutex_);
+    return lststreams_.Remove(_taskid) || lstsenddata_.Remove(_taskid);
+}
+
+// the first packet of a connection, before it is reported connected. the bodies sent go untagged until
+// the answer is taken, what the server sends carries the tag from its answer on.
+void LongLink::__OfferCompress() {
+    ScopedLock lock(mutex_);
+    ++compress_connection_;
+    compress_mode_ = kPayloadCompressNone;
+    compress_dict_id_ = 0;
+    compress_offered_ = 0;
+    compress_agreed_ = false;
+    compress_tagged_ = false;
+    
+    AutoBuffer offer;
+    if (!PayloadCompress::Instance().MakeOffer(offer)) return;
+    compress_offered_ = ::gettickcount();
+    
+    LongLinkSendTask task;
+    task.taskid = Task::kNoopTaskID;
+    task.cmdid = longlink_compress_cmdid();
+    task.send_only = true;
+    longlink_pack(task.cmdid, task.taskid, offer, KNullAtuoBuffer, lstsenddata_.PackBuffer(), tracker_.get());
+    lstsenddata_.PushPacked(task, ::gettickcount());
+}
 
-    for (auto it = lstsenddata_.begin(); it != lstsenddata_.end(); ++it) {
-        if (_taskid == it->first.taskid && 0 == it->second->Pos()) {
-            lstsenddata_.erase(it);
-            return true;
-        }
+// a bad answer, one too late or none at all leaves the bodies sent untagged for the rest of the connection
+void LongLink::__OnCompressAnswer(const AutoBuffer& _body) {
+    ScopedLock lock(mutex_);
+    if (0 == compress_offered_) return;
+    
+    uint64_t span = ::gettickcount() - compress_offered_;
+    compress_offered_ = 0;
+    if (kLonglinkCompressAnswerTimeout < span) {
+        xwarn2(TSF"payload compress answer after %_ms, sent untagged", span);
+        return;
+    }
+    
+    int mode = kPayloadCompressNone;
+    uint32_t dict_id = 0;
+    if (!PayloadCompress::ParseAnswer(_body, mode, dict_id)) {
+        xerror2(TSF"bad payload compress answer, len:%_, sent untagged", _body.Length());
+        return;
     }
+    
+    xinfo2(TSF"payload compress mode:%_, dict:%_", mode, dict_id);
+    if (kPayloadCompressNone == mode) return;
+    
+    compress_mode_ = mode;
+    compress_dict_id_ = dict_id;
+    compress_agreed_ = true;
+    __ConfirmCompress();
+    readwritebreak_.Break();
+}
 
-    return false;
+// mutex_ held. not while a body split before it still has frames to go, the server tells a body by its first frame.
+void LongLink::__ConfirmCompress() {
+    if (!compress_agreed_ || compress_tagged_ || !lststreams_.Empty()) return;
+    
+    AutoBuffer confirm;
+    PayloadCompress::MakeConfirm(compress_mode_, compress_dict_id_, confirm);
+    
+    LongLinkSendTask task;
+    task.taskid = Task::kNoopTaskID;
+    task.cmdid = longlink_compress_cmdid();
+    task.send_only = true;
+    longlink_pack(task.cmdid, task.taskid, confirm, KNullAtuoBuffer, lstsenddata_.PackBuffer(), tracker_.get());
+    lstsenddata_.PushPacked(task, ::gettickcount());
+    compress_tagged_ = true;
+}
+
+// mutex_ held. a frame is queued only when the queue is nearly empty, what is sent later can go in between.
+void LongLink::__FeedStreams() {
+    while (!lststreams_.Empty() && lstsenddata_.UnsentLength() < lststreams_.FrameLength()) {
+        LongLinkSendTask task;
+        if (!lststreams_.PackNext(lstsenddata_.PackBuffer(), task, tracker_.get())) break;
+        lstsenddata_.PushPacked(task, ::gettickcount());
+    }
+    __ConfirmCompress();
+}
+
+void LongLink::SetSendCoalesce(size_t _length, uint32_t _ms) {
+    xinfo2(TSF"send coalesce length:%_, ms:%_", _length, _ms);
+    sg_send_coalesce_length = _length;
+    sg_send_coalesce_ms = _ms;
+}
+
+void LongLink::SetStreamFrame(size_t _frame_length, uint32_t _window) {
+    xinfo2(TSF"stream frame length:%_, window:%_", _frame_length, _window);
+    sg_stream_frame_length = _frame_length;
+    sg_stream_window = _window;
 }
 
 
@@ -228,7 +352,9 @@ bool LongLink::MakeSureConnected(bool* _newone) {
         disconnectinternalcode_ = kNone;
         readwritebreak_.Clear();
         connectbreak_.Clear();
-        lstsenddata_.clear();
+        lstsenddata_.Clear();
+        lststreams_.Clear();
+        lststreams_.SetFrame(sg_stream_frame_length, sg_stream_window);
     }
 
     if (_newone) *_newone = newone;
@@ -427,9 +553,15 @@ SOCKET LongLink::__RunConnect(ConnectProfile& _conn_profile) {
     std::vector<IPPortItem> ip_items;
     std::vector<socket_address> vecaddr;
 
-    netsource_.GetLongLinkItems(ip_items, dns_util_);
     mars::comm::ProxyInfo proxy_info = mars::app::GetProxyInfo("");
     bool use_proxy = proxy_info.IsValid() && mars::comm::kProxyNone != proxy_info.type && mars::comm::kProxyHttp != proxy_info.type && netsource_.GetLongLinkDebugIP().empty();
+
+    if (!use_proxy) {
+        SOCKET standby = __TakeStandby(_conn_profile);
+        if (INVALID_SOCKET != standby) return standby;
+    }
+
+    netsource_.GetLongLinkItems(ip_items, dns_util_);
     xinfo2(TSF"task socket dns ip:%_ proxytype:%_ useproxy:%_", NetSource::DumpTable(ip_items), proxy_info.type, use_proxy);
     
     bool isnat64 = ELocalIPStack_IPv6 == local_ipstack_detect();
@@ -526,6 +658,7 @@ SOCKET LongLink::__RunConnect(ConnectProfile& _conn_profile) {
     
     xinfo2(TSF"task socket connect suc sock:%_, host:%_, ip:%_, port:%_, local_ip:%_, local_port:%_, iptype:%_, costtime:%_, rtt:%_, totalcost:%_, index:%_, net:%_",
            sock, _conn_profile.host, _conn_profile.ip, _conn_profile.port, _conn_profile.local_ip, _conn_profile.local_port, IPSourceTypeString[_conn_profile.ip_type], com_connect.TotalCost(), com_connect.IndexRtt(), com_connect.IndexTotalCost(), com_connect.Index(), ::getNetInfo());
+    __OfferCompress();
     __ConnectStatus(kConnected);
     __UpdateProfile(_conn_profile);
     
@@ -541,6 +674,38 @@ SOCKET LongLink::__RunConnect(ConnectProfile& _conn_profile) {
     return sock;
 }
 
+// the standby connection LongLinkBackgroundSpeedTest keeps, connected and answering noops already.
+// the identify check is done on it as on any new connection.
+SOCKET LongLink::__TakeStandby(ConnectProfile& _conn_profile) {
+    IPPortItem item;
+    unsigned long rtt = 0;
+    SOCKET sock = standby_.Take(_conn_profile.net_type, item, rtt);
+    if (INVALID_SOCKET == sock) return INVALID_SOCKET;
+
+    _conn_profile.ip_items.assign(1, item);
+    _conn_profile.ip_index = 0;
+    _conn_profile.host = item.str_host;
+    _conn_profile.ip_type = item.source_type;
+    _conn_profile.ip = item.str_ip;
+    _conn_profile.port = item.port;
+    _conn_profile.dns_endtime = ::gettickcount();
+    _conn_profile.conn_time = _conn_profile.dns_endtime;
+    _conn_profile.conn_rtt = (unsigned int)rtt;
+    _conn_profile.conn_cost = 0;
+    _conn_profile.tryip_count = 0;
+    _conn_profile.local_ip = socket_address::getsockname(sock).ip();
+    _conn_profile.local_port = socket_address::getsockname(sock).port();
+
+    xinfo2(TSF"task socket standby sock:%_, host:%_, ip:%_, port:%_, local_ip:%_, local_port:%_, iptype:%_, rtt:%_, net:%_",
+           sock, _conn_profile.host, _conn_profile.ip, _conn_profile.port, _conn_profile.local_ip, _conn_profile.local_port, IPSourceTypeString[_conn_profile.ip_type], rtt, ::getNetInfo());
+    __OfferCompress();
+    __ConnectStatus(kConnected);
+    __UpdateProfile(_conn_profile);
+
+    xerror2_if(0 != socket_disable_nagle(sock, 1), TSF"socket_disable_nagle sock:%0, %1(%2)", sock, socket_errno, socket_strerror(socket_errno));
+    return sock;
+}
+
 void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode, ConnectProfile& _profile) {
     
     Alarm alarmnoopinterval(boost::bind(&LongLink::__OnAlarm, this), false);
@@ -549,11 +714,26 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
     std::map <uint32_t, StreamResp> sent_taskids;
     std::vector<LongLinkNWriteData> nsent_datas;
     
-    AutoBuffer bufrecv;
+    LongLinkRecvBuffer bufrecv;
+    bool peer_tagged = false;  // the server answered the compression offer
     bool first_noop_sent = false;
     bool nooping = false;
     xgroup2_define(close_log);
     
+    // edge triggered: the socket stays readable until recv would block, writable until send would block
+    bool readable = false;
+    bool writable = true;
+    uint64_t send_hold_ms = 0;
+    bool send_more = false;  // the last write was cut at kMaxIov, not by the socket
+    
+#ifdef __linux__
+    SocketEpoll epoll(readwritebreak_, true);
+    bool use_epoll = epoll.IsCreateSuc() && epoll.AddSocket(_sock, false);
+    if (!use_epoll) {
+        xwarn2(TSF"epoll unavailable, errno:%_, use select", epoll.Errno());
+    }
+#endif
+    
     while (true) {
         if (!alarmnoopinterval.IsWaiting()) {
             if (first_noop_sent && alarmnoopinterval.Status() != Alarm::kOnAlarm) {
@@ -585,18 +765,47 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
             goto End;
         }
         
-        SocketSelect sel(readwritebreak_, true);
-        sel.PreSelect();
-        sel.Read_FD_SET(_sock);
-        sel.Exception_FD_SET(_sock);
-        
-        ScopedLock lock(mutex_);
-        
-        if (!lstsenddata_.empty()) sel.Write_FD_SET(_sock);
-        
-        lock.unlock();
+        int retsel = 0;
+        int sel_errno = 0;
+        bool sel_exception = false;
+        bool sock_exception = false;
+        bool can_read = false;
+        bool can_write = false;
+        bool check_send = true;
         
-        int retsel = sel.Select(10 * 60 * 1000);
+#ifdef __linux__
+        if (use_epoll) {
+            retsel = epoll.Wait(readable || send_more ? 0 : (0 < send_hold_ms ? (int)send_hold_ms : 10 * 60 * 1000));
+            sel_errno = epoll.Errno();
+            sock_exception = epoll.IsException();
+            readable = readable || epoll.Readable();
+            writable = writable || epoll.Writable();
+            can_read = readable;
+            can_write = writable;
+            // lstsenddata_ only gets data together with a break, no need to look at it otherwise
+            check_send = epoll.IsBreak() || (epoll.IsWriteActive() && epoll.Writable()) || 0 < send_hold_ms || send_more;
+        } else
+#endif
+        {
+            SocketSelect sel(readwritebreak_, true);
+            sel.PreSelect();
+            sel.Read_FD_SET(_sock);
+            sel.Exception_FD_SET(_sock);
+            
+            ScopedLock lock(mutex_);
+            
+            // a held back write waits for the timeout, not for the socket
+            if (!lstsenddata_.Empty() && 0 == send_hold_ms) sel.Write_FD_SET(_sock);
+            
+            lock.unlock();
+            
+            retsel = sel.Select(0 < send_hold_ms ? (int)send_hold_ms : 10 * 60 * 1000);
+            sel_errno = sel.Errno();
+            sel_exception = sel.IsException();
+            sock_exception = 0 != sel.Exception_FD_ISSET(_sock);
+            can_read = 0 != sel.Read_FD_ISSET(_sock);
+            can_write = 0 != sel.Write_FD_ISSET(_sock);
+        }
         
         if (kNone != disconnectinternalcode_) {
             xwarn2(TSF"task socket close sock:%0, user disconnect:%1, nread:%_, nwrite:%_", _sock, disconnectinternalcode_, socket_nread(_sock), socket_nwrite(_sock)) >> close_log;
@@ -604,20 +813,20 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
         }
         
         if (0 > retsel) {
-            xfatal2(TSF"task socket close sock:%0, 0 > retsel, errno:%_, nread:%_, nwrite:%_", _sock, sel.Errno(), socket_nread(_sock), socket_nwrite(_sock)) >> close_log;
+            xfatal2(TSF"task socket close sock:%0, 0 > retsel, errno:%_, nread:%_, nwrite:%_", _sock, sel_errno, socket_nread(_sock), socket_nwrite(_sock)) >> close_log;
             _errtype = kEctSocket;
-            _errcode = sel.Errno();
+            _errcode = sel_errno;
             goto End;
         }
         
-        if (sel.IsException()) {
+        if (sel_exception) {
             xerror2(TSF"task socket close sock:%0, socketselect excptoin:%1(%2), nread:%_, nwrite:%_", _sock, socket_errno, socket_strerror(socket_errno), socket_nread(_sock), socket_nwrite(_sock)) >> close_log;
             _errtype = kEctSocket;
             _errcode = socket_errno;
             goto End;
         }
         
-        if (sel.Exception_FD_ISSET(_sock)) {
+        if (sock_exception) {
             int error = socket_error(_sock);
             xerror2(TSF"task socket close sock:%0, excptoin:%1(%2), nread:%_, nwrite:%_", _sock, error, socket_strerror(error), socket_nread(_sock), socket_nwrite(_sock)) >> close_log;
             _errtype = kEctSocket;
@@ -632,33 +841,29 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
             goto End;
         }
         
-        lock.lock();
         if (socket_nwrite(_sock) == 0 && !nsent_datas.empty()) {
             nsent_datas.clear();
         }
         
-        if (sel.Write_FD_ISSET(_sock) && !lstsenddata_.empty()) {
+        ScopedLock lock(mutex_, check_send);
+        
+        if (check_send) send_hold_ms = lstsenddata_.HoldTime(::gettickcount());
+        if (check_send) send_more = false;
+        
+        if (check_send && 0 == send_hold_ms && can_write && !lstsenddata_.Empty()) {
             xgroup2_define(xlog_group);
             xinfo2(TSF"task socket send sock:%0, ", _sock) >> xlog_group;
             
 #ifndef WIN32
-            iovec* vecwrite = (iovec*)calloc(lstsenddata_.size(), sizeof(iovec));
-            unsigned int offset = 0;
-            
-            for (auto it = lstsenddata_.begin(); it != lstsenddata_.end(); ++it) {
-                vecwrite[offset].iov_base = it->second->PosPtr();
-                vecwrite[offset].iov_len = it->second->PosLength();
-                
-                ++offset;
-            }
-            
-            ssize_t writelen = writev(_sock, vecwrite, (int)lstsenddata_.size());
-            
-            free(vecwrite);
+            int iovcnt = 0;
+            const iovec* vecwrite = lstsenddata_.Iov(iovcnt);
+            size_t offerlen = 0;
+            for (int i = 0; i < iovcnt; ++i) offerlen += vecwrite[i].iov_len;
+            ssize_t writelen = writev(_sock, vecwrite, iovcnt);
 #else
-
-            //ssize_t writelen = ::send(_sock, lstsenddata_.begin()->data.PosPtr(), lstsenddata_.begin()->data.PosLength(), 0);
-			ssize_t writelen = ::send(_sock, lstsenddata_.begin()->second->PosPtr(), lstsenddata_.begin()->second->PosLength(), 0);
+            size_t offerlen = 0;
+            const void* front = lstsenddata_.FrontPtr(offerlen);
+			ssize_t writelen = ::send(_sock, (const char*)front, (int)offerlen, 0);
 #endif
             
             if (0 == writelen || (0 > writelen && !IS_NOBLOCK_SEND_ERRNO(socket_errno))) {
@@ -677,37 +882,43 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
             alarmnoopinterval.Start((int)noop_interval);
             
             
-            xinfo2(TSF"all send:%_, count:%_, ", writelen, lstsenddata_.size()) >> xlog_group;
+            xinfo2(TSF"all send:%_, count:%_, ", writelen, lstsenddata_.Count()) >> xlog_group;
             
             GetSignalOnNetworkDataChange()(XLOGGER_TAG, writelen, 0);
             
-            auto it = lstsenddata_.begin();
-            
-            while (it != lstsenddata_.end() && 0 < writelen) {
-                if (0 == it->second->Pos()) OnSend(it->first.taskid);
+            lstsenddata_.Consume((size_t)writelen, [&](const LongLinkSendQueue::Packet& _packet, size_t _sent, bool _first, bool _last) {
+                if (_first && 0 == _packet.task.frame_offset && Task::kInvalidTaskID != _packet.task.taskid) OnSend(_packet.task.taskid);
                 
-                if ((size_t)writelen >= it->second->PosLength()) {
-                    xinfo2(TSF"sub send taskid:%_, cmdid:%_, %_, len(S:%_, %_/%_), ", it->first.taskid, it->first.cmdid, it->first.cgi, it->second->PosLength(), it->second->PosLength(), it->second->Length()) >> xlog_group;
-                    writelen -= it->second->PosLength();
-                    if (!it->first.send_only) { sent_taskids[it->first.taskid].task = it->first; }
-                    
-                    LongLinkNWriteData nwrite(it->second->Length(), it->first);
-                    nsent_datas.push_back(nwrite);
-                    
-                    it = lstsenddata_.erase(it);
-                } else {
-                    xinfo2(TSF"sub send taskid:%_, cmdid:%_, %_, len(S:%_, %_/%_), ", it->first.taskid, it->first.cmdid, it->first.cgi, writelen, it->second->PosLength(), it->second->Length()) >> xlog_group;
-                    it->second->Seek(writelen, AutoBuffer::ESeekCur);
-                    writelen = 0;
-                }
-            }
+                xinfo2(TSF"sub send taskid:%_, cmdid:%_, %_, len(S:%_/%_), ", _packet.task.taskid, _packet.task.cmdid, _packet.task.cgi, _sent, _packet.length) >> xlog_group;
+                if (!_last) return;
+                
+                nsent_datas.push_back(LongLinkNWriteData(_packet.length, _packet.task));
+                if (_packet.task.more_frames) return;
+                
+                if (!_packet.task.send_only) { sent_taskids[_packet.task.taskid].task = _packet.task; }
+            });
+            __FeedStreams();
+            
+            // a short write means the socket is full, otherwise the rest goes out next round
+            if ((size_t)writelen < offerlen) writable = false;
+            else send_more = !lstsenddata_.Empty();
         }
         
-        lock.unlock();
+#ifdef __linux__
+        // EPOLLOUT is armed only while there is data waiting for room in the socket
+        if (use_epoll && check_send && !epoll.WriteEvent(!lstsenddata_.Empty() && !writable)) {
+            xerror2(TSF"task socket close sock:%0, epoll_ctl errno:%1", _sock, epoll.Errno()) >> close_log;
+            _errtype = kEctSocket;
+            _errcode = epoll.Errno();
+            goto End;
+        }
+#endif
         
-        if (sel.Read_FD_ISSET(_sock)) {
-            bufrecv.AllocWrite(64 * 1024, false);
-            ssize_t recvlen = recv(_sock, bufrecv.PosPtr(), 64 * 1024, 0);
+        if (lock.islocked()) lock.unlock();
+        
+        if (can_read) {
+            ssize_t recvlen = recv(_sock, bufrecv.PrepareWrite(64 * 1024), 64 * 1024, 0);
+            readable = (64 * 1024 == recvlen);
             
             if (0 == recvlen) {
                 _errtype = kEctSocket;
@@ -727,7 +938,7 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
             
             GetSignalOnNetworkDataChange()(XLOGGER_TAG, 0, recvlen);
             
-            bufrecv.Length(bufrecv.Pos() + recvlen, bufrecv.Length() + recvlen);
+            bufrecv.CommitWrite(recvlen);
             xinfo2(TSF"task socket recv sock:%_, recv len:%_, buff len:%_", _sock, recvlen, bufrecv.Length());
             
             while (0 < bufrecv.Length()) {
@@ -737,7 +948,7 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
                 AutoBuffer body;
                 AutoBuffer extension;
                 
-                int unpackret = longlink_unpack(bufrecv, cmdid, taskid, packlen, body, extension, tracker_.get());
+                int unpackret = longlink_unpack(bufrecv.View(), cmdid, taskid, packlen, body, extension, tracker_.get());
                 
                 if (LONGLINK_UNPACK_FALSE == unpackret) {
                     xerror2(TSF"task socket recv sock:%0, unpack error dump:%1", _sock, xdump(bufrecv.Ptr(), bufrecv.Length()));
@@ -746,6 +957,19 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
                     goto End;
                 }
                 
+                if (LONGLINK_UNPACK_STREAM_WINDOW == unpackret) {
+                    uint32_t window = 0;
+                    if (sizeof(window) == body.Length()) memcpy(&window, body.Ptr(), sizeof(window));
+                    xdebug2(TSF"window taskid:%_, +%_", taskid, window);
+                    bufrecv.Consume(packlen);
+                    
+                    ScopedLock lock(mutex_);
+                    lststreams_.Grant(taskid, window);
+                    __FeedStreams();
+                    if (!lstsenddata_.Empty()) readwritebreak_.Break();
+                    continue;
+                }
+                
                 StreamResp& stream_resp = sent_taskids[taskid];
                 xinfo2(TSF"task socket recv sock:%_, pack recv %_ taskid:%_, cmdid:%_, %_, packlen:(%_/%_)", _sock, LONGLINK_UNPACK_CONTINUE == unpackret ? "continue" : "finish", taskid, cmdid, stream_resp.task.cgi, LONGLINK_UNPACK_CONTINUE == unpackret ? bufrecv.Length() : packlen, packlen);
                 lastrecvtime_.gettickcount();
@@ -755,6 +979,8 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
                     break;
                 }
                 
+                size_t body_length = body.Length();
+                
                 if (stream_resp.stream->Ptr()) {
                     stream_resp.stream->Write(body);
                 } else {
@@ -767,7 +993,7 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
                     stream_resp.extension->Attach(extension);
                 }
                 
-                bufrecv.Move(-(int)(packlen));
+                bufrecv.Consume(packlen);
                 xassert2(   unpackret == LONGLINK_UNPACK_STREAM_END
                          || unpackret == LONGLINK_UNPACK_OK
                          || unpackret == LONGLINK_UNPACK_STREAM_PACKAGE,
@@ -775,9 +1001,36 @@ void LongLink::__RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode,
                 
                 if (LONGLINK_UNPACK_STREAM_PACKAGE == unpackret) {
                     OnRecv(taskid, packlen, packlen);
-                } else if (!__NoopResp(cmdid, taskid, stream_resp.stream, stream_resp.extension, alarmnooptimeout, nooping, _profile)) {
-                    OnResponse(kEctOK, 0, cmdid, taskid, stream_resp.stream, stream_resp.extension, _profile);
-					sent_taskids.erase(taskid);
+                    
+                    // the frame is taken, the peer may send as much again
+                    ScopedLock lock(mutex_);
+                    if (0 != lststreams_.Window() && 0 < body_length) {
+                        longlink_pack_window(taskid, (uint32_t)body_length, lstsenddata_.PackBuffer(), tracker_.get());
+                        LongLinkSendTask task;  // no task of ours, Stop can not take it out
+                        task.send_only = true;
+                        lstsenddata_.PushPacked(task, ::gettickcount());
+                        readwritebreak_.Break();
+                    }
+                } else if (!peer_tagged && longlink_compress_cmdid() == cmdid && Task::kNoopTaskID == taskid) {
+                    peer_tagged = true;
+                    __OnCompressAnswer(stream_resp.stream);
+                    sent_taskids.erase(taskid);
+                } else {
+                    if (peer_tagged) {
+                        AutoBuffer plain;
+                        if (!PayloadCompress::Instance().Decode(stream_resp.stream, plain)) {
+                            xerror2(TSF"task socket close sock:%0, decompress taskid:%_, cmdid:%_, len:%_", _sock, taskid, cmdid, stream_resp.stream->Length()) >> close_log;
+                            _errtype = kEctNetMsgXP;
+                            _errcode = kEctNetMsgXPDecompressErr;
+                            goto End;
+                        }
+                        stream_resp.stream->Attach(plain);
+                    }
+                    
+                    if (!__NoopResp(cmdid, taskid, stream_resp.stream, stream_resp.extension, alarmnooptimeout, nooping, _profile)) {
+                        OnResponse(kEctOK, 0, cmdid, taskid, stream_resp.stream, stream_resp.extension, _profile);
+                        sent_taskids.erase(taskid);
+                    }
                 }
             }
         }
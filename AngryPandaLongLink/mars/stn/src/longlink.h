@@ -40,6 +40,9 @@
 
 #include "mars/stn/src/net_source.h"
 #include "mars/stn/src/longlink_identify_checker.h"
+#include "mars/stn/src/longlink_speed_test.h"
+#include "mars/stn/src/longlink_send_queue.h"
+#include "mars/stn/src/longlink_stream_sender.h"
 
 class AutoBuffer;
 class XLogger;
@@ -58,18 +61,18 @@ class NetSource;
 class longlink_tracker;
 
 struct LongLinkNWriteData {
-    LongLinkNWriteData(ssize_t _writelen, const Task& _task)
+    LongLinkNWriteData(ssize_t _writelen, const LongLinkSendTask& _task)
     : writelen(_writelen), task(_task) {}
     
     ssize_t writelen;
-    Task task;
+    LongLinkSendTask task;
 };
         
 struct StreamResp {
-    StreamResp(const Task& _task = Task(Task::kInvalidTaskID))
+    StreamResp(const LongLinkSendTask& _task = LongLinkSendTask())
     : task(_task), stream(KNullAtuoBuffer), extension(KNullAtuoBuffer) {}
     
-    Task task;
+    LongLinkSendTask task;
     move_wrapper<AutoBuffer> stream;
     move_wrapper<AutoBuffer> extension;
 };
@@ -125,6 +128,12 @@ class LongLink {
     bool    Send(const AutoBuffer& _body, const AutoBuffer& _extension, const Task& _task);
     bool    SendWhenNoData(const AutoBuffer& _body, const AutoBuffer& _extension, uint32_t _cmdid, uint32_t _taskid);
     bool    Stop(uint32_t _taskid);
+    
+    // small packets wait up to _ms for _length bytes to go out together, 0 sends at once
+    static void SetSendCoalesce(size_t _length, uint32_t _ms);
+    // bodies longer than _frame_length go in frames interleaved with the other requests, 0 sends them whole.
+    // _window is the credit of a request and of a response before the peer grants more, 0 is unlimited.
+    static void SetStreamFrame(size_t _frame_length, uint32_t _window);
 
     bool            MakeSureConnected(bool* _newone = NULL);
     void            Disconnect(TDisconnectInternalCode _scene);
@@ -132,6 +141,7 @@ class LongLink {
 
     ConnectProfile  Profile() const   { return conn_profile_; }
     tickcount_t&    GetLastRecvTime() { return lastrecvtime_; }
+    LongLinkStandby& Standby()        { return standby_; }
     
   private:
     LongLink(const LongLink&);
@@ -143,12 +153,17 @@ class LongLink {
     void    __RunResponseError(ErrCmdType _type, int _errcode, ConnectProfile& _profile, bool _networkreport = true);
 
     bool    __SendNoopWhenNoData();
+    void    __FeedStreams();
+    void    __OfferCompress();
+    void    __OnCompressAnswer(const AutoBuffer& _body);
+    void    __ConfirmCompress();
     bool    __NoopReq(XLogger& _xlog, Alarm& _alarm, bool need_active_timeout);
     bool    __NoopResp(uint32_t _cmdid, uint32_t _taskid, AutoBuffer& _buf, AutoBuffer& _extension, Alarm& _alarm, bool& _nooping, ConnectProfile& _profile);
 
     virtual void     __OnAlarm();
     virtual void     __Run();
     virtual SOCKET   __RunConnect(ConnectProfile& _conn_profile);
+    SOCKET           __TakeStandby(ConnectProfile& _conn_profile);
     virtual void     __RunReadWrite(SOCKET _sock, ErrCmdType& _errtype, int& _errcode, ConnectProfile& _profile);
     
   protected:
@@ -170,13 +185,23 @@ class LongLink {
     NetSource::DnsUtil                          dns_util_;
     SocketBreaker                               connectbreak_;
 	SocketBreaker             testproxybreak_;
+    LongLinkStandby                             standby_;
     TLongLinkStatus                             connectstatus_;
     ConnectProfile                              conn_profile_;
     TDisconnectInternalCode                     disconnectinternalcode_;
     
     SocketBreaker                                        readwritebreak_;
     LongLinkIdentifyChecker                              identifychecker_;
-    std::list<std::pair<Task, move_wrapper<AutoBuffer>>> lstsenddata_;
+    LongLinkSendQueue                                    lstsenddata_;
+    LongLinkStreamSender                                 lststreams_;
+    
+    // payload compression agreed on the current connection
+    uint64_t                                             compress_offered_;   // gettickcount of the offer, 0 when no answer is awaited
+    bool                                                 compress_agreed_;    // the answer was taken, the confirm goes next
+    bool                                                 compress_tagged_;    // the confirm is queued, the bodies after it carry the tag
+    int                                                  compress_mode_;
+    uint32_t                                             compress_dict_id_;
+    uint32_t                                             compress_connection_;
     tickcount_t                                          lastrecvtime_;
     
     SmartHeartbeat*                              smartheartbeat_;
@@ -0,0 +1,92 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * longlink_recv_buffer.h
+ *
+ * receive buffer of the long link. unpacked packets are consumed by moving a read offset, the unread
+ * bytes are moved to the front only when the next recv does not fit behind them, so a recv full of
+ * small packets costs one short memmove instead of one per packet.
+ */
+
+#ifndef STN_SRC_LONGLINK_RECV_BUFFER_H_
+#define STN_SRC_LONGLINK_RECV_BUFFER_H_
+
+#include <string.h>
+
+#include "mars/comm/autobuffer.h"
+
+namespace mars {
+namespace stn {
+
+class LongLinkRecvBuffer {
+  public:
+    LongLinkRecvBuffer(): read_pos_(0) {}
+    ~LongLinkRecvBuffer() { view_.Detach(); }
+
+    // room for _len bytes behind the unread ones, CommitWrite tells how many were filled
+    void* PrepareWrite(size_t _len) {
+        if (0 < read_pos_ && buffer_.Capacity() - buffer_.Length() < _len) __Compact();
+
+        buffer_.Seek(0, AutoBuffer::ESeekEnd);
+        buffer_.AllocWrite(_len, false);
+        return buffer_.PosPtr();
+    }
+
+    void CommitWrite(size_t _len) {
+        buffer_.Length(buffer_.Length() + _len, buffer_.Length() + _len);
+    }
+
+    void Consume(size_t _len) {
+        read_pos_ += _len;
+
+        // all read, start over at the front for free
+        if (read_pos_ >= buffer_.Length()) {
+            read_pos_ = 0;
+            buffer_.Length(0, 0);
+        }
+    }
+
+    const void* Ptr() const { return buffer_.Ptr((off_t)read_pos_); }
+    size_t Length() const { return buffer_.Length() - read_pos_; }
+
+    // the unread bytes as an AutoBuffer for longlink_unpack. it does not own them and is
+    // valid until the next PrepareWrite or Consume.
+    const AutoBuffer& View() {
+        view_.Detach();
+        view_.Attach(const_cast<void*>(Ptr()), Length());
+        view_.Seek(0, AutoBuffer::ESeekEnd);
+        return view_;
+    }
+
+  private:
+    void __Compact() {
+        size_t len = Length();
+        if (0 < len) memmove(buffer_.Ptr(), buffer_.Ptr((off_t)read_pos_), len);
+        buffer_.Length(len, len);
+        read_pos_ = 0;
+    }
+
+  private:
+    LongLinkRecvBuffer(const LongLinkRecvBuffer&);
+    LongLinkRecvBuffer& operator=(const LongLinkRecvBuffer&);
+
+  private:
+    AutoBuffer buffer_;
+    size_t     read_pos_;
+    AutoBuffer view_;
+};
+
+}}
+
+#endif // STN_SRC_LONGLINK_RECV_BUFFER_H_
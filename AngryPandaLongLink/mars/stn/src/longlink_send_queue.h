@@ -0,0 +1,254 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * longlink_send_queue.h
+ *
+ * send queue of the long link. every packet is packed into one reused buffer, small packets are then
+ * copied back to back into shared chunks and big ones keep their own. the read/write loop fills a
+ * fixed iovec array from the chunks, so a writable socket costs no allocation, and may hold the write
+ * back for a while to let a burst of small packets go out in one writev.
+ */
+
+#ifndef STN_SRC_LONGLINK_SEND_QUEUE_H_
+#define STN_SRC_LONGLINK_SEND_QUEUE_H_
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#include "mars/comm/autobuffer.h"
+#include "mars/comm/move_wrapper.h"
+#include "mars/stn/stn.h"
+
+namespace mars {
+namespace stn {
+
+// what the read/write loop keeps of a Task
+struct LongLinkSendTask {
+    LongLinkSendTask(): taskid(Task::kInvalidTaskID), cmdid(0), send_only(false), frame_offset(0), more_frames(false) {}
+    explicit LongLinkSendTask(const Task& _task)
+    : taskid(_task.taskid), cmdid(_task.cmdid), send_only(_task.send_only), cgi(_task.cgi), frame_offset(0), more_frames(false) {}
+
+    uint32_t    taskid;
+    uint32_t    cmdid;
+    bool        send_only;
+    std::string cgi;
+    size_t      frame_offset;   // of the body, when it is sent in frames
+    bool        more_frames;
+};
+
+class LongLinkSendQueue {
+  public:
+#if defined(IOV_MAX) && IOV_MAX < 64
+    static const int kMaxIov = IOV_MAX;
+#else
+    static const int kMaxIov = 64;
+#endif
+    static const size_t kChunkLength = 16 * 1024;
+    static const size_t kCopyLength = 4 * 1024;  // packets up to this size share a chunk
+
+    struct Packet {
+        LongLinkSendTask task;
+        size_t           length;
+        uint64_t         queue_time;
+    };
+
+  public:
+    LongLinkSendQueue(): unsent_length_(0), coalesce_length_(0), coalesce_ms_(0) {}
+
+    // a write is held back until _length bytes are queued or the oldest packet waited _ms. 0 sends at once.
+    void SetCoalesce(size_t _length, uint32_t _ms) {
+        coalesce_length_ = _length;
+        coalesce_ms_ = _ms;
+    }
+
+    // empty buffer for longlink_pack, PushPacked queues what was packed into it
+    AutoBuffer& PackBuffer() {
+        pack_buffer_.Length(0, 0);
+        return pack_buffer_;
+    }
+
+    void PushPacked(const LongLinkSendTask& _task, uint64_t _now) {
+        size_t len = pack_buffer_.Length();
+
+        if (len <= kCopyLength && !chunks_.empty() && chunks_.back().data->Length() + len <= kChunkLength) {
+            chunks_.back().data->Write(AutoBuffer::ESeekEnd, pack_buffer_.Ptr(), len);
+            ++chunks_.back().packets;
+        } else if (len <= kCopyLength) {
+            AutoBuffer chunk;
+            if (NULL != spare_chunk_.Ptr()) chunk.Attach(spare_chunk_);
+            else chunk.AddCapacity(kChunkLength);
+            chunk.Write(AutoBuffer::ESeekStart, pack_buffer_.Ptr(), len);
+            chunk.Seek(0, AutoBuffer::ESeekStart);
+            __PushChunk(chunk);
+        } else {
+            AutoBuffer chunk;
+            chunk.Attach(pack_buffer_);
+            chunk.Seek(0, AutoBuffer::ESeekStart);
+            __PushChunk(chunk);
+        }
+
+        Packet packet;
+        packet.task = _task;
+        packet.length = len;
+        packet.queue_time = _now;
+        packets_.push_back(packet);
+        unsent_length_ += len;
+    }
+
+    bool Empty() const { return packets_.empty(); }
+    size_t Count() const { return packets_.size(); }
+    size_t UnsentLength() const { return unsent_length_; }
+
+    // takes a packet out before any byte of it went out, not a frame of a body sent in frames
+    bool Remove(uint32_t _taskid) {
+        std::deque<Chunk>::iterator chunk = chunks_.begin();
+        std::deque<Packet>::iterator packet = packets_.begin();
+
+        for (; chunk != chunks_.end(); ++chunk) {
+            size_t offset = chunk->done;
+            for (size_t i = 0; i < chunk->packets; ++i, ++packet) {
+                if (_taskid == packet->task.taskid && (size_t)chunk->data->Pos() <= offset
+                        && 0 == packet->task.frame_offset && !packet->task.more_frames) {
+                    __Erase(chunk, packet, offset);
+                    return true;
+                }
+                offset += packet->length;
+            }
+        }
+
+        return false;
+    }
+
+    void Clear() {
+        chunks_.clear();
+        packets_.clear();
+        unsent_length_ = 0;
+    }
+
+    // ms the write should still wait for more packets, 0 to write now
+    uint64_t HoldTime(uint64_t _now) const {
+        if (0 == coalesce_ms_ || packets_.empty() || unsent_length_ >= coalesce_length_) return 0;
+        if ((size_t)chunks_.front().data->Pos() > chunks_.front().done) return 0;  // finish what was started
+
+        uint64_t waited = _now - packets_.front().queue_time;
+        return waited >= coalesce_ms_ ? 0 : coalesce_ms_ - waited;
+    }
+
+#ifndef _WIN32
+    // the unsent bytes, at most kMaxIov chunks. the array is valid until the queue changes.
+    const iovec* Iov(int& _count) {
+        _count = 0;
+        for (std::deque<Chunk>::iterator it = chunks_.begin(); it != chunks_.end() && _count < kMaxIov; ++it) {
+            iov_[_count].iov_base = it->data->PosPtr();
+            iov_[_count].iov_len = it->data->PosLength();
+            ++_count;
+        }
+        return iov_;
+    }
+#endif
+
+    const void* FrontPtr(size_t& _len) {
+        _len = chunks_.empty() ? 0 : chunks_.front().data->PosLength();
+        return chunks_.empty() ? NULL : chunks_.front().data->PosPtr();
+    }
+
+    // marks _len bytes sent. _func(packet, bytes of it sent now, its first byte went out now, its last
+    // byte went out now) is called for every packet the bytes touched, finished ones are removed after it.
+    template <class F>
+    void Consume(size_t _len, F _func) {
+        while (0 < _len && !chunks_.empty()) {
+            Chunk& chunk = chunks_.front();
+            const Packet& packet = packets_.front();
+
+            size_t pos = chunk.data->Pos();
+            size_t left = chunk.done + packet.length - pos;
+            size_t sent = _len < left ? _len : left;
+            _func(packet, sent, pos == chunk.done, sent == left);
+
+            chunk.data->Seek(sent, AutoBuffer::ESeekCur);
+            _len -= sent;
+            unsent_length_ -= sent;
+
+            if (sent < left) break;
+
+            chunk.done += packet.length;
+            packets_.pop_front();
+            if (0 == --chunk.packets) __PopChunk();
+        }
+    }
+
+  private:
+    struct Chunk {
+        Chunk(AutoBuffer& _data): data(_data), packets(1), done(0) {}
+
+        move_wrapper<AutoBuffer> data;     // Pos() is what went out
+        size_t                   packets;  // not finished yet
+        size_t                   done;     // length of the finished ones in front
+    };
+
+    void __PushChunk(AutoBuffer& _data) {
+        chunks_.push_back(Chunk(_data));
+    }
+
+    void __PopChunk() {
+        AutoBuffer& data = chunks_.front().data;
+        // a chunk of the usual size is kept for the next one
+        if (NULL == spare_chunk_.Ptr() && kChunkLength == data.Capacity()) {
+            data.Length(0, 0);
+            spare_chunk_.Attach(data);
+        }
+        chunks_.pop_front();
+    }
+
+    void __Erase(std::deque<Chunk>::iterator _chunk, std::deque<Packet>::iterator _packet, size_t _offset) {
+        AutoBuffer& data = _chunk->data;
+        size_t tail = data.Length() - _offset - _packet->length;
+        if (0 < tail) memmove((char*)data.Ptr(_offset), data.Ptr(_offset + _packet->length), tail);
+        data.Length(data.Pos(), data.Length() - _packet->length);
+
+        unsent_length_ -= _packet->length;
+        packets_.erase(_packet);
+
+        if (0 == --_chunk->packets) chunks_.erase(_chunk);
+    }
+
+  private:
+    LongLinkSendQueue(const LongLinkSendQueue&);
+    LongLinkSendQueue& operator=(const LongLinkSendQueue&);
+
+  private:
+    std::deque<Chunk>  chunks_;
+    std::deque<Packet> packets_;
+    size_t             unsent_length_;
+
+    AutoBuffer         pack_buffer_;
+    AutoBuffer         spare_chunk_;
+#ifndef _WIN32
+    iovec              iov_[kMaxIov];
+#endif
+
+    size_t             coalesce_length_;
+    uint32_t           coalesce_ms_;
+};
+
+}}
+
+#endif // STN_SRC_LONGLINK_SEND_QUEUE_H_
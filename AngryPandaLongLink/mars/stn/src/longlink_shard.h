@@ -0,0 +1,68 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * longlink_shard.h
+ *
+ * which of the pooled long links a task goes over. a task with a channel_id can only be sent on the
+ * connection it names, the others go by cmdid, so one cmdid keeps its order on one link, or to the
+ * connected link with the fewest bytes still to be sent or received.
+ */
+
+#ifndef STN_SRC_LONGLINK_SHARD_H_
+#define STN_SRC_LONGLINK_SHARD_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "mars/stn/stn.h"
+
+namespace mars {
+namespace stn {
+
+struct LongLinkLoad {
+    LongLinkLoad(): start_time(0), connected(false), outstanding_bytes(0) {}
+
+    uint64_t start_time;           // ConnectProfile::start_time of the current connection
+    bool     connected;
+    uint64_t outstanding_bytes;
+};
+
+// index into _links, 0 is the main long link
+inline size_t PickLongLink(int _policy, const Task& _task, const std::vector<LongLinkLoad>& _links) {
+    if (1 >= _links.size()) return 0;
+
+    if (0 != _task.channel_id) {
+        for (size_t i = 0; i < _links.size(); ++i) {
+            if (_links[i].start_time == _task.channel_id) return i;
+        }
+        return 0;   // fails with kEctLocalChannelID as it did
+    }
+
+    if (kLongLinkShardCmdId == _policy) {
+        return (size_t)(((uint64_t)_task.cmdid * 0x9E3779B97F4A7C15ULL) >> 32) % _links.size();
+    }
+
+    size_t pick = 0;
+    bool found = false;
+    for (size_t i = 0; i < _links.size(); ++i) {
+        if (!_links[i].connected) continue;
+        if (!found || _links[i].outstanding_bytes < _links[pick].outstanding_bytes) pick = i;
+        found = true;
+    }
+    return pick;
+}
+
+}}
+
+#endif // STN_SRC_LONGLINK_SHARD_H_
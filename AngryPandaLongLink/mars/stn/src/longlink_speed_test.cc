@@ -20,7 +20,15 @@
 
 #include "longlink_speed_test.h"
 
+#include <algorithm>
+
+#include "boost/bind.hpp"
+
+#include "mars/app/app.h"
 #include "mars/comm/xlogger/xlogger.h"
+#include "mars/comm/thread/lock.h"
+#include "mars/comm/socket/connect_rtt.h"
+#include "mars/comm/socket/local_ipstack.h"
 #include "mars/comm/socket/unix_socket.h"
 #include "mars/comm/socket/socket_address.h"
 #include "mars/comm/autobuffer.h"
@@ -29,30 +37,39 @@
 #include "mars/stn/stn.h"
 #include "mars/stn/proto/longlink_packer.h"
 
+#include "longlink.h"
+
+#define AYNC_HANDLER asyncreg_.Get()
+#define RETURN_SPEEDTEST_SYNC2ASYNC_FUNC(func) RETURN_SYNC2ASYNC_FUNC(func, )
+
 using namespace mars::stn;
 
 static const unsigned int kCmdIdOutOfBand = 72;
 static const int kTimeout = 10*1000;  // s
+static const unsigned int kCheckTick = 15 * 1000;
+static const int kProbeTimeout = 5 * 1000;
+static const size_t kMaxProbeCount = 8;
+
+static uint32_t sg_background_period = 0;
+static bool sg_background_standby = false;
 
-LongLinkSpeedTestItem::LongLinkSpeedTestItem(const std::string& _ip, uint16_t _port)
+LongLinkSpeedTestItem::LongLinkSpeedTestItem(const std::string& _ip, uint16_t _port, bool _connect_only)
     : ip_(_ip)
     , port_(_port)
+    , addr_(socket_address(_ip.c_str(), _port).v4tov6_address(ELocalIPStack_IPv6 == local_ipstack_detect()))
+    , connect_only_(_connect_only)
     , socket_(-1)
     , state_(kLongLinkSpeedTestConnecting)
     , before_connect_time_(0)
     , after_connect_time_(0) {
         
-    AutoBuffer body;
-    AutoBuffer extension;
-    longlink_noop_req_body(body, extension);
-
-    longlink_pack(longlink_noop_cmdid(), Task::kNoopTaskID, body, extension, req_ab_, NULL);
-    req_ab_.Seek(0, AutoBuffer::ESeekStart);
+    __PackNoop();
 
-    socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    socket_ = socket(addr_.address().sa_family, SOCK_STREAM, IPPROTO_TCP);
 
     if (socket_ == INVALID_SOCKET) {
         xerror2(TSF"socket create error, errno:%0", strerror(errno));
+        state_ = kLongLinkSpeedTestFail;
         return;
     }
 
@@ -67,7 +84,7 @@ LongLinkSpeedTestItem::LongLinkSpeedTestItem(const std::string& _ip, uint16_t _p
         xerror2(TSF"nobio error");
         ::socket_close(socket_);
         socket_ = -1;
-        socket_ = -1;
+        state_ = kLongLinkSpeedTestFail;
         return;
     }
 
@@ -77,14 +94,21 @@ LongLinkSpeedTestItem::LongLinkSpeedTestItem(const std::string& _ip, uint16_t _p
 #endif
     }
 
-    struct sockaddr_in _addr;
-
-    bzero(&_addr, sizeof(_addr));
-    _addr = *(struct sockaddr_in*)(&socket_address(ip_.c_str(), port_).address());
-
     before_connect_time_ = gettickcount();
 
-    ::connect(socket_, (sockaddr*)&_addr, sizeof(_addr));
+    ::connect(socket_, &addr_.address(), addr_.address_length());
+}
+
+LongLinkSpeedTestItem::LongLinkSpeedTestItem(SOCKET _socket, const std::string& _ip, uint16_t _port)
+    : ip_(_ip)
+    , port_(_port)
+    , addr_(socket_address(_ip.c_str(), _port))
+    , connect_only_(false)
+    , socket_(_socket)
+    , state_(kLongLinkSpeedTestReq)
+    , before_connect_time_(0)
+    , after_connect_time_(0) {
+    __PackNoop();
 }
 
 LongLinkSpeedTestItem::~LongLinkSpeedTestItem() {
@@ -104,6 +128,18 @@ void LongLinkSpeedTestItem::HandleFDISSet(SocketSelect& _sel) {
     } else if (_sel.Write_FD_ISSET(socket_)) {
         if (kLongLinkSpeedTestConnecting == state_) {
             after_connect_time_ = gettickcount();
+
+            int error = socket_error(socket_);
+            if (0 != error) {
+                xwarn2(TSF"connect %_:%_ fail, error:%_", ip_, port_, error);
+                state_ = kLongLinkSpeedTestFail;
+                return;
+            }
+
+            if (connect_only_) {
+                state_ = kLongLinkSpeedTestSuc;
+                return;
+            }
         }
 
         state_ = __HandleSpeedTestReq();
@@ -115,6 +151,10 @@ void LongLinkSpeedTestItem::HandleFDISSet(SocketSelect& _sel) {
 }
 
 void LongLinkSpeedTestItem::HandleSetFD(SocketSelect& _sel) {
+    if (kLongLinkSpeedTestFail == state_ || kLongLinkSpeedTestSuc == state_) {
+        return;
+    }
+
     switch (state_) {
     case kLongLinkSpeedTestConnecting:
     case kLongLinkSpeedTestOOB:
@@ -155,6 +195,10 @@ int LongLinkSpeedTestItem::GetState() {
     return state_;
 }
 
+const socket_address& LongLinkSpeedTestItem::GetAddress() {
+    return addr_;
+}
+
 void LongLinkSpeedTestItem::CloseSocket() {
     if (socket_ > 0) {
         ::socket_close(socket_);
@@ -163,6 +207,21 @@ void LongLinkSpeedTestItem::CloseSocket() {
     }
 }
 
+SOCKET LongLinkSpeedTestItem::DetachSocket() {
+    SOCKET sock = socket_;
+    socket_ = -1;
+    return sock;
+}
+
+void LongLinkSpeedTestItem::__PackNoop() {
+    AutoBuffer body;
+    AutoBuffer extension;
+    longlink_noop_req_body(body, extension);
+
+    longlink_pack(longlink_noop_cmdid(), Task::kNoopTaskID, body, extension, req_ab_, NULL);
+    req_ab_.Seek(0, AutoBuffer::ESeekStart);
+}
+
 int LongLinkSpeedTestItem::__HandleSpeedTestReq() {
     ssize_t nwrite =::send(socket_, req_ab_.PosPtr(), req_ab_.Length() - req_ab_.Pos(), 0);
 
@@ -348,7 +407,7 @@ bool LongLinkSpeedTest::GetFastestSocket(int& _fdSocket, std::string& _strIp, un
     for (std::vector<LongLinkSpeedTestItem*>::iterator iter = speedTestItemVec.begin(); iter != speedTestItemVec.end(); ++iter) {
         if (kLongLinkSpeedTestSuc == (*iter)->GetState() && !bRet) {
             bRet = true;
-            _fdSocket = (*iter)->GetSocket();
+            _fdSocket = (*iter)->DetachSocket();
             _connectMillSec = (*iter)->GetConnectTime();
             xdebug2(TSF"speed test success, socket:%0, use time:%1", _fdSocket, _connectMillSec);
         } else {
@@ -366,3 +425,307 @@ bool LongLinkSpeedTest::GetFastestSocket(int& _fdSocket, std::string& _strIp, un
 boost::shared_ptr<NetSource> LongLinkSpeedTest::GetNetSource() {
     return netsource_;
 }
+
+////////////////////////////////////////////////////////////////
+
+LongLinkStandby::LongLinkStandby()
+    : sock_(INVALID_SOCKET)
+    , rtt_(0) {
+}
+
+LongLinkStandby::~LongLinkStandby() {
+    Clear();
+}
+
+void LongLinkStandby::Put(SOCKET _sock, const IPPortItem& _item, const std::string& _net, unsigned long _rtt) {
+    ScopedLock lock(mutex_);
+    if (INVALID_SOCKET != sock_) ::socket_close(sock_);
+
+    sock_ = _sock;
+    item_ = _item;
+    net_ = _net;
+    rtt_ = _rtt;
+    verified_.gettickcount();
+    xinfo2(TSF"standby sock:%_, ip:%_, port:%_, rtt:%_, net:%_", sock_, item_.str_ip, item_.port, rtt_, net_);
+}
+
+SOCKET LongLinkStandby::Take(const std::string& _net, IPPortItem& _item, unsigned long& _rtt) {
+    ScopedLock lock(mutex_);
+    SOCKET sock = sock_;
+    sock_ = INVALID_SOCKET;
+    if (INVALID_SOCKET == sock) return INVALID_SOCKET;
+
+    // closed by the server reads 0, anything it sent unasked leaves the stream in a state nobody knows
+    char byte = 0;
+    ssize_t nrecv = ::recv(sock, &byte, 1, MSG_PEEK);
+    bool open = 0 > nrecv && IS_NOBLOCK_READ_ERRNO(socket_errno) && 0 == socket_error(sock);
+
+    if (!open || _net != net_ || (uint64_t)verified_.gettickspan() > kMaxIdleMs) {
+        xwarn2(TSF"standby sock:%_ dropped, open:%_, net:%_/%_, idle:%_", sock, open, net_, _net, (int64_t)verified_.gettickspan());
+        ::socket_close(sock);
+        return INVALID_SOCKET;
+    }
+
+    _item = item_;
+    _rtt = rtt_;
+    return sock;
+}
+
+void LongLinkStandby::Clear() {
+    ScopedLock lock(mutex_);
+    if (INVALID_SOCKET != sock_) ::socket_close(sock_);
+    sock_ = INVALID_SOCKET;
+}
+
+////////////////////////////////////////////////////////////////
+
+void LongLinkBackgroundSpeedTest::SetStrategy(uint32_t _period_ms, bool _standby) {
+    xinfo2(TSF"background speed test period:%_, standby:%_", _period_ms, _standby);
+    sg_background_period = _period_ms;
+    sg_background_standby = _standby;
+}
+
+bool LongLinkBackgroundSpeedTest::Probe(const std::vector<IPPortItem>& _items, std::vector<int>& _rtts, SocketBreaker& _breaker, int _timeout) {
+    std::vector<LongLinkSpeedTestItem*> probes;
+    for (std::vector<IPPortItem>::const_iterator iter = _items.begin(); iter != _items.end(); ++iter) {
+        probes.push_back(new LongLinkSpeedTestItem(iter->str_ip, iter->port, true));
+    }
+
+    SocketSelect selector(_breaker);
+    uint64_t start = gettickcount();
+    bool broken = false;
+
+    while (true) {
+        selector.PreSelect();
+
+        size_t running = 0;
+        for (std::vector<LongLinkSpeedTestItem*>::iterator iter = probes.begin(); iter != probes.end(); ++iter) {
+            if (kLongLinkSpeedTestSuc == (*iter)->GetState() || kLongLinkSpeedTestFail == (*iter)->GetState()) continue;
+            (*iter)->HandleSetFD(selector);
+            ++running;
+        }
+
+        int64_t left = (int64_t)_timeout - (int64_t)(gettickcount() - start);
+        if (0 == running || 0 >= left) break;
+
+        int ret = selector.Select((int)left);
+
+        if (0 > ret && EINTR == selector.Errno()) continue;
+
+        if (0 > ret || selector.IsException() || selector.IsBreak()) {
+            xwarn2(TSF"probe stop, ret:%_, break:%_", ret, selector.IsBreak());
+            broken = true;
+            break;
+        }
+
+        for (std::vector<LongLinkSpeedTestItem*>::iterator iter = probes.begin(); iter != probes.end(); ++iter) {
+            (*iter)->HandleFDISSet(selector);
+        }
+    }
+
+    _rtts.clear();
+    for (std::vector<LongLinkSpeedTestItem*>::iterator iter = probes.begin(); iter != probes.end(); ++iter) {
+        _rtts.push_back(kLongLinkSpeedTestSuc == (*iter)->GetState() ? (int)(*iter)->GetConnectTime() : -1);
+        delete *iter;
+    }
+
+    return !broken;
+}
+
+bool LongLinkBackgroundSpeedTest::Run(LongLinkSpeedTestItem& _item, SocketBreaker& _breaker, int _timeout) {
+    SocketSelect selector(_breaker);
+    uint64_t start = gettickcount();
+
+    while (kLongLinkSpeedTestSuc != _item.GetState() && kLongLinkSpeedTestFail != _item.GetState()) {
+        int64_t left = (int64_t)_timeout - (int64_t)(gettickcount() - start);
+        if (0 >= left) break;
+
+        selector.PreSelect();
+        _item.HandleSetFD(selector);
+        int ret = selector.Select((int)left);
+
+        if (0 > ret && EINTR == selector.Errno()) continue;
+        if (0 > ret || selector.IsException() || selector.IsBreak()) return false;
+
+        _item.HandleFDISSet(selector);
+    }
+
+    return true;
+}
+
+LongLinkBackgroundSpeedTest::LongLinkBackgroundSpeedTest(NetSource& _netsource, ActiveLogic& _active_logic, LongLink& _longlink, MessageQueue::MessageQueue_t _messagequeue_id)
+    : netsource_(_netsource)
+    , longlink_(_longlink)
+    , asyncreg_(MessageQueue::InstallAsyncHandler(_messagequeue_id)) {
+    xassert2(breaker_.IsCreateSuc(), "create breaker fail");
+
+    active_connection_ = _active_logic.SignalActive.connect(boost::bind(&LongLinkBackgroundSpeedTest::__OnActiveChanged, this, _1));
+
+    if (_active_logic.IsActive()) {
+        __StartCheck();
+    }
+}
+
+LongLinkBackgroundSpeedTest::~LongLinkBackgroundSpeedTest() {
+    active_connection_.disconnect();
+    asyncreg_.CancelAndWait();
+
+    if (thread_.isruning()) {
+        breaker_.Break();
+        dns_util_.Cancel();
+        thread_.join();
+    }
+}
+
+void LongLinkBackgroundSpeedTest::OnNetworkChange() {
+    xinfo_function();
+
+    if (thread_.isruning()) {
+        breaker_.Break();
+        dns_util_.Cancel();
+        thread_.join();
+    }
+
+    longlink_.Standby().Clear();
+    last_run_ = tickcount_t();
+}
+
+void LongLinkBackgroundSpeedTest::__OnActiveChanged(bool _is_active) {
+    ASYNC_BLOCK_START
+
+    xdebug2(TSF"_is_active:%0", _is_active);
+
+    if (_is_active) {
+        __StartCheck();
+    } else {
+        __StopCheck();
+    }
+
+    ASYNC_BLOCK_END
+}
+
+void LongLinkBackgroundSpeedTest::__StartCheck() {
+    RETURN_SPEEDTEST_SYNC2ASYNC_FUNC(boost::bind(&LongLinkBackgroundSpeedTest::__StartCheck, this));
+
+    if (asyncpost_ != MessageQueue::KNullPost) return;
+
+    // the period may be set any time, it is looked at every tick
+    asyncpost_ = MessageQueue::AsyncInvokePeriod(kCheckTick, kCheckTick, boost::bind(&LongLinkBackgroundSpeedTest::__Check, this), asyncreg_.Get());
+}
+
+void LongLinkBackgroundSpeedTest::__StopCheck() {
+    RETURN_SPEEDTEST_SYNC2ASYNC_FUNC(boost::bind(&LongLinkBackgroundSpeedTest::__StopCheck, this));
+
+    if (asyncpost_ == MessageQueue::KNullPost) return;
+
+    MessageQueue::CancelMessage(asyncpost_);
+    asyncpost_ = MessageQueue::KNullPost;
+
+    if (thread_.isruning()) {
+        breaker_.Break();
+        dns_util_.Cancel();
+        thread_.join();
+    }
+
+    // kept alive in the background it is what the os suspends first
+    longlink_.Standby().Clear();
+}
+
+void LongLinkBackgroundSpeedTest::__Check() {
+    if (0 == sg_background_period) {
+        longlink_.Standby().Clear();
+        return;
+    }
+
+    if (!sg_background_standby) longlink_.Standby().Clear();
+
+    if (thread_.isruning()) return;
+    if (last_run_.isValid() && (uint64_t)last_run_.gettickspan() < sg_background_period) return;
+
+    // measures while the link is up, a link connecting races its candidates itself
+    if (LongLink::kConnected != longlink_.ConnectStatus()) return;
+
+    mars::comm::ProxyInfo proxy_info = mars::app::GetProxyInfo("");
+    if (proxy_info.IsValid() && mars::comm::kProxyNone != proxy_info.type && mars::comm::kProxyHttp != proxy_info.type) return;
+
+    if (!breaker_.IsCreateSuc() && !breaker_.ReCreate()) {
+        xassert2(false, "break error!");
+        return;
+    }
+
+    // the profile is written on this thread, the speed test thread gets a copy of the ip
+    last_run_.gettickcount();
+    thread_.start(boost::bind(&LongLinkBackgroundSpeedTest::__Run, this, longlink_.Profile().ip));
+}
+
+void LongLinkBackgroundSpeedTest::__Run(const std::string& _link_ip) {
+    breaker_.Clear();
+
+    std::string net;
+    if (kNoNet == getCurrNetLabel(net)) return;
+
+    std::vector<IPPortItem> items;
+    netsource_.GetLongLinkItems(items, dns_util_);
+    if (items.size() > kMaxProbeCount) items.resize(kMaxProbeCount);
+    if (items.empty()) return;
+
+    std::vector<int> rtts;
+    if (!Probe(items, rtts, breaker_, kProbeTimeout)) return;
+
+    XMessage rtts_log;
+    for (size_t i = 0; i < items.size(); ++i) {
+        rtts_log << rtts[i] << (i + 1 < items.size() ? "|" : "");
+        socket_address addr = socket_address(items[i].str_ip.c_str(), items[i].port).v4tov6_address(ELocalIPStack_IPv6 == local_ipstack_detect());
+
+        if (0 <= rtts[i]) {
+            ConnectRttTable::Instance().OnConnected(addr, rtts[i]);
+        } else {
+            ConnectRttTable::Instance().OnFailed(addr);
+        }
+
+        netsource_.ReportLongIP(0 <= rtts[i], items[i].str_ip, items[i].port);
+    }
+
+    xinfo2(TSF"background speed test %_, rtts:%_", NetSource::DumpTable(items), rtts_log.String());
+
+    if (sg_background_standby) __KeepStandby(net, _link_ip, items, rtts);
+}
+
+void LongLinkBackgroundSpeedTest::__KeepStandby(const std::string& _net, const std::string& _link_ip, const std::vector<IPPortItem>& _items, const std::vector<int>& _rtts) {
+    LongLinkStandby& standby = longlink_.Standby();
+
+    // a standby kept before gets a noop, which also keeps its nat mapping
+    IPPortItem item;
+    unsigned long rtt = 0;
+    SOCKET sock = standby.Take(_net, item, rtt);
+
+    if (INVALID_SOCKET != sock) {
+        LongLinkSpeedTestItem noop(sock, item.str_ip, item.port);
+        if (!Run(noop, breaker_, kProbeTimeout)) return;
+
+        if (kLongLinkSpeedTestSuc == noop.GetState()) {
+            standby.Put(noop.DetachSocket(), item, _net, rtt);
+            return;
+        }
+        xwarn2(TSF"standby %_:%_ noop fail", item.str_ip, item.port);
+    }
+
+    // the fastest, on another ip than the long link if there is one, so a server going away does not take both
+    std::vector<std::pair<int, size_t> > ranked;
+    for (size_t i = 0; i < _items.size(); ++i) {
+        if (0 > _rtts[i]) continue;
+        ranked.push_back(std::make_pair((_items[i].str_ip == _link_ip ? 0x10000000 : 0) + _rtts[i], i));
+    }
+    std::sort(ranked.begin(), ranked.end());
+
+    for (size_t i = 0; i < ranked.size() && i < 2; ++i) {
+        const IPPortItem& candidate = _items[ranked[i].second];
+        LongLinkSpeedTestItem verify(candidate.str_ip, candidate.port);
+        if (!Run(verify, breaker_, kProbeTimeout)) return;
+
+        if (kLongLinkSpeedTestSuc == verify.GetState()) {
+            standby.Put(verify.DetachSocket(), candidate, _net, verify.GetConnectTime());
+            return;
+        }
+    }
+}
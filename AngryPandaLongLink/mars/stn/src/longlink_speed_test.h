@@ -25,8 +25,15 @@
 #include <vector>
 
 #include "boost/shared_ptr.hpp"
+#include "boost/signals2.hpp"
 
+#include "mars/baseevent/active_logic.h"
 #include "mars/comm/autobuffer.h"
+#include "mars/comm/tickcount.h"
+#include "mars/comm/thread/mutex.h"
+#include "mars/comm/thread/thread.h"
+#include "mars/comm/messagequeue/message_queue.h"
+#include "mars/comm/socket/socket_address.h"
 #include "mars/comm/socket/socketselect.h"
 #include "mars/comm/socket/unix_socket.h"
 
@@ -44,9 +51,14 @@ enum ELongLinkSpeedTestState {
 namespace mars {
     namespace stn {
 
+class LongLink;
+
 class LongLinkSpeedTestItem {
   public:
-    LongLinkSpeedTestItem(const std::string& _ip, uint16_t _port);
+    // _connect_only: done once connected, no noop
+    LongLinkSpeedTestItem(const std::string& _ip, uint16_t _port, bool _connect_only = false);
+    // a noop on the connected _socket, which the item owns from now on
+    LongLinkSpeedTestItem(SOCKET _socket, const std::string& _ip, uint16_t _port);
     ~LongLinkSpeedTestItem();
 
     void HandleFDISSet(SocketSelect& _sel);
@@ -57,16 +69,21 @@ class LongLinkSpeedTestItem {
     unsigned int GetPort();
     unsigned long GetConnectTime();
     int GetState();
+    const socket_address& GetAddress();
 
     void CloseSocket();
+    SOCKET DetachSocket();
 
   private:
+    void __PackNoop();
     int __HandleSpeedTestReq();
     int __HandleSpeedTestResp();
 
   private:
     std::string ip_;
     unsigned int port_;
+    socket_address addr_;
+    bool connect_only_;
     SOCKET socket_;
     int state_;
 
@@ -90,6 +107,75 @@ class LongLinkSpeedTest {
     SocketBreaker breaker_;
     SocketSelect selector_;
 };
+
+// one connection to the long link server kept aside and checked with a noop now and then,
+// the long link takes it over instead of connecting when it drops
+class LongLinkStandby {
+  public:
+    static const uint64_t kMaxIdleMs = 4 * 60 * 1000;  // below the ~5 min mobile nats keep an idle mapping
+
+  public:
+    LongLinkStandby();
+    ~LongLinkStandby();
+
+    // _sock was verified just now on network _net, a standby kept before is closed
+    void Put(SOCKET _sock, const IPPortItem& _item, const std::string& _net, unsigned long _rtt);
+    // the standby of network _net if it is still open and was verified within kMaxIdleMs, INVALID_SOCKET otherwise
+    SOCKET Take(const std::string& _net, IPPortItem& _item, unsigned long& _rtt);
+    void Clear();
+
+  private:
+    LongLinkStandby(const LongLinkStandby&);
+    LongLinkStandby& operator=(const LongLinkStandby&);
+
+  private:
+    Mutex           mutex_;
+    SOCKET          sock_;
+    IPPortItem      item_;
+    std::string     net_;
+    unsigned long   rtt_;
+    tickcount_t     verified_;
+};
+
+// while the app is active, connects to every long link candidate once a period, feeds the rtts to ConnectRttTable and
+// the results to NetSource, and keeps the LongLinkStandby of the long link if asked to
+class LongLinkBackgroundSpeedTest {
+  public:
+    // every _period_ms while the long link is connected, 0 stops it. _standby keeps a standby connection too.
+    static void SetStrategy(uint32_t _period_ms, bool _standby);
+
+    // connects to all of _items at once, _rtts[i] is the connect time of _items[i] or -1. false if broken.
+    static bool Probe(const std::vector<IPPortItem>& _items, std::vector<int>& _rtts, SocketBreaker& _breaker, int _timeout);
+    // runs _item until it succeeds, fails or _timeout ms passed. false if broken.
+    static bool Run(LongLinkSpeedTestItem& _item, SocketBreaker& _breaker, int _timeout);
+
+  public:
+    LongLinkBackgroundSpeedTest(NetSource& _netsource, ActiveLogic& _active_logic, LongLink& _longlink, MessageQueue::MessageQueue_t _messagequeue_id);
+    ~LongLinkBackgroundSpeedTest();
+
+    // stops a test running and drops the standby, it is of the network before
+    void OnNetworkChange();
+
+  private:
+    void __OnActiveChanged(bool _is_active);
+    void __StartCheck();
+    void __StopCheck();
+    void __Check();
+    void __Run(const std::string& _link_ip);
+    void __KeepStandby(const std::string& _net, const std::string& _link_ip, const std::vector<IPPortItem>& _items, const std::vector<int>& _rtts);
+
+  private:
+    NetSource&                              netsource_;
+    LongLink&                               longlink_;
+    Thread                                  thread_;
+    SocketBreaker                           breaker_;
+    tickcount_t                             last_run_;
+    boost::signals2::scoped_connection      active_connection_;
+
+    MessageQueue::ScopeRegister             asyncreg_;
+    MessageQueue::MessagePost_t             asyncpost_;
+    NetSource::DnsUtil                      dns_util_;
+};
         
     }
 }
@@ -0,0 +1,134 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * longlink_stream_sender.h
+ *
+ * requests too big for one frame, cut into frames taken in turn, one from each, so a small request
+ * queued behind a big one waits for a frame and not for the whole body. with a window, a request
+ * sends no more than the peer gave it credit for.
+ */
+
+#ifndef STN_SRC_LONGLINK_STREAM_SENDER_H_
+#define STN_SRC_LONGLINK_STREAM_SENDER_H_
+
+#include <stdint.h>
+#include <list>
+
+#include "mars/comm/autobuffer.h"
+#include "mars/comm/move_wrapper.h"
+
+#include "longlink_send_queue.h"
+#include "proto/longlink_packer.h"
+
+namespace mars {
+namespace stn {
+
+class LongLinkStreamSender {
+  public:
+    LongLinkStreamSender(): frame_length_(0), window_(0) {}
+
+    // 0 frame length sends every body whole, 0 window sends without waiting for credit
+    void SetFrame(size_t _frame_length, uint32_t _window) {
+        frame_length_ = _frame_length;
+        window_ = _window;
+    }
+
+    size_t FrameLength() const { return frame_length_; }
+    uint32_t Window() const { return window_; }
+
+    // whether a body of _length goes in frames
+    bool Split(size_t _length) const { return 0 < frame_length_ && _length > frame_length_; }
+
+    void Push(const LongLinkSendTask& _task, const AutoBuffer& _body, const AutoBuffer& _extension) {
+        streams_.push_back(Stream(_task, 0 == window_ ? kNoWindow : window_));
+        Stream& stream = streams_.back();
+        stream.body->Write(_body.Ptr(), _body.Length());
+        if (NULL != _extension.Ptr()) stream.extension->Write(_extension.Ptr(), _extension.Length());
+    }
+
+    bool Empty() const { return streams_.empty(); }
+
+    // takes a request out before its first frame was packed, the peer would wait for the rest otherwise
+    bool Remove(uint32_t _taskid) {
+        for (std::list<Stream>::iterator it = streams_.begin(); it != streams_.end(); ++it) {
+            if (_taskid != it->task.taskid) continue;
+            if (0 != it->offset) return false;
+            streams_.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+    void Grant(uint32_t _taskid, uint32_t _window) {
+        for (std::list<Stream>::iterator it = streams_.begin(); it != streams_.end(); ++it) {
+            if (_taskid == it->task.taskid && kNoWindow != it->window) it->window += _window;
+        }
+    }
+
+    void Clear() { streams_.clear(); }
+
+    // packs the next frame of the first request with credit left and moves it to the back.
+    // _task.frame_offset and _task.more_frames tell the frame apart. false if none can go now.
+    bool PackNext(AutoBuffer& _packed, LongLinkSendTask& _task, longlink_tracker* _tracker) {
+        for (std::list<Stream>::iterator it = streams_.begin(); it != streams_.end(); ++it) {
+            if (0 == it->window) continue;
+
+            size_t left = it->body->Length() - it->offset;
+            size_t length = left < frame_length_ ? left : frame_length_;
+            if (length > it->window) length = (size_t)it->window;
+
+            bool more = length < left;
+            longlink_pack_frame(it->task.cmdid, it->task.taskid, it->body->Ptr(it->offset), length, more, it->extension, _packed, _tracker);
+
+            _task = it->task;
+            _task.frame_offset = it->offset;
+            _task.more_frames = more;
+
+            it->offset += length;
+            if (kNoWindow != it->window) it->window -= length;
+
+            if (more) streams_.splice(streams_.end(), streams_, it);
+            else streams_.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+  private:
+    static const uint64_t kNoWindow = ~(uint64_t)0;
+
+    struct Stream {
+        Stream(const LongLinkSendTask& _task, uint64_t _window)
+        : task(_task), body(KNullAtuoBuffer), extension(KNullAtuoBuffer), offset(0), window(_window) {}
+
+        LongLinkSendTask          task;
+        move_wrapper<AutoBuffer>  body;
+        move_wrapper<AutoBuffer>  extension;
+        size_t                    offset;   // packed so far
+        uint64_t                  window;   // kNoWindow without flow control
+    };
+
+  private:
+    LongLinkStreamSender(const LongLinkStreamSender&);
+    LongLinkStreamSender& operator=(const LongLinkStreamSender&);
+
+  private:
+    size_t            frame_length_;
+    uint32_t          window_;
+    std::list<Stream> streams_;
+};
+
+}}
+
+#endif // STN_SRC_LONGLINK_STREAM_SENDER_H_
@@ -44,12 +44,15 @@ using namespace mars::stn;
 
 #define AYNC_HANDLER asyncreg_.Get()
 #define RETURN_LONKLINK_SYNC2ASYNC_FUNC(func) RETURN_SYNC2ASYNC_FUNC(func, )
+#define RETURN_LONKLINK_SYNC2ASYNC_FUNC_TITLE(func, title) RETURN_SYNC2ASYNC_FUNC_TITLE(func, title, )
 
 LongLinkTaskManager::LongLinkTaskManager(NetSource& _netsource, ActiveLogic& _activelogic, DynamicTimeout& _dynamictimeout, MessageQueue::MessageQueue_t  _messagequeue_id)
     : asyncreg_(MessageQueue::InstallAsyncHandler(_messagequeue_id))
+    , timeout_wheel_(::gettickcount())
     , lastbatcherrortime_(0)
     , retry_interval_(0)
     , tasks_continuous_fail_count_(0)
+    , outstanding_bytes_(0)
     , longlink_(LongLinkChannelFactory::Create(_messagequeue_id, _netsource))
     , longlinkconnectmon_(new LongLinkConnectMonitor(_activelogic, *longlink_, _messagequeue_id))
     , dynamic_timeout_(_dynamictimeout)
@@ -67,6 +70,7 @@ LongLinkTaskManager::LongLinkTaskManager(NetSource& _netsource, ActiveLogic& _ac
 LongLinkTaskManager::~LongLinkTaskManager() {
     xinfo_function();
     longlink_->SignalConnection.disconnect(boost::bind(&LongLinkTaskManager::__SignalConnection, this, _1));
+    TaskCodecPool::Instance().CancelAndWait(this);
     asyncreg_.CancelAndWait();
     
     __BatchErrorRespHandle(kEctLocal, kEctLocalReset, kTaskFailHandleTaskEnd, Task::kInvalidTaskID, longlink_->Profile(), false);
@@ -85,8 +89,8 @@ bool LongLinkTaskManager::StartTask(const Task& _task) {
     TaskProfile task(_task);
     task.link_type = Task::kChannelLong;
 
-    lst_cmd_.push_back(task);
-    lst_cmd_.sort(__CompareTask);
+    std::list<TaskProfile>::iterator it = lst_cmd_.insert(task);
+    __ScheduleTimeout(*it);
 
     __RunLoop();
     return true;
@@ -95,38 +99,21 @@ bool LongLinkTaskManager::StartTask(const Task& _task) {
 bool LongLinkTaskManager::StopTask(uint32_t _taskid) {
     xverbose_function();
 
-    std::list<TaskProfile>::iterator first = lst_cmd_.begin();
-    std::list<TaskProfile>::iterator last = lst_cmd_.end();
+    std::list<TaskProfile>::iterator it = lst_cmd_.find(_taskid);
+    if (lst_cmd_.end() == it) return false;
 
-    while (first != last) {
-        if (_taskid == first->task.taskid) {
-            xinfo2(TSF"find the task taskid:%0", _taskid);
-
-            longlink_->Stop(first->task.taskid);
-            lst_cmd_.erase(first);
-            return true;
-        }
+    xinfo2(TSF"find the task taskid:%0", _taskid);
 
-        ++first;
-    }
-
-    return false;
+    longlink_->Stop(it->task.taskid);
+    __Untrack(*it);
+    lst_cmd_.erase(it);
+    return true;
 }
 
 bool LongLinkTaskManager::HasTask(uint32_t _taskid) const {
     xverbose_function();
 
-    std::list<TaskProfile>::const_iterator first = lst_cmd_.begin();
-    std::list<TaskProfile>::const_iterator last = lst_cmd_.end();
-
-    while (first != last) {
-    	if (_taskid == first->task.taskid) {
-    		return true;
-    	}
-    	++first;
-    }
-
-    return false;
+    return lst_cmd_.end() != lst_cmd_.find(_taskid);
 }
 
 void LongLinkTaskManager::ClearTasks() {
@@ -134,6 +121,8 @@ void LongLinkTaskManager::ClearTasks() {
     longlink_->Disconnect(LongLink::kReset);
     MessageQueue::CancelMessage(asyncreg_.Get(), 0);
     lst_cmd_.clear();
+    timeout_wheel_.Clear();
+    outstanding_bytes_ = 0;
 }
 
 unsigned int LongLinkTaskManager::GetTaskCount() {
@@ -154,6 +143,7 @@ void LongLinkTaskManager::RedoTasks() {
         std::list<TaskProfile>::iterator next = first;
         ++next;
 
+        __Untrack(*first);
         first->InitSendParam();
         first->last_failed_dyntime_status = 0;
 
@@ -184,15 +174,16 @@ void LongLinkTaskManager::__RunLoop() {
     }
 
     __RunOnTimeout();
-    __RunOnStartTask();
+    bool waiting = __RunOnStartTask();
 
     if (!lst_cmd_.empty()) {
 #ifdef ANDROID
         wakeup_lock_->Lock(30 * 1000);
 #endif
-      MessageQueue::FasterMessage(asyncreg_.Get(),
-                                  MessageQueue::Message((MessageQueue::MessageTitle_t)this, boost::bind(&LongLinkTaskManager::__RunLoop, this)),
-                                  MessageQueue::MessageTiming(1000));
+        // next timeout, tasks waiting to be sent are tried again every second
+        uint64_t next = timeout_wheel_.NextTime();
+        if (waiting) next = std::min(next, ::gettickcount() + 1000);
+        if (TimingWheel<uint32_t>::kNever != next) __PostRunLoop(next);
     } else {
 #ifdef ANDROID
         /*cancel the last wakeuplock*/
@@ -201,17 +192,37 @@ void LongLinkTaskManager::__RunLoop() {
     }
 }
 
-void LongLinkTaskManager::__RunOnTimeout() {
-    std::list<TaskProfile>::iterator first = lst_cmd_.begin();
-    std::list<TaskProfile>::iterator last = lst_cmd_.end();
+void LongLinkTaskManager::__PostRunLoop(uint64_t _time) {
+    uint64_t cur_time = ::gettickcount();
+    MessageQueue::FasterMessage(asyncreg_.Get(),
+                                MessageQueue::Message((MessageQueue::MessageTitle_t)this, boost::bind(&LongLinkTaskManager::__RunLoop, this)),
+                                MessageQueue::MessageTiming(_time > cur_time ? (int64_t)(_time - cur_time) : 0));
+}
+
+// puts the task into the wheel if it has to be looked at before its current check time
+bool LongLinkTaskManager::__ScheduleTimeout(TaskProfile& _profile) {
+    uint64_t time = __NextTimeoutTime(_profile);
+    if (0 != _profile.timeout_check_time && _profile.timeout_check_time <= time) return false;
+
+    _profile.timeout_check_time = time;
+    timeout_wheel_.Add(time, _profile.task.taskid);
+    return true;
+}
 
+void LongLinkTaskManager::__RunOnTimeout() {
     uint64_t cur_time = ::gettickcount();
     int socket_timeout_code = 0;
     bool istasktimeout = false;
 
-    while (first != last) {
-        std::list<TaskProfile>::iterator next = first;
-        ++next;
+    timeout_expired_.clear();
+    timeout_wheel_.Expire(cur_time, timeout_expired_);
+
+    for (std::vector<uint32_t>::iterator id = timeout_expired_.begin(); id != timeout_expired_.end(); ++id) {
+        std::list<TaskProfile>::iterator first = __Locate(*id);
+
+        // gone, or this entry is stale and the task waits for a later look
+        if (lst_cmd_.end() == first || 0 == first->timeout_check_time || cur_time < first->timeout_check_time) continue;
+        first->timeout_check_time = 0;
 
         if (first->running_id && 0 < first->transfer_profile.start_send_time) {
             if (0 == first->transfer_profile.last_receive_pkg_time && cur_time - first->transfer_profile.start_send_time >= first->transfer_profile.first_pkg_timeout) {
@@ -237,9 +248,10 @@ void LongLinkTaskManager::__RunOnTimeout() {
         if (cur_time - first->start_task_time >= first->task_timeout) {
             __SingleRespHandle(first, kEctLocal, kEctLocalTaskTimeout, kTaskFailHandleTaskTimeout, longlink_->Profile());
             istasktimeout = true;
+            continue;
         }
 
-        first = next;
+        __ScheduleTimeout(*first);
     }
 
     if (0 != socket_timeout_code) {
@@ -252,7 +264,8 @@ void LongLinkTaskManager::__RunOnTimeout() {
     }
 }
 
-void LongLinkTaskManager::__RunOnStartTask() {
+// true if a task is left waiting to be sent
+bool LongLinkTaskManager::__RunOnStartTask() {
     std::list<TaskProfile>::iterator first = lst_cmd_.begin();
     std::list<TaskProfile>::iterator last = lst_cmd_.end();
 
@@ -263,6 +276,7 @@ void LongLinkTaskManager::__RunOnStartTask() {
     bool canretry = curtime - lastbatcherrortime_ >= retry_interval_;
     bool canprint = true;
     int sent_count = 0;
+    bool waiting = false;
 
     while (first != last) {
         std::list<TaskProfile>::iterator next = first;
@@ -280,6 +294,7 @@ void LongLinkTaskManager::__RunOnStartTask() {
                        retry_interval_, curtime, lastbatcherrortime_, curtime - lastbatcherrortime_);
             
             canprint = false;
+            waiting = true;
             first = next;
             continue;
         }
@@ -293,6 +308,7 @@ void LongLinkTaskManager::__RunOnStartTask() {
 
             if (!ismakesureauthsuccess) {
                 xinfo2_if(curtime % 3 == 0, TSF"makeSureAuth retsult=%0", ismakesureauthsuccess);
+                waiting = true;
                 first = next;
                 continue;
             }
@@ -303,7 +319,12 @@ void LongLinkTaskManager::__RunOnStartTask() {
         int error_code = 0;
 
         if (!first->antiavalanche_checked) {
-			if (!Req2Buf(first->task.taskid, first->task.user_context, bufreq, buffer_extension, error_code, Task::kChannelLong)) {
+            TaskEncodeResult encode_result = __EncodeRequest(first, bufreq, buffer_extension, error_code);
+            if (kTaskEncodePending == encode_result) {
+                first = next;
+                continue;
+            }
+			if (kTaskEncodeOK != encode_result) {
 				__SingleRespHandle(first, kEctEnDecode, error_code, kTaskFailHandleTaskEnd, longlink_->Profile());
 				first = next;
 				continue;
@@ -322,6 +343,8 @@ void LongLinkTaskManager::__RunOnStartTask() {
 		if (!longlinkconnectmon_->MakeSureConnected()) {
             if (0 != first->task.channel_id) {
                 __SingleRespHandle(first, kEctLocal, kEctLocalChannelID, kTaskFailHandleTaskEnd, longlink_->Profile());
+            } else {
+                waiting = true;
             }
             
             first = next;
@@ -335,7 +358,12 @@ void LongLinkTaskManager::__RunOnStartTask() {
         }
         
 		if (0 == bufreq.Length()) {
-			if (!Req2Buf(first->task.taskid, first->task.user_context, bufreq, buffer_extension, error_code, Task::kChannelLong)) {
+            TaskEncodeResult encode_result = __EncodeRequest(first, bufreq, buffer_extension, error_code);
+            if (kTaskEncodePending == encode_result) {
+                first = next;
+                continue;
+            }
+			if (kTaskEncodeOK != encode_result) {
 				__SingleRespHandle(first, kEctEnDecode, error_code, kTaskFailHandleTaskEnd, longlink_->Profile());
 				first = next;
 				continue;
@@ -358,10 +386,13 @@ void LongLinkTaskManager::__RunOnStartTask() {
 
         if (!first->running_id) {
             xwarn2(TSF"task add into longlink readwrite fail cgi:%_, cmdid:%_, taskid:%_", first->task.cgi, first->task.cmdid, first->task.taskid);
+            waiting = true;
             first = next;
             continue;
         }
 
+        __Track(*first);
+
         xinfo2(TSF"task add into longlink readwrite suc cgi:%_, cmdid:%_, taskid:%_, size:%_, timeout(firstpkg:%_, rw:%_, task:%_), retry:%_",
                first->task.cgi, first->task.cmdid, first->task.taskid, first->transfer_profile.send_data_size, first->transfer_profile.first_pkg_timeout / 1000,
                first->transfer_profile.read_write_timeout / 1000, first->task_timeout / 1000, first->remain_retry_count);
@@ -373,6 +404,44 @@ void LongLinkTaskManager::__RunOnStartTask() {
         ++sent_count;
         first = next;
     }
+
+    return waiting;
+}
+
+// Req2Buf inline, or on the codec pool when it has workers: pending until __OnEncoded brings the request back
+TaskEncodeResult LongLinkTaskManager::__EncodeRequest(std::list<TaskProfile>::iterator _it, AutoBuffer& _bufreq, AutoBuffer& _extension, int& _error_code) {
+    if (_it->encoded) {
+        boost::shared_ptr<TaskCodecJob> job = _it->encoded;
+        _it->encoded.reset();
+        _bufreq.Attach(job->buffer);
+        _extension.Attach(job->extension);
+        _error_code = job->error_code;
+        return job->result ? kTaskEncodeOK : kTaskEncodeFail;
+    }
+
+    if (_it->encoding) return kTaskEncodePending;
+
+    boost::shared_ptr<TaskCodecJob> job(new TaskCodecJob(_it->task.taskid, ++_it->encode_seq));
+    if (TaskCodecPool::Instance().Submit(this, TaskCodecPool::EncodeLane(_it->task.priority),
+                                         boost::bind(&TaskCodecJob::Encode, job, _it->task.user_context, (int)Task::kChannelLong),
+                                         boost::bind(&LongLinkTaskManager::__OnEncoded, this, job))) {
+        _it->encoding = true;
+        return kTaskEncodePending;
+    }
+
+    return Req2Buf(_it->task.taskid, _it->task.user_context, _bufreq, _extension, _error_code, Task::kChannelLong) ? kTaskEncodeOK : kTaskEncodeFail;
+}
+
+void LongLinkTaskManager::__OnEncoded(boost::shared_ptr<TaskCodecJob> _job) {
+    // titled, CancelMessage(asyncreg_.Get(), 0) must not lose it
+    RETURN_LONKLINK_SYNC2ASYNC_FUNC_TITLE(boost::bind(&LongLinkTaskManager::__OnEncoded, this, _job), _job.get());
+
+    std::list<TaskProfile>::iterator it = __Locate(_job->taskid);
+    if (lst_cmd_.end() == it || !it->encoding || _job->seq != it->encode_seq) return;   // stopped or started over meanwhile
+
+    it->encoding = false;
+    it->encoded = _job;
+    __PostRunLoop(::gettickcount());
 }
 
 bool LongLinkTaskManager::__SingleRespHandle(std::list<TaskProfile>::iterator _it, ErrCmdType _err_type, int _err_code, int _fail_handle, const ConnectProfile& _connect_profile) {
@@ -417,6 +486,7 @@ bool LongLinkTaskManager::__SingleRespHandle(std::list<TaskProfile>::iterator _i
         _it->PushHistory();
         ReportTaskProfile(*_it);
 
+        __Untrack(*_it);
         lst_cmd_.erase(_it);
         return true;
     }
@@ -429,6 +499,7 @@ bool LongLinkTaskManager::__SingleRespHandle(std::list<TaskProfile>::iterator _i
 
     _it->remain_retry_count--;
     _it->PushHistory();
+    __Untrack(*_it);
     _it->InitSendParam();
     
     return false;
@@ -483,22 +554,26 @@ void LongLinkTaskManager::__BatchErrorRespHandle(ErrCmdType _err_type, int _err_
     }
 }
 
-struct find_task {
-  public:
-    bool operator()(const TaskProfile& value) {return taskid == value.task.taskid;}
-
-  public:
-    uint32_t taskid;
-};
-
 std::list<TaskProfile>::iterator LongLinkTaskManager::__Locate(uint32_t _taskid) {
     if (Task::kInvalidTaskID == _taskid) return lst_cmd_.end();
+    return lst_cmd_.find(_taskid);
+}
+
+static uint64_t __OutstandingBytes(const TaskProfile& _profile) {
+    if (!_profile.running_id) return 0;
 
-    find_task find_functor;
-    find_functor.taskid = _taskid;
-    std::list<TaskProfile>::iterator it = std::find_if(lst_cmd_.begin(), lst_cmd_.end(), find_functor);
+    const TransferProfile& transfer = _profile.transfer_profile;
+    return transfer.send_data_size + (transfer.receive_data_size > transfer.received_size ? transfer.receive_data_size - transfer.received_size : 0);
+}
+
+// a task counts towards outstanding_bytes_ while it is sent, __Untrack before changing it and __Track after
+void LongLinkTaskManager::__Track(const TaskProfile& _profile) {
+    outstanding_bytes_ += __OutstandingBytes(_profile);
+}
 
-    return it;
+void LongLinkTaskManager::__Untrack(const TaskProfile& _profile) {
+    uint64_t bytes = __OutstandingBytes(_profile);
+    outstanding_bytes_ = outstanding_bytes_ > bytes ? outstanding_bytes_ - bytes : 0;
 }
 
 void LongLinkTaskManager::__OnResponse(ErrCmdType _error_type, int _error_code, uint32_t _cmdid, uint32_t _taskid, AutoBuffer& _body, AutoBuffer& _extension, const ConnectProfile& _connect_profile) {
@@ -527,17 +602,50 @@ void LongLinkTaskManager::__OnResponse(ErrCmdType _error_type, int _error_code,
         return;
     }
     
+    __Untrack(*it);
     it->transfer_profile.received_size = body->Length();
     it->transfer_profile.receive_data_size = body->Length();
     it->transfer_profile.last_receive_pkg_time = ::gettickcount();
+    __Track(*it);
     
-    int err_code = 0;
-    int handle_type = Buf2Resp(it->task.taskid, it->task.user_context, body, extension, err_code, Task::kChannelLong);
+    boost::shared_ptr<TaskCodecJob> job(new TaskCodecJob(it->task.taskid, ++it->decode_seq));
+    job->buffer.Attach(body.get());
+    job->extension.Attach(extension.get());
+
+    if (TaskCodecPool::Instance().Submit(this, TaskCodecPool::DecodeLane(it->task.priority),
+                                         boost::bind(&TaskCodecJob::Decode, job, it->task.user_context, (int)Task::kChannelLong),
+                                         boost::bind(&LongLinkTaskManager::__OnDecoded, this, job, _connect_profile))) {
+        return;
+    }
+
+    job->Decode(it->task.user_context, Task::kChannelLong);
+    __OnDecoded(job, _connect_profile);
+}
+
+void LongLinkTaskManager::__OnDecoded(boost::shared_ptr<TaskCodecJob> _job, const ConnectProfile& _connect_profile) {
+    RETURN_LONKLINK_SYNC2ASYNC_FUNC_TITLE(boost::bind(&LongLinkTaskManager::__OnDecoded, this, _job, _connect_profile), _job.get());
+
+    std::list<TaskProfile>::iterator it = __Locate(_job->taskid);
+
+    if (lst_cmd_.end() == it) {
+        xwarn2(TSF"task no found after decode task:%0", _job->taskid);
+        return;
+    }
+
+    // timed out, retried or started over while Buf2Resp ran, the response is not for this send
+    if (_job->seq != it->decode_seq) {
+        xwarn2(TSF"stale decode dropped task:%0, seq:%1, now:%2", _job->taskid, _job->seq, it->decode_seq);
+        return;
+    }
+
+    AutoBuffer& body = _job->buffer;
+    int err_code = _job->error_code;
+    int handle_type = _job->result;
     
     switch(handle_type){
         case kTaskFailHandleNoError:
         {
-            dynamic_timeout_.CgiTaskStatistic(it->task.cgi, (unsigned int)it->transfer_profile.send_data_size + (unsigned int)body->Length(), ::gettickcount() - it->transfer_profile.start_send_time);
+            dynamic_timeout_.CgiTaskStatistic(it->task.cgi, (unsigned int)it->transfer_profile.send_data_size + (unsigned int)body.Length(), ::gettickcount() - it->transfer_profile.start_send_time);
             __SingleRespHandle(it, kEctOK, err_code, handle_type, _connect_profile);
             xassert2(fun_notify_network_err_);
             fun_notify_network_err_(__LINE__, kEctOK, err_code, _connect_profile.ip, _connect_profile.port);
@@ -565,7 +673,7 @@ void LongLinkTaskManager::__OnResponse(ErrCmdType _error_type, int _error_code,
             break;
         case kTaskFailHandleDefault:
         {
-            xerror2(TSF"task decode error taskid:%_, handle_type:%_, err_code:%_, body dump:%_", it->task.taskid, handle_type, err_code, xdump(body->Ptr(), body->Length()));
+            xerror2(TSF"task decode error taskid:%_, handle_type:%_, err_code:%_, body dump:%_", it->task.taskid, handle_type, err_code, xdump(body.Ptr(), body.Length()));
             __BatchErrorRespHandle(kEctEnDecode, err_code, handle_type, it->task.taskid, _connect_profile);
             xassert2(fun_notify_network_err_);
             fun_notify_network_err_(__LINE__, kEctEnDecode, err_code, _connect_profile.ip, _connect_profile.port);
@@ -594,6 +702,7 @@ void LongLinkTaskManager::__OnSend(uint32_t _taskid) {
     		it->transfer_profile.first_start_send_time = ::gettickcount();
         it->transfer_profile.start_send_time = ::gettickcount();
         xdebug2(TSF"taskid:%_, starttime:%_", it->task.taskid, it->transfer_profile.start_send_time / 1000);
+        if (__ScheduleTimeout(*it)) __PostRunLoop(it->timeout_check_time);
     }
 }
 
@@ -603,10 +712,13 @@ void LongLinkTaskManager::__OnRecv(uint32_t _taskid, size_t _cachedsize, size_t
     std::list<TaskProfile>::iterator it = __Locate(_taskid);
 
     if (lst_cmd_.end() != it) {
+        __Untrack(*it);
         it->transfer_profile.received_size = _cachedsize;
         it->transfer_profile.receive_data_size = _totalsize;
         it->transfer_profile.last_receive_pkg_time = ::gettickcount();
+        __Track(*it);
         xdebug2(TSF"taskid:%_, cachedsize:%_, _totalsize:%_", it->task.taskid, _cachedsize, _totalsize);
+        if (__ScheduleTimeout(*it)) __PostRunLoop(it->timeout_check_time);
     } else {
         xwarn2(TSF"not found taskid:%_ cachedsize:%_, _totalsize:%_", _taskid, _cachedsize, _totalsize);
     }
@@ -22,16 +22,20 @@
 #define STN_SRC_LONGLINK_TASK_MANAGER_H_
 
 #include <list>
+#include <vector>
 #include <stdint.h>
 
 #include "boost/function.hpp"
 
 #include "mars/comm/messagequeue/message_queue.h"
 #include "mars/comm/alarm.h"
+#include "mars/comm/timing_wheel.h"
 #include "mars/stn/stn.h"
 
 #include "longlink.h"
 #include "longlink_connect_monitor.h"
+#include "task_codec_pool.h"
+#include "task_table.h"
 
 class AutoBuffer;
 class ActiveLogic;
@@ -73,6 +77,7 @@ class LongLinkTaskManager {
 
     unsigned int GetTaskCount();
     unsigned int GetTasksContinuousFailCount();
+    uint64_t GetOutstandingBytes() const { return outstanding_bytes_; }
 
   private:
     // from ILongLinkObserver
@@ -82,20 +87,30 @@ class LongLinkTaskManager {
     void __SignalConnection(LongLink::TLongLinkStatus _connect_status);
 
     void __RunLoop();
+    void __PostRunLoop(uint64_t _time);
     void __RunOnTimeout();
-    void __RunOnStartTask();
+    bool __RunOnStartTask();
+    bool __ScheduleTimeout(TaskProfile& _profile);
+    TaskEncodeResult __EncodeRequest(std::list<TaskProfile>::iterator _it, AutoBuffer& _bufreq, AutoBuffer& _extension, int& _error_code);
+    void __OnEncoded(boost::shared_ptr<TaskCodecJob> _job);
+    void __OnDecoded(boost::shared_ptr<TaskCodecJob> _job, const ConnectProfile& _connect_profile);
 
     void __BatchErrorRespHandle(ErrCmdType _err_type, int _err_code, int _fail_handle, uint32_t _src_taskid, const ConnectProfile& _connect_profile, bool _callback_runing_task_only = true);
     bool __SingleRespHandle(std::list<TaskProfile>::iterator _it, ErrCmdType _err_type, int _err_code, int _fail_handle, const ConnectProfile& _connect_profile);
 
     std::list<TaskProfile>::iterator __Locate(uint32_t  _taskid);
+    void __Track(const TaskProfile& _profile);
+    void __Untrack(const TaskProfile& _profile);
 
   private:
     MessageQueue::ScopeRegister     asyncreg_;
-    std::list<TaskProfile>          lst_cmd_;
+    TaskTable                       lst_cmd_;
+    TimingWheel<uint32_t>           timeout_wheel_;    // taskid at TaskProfile::timeout_check_time
+    std::vector<uint32_t>           timeout_expired_;
     uint64_t                        lastbatcherrortime_;   // ms
     unsigned long                   retry_interval_;	//ms
     unsigned int                    tasks_continuous_fail_count_;
+    uint64_t                        outstanding_bytes_;    // sent requests and the rest of their responses
 
     LongLink*                       longlink_;
     LongLinkConnectMonitor*         longlinkconnectmon_;
@@ -21,6 +21,7 @@
 #include "net_core.h"
 
 #include <stdlib.h>
+#include <algorithm>
 
 #include "boost/bind.hpp"
 #include "boost/ref.hpp"
@@ -44,11 +45,14 @@
 #include "net_check_logic.h"
 #include "anti_avalanche.h"
 #include "shortlink_task_manager.h"
+#include "shortlink_pool.h"
 #include "dynamic_timeout.h"
 
 #ifdef USE_LONG_LINK
+#include "longlink_shard.h"
 #include "longlink_task_manager.h"
 #include "netsource_timercheck.h"
+#include "longlink_speed_test.h"
 #include "timing_sync.h"
 #endif
 
@@ -101,6 +105,7 @@ inline  static bool __ValidAndInitDefault(Task& _task, XLogger& _group) {
 #define AYNC_HANDLER asyncreg_.Get()
 
 static const int kShortlinkErrTime = 3;
+static const int kMaxLongLinkPool = 8;
 
 
 NetCore::NetCore()
@@ -115,8 +120,10 @@ NetCore::NetCore()
 #ifdef USE_LONG_LINK
     , zombie_task_manager_(new ZombieTaskManager(messagequeue_creater_.GetMessageQueue()))
     , longlink_task_manager_(new LongLinkTaskManager(*net_source_, *ActiveLogic::Singleton::Instance(), *dynamic_timeout_, messagequeue_creater_.GetMessageQueue()))
+    , longlink_shard_policy_(kLongLinkShardLeastOutstanding)
     , signalling_keeper_(new SignallingKeeper(longlink_task_manager_->LongLinkChannel(), messagequeue_creater_.GetMessageQueue()))
     , netsource_timercheck_(new NetSourceTimerCheck(net_source_, *ActiveLogic::Singleton::Instance(), longlink_task_manager_->LongLinkChannel(), messagequeue_creater_.GetMessageQueue()))
+    , longlink_speedtest_(new LongLinkBackgroundSpeedTest(*net_source_, *ActiveLogic::Singleton::Instance(), longlink_task_manager_->LongLinkChannel(), messagequeue_creater_.GetMessageQueue()))
     , timing_sync_(new TimingSync(*ActiveLogic::Singleton::Instance()))
 #endif
     , shortlink_try_flag_(false) {
@@ -219,7 +226,13 @@ NetCore::~NetCore() {
 
     push_preprocess_signal_.disconnect_all_slots();
 
+    for (std::vector<LongLinkTaskManager*>::iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        delete *it;
+    }
+    longlink_pool_.clear();
+
     delete netsource_timercheck_;
+    delete longlink_speedtest_;
     delete signalling_keeper_;
     delete longlink_task_manager_;
     delete timing_sync_;
@@ -227,6 +240,7 @@ NetCore::~NetCore() {
 #endif
 
     delete shortlink_task_manager_;
+    ShortLinkConnectionPool::Instance().Clear();
     delete dynamic_timeout_;
     
     delete anti_avalanche_;
@@ -287,12 +301,13 @@ void NetCore::StartTask(const Task& _task) {
     bool start_ok = false;
 
 #ifdef USE_LONG_LINK
+    LongLinkTaskManager* longlink = __PickLongLink(task);
 
-    if (LongLink::kConnected != longlink_task_manager_->LongLinkChannel().ConnectStatus()
+    if (LongLink::kConnected != longlink->LongLinkChannel().ConnectStatus()
             && (Task::kChannelLong & task.channel_select) && ActiveLogic::Singleton::Instance()->IsForeground()
 
             && (15 * 60 * 1000 >= gettickcount() - ActiveLogic::Singleton::Instance()->LastForegroundChangeTime()))
-        longlink_task_manager_->getLongLinkConnectMonitor().MakeSureConnected();
+        longlink->getLongLinkConnectMonitor().MakeSureConnected();
 
 #endif
 
@@ -302,15 +317,15 @@ void NetCore::StartTask(const Task& _task) {
     case Task::kChannelBoth: {
 
 #ifdef USE_LONG_LINK
-        bool bUseLongLink = LongLink::kConnected == longlink_task_manager_->LongLinkChannel().ConnectStatus();
+        bool bUseLongLink = LongLink::kConnected == longlink->LongLinkChannel().ConnectStatus();
 
         if (bUseLongLink && task.channel_strategy == Task::kChannelFastStrategy) {
-            xinfo2(TSF"long link task count:%0, ", longlink_task_manager_->GetTaskCount());
-            bUseLongLink = bUseLongLink && (longlink_task_manager_->GetTaskCount() <= kFastSendUseLonglinkTaskCntLimit);
+            xinfo2(TSF"long link task count:%0, ", longlink->GetTaskCount());
+            bUseLongLink = bUseLongLink && (longlink->GetTaskCount() <= kFastSendUseLonglinkTaskCntLimit);
         }
 
         if (bUseLongLink)
-            start_ok = longlink_task_manager_->StartTask(task);
+            start_ok = longlink->StartTask(task);
         else
 #endif
             start_ok = shortlink_task_manager_->StartTask(task);
@@ -319,7 +334,7 @@ void NetCore::StartTask(const Task& _task) {
 #ifdef USE_LONG_LINK
 
     case Task::kChannelLong:
-        start_ok = longlink_task_manager_->StartTask(task);
+        start_ok = longlink->StartTask(task);
         break;
 #endif
 
@@ -349,6 +364,9 @@ void NetCore::StopTask(uint32_t _taskid) {
     
 #ifdef USE_LONG_LINK
     if (longlink_task_manager_->StopTask(_taskid)) return;
+    for (std::vector<LongLinkTaskManager*>::iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        if ((*it)->StopTask(_taskid)) return;
+    }
     if (zombie_task_manager_->StopTask(_taskid)) return;
 #endif
 
@@ -364,6 +382,9 @@ bool NetCore::HasTask(uint32_t _taskid) const {
 
 #ifdef USE_LONG_LINK
     if (longlink_task_manager_->HasTask(_taskid)) return true;
+    for (std::vector<LongLinkTaskManager*>::const_iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        if ((*it)->HasTask(_taskid)) return true;
+    }
     if (zombie_task_manager_->HasTask(_taskid)) return true;
 #endif
     if (shortlink_task_manager_->HasTask(_taskid)) return true;
@@ -376,6 +397,9 @@ void NetCore::ClearTasks() {
     
 #ifdef USE_LONG_LINK
     longlink_task_manager_->ClearTasks();
+    for (std::vector<LongLinkTaskManager*>::iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        (*it)->ClearTasks();
+    }
     zombie_task_manager_->ClearTasks();
 #endif
     shortlink_task_manager_->ClearTasks();
@@ -424,15 +448,21 @@ void NetCore::OnNetworkChange() {
     
 #ifdef USE_LONG_LINK
     netsource_timercheck_->CancelConnect();
+    longlink_speedtest_->OnNetworkChange();
 #endif
 
     net_source_->ClearCache();
+    ShortLinkConnectionPool::Instance().Clear();
     
     dynamic_timeout_->ResetStatus();
 #ifdef USE_LONG_LINK
     timing_sync_->OnNetworkChange();
     if (longlink_task_manager_->getLongLinkConnectMonitor().NetworkChange())
         longlink_task_manager_->RedoTasks();
+    for (std::vector<LongLinkTaskManager*>::iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        if ((*it)->getLongLinkConnectMonitor().NetworkChange())
+            (*it)->RedoTasks();
+    }
     zombie_task_manager_->RedoTasks();
 #endif
     
@@ -458,6 +488,54 @@ void NetCore::StopSignal() {
 #ifdef USE_LONG_LINK
 LongLink& NetCore::Longlink() { return longlink_task_manager_->LongLinkChannel();}
 
+void NetCore::SetLongLinkPool(int _count, int _policy) {
+    ASYNC_BLOCK_START
+
+    xinfo2(TSF"longlink pool count:%_, policy:%_", _count, _policy);
+    int count = std::max(1, std::min(_count, kMaxLongLinkPool));
+    longlink_shard_policy_ = _policy;
+
+    while ((int)longlink_pool_.size() + 1 < count) longlink_pool_.push_back(__NewPooledLongLink());
+
+    // the tasks of a link taken away end with kEctLocalReset
+    while ((int)longlink_pool_.size() + 1 > count) {
+        delete longlink_pool_.back();
+        longlink_pool_.pop_back();
+    }
+
+    ASYNC_BLOCK_END
+}
+
+LongLinkTaskManager* NetCore::__PickLongLink(const Task& _task) {
+    if (longlink_pool_.empty()) return longlink_task_manager_;
+
+    std::vector<LongLinkLoad> links(longlink_pool_.size() + 1);
+    for (size_t i = 0; i < links.size(); ++i) {
+        LongLinkTaskManager* longlink = 0 == i ? longlink_task_manager_ : longlink_pool_[i - 1];
+        links[i].start_time = longlink->LongLinkChannel().Profile().start_time;
+        links[i].connected = LongLink::kConnected == longlink->LongLinkChannel().ConnectStatus();
+        links[i].outstanding_bytes = longlink->GetOutstandingBytes();
+    }
+
+    size_t pick = PickLongLink(longlink_shard_policy_, _task, links);
+    xdebug2(TSF"taskid:%_, cmdid:%_ on longlink %_ of %_", _task.taskid, _task.cmdid, pick, links.size());
+    return 0 == pick ? longlink_task_manager_ : longlink_pool_[pick - 1];
+}
+
+// carries tasks only, signalling, timer check and the connection status the app sees stay on longlink_task_manager_
+LongLinkTaskManager* NetCore::__NewPooledLongLink() {
+    LongLinkTaskManager* longlink = new LongLinkTaskManager(*net_source_, *ActiveLogic::Singleton::Instance(), *dynamic_timeout_, messagequeue_creater_.GetMessageQueue());
+
+    longlink->fun_callback_ = boost::bind(&NetCore::__CallBack, this, (int)kCallFromLong, _1, _2, _3, _4, _5);
+    longlink->fun_notify_retry_all_tasks = boost::bind(&NetCore::RetryTasks, this, _1, _2, _3, _4);
+    longlink->fun_notify_network_err_ = boost::bind(&NetCore::__OnLongLinkNetworkError, this, _1, _2, _3, _4, _5);
+    longlink->fun_anti_avalanche_check_ = boost::bind(&AntiAvalanche::Check, anti_avalanche_, _1, _2, _3);
+    longlink->LongLinkChannel().fun_network_report_ = boost::bind(&NetCore::__OnLongLinkNetworkError, this, _1, _2, _3, _4, _5);
+
+    longlink->LongLinkChannel().MakeSureConnected();
+    return longlink;
+}
+
 #ifdef __APPLE__
 void NetCore::__ResetLongLink() {
     SYNC2ASYNC_FUNC(boost::bind(&NetCore::__ResetLongLink, this));
@@ -484,6 +562,11 @@ void NetCore::RedoTasks() {
     longlink_task_manager_->LongLinkChannel().Disconnect(LongLink::kReset);
     longlink_task_manager_->LongLinkChannel().MakeSureConnected();
     longlink_task_manager_->RedoTasks();
+    for (std::vector<LongLinkTaskManager*>::iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        (*it)->LongLinkChannel().Disconnect(LongLink::kReset);
+        (*it)->LongLinkChannel().MakeSureConnected();
+        (*it)->RedoTasks();
+    }
     zombie_task_manager_->RedoTasks();
 #endif
     shortlink_task_manager_->RedoTasks();
@@ -496,6 +579,9 @@ void NetCore::RetryTasks(ErrCmdType _err_type, int _err_code, int _fail_handle,
 	shortlink_task_manager_->RetryTasks(_err_type, _err_code, _fail_handle, _src_taskid);
 #ifdef USE_LONG_LINK
 	longlink_task_manager_->RetryTasks(_err_type, _err_code, _fail_handle, _src_taskid);
+    for (std::vector<LongLinkTaskManager*>::iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        (*it)->RetryTasks(_err_type, _err_code, _fail_handle, _src_taskid);
+    }
 #endif
 }
 
@@ -716,6 +802,9 @@ void NetCore::__OnTimerCheckSuc() {
 #ifdef USE_LONG_LINK
     xinfo2("netsource timercheck disconnect longlink");
     longlink_task_manager_->LongLinkChannel().Disconnect(LongLink::kTimeCheckSucc);
+    for (std::vector<LongLinkTaskManager*>::iterator it = longlink_pool_.begin(); it != longlink_pool_.end(); ++it) {
+        (*it)->LongLinkChannel().Disconnect(LongLink::kTimeCheckSucc);
+    }
     
 #endif
 
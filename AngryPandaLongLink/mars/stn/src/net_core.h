@@ -21,6 +21,8 @@
 #ifndef STN_SRC_NET_CORE_H_
 #define STN_SRC_NET_CORE_H_
 
+#include <vector>
+
 #include "mars/comm/singleton.h"
 #include "mars/comm/messagequeue/message_queue.h"
 
@@ -44,6 +46,7 @@ class LongLinkTaskManager;
 class TimingSync;
 class ZombieTaskManager;
 class NetSourceTimerCheck;
+class LongLinkBackgroundSpeedTest;
 #endif
         
 class SignallingKeeper;
@@ -86,6 +89,7 @@ class NetCore {
 
 #ifdef USE_LONG_LINK
     LongLink& Longlink();
+    void    SetLongLinkPool(int _count, int _policy);
 #endif
 
   private:
@@ -103,6 +107,8 @@ class NetCore {
     void    __OnLongLinkNetworkError(int _line, ErrCmdType _err_type, int _err_code, const std::string& _ip, uint16_t _port);
     void    __OnLongLinkConnStatusChange(LongLink::TLongLinkStatus _status);
     void    __ResetLongLink();
+    LongLinkTaskManager* __PickLongLink(const Task& _task);
+    LongLinkTaskManager* __NewPooledLongLink();
 #endif
     
     void    __ConnStatusCallBack();
@@ -128,8 +134,11 @@ class NetCore {
 #ifdef USE_LONG_LINK
     ZombieTaskManager*                  zombie_task_manager_;
     LongLinkTaskManager*                longlink_task_manager_;
+    std::vector<LongLinkTaskManager*>   longlink_pool_;         // besides longlink_task_manager_, which keeps signalling and status
+    int                                 longlink_shard_policy_;
     SignallingKeeper*                   signalling_keeper_;
     NetSourceTimerCheck*                netsource_timercheck_;
+    LongLinkBackgroundSpeedTest*        longlink_speedtest_;
     TimingSync*                         timing_sync_;
 #endif
 
@@ -0,0 +1,503 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * payload_compress.h
+ *
+ * compression of request and response bodies below the packer. on the long link every body of a connection
+ * that agreed on it starts with a tag, 0 for a body stored as it is, otherwise the mode followed by the length
+ * before compression. the server tags what it sends from its answer to the offer on, the client from its
+ * confirm of the answer on. the short link goes by Accept-Encoding and Content-Encoding instead.
+ *
+ * zstd needs libzstd and is built with STN_WITH_ZSTD, lz4 needs liblz4 and STN_WITH_LZ4, zlib is always there.
+ */
+
+#ifndef STN_SRC_PAYLOAD_COMPRESS_H_
+#define STN_SRC_PAYLOAD_COMPRESS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#ifdef STN_WITH_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#ifdef STN_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#include "boost/shared_ptr.hpp"
+
+#include "mars/comm/autobuffer.h"
+#include "mars/comm/thread/lock.h"
+#include "mars/stn/stn.h"
+
+namespace mars {
+namespace stn {
+
+class PayloadCompress {
+  public:
+    static const size_t kMaxLength = 64 * 1024 * 1024;   // a body said to be longer is taken as broken
+    static const size_t kTagLength = 5;                   // mode, then the length before compression
+    static const uint8_t kAgreeVersion = 1;
+    static const size_t kAgreeLength = 6;                 // version, modes, dictionary id
+
+    static PayloadCompress& Instance() {
+        static PayloadCompress compress;
+        return compress;
+    }
+
+    // what this build can do
+    static int Built() {
+        int modes = kPayloadCompressZlib;
+#ifdef STN_WITH_ZSTD
+        modes |= kPayloadCompressZstd;
+#endif
+#ifdef STN_WITH_LZ4
+        modes |= kPayloadCompressLz4;
+#endif
+        return modes;
+    }
+
+    // the best of _modes: zstd for the ratio, then lz4 for the speed
+    static int Choose(int _modes) {
+        _modes &= Built();
+        if (_modes & kPayloadCompressZstd) return kPayloadCompressZstd;
+        if (_modes & kPayloadCompressLz4) return kPayloadCompressLz4;
+        if (_modes & kPayloadCompressZlib) return kPayloadCompressZlib;
+        return kPayloadCompressNone;
+    }
+
+  public:
+    PayloadCompress(): modes_(kPayloadCompressNone), min_length_(0) {}
+
+    // 0 modes is off. bodies shorter than _min_length are not worth it.
+    void SetModes(int _modes, size_t _min_length) {
+        ScopedLock lock(mutex_);
+        modes_ = _modes & Built();
+        min_length_ = _min_length;
+    }
+
+    // overrides the min length for _cmdid, ~0 never compresses its bodies
+    void SetCmdIdMinLength(uint32_t _cmdid, size_t _min_length) {
+        ScopedLock lock(mutex_);
+        cmdid_min_length_[_cmdid] = _min_length;
+    }
+
+    // a zstd dictionary the server has too. false when it is not one or zstd is not built.
+    bool SetDict(const void* _dict, size_t _length) {
+        boost::shared_ptr<Dict> dict;
+#ifdef STN_WITH_ZSTD
+        if (NULL != _dict && 0 < _length) {
+            dict.reset(new Dict);
+            dict->id = (uint32_t)ZSTD_getDictID_fromDict(_dict, _length);
+            dict->cdict = ZSTD_createCDict(_dict, _length, kZstdLevel);
+            dict->ddict = ZSTD_createDDict(_dict, _length);
+            if (0 == dict->id || NULL == dict->cdict || NULL == dict->ddict) return false;
+        }
+#else
+        if (NULL != _dict && 0 < _length) return false;
+#endif
+        ScopedLock lock(mutex_);
+        dict_ = dict;
+        return true;
+    }
+
+    // a zstd dictionary of about _length bytes from bodies like the ones sent
+    static bool TrainDict(const std::vector<std::string>& _samples, size_t _length, std::string& _dict) {
+#ifdef STN_WITH_ZSTD
+        std::string samples;
+        std::vector<size_t> sizes;
+        for (std::vector<std::string>::const_iterator it = _samples.begin(); it != _samples.end(); ++it) {
+            samples += *it;
+            sizes.push_back(it->size());
+        }
+        if (sizes.empty()) return false;
+
+        _dict.resize(_length);
+        size_t ret = ZDICT_trainFromBuffer(&_dict[0], _length, samples.data(), &sizes[0], (unsigned)sizes.size());
+        if (ZDICT_isError(ret)) return false;
+        _dict.resize(ret);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    int Modes() {
+        ScopedLock lock(mutex_);
+        return modes_;
+    }
+
+    uint32_t DictID() {
+        ScopedLock lock(mutex_);
+        return dict_ ? dict_->id : 0;
+    }
+
+    PayloadCompressStats Stats() {
+        ScopedLock lock(mutex_);
+        return stats_;
+    }
+
+  public:
+    // long link: what a new connection offers, empty when it is off
+    bool MakeOffer(AutoBuffer& _body) {
+        int modes = Modes();
+        if (kPayloadCompressNone == modes) return false;
+        __WriteAgree(_body, modes, DictID());
+        return true;
+    }
+
+    // long link: the server's choice out of the offer. _dict_id is 0 unless it has the dictionary too.
+    static bool ParseAnswer(const AutoBuffer& _body, int& _mode, uint32_t& _dict_id) {
+        int modes = 0;
+        if (!__ReadAgree(_body, modes, _dict_id)) return false;
+        _mode = Choose(modes);
+        return true;
+    }
+
+    // long link: sent once the answer is taken, the bodies after it carry the tag. read with ParseAnswer.
+    static void MakeConfirm(int _mode, uint32_t _dict_id, AutoBuffer& _body) {
+        __WriteAgree(_body, _mode, _dict_id);
+    }
+
+    // the server side of it, for tests and servers built from this
+    bool MakeAnswer(const AutoBuffer& _offer, AutoBuffer& _answer) {
+        int modes = 0;
+        uint32_t dict_id = 0;
+        if (!__ReadAgree(_offer, modes, dict_id)) return false;
+        if (dict_id != DictID()) dict_id = 0;
+        __WriteAgree(_answer, Choose(modes & Modes()), dict_id);
+        return true;
+    }
+
+    // long link: _body tagged, compressed with _mode when it is long enough and gets shorter
+    void Encode(int _mode, uint32_t _dict_id, uint32_t _cmdid, const void* _body, size_t _length, AutoBuffer& _out) {
+        __Reserve(_out, kTagLength + _length);
+
+        if (kPayloadCompressNone != _mode && _length >= __MinLength(_cmdid)) {
+            uint64_t begin = __CpuUs();
+            size_t packed = __Compress(_mode, __UseDict(_dict_id), _body, _length, _out, kTagLength);
+            if (0 < packed && packed < _length) {
+                unsigned char tag[kTagLength] = {(unsigned char)_mode, (unsigned char)(_length >> 24), (unsigned char)(_length >> 16),
+                                                 (unsigned char)(_length >> 8), (unsigned char)_length};
+                _out.Write((off_t)0, tag, kTagLength);
+                _out.Length(0, kTagLength + packed);
+                __Count(true, _length, kTagLength + packed, __CpuUs() - begin);
+                return;
+            }
+        }
+
+        unsigned char stored = kPayloadCompressNone;
+        _out.Length(0, 0);
+        _out.Write(&stored, 1);
+        if (0 < _length) _out.Write(_body, _length);
+        _out.Seek(0, AutoBuffer::ESeekStart);
+    }
+
+    // long link: _tagged back to what was encoded, false if it is broken
+    bool Decode(const AutoBuffer& _tagged, AutoBuffer& _out) {
+        const unsigned char* p = (const unsigned char*)_tagged.Ptr();
+        if (NULL == p || 0 == _tagged.Length()) return false;
+
+        if (kPayloadCompressNone == p[0]) {
+            _out.Write(p + 1, _tagged.Length() - 1);
+            _out.Seek(0, AutoBuffer::ESeekStart);
+            return true;
+        }
+
+        if (_tagged.Length() < kTagLength) return false;
+        size_t length = ((size_t)p[1] << 24) | ((size_t)p[2] << 16) | ((size_t)p[3] << 8) | p[4];
+        if (length > kMaxLength) return false;
+
+        uint64_t begin = __CpuUs();
+        if (!__Decompress(p[0], p + kTagLength, _tagged.Length() - kTagLength, length, _out)) return false;
+        __Count(false, 0, _out.Length(), __CpuUs() - begin);
+        _out.Seek(0, AutoBuffer::ESeekStart);
+        return true;
+    }
+
+    // short link: Accept-Encoding of a request, empty when off
+    std::string AcceptEncoding() {
+        int modes = Modes();
+        std::string accept;
+        if (modes & kPayloadCompressZstd) accept += "zstd";
+        if (modes & kPayloadCompressZlib) accept += accept.empty() ? "deflate" : ", deflate";
+        return accept;
+    }
+
+    // none for what it does not know, the body is passed on as it came
+    static int ContentEncodingMode(const char* _encoding) {
+        if (NULL == _encoding) return kPayloadCompressNone;
+        if (0 == strcmp("zstd", _encoding)) return kPayloadCompressZstd & Built();
+        if (0 == strcmp("deflate", _encoding)) return kPayloadCompressZlib;
+        return kPayloadCompressNone;
+    }
+
+    static const char* ContentEncoding(int _mode) {
+        switch (_mode) {
+            case kPayloadCompressZstd: return "zstd";
+            case kPayloadCompressZlib: return "deflate";
+            default: return NULL;
+        }
+    }
+
+    // short link: a host that answered with a Content-Encoding takes request bodies in it too
+    void LearnHost(const std::string& _host, int _mode) {
+        ScopedLock lock(mutex_);
+        if (kPayloadCompressNone == _mode) return;
+        host_mode_[_host] = _mode;
+    }
+
+    int HostMode(const std::string& _host) {
+        ScopedLock lock(mutex_);
+        std::map<std::string, int>::iterator it = host_mode_.find(_host);
+        return host_mode_.end() == it ? kPayloadCompressNone : (it->second & modes_);
+    }
+
+    // short link: _body in a Content-Encoding, false when it is not worth it
+    bool EncodeContent(int _mode, uint32_t _cmdid, const AutoBuffer& _body, AutoBuffer& _out) {
+        if (NULL == ContentEncoding(_mode) || _body.Length() < __MinLength(_cmdid)) return false;
+
+        uint64_t begin = __CpuUs();
+        size_t packed = __Compress(_mode, boost::shared_ptr<Dict>(), _body.Ptr(), _body.Length(), _out, 0);
+        if (0 == packed || packed >= _body.Length()) return false;
+
+        _out.Length(0, packed);
+        __Count(true, _body.Length(), packed, __CpuUs() - begin);
+        return true;
+    }
+
+    bool DecodeContent(int _mode, const AutoBuffer& _body, AutoBuffer& _out) {
+        uint64_t begin = __CpuUs();
+        if (!__Decompress(_mode, _body.Ptr(), _body.Length(), 0, _out)) return false;
+        __Count(false, 0, _out.Length(), __CpuUs() - begin);
+        _out.Seek(0, AutoBuffer::ESeekStart);
+        return true;
+    }
+
+  private:
+    static const int kZstdLevel = 3;
+
+    struct Dict {
+        Dict(): id(0)
+#ifdef STN_WITH_ZSTD
+        , cdict(NULL), ddict(NULL)
+#endif
+        {}
+
+        ~Dict() {
+#ifdef STN_WITH_ZSTD
+            if (NULL != cdict) ZSTD_freeCDict(cdict);
+            if (NULL != ddict) ZSTD_freeDDict(ddict);
+#endif
+        }
+
+        uint32_t     id;
+#ifdef STN_WITH_ZSTD
+        ZSTD_CDict*  cdict;
+        ZSTD_DDict*  ddict;
+#endif
+    };
+
+    static void __WriteAgree(AutoBuffer& _body, int _modes, uint32_t _dict_id) {
+        unsigned char agree[kAgreeLength] = {kAgreeVersion, (unsigned char)_modes, (unsigned char)(_dict_id >> 24), (unsigned char)(_dict_id >> 16),
+                                             (unsigned char)(_dict_id >> 8), (unsigned char)_dict_id};
+        _body.Write(agree, kAgreeLength);
+        _body.Seek(0, AutoBuffer::ESeekStart);
+    }
+
+    static bool __ReadAgree(const AutoBuffer& _body, int& _modes, uint32_t& _dict_id) {
+        const unsigned char* p = (const unsigned char*)_body.Ptr();
+        if (NULL == p || _body.Length() < kAgreeLength || kAgreeVersion != p[0]) return false;
+        _modes = p[1];
+        _dict_id = ((uint32_t)p[2] << 24) | ((uint32_t)p[3] << 16) | ((uint32_t)p[4] << 8) | p[5];
+        return true;
+    }
+
+    size_t __MinLength(uint32_t _cmdid) {
+        ScopedLock lock(mutex_);
+        std::map<uint32_t, size_t>::iterator it = cmdid_min_length_.find(_cmdid);
+        return cmdid_min_length_.end() == it ? min_length_ : it->second;
+    }
+
+    boost::shared_ptr<Dict> __UseDict(uint32_t _dict_id) {
+        ScopedLock lock(mutex_);
+        if (0 == _dict_id || !dict_ || _dict_id != dict_->id) return boost::shared_ptr<Dict>();
+        return dict_;
+    }
+
+    static void __Reserve(AutoBuffer& _buffer, size_t _capacity) {
+        if (_buffer.Capacity() < _capacity) _buffer.AddCapacity(_capacity - _buffer.Capacity());
+    }
+
+    // compressed length written at _offset of _out, 0 if it failed
+    static size_t __Compress(int _mode, const boost::shared_ptr<Dict>& _dict, const void* _src, size_t _length, AutoBuffer& _out, size_t _offset) {
+        switch (_mode) {
+            case kPayloadCompressZlib: {
+                uLongf bound = compressBound((uLong)_length);
+                __Reserve(_out, _offset + bound);
+                if (Z_OK != compress2((Bytef*)_out.Ptr(_offset), &bound, (const Bytef*)_src, (uLong)_length, Z_DEFAULT_COMPRESSION)) return 0;
+                return bound;
+            }
+#ifdef STN_WITH_ZSTD
+            case kPayloadCompressZstd: {
+                size_t bound = ZSTD_compressBound(_length);
+                __Reserve(_out, _offset + bound);
+                ZSTD_CCtx* cctx = ZSTD_createCCtx();
+                if (NULL == cctx) return 0;
+                size_t ret = _dict ? ZSTD_compress_usingCDict(cctx, _out.Ptr(_offset), bound, _src, _length, _dict->cdict)
+                                   : ZSTD_compressCCtx(cctx, _out.Ptr(_offset), bound, _src, _length, kZstdLevel);
+                ZSTD_freeCCtx(cctx);
+                return ZSTD_isError(ret) ? 0 : ret;
+            }
+#endif
+#ifdef STN_WITH_LZ4
+            case kPayloadCompressLz4: {
+                if (_length > (size_t)LZ4_MAX_INPUT_SIZE) return 0;
+                int bound = LZ4_compressBound((int)_length);
+                __Reserve(_out, _offset + bound);
+                int ret = LZ4_compress_default((const char*)_src, (char*)_out.Ptr(_offset), (int)_length, bound);
+                return 0 < ret ? (size_t)ret : 0;
+            }
+#endif
+            default:
+                return 0;
+        }
+    }
+
+    // _length is the length before compression, 0 when it is not known
+    bool __Decompress(int _mode, const void* _src, size_t _src_length, size_t _length, AutoBuffer& _out) {
+        switch (_mode) {
+            case kPayloadCompressZlib: {
+                z_stream stream;
+                memset(&stream, 0, sizeof(stream));
+                if (Z_OK != inflateInit(&stream)) return false;
+
+                stream.next_in = (Bytef*)_src;
+                stream.avail_in = (uInt)_src_length;
+                size_t capacity = 0 < _length ? _length : 4 * _src_length + 256;
+
+                int ret = Z_OK;
+                while (Z_OK == ret) {
+                    if (capacity > kMaxLength) capacity = kMaxLength;
+                    __Reserve(_out, capacity);
+                    stream.next_out = (Bytef*)_out.Ptr(stream.total_out);
+                    stream.avail_out = (uInt)(capacity - stream.total_out);
+                    ret = inflate(&stream, Z_NO_FLUSH);
+                    if (Z_OK == ret && 0 == stream.avail_out && capacity >= kMaxLength) ret = Z_BUF_ERROR;
+                    capacity *= 2;
+                }
+                size_t out = stream.total_out;
+                inflateEnd(&stream);
+
+                if (Z_STREAM_END != ret || (0 < _length && out != _length)) return false;
+                _out.Length(0, out);
+                return true;
+            }
+#ifdef STN_WITH_ZSTD
+            case kPayloadCompressZstd: {
+                boost::shared_ptr<Dict> dict;
+                uint32_t dict_id = (uint32_t)ZSTD_getDictID_fromFrame(_src, _src_length);
+                if (0 != dict_id && !(dict = __UseDict(dict_id))) return false;
+
+                ZSTD_DCtx* dctx = ZSTD_createDCtx();
+                if (NULL == dctx) return false;
+                if (dict) ZSTD_DCtx_refDDict(dctx, dict->ddict);
+
+                ZSTD_inBuffer input = {_src, _src_length, 0};
+                // one byte over, so a frame longer than it said fails instead of looking done
+                size_t capacity = 0 < _length ? _length + 1 : 4 * _src_length + 256;
+                size_t ret = 1;
+                size_t out = 0;
+                while (0 != ret) {
+                    if (out == capacity) {
+                        if (capacity >= kMaxLength || 0 < _length) break;
+                        capacity = capacity * 2 > kMaxLength ? kMaxLength : capacity * 2;
+                    }
+                    __Reserve(_out, capacity);
+                    ZSTD_outBuffer output = {_out.Ptr(), capacity, out};
+                    ret = ZSTD_decompressStream(dctx, &output, &input);
+                    out = output.pos;
+                    if (ZSTD_isError(ret)) break;
+                    if (0 != ret && input.pos == input.size && output.pos < output.size) break;   // cut short
+                }
+                ZSTD_freeDCtx(dctx);
+
+                if (0 != ret || (0 < _length && out != _length)) return false;
+                _out.Length(0, out);
+                return true;
+            }
+#endif
+#ifdef STN_WITH_LZ4
+            case kPayloadCompressLz4: {
+                if (0 == _length || _length > (size_t)LZ4_MAX_INPUT_SIZE) return false;
+                __Reserve(_out, _length);
+                int ret = LZ4_decompress_safe((const char*)_src, (char*)_out.Ptr(), (int)_src_length, (int)_length);
+                if (ret != (int)_length) return false;
+                _out.Length(0, _length);
+                return true;
+            }
+#endif
+            default:
+                return false;
+        }
+    }
+
+    static uint64_t __CpuUs() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+        timespec ts;
+        if (0 != clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return 0;
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+        return 0;
+#endif
+    }
+
+    void __Count(bool _compress, size_t _raw, size_t _out, uint64_t _cpu_us) {
+        ScopedLock lock(mutex_);
+        if (_compress) {
+            ++stats_.compressed_count;
+            stats_.raw_bytes += _raw;
+            stats_.compressed_bytes += _out;
+            stats_.compress_cpu_us += _cpu_us;
+        } else {
+            ++stats_.decompressed_count;
+            stats_.decompressed_bytes += _out;
+            stats_.decompress_cpu_us += _cpu_us;
+        }
+    }
+
+  private:
+    PayloadCompress(const PayloadCompress&);
+    PayloadCompress& operator=(const PayloadCompress&);
+
+  private:
+    Mutex                         mutex_;
+    int                           modes_;
+    size_t                        min_length_;
+    std::map<uint32_t, size_t>    cmdid_min_length_;
+    std::map<std::string, int>    host_mode_;
+    boost::shared_ptr<Dict>       dict_;
+    PayloadCompressStats          stats_;
+};
+
+}}
+
+#endif // STN_SRC_PAYLOAD_COMPRESS_H_
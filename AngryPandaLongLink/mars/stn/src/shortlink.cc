@@ -40,6 +40,7 @@
 #include "mars/comm/socket/getsocktcpinfo.h"
 #endif
 #include "mars/stn/proto/shortlink_packer.h"
+#include "payload_compress.h"
 
 
 
@@ -103,8 +104,10 @@ ShortLink::ShortLink(MessageQueue::MessageQueue_t _messagequeueid, NetSource& _n
     : asyncreg_(MessageQueue::InstallAsyncHandler(_messagequeueid))
 	, net_source_(_netsource)
 	, task_(_task)
-	, thread_(boost::bind(&ShortLink::__Run, this), XLOGGER_TAG "::shortlink")
     , use_proxy_(_use_proxy)
+    , reused_(false)
+    , stale_(false)
+    , keepalive_ms_(0)
     , tracker_(shortlink_tracker::Create())
     {
     xinfo2(TSF"%_, handler:(%_,%_)",XTHIS, asyncreg_.Get().queue, asyncreg_.Get().seq);
@@ -122,7 +125,19 @@ void ShortLink::SendRequest(AutoBuffer& _buf_req, AutoBuffer& _buffer_extend) {
     xdebug2(XTHIS)(TSF"bufReq.size:%_", _buf_req.Length());
     send_body_.Attach(_buf_req);
     send_extend_.Attach(_buffer_extend);
-    thread_.start();
+    if (ShortLinkWorkers::Instance().Run(this, boost::bind(&ShortLink::__Run, this))) return;
+
+    // the task manager is still walking its tasks, told from the message queue
+    MessageQueue::AsyncInvoke(boost::bind(&ShortLink::__OnStartFail, this), AYNC_HANDLER);
+}
+
+void ShortLink::__OnStartFail() {
+    xerror2(TSF"no thread for taskid:%_, cgi:%_, @%_", task_.taskid, task_.cgi, this);
+
+    ConnectProfile conn_profile;
+    getCurrNetLabel(conn_profile.net_type);
+    conn_profile.start_time = ::gettickcount();
+    __RunResponseError(kEctLocal, kEctLocalStartTaskFail, conn_profile, false);
 }
 
 void ShortLink::__Run() {
@@ -144,10 +159,34 @@ void ShortLink::__Run() {
     int errcode = 0;
     __RunReadWrite(fd_socket, errtype, errcode, conn_profile);
 
+    // a socket an earlier task left open was closed before the request got out, once more on a new one.
+    // once the request is sent it is a POST the server may have run, it is not sent again.
+    if (stale_) {
+        xwarn2(TSF"kept alive socket %_ closed by server, %_", fd_socket, message.String());
+        socket_close(fd_socket);
+        conn_profile.ip_items.clear();
+        fd_socket = __RunConnect(conn_profile);
+        if (INVALID_SOCKET == fd_socket) return;
+        __RunReadWrite(fd_socket, errtype, errcode, conn_profile);
+    }
+
     conn_profile.disconn_signal = ::getSignal(::getNetInfo() == kWifi);
     __UpdateProfile(conn_profile);
 
-    socket_close(fd_socket);
+    if (0 < keepalive_ms_ && !breaker_.IsBreak()) {
+        ShortLinkConnection conn;
+        conn.sock = fd_socket;
+        conn.host = conn_profile.host;
+        conn.ip = conn_profile.ip;
+        conn.port = conn_profile.port;
+        conn.ip_type = conn_profile.ip_type;
+        conn.local_ip = conn_profile.local_ip;
+        conn.local_port = conn_profile.local_port;
+        conn.nat64 = conn_profile.nat64;
+        ShortLinkConnectionPool::Instance().Put(conn, keepalive_ms_, ::gettickcount());
+    } else {
+        socket_close(fd_socket);
+    }
 }
 
 
@@ -155,6 +194,7 @@ SOCKET ShortLink::__RunConnect(ConnectProfile& _conn_profile) {
     xmessage2_define(message)(TSF"taskid:%_, cgi:%_, @%_", task_.taskid, task_.cgi, this);
 
     std::vector<socket_address> vecaddr;
+    reused_ = false;
 
     _conn_profile.dns_time = ::gettickcount();
     __UpdateProfile(_conn_profile);
@@ -234,6 +274,12 @@ SOCKET ShortLink::__RunConnect(ConnectProfile& _conn_profile) {
     getCurrNetLabel(_conn_profile.net_type);
     __UpdateProfile(_conn_profile);
 
+    ShortLinkConnection pooled;
+    if (!stale_ && !use_proxy && ShortLinkConnectionPool::Instance().Enabled()
+            && ShortLinkConnectionPool::Instance().Get(_conn_profile.host, _conn_profile.port, ::gettickcount(), pooled)) {
+        return __ReuseConnection(pooled, _conn_profile);
+    }
+
     // set the first ip info to the profiler, after connect, the ip info will be overwrriten by the real one
 
     ShortLinkConnectObserver connect_observer(*this);
@@ -289,6 +335,40 @@ SOCKET ShortLink::__RunConnect(ConnectProfile& _conn_profile) {
     return sock;
 }
 
+SOCKET ShortLink::__ReuseConnection(const ShortLinkConnection& _conn, ConnectProfile& _conn_profile) {
+    int index = -1;
+    for (size_t i = 0; i < _conn_profile.ip_items.size(); ++i) {
+        if (_conn.ip == _conn_profile.ip_items[i].str_ip) {
+            index = (int)i;
+            break;
+        }
+    }
+
+    // dns has moved on since, the profile still tells where it goes
+    if (-1 == index) {
+        IPPortItem item = {_conn.ip, _conn.port, _conn.ip_type, _conn.host};
+        _conn_profile.ip_items.push_back(item);
+        index = (int)_conn_profile.ip_items.size() - 1;
+    }
+
+    _conn_profile.ip_index = index;
+    _conn_profile.host = _conn.host;
+    _conn_profile.ip = _conn.ip;
+    _conn_profile.port = _conn.port;
+    _conn_profile.ip_type = _conn.ip_type;
+    _conn_profile.local_ip = _conn.local_ip;
+    _conn_profile.local_port = _conn.local_port;
+    _conn_profile.nat64 = _conn.nat64;
+    _conn_profile.conn_rtt = 0;
+    _conn_profile.conn_cost = 0;
+    _conn_profile.conn_time = gettickcount();
+    __UpdateProfile(_conn_profile);
+
+    reused_ = true;
+    xinfo2(TSF"task socket reuse sock:%_, taskid:%_, host:%_, ip:%_, port:%_, local_port:%_", _conn.sock, task_.taskid, _conn.host, _conn.ip, _conn.port, _conn.local_port);
+    return _conn.sock;
+}
+
 void ShortLink::__RunReadWrite(SOCKET _socket, int& _err_type, int& _err_code, ConnectProfile& _conn_profile) {
 	xmessage2_define(message)(TSF"taskid:%_, cgi:%_, @%_", task_.taskid, task_.cgi, this);
 
@@ -319,9 +399,23 @@ void ShortLink::__RunReadWrite(SOCKET _socket, int& _err_type, int& _err_code, C
 		headers[http::HeaderFields::kStringProxyAuthorization] = auth_info;
 	}
 
+	// not through a proxy, the socket goes to the proxy and not to the host
+	bool keepalive = kIPSourceProxy != _conn_profile.ip_type && ShortLinkConnectionPool::Instance().Enabled();
+	if (keepalive) headers.insert(http::HeaderFields::MakeConnectionKeepalive());
+	keepalive_ms_ = 0;
+
+	std::string accept_encoding = PayloadCompress::Instance().AcceptEncoding();
+	if (!accept_encoding.empty()) headers[http::HeaderFields::KStringAcceptEncoding] = accept_encoding;
+
+	// a host that answered in a Content-Encoding takes the request body in it too
+	AutoBuffer encoded_body;
+	int encode_mode = PayloadCompress::Instance().HostMode(_conn_profile.host);
+	bool encoded = PayloadCompress::Instance().EncodeContent(encode_mode, task_.cmdid, send_body_, encoded_body);
+	if (encoded) headers[http::HeaderFields::kStringContentEncoding] = PayloadCompress::ContentEncoding(encode_mode);
+
 	AutoBuffer out_buff;
 
-	shortlink_pack(url, headers, send_body_, send_extend_, out_buff, tracker_.get());
+	shortlink_pack(url, headers, encoded ? encoded_body : send_body_, send_extend_, out_buff, tracker_.get());
 
 	// send request
 	xgroup2_define(group_send);
@@ -329,6 +423,12 @@ void ShortLink::__RunReadWrite(SOCKET _socket, int& _err_type, int& _err_code, C
 
 	int send_ret = block_socket_send(_socket, (const unsigned char*)out_buff.Ptr(), (unsigned int)out_buff.Length(), breaker_, _err_code);
 
+	if (send_ret < 0 && reused_ && !breaker_.IsBreak()) {
+		xwarn2(TSF"send on kept alive socket fail, errno:%_", strerror(_err_code)) >> group_send;
+		stale_ = true;
+		return;
+	}
+
 	if (send_ret < 0) {
 		xerror2(TSF"Send Request Error, ret:%0, errno:%1, nread:%_, nwrite:%_", send_ret, strerror(_err_code), socket_nread(_socket), socket_nwrite(_socket)) >> group_send;
 		__RunResponseError(kEctSocket, (_err_code == 0) ? kEctSocketWritenWithNonBlock : _err_code, _conn_profile, true);
@@ -413,13 +513,31 @@ void ShortLink::__RunReadWrite(SOCKET _socket, int& _err_type, int& _err_code, C
 			break;
 		}
 		else if (parse_status == http::Parser::kEnd) {
+			// the server keeps it open unless it says otherwise, http/1.0 only when asked
+			if (keepalive && kVersion_1_1 == parser.Status().Version() && !parser.Fields().IsConnectionClose())
+				keepalive_ms_ = ShortLinkConnectionPool::Instance().KeepAliveMs(parser.Fields().KeepAliveTimeout());
+
 			if (status_code != 200) {
 				xerror2(TSF"@%0, status_code != 200, code:%1, http dump:%2 \n headers size:%3", this, status_code, xdump(recv_buf.Ptr(), recv_buf.Length()), parser.Fields().GetHeaders().size()) >> group_close;
 				__RunResponseError(kEctHttp, status_code, _conn_profile, true);
 			}
 			else {
 				xinfo2(TSF"@%0, headers size:%_, ", this, parser.Fields().GetHeaders().size()) >> group_recv;
-				__OnResponse(kEctOK, status_code, body, extension, _conn_profile, true);
+
+				const char* content_encoding = parser.Fields().HeaderField(http::HeaderFields::kStringContentEncoding);
+				int decode_mode = PayloadCompress::ContentEncodingMode(content_encoding);
+				AutoBuffer decoded_body;
+
+				if (kPayloadCompressNone != decode_mode && !PayloadCompress::Instance().DecodeContent(decode_mode, body, decoded_body)) {
+					xerror2(TSF"@%0, content encoding:%1 decode fail, len:%2", this, content_encoding, body.Length()) >> group_close;
+					__RunResponseError(kEctHttp, kEctHttpContentDecode, _conn_profile, true);
+				} else {
+					if (kPayloadCompressNone != decode_mode) {
+						body.Attach(decoded_body);
+						PayloadCompress::Instance().LearnHost(_conn_profile.host, decode_mode);
+					}
+					__OnResponse(kEctOK, status_code, body, extension, _conn_profile, true);
+				}
 			}
 			break;
 		}
@@ -471,7 +589,7 @@ void ShortLink::__OnResponse(ErrCmdType _errType, int _status, AutoBuffer& _body
 void ShortLink::__CancelAndWaitWorkerThread() {
     xdebug_function();
 
-    if (!thread_.isruning()) return;
+    if (!ShortLinkWorkers::Instance().Running(this)) return;
 
     xassert2(breaker_.IsCreateSuc());
 
@@ -481,5 +599,5 @@ void ShortLink::__CancelAndWaitWorkerThread() {
     }
 
     dns_util_.Cancel();
-    thread_.join();
+    ShortLinkWorkers::Instance().Wait(this);
 }
@@ -38,6 +38,7 @@
 
 #include "net_source.h"
 #include "shortlink_interface.h"
+#include "shortlink_pool.h"
 
 namespace mars {
 namespace stn {
@@ -58,6 +59,8 @@ class ShortLink : public ShortLinkInterface {
     virtual SOCKET   __RunConnect(ConnectProfile& _conn_profile);
     virtual void     __RunReadWrite(SOCKET _sock, int& _errtype, int& _errcode, ConnectProfile& _conn_profile);
     void             __CancelAndWaitWorkerThread();
+    void             __OnStartFail();
+    SOCKET           __ReuseConnection(const ShortLinkConnection& _conn, ConnectProfile& _conn_profile);
 
     void			 __UpdateProfile(const ConnectProfile& _conn_profile);
 
@@ -68,7 +71,6 @@ class ShortLink : public ShortLinkInterface {
     MessageQueue::ScopeRegister     asyncreg_;
     NetSource&                      net_source_;
     Task                            task_;
-    Thread                          thread_;
 
     SocketBreaker                   breaker_;
     ConnectProfile                  conn_profile_;
@@ -76,6 +78,10 @@ class ShortLink : public ShortLinkInterface {
     const bool                      use_proxy_;
     AutoBuffer                      send_body_;
     AutoBuffer                      send_extend_;
+
+    bool                            reused_;        // the socket was left open by an earlier task
+    bool                            stale_;         // and the server closed it before the request got there
+    uint64_t                        keepalive_ms_;  // 0 closes the socket after the response
     
     boost::scoped_ptr<shortlink_tracker> tracker_;
 };
@@ -0,0 +1,334 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * shortlink_pool.h
+ *
+ * what ShortLink keeps between tasks: sockets the server left open after a response, by host and port,
+ * so the next task to the host skips dns and the connect, and the threads tasks ran on, so the next
+ * task does not start one. off until SetKeepAlive is given an idle time, the threads are always kept.
+ */
+
+#ifndef STN_SRC_SHORTLINK_POOL_H_
+#define STN_SRC_SHORTLINK_POOL_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/function.hpp"
+
+#include "mars/comm/socket/unix_socket.h"
+#include "mars/comm/thread/condition.h"
+#include "mars/comm/thread/lock.h"
+#include "mars/comm/thread/thread.h"
+#include "mars/comm/time_utils.h"
+#include "mars/comm/xlogger/xlogger.h"
+#include "mars/stn/stn.h"
+
+namespace mars {
+namespace stn {
+
+// a socket left open and where it goes, for the ConnectProfile of the task that takes it
+struct ShortLinkConnection {
+    ShortLinkConnection(): sock(INVALID_SOCKET), port(0), ip_type(kIPSourceNULL), local_port(0), nat64(false), expire(0) {}
+
+    SOCKET        sock;
+    std::string   host;
+    std::string   ip;
+    uint16_t      port;
+    IPSourceType  ip_type;
+    std::string   local_ip;
+    uint16_t      local_port;
+    bool          nat64;
+    uint64_t      expire;       // gettickcount, closed after
+};
+
+class ShortLinkConnectionPool {
+  public:
+    static const size_t kMaxPerHost = 4;
+    static const size_t kMaxIdle = 16;
+    static const uint64_t kServerMarginMs = 1000;   // gone before the server's Keep-Alive timeout closes it
+
+    static ShortLinkConnectionPool& Instance() {
+        static ShortLinkConnectionPool pool;
+        return pool;
+    }
+
+  public:
+    ShortLinkConnectionPool(): idle_ms_(0) {}
+    ~ShortLinkConnectionPool() { Clear(); }
+
+    // 0 closes every socket after its response, as it always did
+    void SetKeepAlive(uint64_t _idle_ms) {
+        ScopedLock lock(mutex_);
+        idle_ms_ = _idle_ms;
+        if (0 < idle_ms_) return;
+        lock.unlock();
+        Clear();
+    }
+
+    bool Enabled() {
+        ScopedLock lock(mutex_);
+        return 0 < idle_ms_;
+    }
+
+    // how long a socket may be kept once its response came, 0 to close it. _server_timeout_s is
+    // the timeout of the response's Keep-Alive header, -1 when it had none.
+    uint64_t KeepAliveMs(int _server_timeout_s) {
+        ScopedLock lock(mutex_);
+        if (0 > _server_timeout_s) return idle_ms_;
+        uint64_t server_ms = (uint64_t)_server_timeout_s * 1000;
+        if (server_ms <= kServerMarginMs) return 0;
+        return std::min(idle_ms_, server_ms - kServerMarginMs);
+    }
+
+    // the newest socket to _host:_port still open. false if there is none.
+    bool Get(const std::string& _host, uint16_t _port, uint64_t _now, ShortLinkConnection& _conn) {
+        std::vector<SOCKET> dead;
+        bool found = false;
+
+        ScopedLock lock(mutex_);
+        __Expire(_now, dead);
+
+        for (std::list<ShortLinkConnection>::iterator it = idle_.begin(); it != idle_.end();) {
+            if (_host != it->host || _port != it->port) {
+                ++it;
+                continue;
+            }
+
+            ShortLinkConnection conn = *it;
+            it = idle_.erase(it);
+
+            if (__Closed(conn.sock)) {
+                dead.push_back(conn.sock);
+                continue;
+            }
+
+            _conn = conn;
+            found = true;
+            break;
+        }
+        lock.unlock();
+
+        __Close(dead);
+        return found;
+    }
+
+    // keeps _conn for the next task to its host, it is closed when there is no room
+    void Put(const ShortLinkConnection& _conn, uint64_t _keepalive_ms, uint64_t _now) {
+        std::vector<SOCKET> dead;
+
+        ScopedLock lock(mutex_);
+        __Expire(_now, dead);
+
+        if (0 == idle_ms_ || 0 == _keepalive_ms) {
+            dead.push_back(_conn.sock);
+        } else {
+            size_t same_host = 0;
+            for (std::list<ShortLinkConnection>::iterator it = idle_.begin(); it != idle_.end(); ++it) {
+                if (_conn.host == it->host && _conn.port == it->port) ++same_host;
+            }
+
+            // newest in front, the oldest of the host or of all go first
+            idle_.push_front(_conn);
+            idle_.front().expire = _now + _keepalive_ms;
+
+            if (same_host >= kMaxPerHost) {
+                for (std::list<ShortLinkConnection>::reverse_iterator it = idle_.rbegin(); it != idle_.rend(); ++it) {
+                    if (_conn.host != it->host || _conn.port != it->port) continue;
+                    dead.push_back(it->sock);
+                    idle_.erase(--(it.base()));
+                    break;
+                }
+            }
+
+            if (idle_.size() > kMaxIdle) {
+                dead.push_back(idle_.back().sock);
+                idle_.pop_back();
+            }
+        }
+        lock.unlock();
+
+        __Close(dead);
+    }
+
+    // the network changed, none of them goes anywhere now
+    void Clear() {
+        std::vector<SOCKET> dead;
+
+        ScopedLock lock(mutex_);
+        for (std::list<ShortLinkConnection>::iterator it = idle_.begin(); it != idle_.end(); ++it) dead.push_back(it->sock);
+        idle_.clear();
+        lock.unlock();
+
+        __Close(dead);
+    }
+
+    size_t IdleCount() {
+        ScopedLock lock(mutex_);
+        return idle_.size();
+    }
+
+  private:
+    void __Expire(uint64_t _now, std::vector<SOCKET>& _dead) {
+        for (std::list<ShortLinkConnection>::iterator it = idle_.begin(); it != idle_.end();) {
+            if (_now < it->expire) {
+                ++it;
+                continue;
+            }
+            _dead.push_back(it->sock);
+            it = idle_.erase(it);
+        }
+    }
+
+    // an idle socket with something to read was closed by the server, or sent what nobody asked for
+    static bool __Closed(SOCKET _sock) {
+#ifdef _WIN32
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(_sock, &readfds);
+        struct timeval timeout = {0, 0};
+        return 0 != select(0, &readfds, NULL, NULL, &timeout);
+#else
+        char byte = 0;
+        ssize_t ret = ::recv(_sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return !(0 > ret && IS_NOBLOCK_READ_ERRNO(socket_errno));
+#endif
+    }
+
+    static void __Close(const std::vector<SOCKET>& _socks) {
+        for (std::vector<SOCKET>::const_iterator it = _socks.begin(); it != _socks.end(); ++it) socket_close(*it);
+    }
+
+  private:
+    ShortLinkConnectionPool(const ShortLinkConnectionPool&);
+    ShortLinkConnectionPool& operator=(const ShortLinkConnectionPool&);
+
+  private:
+    Mutex                            mutex_;
+    uint64_t                         idle_ms_;
+    std::list<ShortLinkConnection>   idle_;
+};
+
+// threads for ShortLink::__Run. a task goes to a thread done with its last one, or to a new thread when
+// all are busy, so tasks never wait for each other. a thread left idle for kIdleMs ends.
+class ShortLinkWorkers {
+  public:
+    static const int kMaxIdle = 4;
+    static const int kIdleMs = 60 * 1000;
+
+    // never destroyed, idle threads may still be waiting on it at exit
+    static ShortLinkWorkers& Instance() {
+        static ShortLinkWorkers* workers = new ShortLinkWorkers;
+        return *workers;
+    }
+
+  public:
+    ShortLinkWorkers(): idle_(0), started_(0) {}
+
+    // false if there was no idle thread and a new one could not be started, _job does not run then
+    bool Run(const void* _owner, const boost::function<void ()>& _job) {
+        ScopedLock lock(mutex_);
+        running_.insert(_owner);
+
+        Job job = {_owner, _job};
+        if ((size_t)idle_ > handed_.size()) {
+            handed_.push_back(job);
+            cond_.notifyOne(lock);
+            return true;
+        }
+        ++started_;
+        lock.unlock();
+
+        // Thread detaches what it started when it is destroyed
+        Thread thread(boost::bind(&ShortLinkWorkers::__Worker, this, job), XLOGGER_TAG "::shortlink");
+        if (0 == thread.start()) return true;
+
+        xerror2(TSF"shortlink worker not started");
+        lock.lock();
+        running_.erase(_owner);
+        --started_;
+        done_.notifyAll(lock);
+        return false;
+    }
+
+    bool Running(const void* _owner) {
+        ScopedLock lock(mutex_);
+        return 0 != running_.count(_owner);
+    }
+
+    void Wait(const void* _owner) {
+        ScopedLock lock(mutex_);
+        while (0 != running_.count(_owner)) done_.wait(lock);
+    }
+
+    // threads started since the beginning, for tests
+    int Started() {
+        ScopedLock lock(mutex_);
+        return started_;
+    }
+
+  private:
+    struct Job {
+        const void*               owner;
+        boost::function<void ()>  run;
+    };
+
+    void __Worker(Job _job) {
+        while (true) {
+            _job.run();
+            _job.run.clear();
+
+            ScopedLock lock(mutex_);
+            running_.erase(_job.owner);
+            done_.notifyAll(lock);
+
+            if (kMaxIdle <= idle_) return;
+
+            ++idle_;
+            uint64_t deadline = ::gettickcount() + kIdleMs;
+            while (handed_.empty()) {
+                uint64_t now = ::gettickcount();
+                if (now >= deadline) break;
+                cond_.wait(lock, (long)(deadline - now));
+            }
+            --idle_;
+
+            if (handed_.empty()) return;
+            _job = handed_.front();
+            handed_.pop_front();
+        }
+    }
+
+  private:
+    ShortLinkWorkers(const ShortLinkWorkers&);
+    ShortLinkWorkers& operator=(const ShortLinkWorkers&);
+
+  private:
+    Mutex                    mutex_;
+    Condition                cond_;
+    Condition                done_;
+    int                      idle_;
+    int                      started_;
+    std::list<Job>           handed_;
+    std::set<const void*>    running_;
+};
+
+}}
+
+#endif // STN_SRC_SHORTLINK_POOL_H_
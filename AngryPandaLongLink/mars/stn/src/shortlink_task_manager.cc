@@ -47,6 +47,7 @@ using namespace mars::app;
 ShortLinkTaskManager::ShortLinkTaskManager(NetSource& _netsource, DynamicTimeout& _dynamictimeout, MessageQueue::MessageQueue_t _messagequeueid)
     : asyncreg_(MessageQueue::InstallAsyncHandler(_messagequeueid))
     , net_source_(_netsource)
+    , timeout_wheel_(::gettickcount())
     , default_use_proxy_(true)
     , tasks_continuous_fail_count_(0)
     , dynamic_timeout_(_dynamictimeout)
@@ -60,6 +61,7 @@ ShortLinkTaskManager::ShortLinkTaskManager(NetSource& _netsource, DynamicTimeout
 
 ShortLinkTaskManager::~ShortLinkTaskManager() {
     xinfo_function();
+    TaskCodecPool::Instance().CancelAndWait(this);
     asyncreg_.CancelAndWait();
     xinfo2(TSF"lst_cmd_ count=%0", lst_cmd_.size());
     __BatchErrorRespHandle(kEctLocal, kEctLocalReset, kTaskFailHandleTaskEnd, Task::kInvalidTaskID, false);
@@ -82,8 +84,8 @@ bool ShortLinkTaskManager::StartTask(const Task& _task) {
     TaskProfile task(_task);
     task.link_type = Task::kChannelShort;
 
-    lst_cmd_.push_back(task);
-    lst_cmd_.sort(__CompareTask);
+    std::list<TaskProfile>::iterator it = lst_cmd_.insert(task);
+    __ScheduleTimeout(*it);
 
     __RunLoop();
     return true;
@@ -92,38 +94,20 @@ bool ShortLinkTaskManager::StartTask(const Task& _task) {
 bool ShortLinkTaskManager::StopTask(uint32_t _taskid) {
     xverbose_function();
 
-    std::list<TaskProfile>::iterator first = lst_cmd_.begin();
-    std::list<TaskProfile>::iterator last = lst_cmd_.end();
-
-    while (first != last) {
-        if (_taskid == first->task.taskid) {
-            xinfo2(TSF"find the task, taskid:%0", _taskid);
+    std::list<TaskProfile>::iterator it = lst_cmd_.find(_taskid);
+    if (lst_cmd_.end() == it) return false;
 
-            __DeleteShortLink(first->running_id);
-            lst_cmd_.erase(first);
-            return true;
-        }
-
-        ++first;
-    }
+    xinfo2(TSF"find the task, taskid:%0", _taskid);
 
-    return false;
+    __DeleteShortLink(it->running_id);
+    lst_cmd_.erase(it);
+    return true;
 }
 
 bool ShortLinkTaskManager::HasTask(uint32_t _taskid) const {
     xverbose_function();
 
-    std::list<TaskProfile>::const_iterator first = lst_cmd_.begin();
-    std::list<TaskProfile>::const_iterator last = lst_cmd_.end();
-
-    while (first != last) {
-    	if (_taskid == first->task.taskid) {
-    		return true;
-    	}
-    	++first;
-    }
-
-    return false;
+    return lst_cmd_.end() != lst_cmd_.find(_taskid);
 }
 
 void ShortLinkTaskManager::ClearTasks() {
@@ -136,6 +120,7 @@ void ShortLinkTaskManager::ClearTasks() {
     }
 
     lst_cmd_.clear();
+    timeout_wheel_.Clear();
 }
 
 unsigned int ShortLinkTaskManager::GetTasksContinuousFailCount() {
@@ -153,15 +138,16 @@ void ShortLinkTaskManager::__RunLoop() {
     }
 
     __RunOnTimeout();
-    __RunOnStartTask();
+    bool waiting = __RunOnStartTask();
 
     if (!lst_cmd_.empty()) {
 #ifdef ANDROID
         wakeup_lock_->Lock(30 * 1000);
 #endif
-        MessageQueue::FasterMessage(asyncreg_.Get(),
-                                    MessageQueue::Message((MessageQueue::MessageTitle_t)this, boost::bind(&ShortLinkTaskManager::__RunLoop, this)),
-                                    MessageQueue::MessageTiming(1000));
+        // next timeout, tasks waiting to be sent are tried again every second
+        uint64_t next = timeout_wheel_.NextTime();
+        if (waiting) next = std::min(next, ::gettickcount() + 1000);
+        if (TimingWheel<uint32_t>::kNever != next) __PostRunLoop(next);
     } else {
 #ifdef ANDROID
         /*cancel the last wakeuplock*/
@@ -170,16 +156,36 @@ void ShortLinkTaskManager::__RunLoop() {
     }
 }
 
+void ShortLinkTaskManager::__PostRunLoop(uint64_t _time) {
+    uint64_t cur_time = ::gettickcount();
+    MessageQueue::FasterMessage(asyncreg_.Get(),
+                                MessageQueue::Message((MessageQueue::MessageTitle_t)this, boost::bind(&ShortLinkTaskManager::__RunLoop, this)),
+                                MessageQueue::MessageTiming(_time > cur_time ? (int64_t)(_time - cur_time) : 0));
+}
+
+// puts the task into the wheel if it has to be looked at before its current check time
+bool ShortLinkTaskManager::__ScheduleTimeout(TaskProfile& _profile) {
+    uint64_t time = __NextTimeoutTime(_profile);
+    if (0 != _profile.timeout_check_time && _profile.timeout_check_time <= time) return false;
+
+    _profile.timeout_check_time = time;
+    timeout_wheel_.Add(time, _profile.task.taskid);
+    return true;
+}
+
 void ShortLinkTaskManager::__RunOnTimeout() {
     xverbose2(TSF"lst_cmd_ size=%0", lst_cmd_.size());
-    std::list<TaskProfile>::iterator first = lst_cmd_.begin();
-    std::list<TaskProfile>::iterator last = lst_cmd_.end();
-
     uint64_t cur_time = ::gettickcount();
 
-    while (first != last) {
-        std::list<TaskProfile>::iterator next = first;
-        ++next;
+    timeout_expired_.clear();
+    timeout_wheel_.Expire(cur_time, timeout_expired_);
+
+    for (std::vector<uint32_t>::iterator id = timeout_expired_.begin(); id != timeout_expired_.end(); ++id) {
+        std::list<TaskProfile>::iterator first = __Locate(*id);
+
+        // gone, or this entry is stale and the task waits for a later look
+        if (lst_cmd_.end() == first || 0 == first->timeout_check_time || cur_time < first->timeout_check_time) continue;
+        first->timeout_check_time = 0;
 
         ErrCmdType err_type = kEctLocal;
         int socket_timeout_code = 0;
@@ -211,16 +217,18 @@ void ShortLinkTaskManager::__RunOnTimeout() {
             int port = first->running_id ? ((ShortLinkInterface*)first->running_id)->Profile().port : 0;
             dynamic_timeout_.CgiTaskStatistic(first->task.cgi, kDynTimeTaskFailedPkgLen, 0);
             __SetLastFailedStatus(first);
-            __SingleRespHandle(first, err_type, socket_timeout_code, err_type == kEctLocal ? kTaskFailHandleTaskTimeout : kTaskFailHandleDefault, 0, first->running_id ? ((ShortLinkInterface*)first->running_id)->Profile() : ConnectProfile());
+            bool end = __SingleRespHandle(first, err_type, socket_timeout_code, err_type == kEctLocal ? kTaskFailHandleTaskTimeout : kTaskFailHandleDefault, 0, first->running_id ? ((ShortLinkInterface*)first->running_id)->Profile() : ConnectProfile());
             xassert2(fun_notify_network_err_);
             fun_notify_network_err_(__LINE__, err_type, socket_timeout_code, ip, host, port);
+            if (end) continue;
         }
 
-        first = next;
+        __ScheduleTimeout(*first);
     }
 }
 
-void ShortLinkTaskManager::__RunOnStartTask() {
+// true if a task is left waiting to be sent
+bool ShortLinkTaskManager::__RunOnStartTask() {
     std::list<TaskProfile>::iterator first = lst_cmd_.begin();
     std::list<TaskProfile>::iterator last = lst_cmd_.end();
 
@@ -228,6 +236,7 @@ void ShortLinkTaskManager::__RunOnStartTask() {
     bool ismakesureauthsuccess = false;
     uint64_t curtime = ::gettickcount();
     int sent_count = 0;
+    bool waiting = false;
 
     while (first != last) {
         std::list<TaskProfile>::iterator next = first;
@@ -242,6 +251,7 @@ void ShortLinkTaskManager::__RunOnStartTask() {
         //重试间隔
         if (first->retry_time_interval > curtime - first->retry_start_time) {
             xdebug2(TSF"retry interval, taskid:%0, task retry late task, wait:%1", first->task.taskid, (curtime - first->transfer_profile.loop_start_task_time) / 1000);
+            waiting = true;
             first = next;
             continue;
         }
@@ -256,6 +266,7 @@ void ShortLinkTaskManager::__RunOnStartTask() {
 
             if (!ismakesureauthsuccess) {
                 xinfo2_if(curtime % 3 == 1, TSF"makeSureAuth retsult=%0", ismakesureauthsuccess);
+                waiting = true;
                 first = next;
                 continue;
             }
@@ -265,7 +276,13 @@ void ShortLinkTaskManager::__RunOnStartTask() {
         AutoBuffer buffer_extension;
         int error_code = 0;
 
-        if (!Req2Buf(first->task.taskid, first->task.user_context, bufreq, buffer_extension, error_code, Task::kChannelShort)) {
+        TaskEncodeResult encode_result = __EncodeRequest(first, bufreq, buffer_extension, error_code);
+        if (kTaskEncodePending == encode_result) {
+            first = next;
+            continue;
+        }
+
+        if (kTaskEncodeOK != encode_result) {
             __SingleRespHandle(first, kEctEnDecode, error_code, kTaskFailHandleTaskEnd, 0, first->running_id ? ((ShortLinkInterface*)first->running_id)->Profile() : ConnectProfile());
             first = next;
             continue;
@@ -292,10 +309,12 @@ void ShortLinkTaskManager::__RunOnStartTask() {
         worker->OnRecv = boost::bind(&ShortLinkTaskManager::__OnRecv, this, _1, _2, _3);
         worker->OnResponse = boost::bind(&ShortLinkTaskManager::__OnResponse, this, _1, _2, _3, _4, _5, _6, _7);
         first->running_id = (intptr_t)worker;
+        lst_cmd_.index_running(first);
 
         xassert2(worker && first->running_id);
         if (!first->running_id) {
 			xwarn2(TSF"task add into shortlink readwrite fail cgi:%_, cmdid:%_, taskid:%_", first->task.cgi, first->task.cmdid, first->task.taskid);
+			waiting = true;
 			first = next;
 			continue;
 		}
@@ -309,15 +328,44 @@ void ShortLinkTaskManager::__RunOnStartTask() {
         ++sent_count;
         first = next;
     }
+
+    return waiting;
+}
+
+// Req2Buf inline, or on the codec pool when it has workers: pending until __OnEncoded brings the request back
+TaskEncodeResult ShortLinkTaskManager::__EncodeRequest(std::list<TaskProfile>::iterator _it, AutoBuffer& _bufreq, AutoBuffer& _extension, int& _error_code) {
+    if (_it->encoded) {
+        boost::shared_ptr<TaskCodecJob> job = _it->encoded;
+        _it->encoded.reset();
+        _bufreq.Attach(job->buffer);
+        _extension.Attach(job->extension);
+        _error_code = job->error_code;
+        return job->result ? kTaskEncodeOK : kTaskEncodeFail;
+    }
+
+    if (_it->encoding) return kTaskEncodePending;
+
+    boost::shared_ptr<TaskCodecJob> job(new TaskCodecJob(_it->task.taskid, ++_it->encode_seq));
+    if (TaskCodecPool::Instance().Submit(this, TaskCodecPool::EncodeLane(_it->task.priority),
+                                         boost::bind(&TaskCodecJob::Encode, job, _it->task.user_context, (int)Task::kChannelShort),
+                                         boost::bind(&ShortLinkTaskManager::__OnEncoded, this, job))) {
+        _it->encoding = true;
+        return kTaskEncodePending;
+    }
+
+    return Req2Buf(_it->task.taskid, _it->task.user_context, _bufreq, _extension, _error_code, Task::kChannelShort) ? kTaskEncodeOK : kTaskEncodeFail;
 }
 
-struct find_seq {
-  public:
-    bool operator()(const TaskProfile& _value) {return p_worker == (ShortLinkInterface*)_value.running_id;}
+void ShortLinkTaskManager::__OnEncoded(boost::shared_ptr<TaskCodecJob> _job) {
+    RETURN_SHORTLINK_SYNC2ASYNC_FUNC_TITLE(boost::bind(&ShortLinkTaskManager::__OnEncoded, this, _job), _job.get());
 
-  public:
-    ShortLinkInterface* p_worker;
-};
+    std::list<TaskProfile>::iterator it = __Locate(_job->taskid);
+    if (lst_cmd_.end() == it || !it->encoding || _job->seq != it->encode_seq) return;   // stopped or started over meanwhile
+
+    it->encoding = false;
+    it->encoded = _job;
+    __PostRunLoop(::gettickcount());
+}
 
 void ShortLinkTaskManager::__OnResponse(ShortLinkInterface* _worker, ErrCmdType _err_type, int _status, AutoBuffer& _body, AutoBuffer& _extension, bool _cancel_retry, ConnectProfile& _conn_profile) {
     move_wrapper<AutoBuffer> body(_body);
@@ -352,13 +400,45 @@ void ShortLinkTaskManager::__OnResponse(ShortLinkInterface* _worker, ErrCmdType
 		it->remain_retry_count > 0 ? it->remain_retry_count-- : it->remain_retry_count;
 	}
 
-	int err_code = 0;
-	int handle_type = Buf2Resp(it->task.taskid, it->task.user_context, body, extension, err_code, Task::kChannelShort);
+	boost::shared_ptr<TaskCodecJob> job(new TaskCodecJob(it->task.taskid, ++it->decode_seq));
+	job->buffer.Attach(body.get());
+	job->extension.Attach(extension.get());
+
+	if (TaskCodecPool::Instance().Submit(this, TaskCodecPool::DecodeLane(it->task.priority),
+	                                     boost::bind(&TaskCodecJob::Decode, job, it->task.user_context, (int)Task::kChannelShort),
+	                                     boost::bind(&ShortLinkTaskManager::__OnDecoded, this, _worker, job, _conn_profile))) {
+		return;
+	}
+
+	job->Decode(it->task.user_context, Task::kChannelShort);
+	__OnDecoded(_worker, job, _conn_profile);
+}
+
+void ShortLinkTaskManager::__OnDecoded(ShortLinkInterface* _worker, boost::shared_ptr<TaskCodecJob> _job, const ConnectProfile& _conn_profile) {
+    RETURN_SHORTLINK_SYNC2ASYNC_FUNC_TITLE(boost::bind(&ShortLinkTaskManager::__OnDecoded, this, _worker, _job, _conn_profile), _worker);
+
+    // the worker is gone if the task ended or was retried while Buf2Resp ran
+    std::list<TaskProfile>::iterator it = __LocateBySeq((intptr_t)_worker);
+
+    if (lst_cmd_.end() == it) {
+        xwarn2(TSF"task no found after decode task:%0, worker:%1", _job->taskid, _worker);
+        return;
+    }
+
+    // a worker address can be taken again by the next send of the task
+    if (_job->seq != it->decode_seq) {
+        xwarn2(TSF"stale decode dropped task:%0, worker:%1, seq:%2, now:%3", _job->taskid, _worker, _job->seq, it->decode_seq);
+        return;
+    }
+
+	AutoBuffer& body = _job->buffer;
+	int err_code = _job->error_code;
+	int handle_type = _job->result;
 
 	switch(handle_type){
 		case kTaskFailHandleNoError:
 		{
-			dynamic_timeout_.CgiTaskStatistic(it->task.cgi, (unsigned int)it->transfer_profile.send_data_size + (unsigned int)body.get().Length(), ::gettickcount() - it->transfer_profile.start_send_time);
+			dynamic_timeout_.CgiTaskStatistic(it->task.cgi, (unsigned int)it->transfer_profile.send_data_size + (unsigned int)body.Length(), ::gettickcount() - it->transfer_profile.start_send_time);
 			__SingleRespHandle(it, kEctOK, err_code, handle_type, (unsigned int)it->transfer_profile.receive_data_size, _conn_profile);
 			xassert2(fun_notify_network_err_);
 			fun_notify_network_err_(__LINE__, kEctOK, err_code, _conn_profile.ip, _conn_profile.host, _conn_profile.port);
@@ -385,7 +465,7 @@ void ShortLinkTaskManager::__OnResponse(ShortLinkInterface* _worker, ErrCmdType
 			break;
 		case kTaskFailHandleDefault:
 		{
-			xerror2(TSF"task decode error handle_type:%_, err_code:%_, pWorker:%_, taskid:%_ body dump:%_", handle_type, err_code, (void*)it->running_id, it->task.taskid, xdump(body->Ptr(), body->Length()));
+			xerror2(TSF"task decode error handle_type:%_, err_code:%_, pWorker:%_, taskid:%_ body dump:%_", handle_type, err_code, (void*)it->running_id, it->task.taskid, xdump(body.Ptr(), body.Length()));
 			__SingleRespHandle(it, kEctEnDecode, err_code, handle_type, (unsigned int)it->transfer_profile.receive_data_size, _conn_profile);
 			xassert2(fun_notify_network_err_);
 			fun_notify_network_err_(__LINE__, kEctEnDecode, handle_type, _conn_profile.ip, _conn_profile.host, _conn_profile.port);
@@ -413,6 +493,7 @@ void ShortLinkTaskManager::__OnSend(ShortLinkInterface* _worker) {
     	    		it->transfer_profile.first_start_send_time = ::gettickcount();
         it->transfer_profile.start_send_time = ::gettickcount();
         xdebug2(TSF"taskid:%_, worker:%_, nStartSendTime:%_", it->task.taskid, _worker, it->transfer_profile.start_send_time / 1000);
+        if (__ScheduleTimeout(*it)) __PostRunLoop(it->timeout_check_time);
     }
 }
 
@@ -427,6 +508,7 @@ void ShortLinkTaskManager::__OnRecv(ShortLinkInterface* _worker, unsigned int _c
         it->transfer_profile.received_size = _cached_size;
         it->transfer_profile.receive_data_size = _total_size;
         xdebug2(TSF"worker:%_, last_recvtime:%_, cachedsize:%_, totalsize:%_", _worker, it->transfer_profile.last_receive_pkg_time / 1000, _cached_size, _total_size);
+        if (__ScheduleTimeout(*it)) __PostRunLoop(it->timeout_check_time);
     } else {
         xwarn2(TSF"not found worker:%_", _worker);
     }
@@ -563,18 +645,19 @@ bool ShortLinkTaskManager::__SingleRespHandle(std::list<TaskProfile>::iterator _
     return false;
 }
 
+std::list<TaskProfile>::iterator ShortLinkTaskManager::__Locate(uint32_t _taskid) {
+    if (Task::kInvalidTaskID == _taskid) return lst_cmd_.end();
+    return lst_cmd_.find(_taskid);
+}
+
 std::list<TaskProfile>::iterator ShortLinkTaskManager::__LocateBySeq(intptr_t _running_id) {
     if (!_running_id) return lst_cmd_.end();
-
-    find_seq find_functor;
-    find_functor.p_worker = (ShortLinkInterface*)_running_id;
-    std::list<TaskProfile>::iterator it = std::find_if(lst_cmd_.begin(), lst_cmd_.end(), find_functor);
-
-    return it;
+    return lst_cmd_.find_running(_running_id);
 }
 
 void ShortLinkTaskManager::__DeleteShortLink(intptr_t& _running_id) {
     if (!_running_id) return;
+    lst_cmd_.unindex_running(_running_id);
     ShortLinkInterface* p_shortlink = (ShortLinkInterface*)_running_id;
     Thread thread([=] () {
         ShortLinkChannelFactory::Destory(p_shortlink);
@@ -22,16 +22,20 @@
 #define STN_SRC_SHORTLINK_TASK_MANAGER_H_
 
 #include <list>
+#include <vector>
 #include <stdint.h>
 
 #include "boost/function.hpp"
 
 #include "mars/comm/messagequeue/message_queue.h"
 #include "mars/comm/alarm.h"
+#include "mars/comm/timing_wheel.h"
 #include "mars/stn/stn.h"
 #include "mars/stn/task_profile.h"
 
 #include "shortlink.h"
+#include "task_codec_pool.h"
+#include "task_table.h"
 
 class AutoBuffer;
 
@@ -67,16 +71,22 @@ class ShortLinkTaskManager {
 
   private:
     void __RunLoop();
+    void __PostRunLoop(uint64_t _time);
     void __RunOnTimeout();
-    void __RunOnStartTask();
+    bool __RunOnStartTask();
+    bool __ScheduleTimeout(TaskProfile& _profile);
+    TaskEncodeResult __EncodeRequest(std::list<TaskProfile>::iterator _it, AutoBuffer& _bufreq, AutoBuffer& _extension, int& _error_code);
+    void __OnEncoded(boost::shared_ptr<TaskCodecJob> _job);
 
     void __OnResponse(ShortLinkInterface* _worker, ErrCmdType _err_type, int _status, AutoBuffer& _body, AutoBuffer& _extension, bool _cancel_retry, ConnectProfile& _conn_profile);
+    void __OnDecoded(ShortLinkInterface* _worker, boost::shared_ptr<TaskCodecJob> _job, const ConnectProfile& _conn_profile);
     void __OnSend(ShortLinkInterface* _worker);
     void __OnRecv(ShortLinkInterface* _worker, unsigned int _cached_size, unsigned int _total_size);
 
     void __BatchErrorRespHandle(ErrCmdType _err_type, int _err_code, int _fail_handle, uint32_t _src_taskid, bool _callback_runing_task_only = true);
     bool __SingleRespHandle(std::list<TaskProfile>::iterator _it, ErrCmdType _err_type, int _err_code, int _fail_handle, size_t _resp_length, const ConnectProfile& _connect_profile);
 
+    std::list<TaskProfile>::iterator __Locate(uint32_t _taskid);
     std::list<TaskProfile>::iterator __LocateBySeq(intptr_t _running_id);
 
     void __DeleteShortLink(intptr_t& _running_id);
@@ -85,7 +95,9 @@ class ShortLinkTaskManager {
     MessageQueue::ScopeRegister     asyncreg_;
     NetSource&                      net_source_;
     
-    std::list<TaskProfile>          lst_cmd_;
+    TaskTable                       lst_cmd_;
+    TimingWheel<uint32_t>           timeout_wheel_;    // taskid at TaskProfile::timeout_check_time
+    std::vector<uint32_t>           timeout_expired_;
     
     bool                            default_use_proxy_;
     unsigned int                    tasks_continuous_fail_count_;
@@ -26,30 +26,19 @@
 #include <algorithm>
 
 #include "boost/filesystem.hpp"
-#include "boost/bind.hpp"
-#include "boost/accumulators/numeric/functional.hpp"
-
 
 #include "mars/comm/time_utils.h"
 #include "mars/comm/xlogger/xlogger.h"
 #include "mars/comm/platform_comm.h"
+#include "mars/comm/socket/connect_rtt.h"
 
 #include "mars/app/app.h"
 
-#define IPPORT_RECORDS_FILENAME "/ipportrecords2.xml"
+#define IPPORT_RECORDS_FILENAME "/ipportrecords2.xml"   // before IPPortHistory, imported once
+#define IPPORT_HISTORY_FILENAME "/ipporthistory.bin"
+#define CONNECT_RTT_FILENAME "/connectrtt.txt"
 
-static const time_t kRecordTimeout = 60 * 60 * 24;
 static const char* const kFolderName = "host";
-// const static char* const RECORDS = "records";
-static const char* const kRecord = "record";
-static const char* const kItem = "item";
-static const char* const kTime = "time";
-static const char* const kNetInfo = "netinfo";
-static const char* const kIP = "ip";
-static const char* const kPort = "port";
-//static const char* const kSuccess = "succ";
-//static const char* const kTotal = "total";
-static const char* const kHistoryResult = "historyresult";
 
 static const unsigned int kBanTime = 6 * 60 * 1000;  // 6 min
 static const int kBanFailCount = 3;
@@ -69,18 +58,13 @@ uint32_t CAL_BIT_COUNT(uint64_t RECORDS) {
     return COUNT;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////
-namespace mars { namespace stn {
-    struct BanItem {
-        std::string ip;
-        uint16_t port;
-        uint8_t records;
-        tickcount_t last_fail_time;
-        tickcount_t last_suc_time;
-        BanItem(): port(0), records(0) {}
-    };
-}}
+static std::string __BanKey(const std::string& _ip, uint16_t _port) {
+    char port[8];
+    snprintf(port, sizeof(port), ":%u", (unsigned int)_port);
+    return _ip + port;
+}
 
+///////////////////////////////////////////////////////////////////////////////////////////
 using namespace mars::stn;
 
 SimpleIPPortSort::SimpleIPPortSort()
@@ -89,101 +73,69 @@ SimpleIPPortSort::SimpleIPPortSort()
     if (!boost::filesystem::exists(hostpath_)){
         boost::filesystem::create_directory(hostpath_);
     }
-        
+
     ScopedLock lock(mutex_);
-    __LoadXml();
+    if (!history_.Open(hostpath_ + IPPORT_HISTORY_FILENAME)) {
+        xwarn2(TSF"ipport history not mapped, kept in memory");
+    }
+
+    if (boost::filesystem::exists(hostpath_ + IPPORT_RECORDS_FILENAME)) {
+        int count = history_.ImportXml(hostpath_ + IPPORT_RECORDS_FILENAME, time(NULL));
+        xinfo2(TSF"ipport records imported:%_", count);
+
+        boost::system::error_code ec;
+        boost::filesystem::remove(hostpath_ + IPPORT_RECORDS_FILENAME, ec);
+    }
     lock.unlock();
+    ConnectRttTable::Instance().Load(hostpath_ + CONNECT_RTT_FILENAME);
     InitHistory2BannedList(false);
 }
 
 SimpleIPPortSort::~SimpleIPPortSort() {
     ScopedLock lock(mutex_);
-    __SaveXml();
-}
-
-void SimpleIPPortSort::__SaveXml() {
-    __RemoveTimeoutXml();
-    recordsxml_.SaveFile((hostpath_ + IPPORT_RECORDS_FILENAME).c_str());
-}
-
-void SimpleIPPortSort::__LoadXml() {
-    tinyxml2::XMLError error = recordsxml_.LoadFile((hostpath_ + IPPORT_RECORDS_FILENAME).c_str());
-    if (tinyxml2::XML_SUCCESS != error) return;
-    __RemoveTimeoutXml();
+    history_.Close();
+    ConnectRttTable::Instance().Save(hostpath_ + CONNECT_RTT_FILENAME);
 }
 
-void SimpleIPPortSort::__RemoveTimeoutXml() {
-    std::vector<tinyxml2::XMLElement*> remove_ele_ptr_list;
-
-    for (tinyxml2::XMLElement* record = recordsxml_.FirstChildElement(kRecord);
-            NULL != record; record = record->NextSiblingElement(kRecord)) {
-        const char* lasttime_chr = record->Attribute(kTime);
-
-        if (lasttime_chr) {
-            struct timeval now = {0};
-            gettimeofday(&now, NULL);
-            time_t lasttime = (time_t)strtoul(lasttime_chr, NULL, 10);
-
-            if (now.tv_sec < lasttime || now.tv_sec - lasttime >= kRecordTimeout) {
-                remove_ele_ptr_list.push_back(record);
-            }
-        } else {
-            remove_ele_ptr_list.push_back(record);
-        }
-    }
-
-    for (std::vector<tinyxml2::XMLElement*>::iterator iter = remove_ele_ptr_list.begin();
-            iter != remove_ele_ptr_list.end(); ++iter) {
-        recordsxml_.DeleteChild(*iter);
-    }
-}
-
-void SimpleIPPortSort::InitHistory2BannedList(bool _savexml) {
+void SimpleIPPortSort::InitHistory2BannedList(bool _compact) {
     ScopedLock lock(mutex_);
-    if (_savexml) __SaveXml();
+    if (_compact) {
+        history_.Compact(time(NULL));
+        ConnectRttTable::Instance().Save(hostpath_ + CONNECT_RTT_FILENAME);
+    }
     
     _ban_fail_list_.clear();
     
     std::string curr_netinfo;
-    if (kNoNet == getCurrNetLabel(curr_netinfo)) return;
-
-    const tinyxml2::XMLElement* record = NULL;
-
-    for (record = recordsxml_.FirstChildElement(kRecord);
-            NULL != record; record = record->NextSiblingElement(kRecord)) {
-        const char* netinfoChr = record->Attribute(kNetInfo);
-
-        if (netinfoChr && (0 == strcmp(netinfoChr, curr_netinfo.c_str()))) {
-            xwarn2(TSF"netinfoChr:%_, curr_netinfo.c_str():%_", netinfoChr, curr_netinfo.c_str());
-            break;
-        }
-    }
+    int netlabel = getCurrNetLabel(curr_netinfo);
+    ConnectRttTable::Instance().SetNetwork(curr_netinfo);
+    if (kNoNet == netlabel) return;
 
-    if (NULL == record) { return; }
+    std::vector<IPPortHistory::Item> items;
+    history_.Items(curr_netinfo, items);
 
-    for (const tinyxml2::XMLElement* item = record->FirstChildElement(kItem); NULL != item; item = item->NextSiblingElement(kItem)) {
-        const char* ip = item->Attribute(kIP);
-        uint32_t    port = item->UnsignedAttribute(kPort);
-        uint64_t    historyresult = (uint64_t)item->Int64Attribute(kHistoryResult);
-        
+    for (std::vector<IPPortHistory::Item>::iterator it = items.begin(); it != items.end(); ++it) {
         struct BanItem banitem;
-        banitem.ip = ip;
-        banitem.port = port;
+        banitem.ip = it->ip;
+        banitem.port = it->port;
         banitem.records = 0;
+        banitem.score = it->score;
+        banitem.score_time = it->time;
         //8 in 1
+        uint64_t historyresult = it->history;
         for (int i = 0; i < 8; ++i) {
             SET_BIT(historyresult & 0xFF, banitem.records);
             historyresult >>= 8;
         }
-        _ban_fail_list_.push_back(banitem);
+        _ban_fail_list_[__BanKey(banitem.ip, banitem.port)] = banitem;
     }
 }
 
 void SimpleIPPortSort::RemoveBannedList(const std::string& _ip) {
     ScopedLock lock(mutex_);
 
-    for (std::vector<BanItem>::iterator iter = _ban_fail_list_.begin(); iter != _ban_fail_list_.end();) {
-        if (iter->ip == _ip)
+    for (std::unordered_map<std::string, BanItem>::iterator iter = _ban_fail_list_.begin(); iter != _ban_fail_list_.end();) {
+        if (iter->second.ip == _ip)
             iter = _ban_fail_list_.erase(iter);
         else
             ++iter;
@@ -200,71 +152,36 @@ void SimpleIPPortSort::Update(const std::string& _ip, uint16_t _port, bool _is_s
     
     __UpdateBanList(_is_success,  _ip,  _port);
 
-    tinyxml2::XMLElement* record = NULL;
-
-    for (record = recordsxml_.FirstChildElement(kRecord);
-            NULL != record; record = record->NextSiblingElement(kRecord)) {
-        const char* netinfo_chr = record->Attribute(kNetInfo);
-        if (netinfo_chr && (0 == strcmp(netinfo_chr, curr_net_info.c_str()))) break;
-    }
-
-    if (NULL == record) {
-        struct timeval timeval = {0};
-        gettimeofday(&timeval, NULL);
-        char timebuf[128] = {0};
-        snprintf(timebuf, sizeof(timebuf), "%ld", timeval.tv_sec);
-        
-        record = recordsxml_.NewElement(kRecord);
-        record->SetAttribute(kNetInfo, curr_net_info.c_str());
-        record->SetAttribute(kTime, timebuf);
-        recordsxml_.InsertEndChild(record);
-    }
-
-    tinyxml2::XMLElement* item = NULL;
-
-    for (item = record->FirstChildElement(kItem);
-            NULL != item; item = item->NextSiblingElement(kItem)) {
-        const char* ip = item->Attribute(kIP);
-        uint32_t port = item->UnsignedAttribute(kPort);
-
-        if (ip && (0 == strcmp(ip, _ip.c_str())) && port == _port) break;
-    }
-
-    if (NULL == item) {
-        item = recordsxml_.NewElement(kItem);
-        item->SetAttribute(kIP, _ip.c_str());
-        item->SetAttribute(kPort, _port);
-        record->InsertEndChild(item);
+    // one record appended, the file is never written whole
+    IPPortHistory::Item item;
+    if (!history_.Get(curr_net_info, _ip, _port, item)) {
+        item.ip = _ip;
+        item.port = _port;
     }
+    IPPortHistory::Add(item, _is_success, time(NULL));
+    history_.Put(curr_net_info, item);
 
-    uint64_t history_result = item->Int64Attribute(kHistoryResult);
-    SET_BIT(!_is_success, history_result);
-    item->SetAttribute(kHistoryResult, (int64_t)history_result);
+    BanItem& banitem = _ban_fail_list_[__BanKey(_ip, _port)];
+    banitem.score = item.score;
+    banitem.score_time = item.time;
 }
 
-std::vector<BanItem>::iterator  SimpleIPPortSort::__FindBannedIter(const std::string& _ip, unsigned short _port) const {
-    std::vector<BanItem>::iterator iter;
-
-    for (iter = _ban_fail_list_.begin(); iter != _ban_fail_list_.end(); ++iter) {
-        if (iter->ip == _ip && iter->port == _port) {
-            return iter;
-        }
-    }
-
-    return iter;
+const BanItem* SimpleIPPortSort::__FindBanItem(const std::string& _ip, unsigned short _port) const {
+    std::unordered_map<std::string, BanItem>::const_iterator iter = _ban_fail_list_.find(__BanKey(_ip, _port));
+    return _ban_fail_list_.end() == iter ? NULL : &iter->second;
 }
 
 bool SimpleIPPortSort::__IsBanned(const std::string& _ip, unsigned short _port) const {
-    return __IsBanned(__FindBannedIter(_ip, _port));
+    return __IsBanned(__FindBanItem(_ip, _port));
 }
 
-bool SimpleIPPortSort::__IsBanned(std::vector<BanItem>::iterator _iter) const {
-    if (_iter == _ban_fail_list_.end()) return false;
+bool SimpleIPPortSort::__IsBanned(const BanItem* _item) const {
+    if (NULL == _item) return false;
 
-    bool baned =  CAL_BIT_COUNT(_iter->records) >= kBanFailCount;
+    bool baned =  CAL_BIT_COUNT(_item->records) >= kBanFailCount;
     if (!baned) return false;
 
-    if (_iter->last_fail_time.gettickspan() < kBanTime) {
+    if (_item->last_fail_time.gettickspan() < kBanTime) {
         return true;
     }
 
@@ -272,43 +189,33 @@ bool SimpleIPPortSort::__IsBanned(std::vector<BanItem>::iterator _iter) const {
 }
 
 void SimpleIPPortSort::__UpdateBanList(bool _is_success, const std::string& _ip, unsigned short _port) {
-    for (std::vector<BanItem>::iterator iter = _ban_fail_list_.begin(); iter != _ban_fail_list_.end(); ++iter) {
-        if (iter->ip == _ip && iter->port == _port) {
-            SET_BIT(!_is_success, iter->records);
-            if (_is_success)
-                iter->last_suc_time.gettickcount();
-            else
-                iter->last_fail_time.gettickcount();
-            return;
-        }
+    std::string key = __BanKey(_ip, _port);
+    std::unordered_map<std::string, BanItem>::iterator iter = _ban_fail_list_.find(key);
+
+    if (_ban_fail_list_.end() == iter) {
+        BanItem item;
+        item.ip = _ip;
+        item.port = _port;
+        iter = _ban_fail_list_.insert(std::make_pair(key, item)).first;
     }
 
-    BanItem item;
-    item.ip = _ip;
-    item.port = _port;
-    SET_BIT(!_is_success, item.records);
-    
+    SET_BIT(!_is_success, iter->second.records);
     if (_is_success)
-        item.last_suc_time.gettickcount();
+        iter->second.last_suc_time.gettickcount();
     else
-        item.last_fail_time.gettickcount();
-    
-    _ban_fail_list_.push_back(item);
+        iter->second.last_fail_time.gettickcount();
 }
 
 bool SimpleIPPortSort::__CanUpdate(const std::string& _ip, uint16_t _port, bool _is_success) const {
-    for (std::vector<BanItem>::iterator iter = _ban_fail_list_.begin(); iter != _ban_fail_list_.end(); ++iter) {
-        if (iter->ip == _ip && iter->port == _port) {
-            if (_is_success) {
-                return kSuccessUpdateInterval < iter->last_suc_time.gettickspan() ? true:false;
-            }
-            else {
-                return kFailUpdateInterval < iter->last_fail_time.gettickspan() ? true:false;
-            }
-        }
+    const BanItem* item = __FindBanItem(_ip, _port);
+    if (NULL == item) return true;
+
+    if (_is_success) {
+        return kSuccessUpdateInterval < item->last_suc_time.gettickspan() ? true:false;
+    }
+    else {
+        return kFailUpdateInterval < item->last_fail_time.gettickspan() ? true:false;
     }
-    
-    return true;
 }
 
 void SimpleIPPortSort::__FilterbyBanned(std::vector<IPPortItem>& _items) const {
@@ -343,62 +250,61 @@ void SimpleIPPortSort::__SortbyBanned(std::vector<IPPortItem>& _items) const {
     //random_shuffle new and history
     std::random_shuffle(_items.begin(), _items.end());
 
-    //separate new and history
-    std::deque<IPPortItem> items_history(_items.size());
-    std::deque<IPPortItem> items_new(_items.size());
-    auto find_lambda = [&](const IPPortItem& _v) {
-        for (std::vector<BanItem>::const_iterator it_banned = _ban_fail_list_.begin(); it_banned != _ban_fail_list_.end(); ++it_banned) {
-            if (it_banned->ip == _v.str_ip && it_banned->port == _v.port) {
-                return true;
-            }
-        }
-        return false;
+    //separate new and history, each looked up once
+    struct Ranked {
+        const IPPortItem* item;
+        const BanItem* ban;
+        float score;
     };
+    std::deque<Ranked> items_history;
+    std::deque<IPPortItem> items_new;
+    time_t now = time(NULL);
+
+    for (std::vector<IPPortItem>::const_iterator it = _items.begin(); it != _items.end(); ++it) {
+        const BanItem* ban = __FindBanItem(it->str_ip, it->port);
+        if (NULL == ban) {
+            items_new.push_back(*it);
+            continue;
+        }
+        Ranked ranked = {&(*it), ban, IPPortHistory::Decay(ban->score, ban->score_time, now)};
+        items_history.push_back(ranked);
+    }
     
-    items_history.erase(std::remove_copy_if(_items.begin(), _items.end(), items_history.begin(), !boost::bind<bool>(find_lambda, _1)), items_history.end());
-    items_new.erase(std::remove_copy_if(_items.begin(), _items.end(), items_new.begin(), find_lambda), items_new.end());
-    xassert2(_items.size() == items_history.size()+items_new.size(), TSF"_item:%_, history:%_, new:%_", _items.size(), items_history.size(), items_new.size());
-    
-    //sort history
+    //sort history, the best decayed score first
     std::sort(items_history.begin(), items_history.end(),
-              [&](const IPPortItem& _l, const IPPortItem& _r){
-                  auto find_lr_lambda  = [](const BanItem& _v, const IPPortItem& _find) {
-                      return _v.ip == _find.str_ip && _v.port == _find.port;
-                  };
-                      
-                  std::vector<BanItem>::const_iterator  l = std::find_if(_ban_fail_list_.begin(), _ban_fail_list_.end(), boost::bind<bool>(find_lr_lambda, _1, _l));
-                  std::vector<BanItem>::const_iterator  r = std::find_if(_ban_fail_list_.begin(), _ban_fail_list_.end(), boost::bind<bool>(find_lr_lambda, _1, _r));
-                      
-                  xassert2(l != _ban_fail_list_.end());
-                  xassert2(r != _ban_fail_list_.end());
-                      
-                 if (CAL_BIT_COUNT(l->records) != CAL_BIT_COUNT(r->records))
-                     return CAL_BIT_COUNT(l->records) < CAL_BIT_COUNT(r->records);
+              [](const Ranked& _l, const Ranked& _r){
+                  if (_l.score != _r.score)
+                      return _l.score > _r.score;
+
+                  if (CAL_BIT_COUNT(_l.ban->records) != CAL_BIT_COUNT(_r.ban->records))
+                      return CAL_BIT_COUNT(_l.ban->records) < CAL_BIT_COUNT(_r.ban->records);
                       
-                 if (l->last_fail_time != r->last_fail_time)
-                     return l->last_fail_time < r->last_fail_time;
+                  if (_l.ban->last_fail_time != _r.ban->last_fail_time)
+                      return _l.ban->last_fail_time < _r.ban->last_fail_time;
                   
-                 if (l->last_suc_time != r->last_suc_time)
-                     return l->last_suc_time > r->last_suc_time;
+                  if (_l.ban->last_suc_time != _r.ban->last_suc_time)
+                      return _l.ban->last_suc_time > _r.ban->last_suc_time;
                   
                   //random by std::random_shuffle(_items.begin(), _items.end());
                   return false;
               });
     
    //merge
-    _items.clear();
+    std::vector<IPPortItem> merged;
+    merged.reserve(_items.size());
     while ( !items_history.empty() || !items_new.empty()) {
         int ran = rand()%(items_history.size()+items_new.size());
         if (0 <= ran && ran < (int)items_history.size()) {
-            _items.push_back(items_history.front());
+            merged.push_back(*items_history.front().item);
             items_history.pop_front();
         } else if ((int)items_history.size() <= ran && ran < (int)(items_history.size()+items_new.size())) {
-            _items.push_back(items_new.front());
+            merged.push_back(items_new.front());
             items_new.pop_front();
         } else {
             xassert2(false, TSF"ran:%_, history:%_, new:%_", ran, items_history.size(), items_new.size());
         }
     }
+    _items.swap(merged);
 }
 
 
@@ -416,4 +322,3 @@ void SimpleIPPortSort::AddServerBan(const std::string& _ip) {
     ScopedLock lock(mutex_);
     _server_bans_[_ip] = ::gettickcount();
 }
-
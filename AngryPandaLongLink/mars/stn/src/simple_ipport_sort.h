@@ -24,23 +24,34 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 #include "mars/comm/thread/lock.h"
-#include "mars/comm/tinyxml2.h"
 #include "mars/comm/tickcount.h"
 #include "mars/stn/stn.h"
 
+#include "ipport_history.h"
+
 namespace mars {
 namespace stn {
 
-struct BanItem;
+struct BanItem {
+    std::string ip;
+    uint16_t port;
+    uint8_t records;
+    float score;
+    time_t score_time;
+    tickcount_t last_fail_time;
+    tickcount_t last_suc_time;
+    BanItem(): port(0), records(0), score(0), score_time(0) {}
+};
     
 class SimpleIPPortSort {
   public:
     SimpleIPPortSort();
     ~SimpleIPPortSort();
 
-    void InitHistory2BannedList(bool _savexml);
+    void InitHistory2BannedList(bool _compact);
     void RemoveBannedList(const std::string& _ip);
     void Update(const std::string& _ip, uint16_t _port, bool _is_success);
 
@@ -49,12 +60,8 @@ class SimpleIPPortSort {
     void AddServerBan(const std::string& _ip);
     
   private:
-    void __LoadXml();
-    void __SaveXml();
-    void __RemoveTimeoutXml();
-
-    std::vector<BanItem>::iterator __FindBannedIter(const std::string& _ip, uint16_t _port) const;
-    bool __IsBanned(std::vector<BanItem>::iterator _iter) const;
+    const BanItem* __FindBanItem(const std::string& _ip, uint16_t _port) const;
+    bool __IsBanned(const BanItem* _item) const;
     bool __IsBanned(const std::string& _ip, uint16_t _port) const;
     void __UpdateBanList(bool _isSuccess, const std::string& _ip, uint16_t _port);
     bool __CanUpdate(const std::string& _ip, uint16_t _port, bool _is_success) const;
@@ -69,10 +76,10 @@ class SimpleIPPortSort {
 
   private:
     std::string hostpath_;
-    tinyxml2::XMLDocument recordsxml_;
+    IPPortHistory history_;
 
     mutable Mutex mutex_;
-    mutable std::vector<BanItem> _ban_fail_list_;
+    mutable std::unordered_map<std::string, BanItem> _ban_fail_list_;  // by ip:port
     mutable std::map<std::string, uint64_t> _server_bans_;
 };
 
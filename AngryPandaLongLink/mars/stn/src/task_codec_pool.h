@@ -0,0 +1,271 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * task_codec_pool.h
+ *
+ * worker threads running Req2Buf and Buf2Resp for the task managers, so heavy serialization does not
+ * hold up the network thread. jobs run in parallel, their done callbacks are made one at a time in the
+ * order the jobs were submitted within the same owner and lane. off until SetThreads is given a count.
+ */
+
+#ifndef STN_SRC_TASK_CODEC_POOL_H_
+#define STN_SRC_TASK_CODEC_POOL_H_
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/function.hpp"
+
+#include "mars/comm/autobuffer.h"
+#include "mars/comm/thread/condition.h"
+#include "mars/comm/thread/lock.h"
+#include "mars/comm/thread/thread.h"
+#include "mars/stn/stn.h"
+
+namespace mars {
+namespace stn {
+
+enum TaskEncodeResult {
+    kTaskEncodeOK,
+    kTaskEncodeFail,
+    kTaskEncodePending,    // on the codec pool, the task manager is called back when it is done
+};
+
+// what a job gives Req2Buf or Buf2Resp and gets back
+struct TaskCodecJob {
+    TaskCodecJob(uint32_t _taskid, uint32_t _seq): taskid(_taskid), seq(_seq), error_code(0), result(0) {}
+
+    void Encode(void* _user_context, int _channel_select) {
+        result = Req2Buf(taskid, _user_context, buffer, extension, error_code, _channel_select) ? 1 : 0;
+    }
+
+    void Decode(void* _user_context, int _channel_select) {
+        result = Buf2Resp(taskid, _user_context, buffer, extension, error_code, _channel_select);
+    }
+
+    uint32_t   taskid;
+    uint32_t   seq;
+    AutoBuffer buffer;      // the request Req2Buf made, or the response body for Buf2Resp
+    AutoBuffer extension;
+    int        error_code;
+    int        result;      // Req2Buf's return, or the fail handle of Buf2Resp
+};
+
+class TaskCodecPool {
+  public:
+    static const int kMaxThreads = 16;
+
+    // never destroyed, joining the workers at static destruction would run codec jobs against globals already gone
+    static TaskCodecPool& Instance() {
+        static TaskCodecPool* pool = new TaskCodecPool;
+        return *pool;
+    }
+
+    static int EncodeLane(int _priority) { return _priority; }
+    static int DecodeLane(int _priority) { return 0x100 + _priority; }
+
+  public:
+    TaskCodecPool(): stopping_(false), thread_count_(0) {}
+    ~TaskCodecPool() { SetThreads(0); }
+
+    // 0 stops the workers after what is queued, the task managers encode and decode inline again
+    void SetThreads(int _count) {
+        if (0 > _count) _count = 0;
+        if (kMaxThreads < _count) _count = kMaxThreads;
+
+        ScopedLock config_lock(config_mutex_);
+
+        ScopedLock lock(mutex_);
+        if (_count == (int)threads_.size()) return;
+        stopping_ = true;
+        thread_count_ = 0;
+        cond_.notifyAll(lock);
+        lock.unlock();
+
+        for (std::vector<Thread*>::iterator it = threads_.begin(); it != threads_.end(); ++it) {
+            (*it)->join();
+            delete *it;
+        }
+        threads_.clear();
+
+        lock.lock();
+        stopping_ = false;
+        lock.unlock();
+
+        for (int i = 0; i < _count; ++i) {
+            Thread* thread = new Thread(boost::bind(&TaskCodecPool::__Worker, this), "task_codec");
+            thread->start();
+            threads_.push_back(thread);
+        }
+
+        lock.lock();
+        thread_count_ = _count;
+    }
+
+    bool Enabled() {
+        ScopedLock lock(mutex_);
+        return 0 < thread_count_;
+    }
+
+    // false when there are no workers, the caller does the job itself
+    bool Submit(const void* _owner, int _lane, const boost::function<void ()>& _work, const boost::function<void ()>& _done) {
+        ScopedLock lock(mutex_);
+        if (0 >= thread_count_) return false;
+
+        Lane& lane = lanes_[LaneKey(_owner, _lane)];
+        Job job = {_owner, _lane, lane.next_submit++, _work, _done};
+        jobs_.push_back(job);
+        ++busy_[_owner];
+
+        cond_.notifyOne(lock);
+        return true;
+    }
+
+    // drops the jobs of _owner not yet called back and waits for the running ones and a callback in progress
+    void CancelAndWait(const void* _owner) {
+        ScopedLock lock(mutex_);
+        if (0 == busy_.count(_owner)) return;
+        cancelled_.insert(_owner);
+
+        for (std::list<Job>::iterator it = jobs_.begin(); it != jobs_.end();) {
+            if (_owner == it->owner) {
+                __Leave(_owner);
+                it = jobs_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        for (std::map<LaneKey, Lane>::iterator it = lanes_.begin(); it != lanes_.end(); ++it) {
+            if (_owner != it->first.first) continue;
+            for (size_t i = 0; i < it->second.finished.size(); ++i) __Leave(_owner);
+            it->second.finished.clear();
+        }
+
+        while (0 != busy_.count(_owner)) idle_.wait(lock);
+
+        for (std::map<LaneKey, Lane>::iterator it = lanes_.begin(); it != lanes_.end();) {
+            if (_owner == it->first.first) lanes_.erase(it++);
+            else ++it;
+        }
+        cancelled_.erase(_owner);
+    }
+
+  private:
+    typedef std::pair<const void*, int> LaneKey;
+
+    struct Job {
+        const void*               owner;
+        int                       lane;
+        uint64_t                  seq;
+        boost::function<void ()>  work;
+        boost::function<void ()>  done;
+    };
+
+    struct Lane {
+        Lane(): next_submit(0), next_done(0), delivering(false) {}
+
+        uint64_t                  next_submit;
+        uint64_t                  next_done;
+        bool                      delivering;
+        std::map<uint64_t, Job>   finished;
+    };
+
+    void __Worker() {
+        ScopedLock lock(mutex_);
+
+        while (true) {
+            if (jobs_.empty()) {
+                if (stopping_) return;
+                cond_.wait(lock);
+                continue;
+            }
+
+            Job job = jobs_.front();
+            jobs_.pop_front();
+
+            lock.unlock();
+            job.work();
+            job.work.clear();
+            lock.lock();
+
+            if (cancelled_.count(job.owner)) {
+                __Leave(job.owner);
+                continue;
+            }
+
+            Lane& lane = lanes_[LaneKey(job.owner, job.lane)];
+            lane.finished.insert(std::make_pair(job.seq, job));
+
+            // whoever holds the lane hands out what is done in order, the others leave theirs behind
+            if (lane.delivering) continue;
+            lane.delivering = true;
+
+            while (!lane.finished.empty() && lane.next_done == lane.finished.begin()->first) {
+                Job ready = lane.finished.begin()->second;
+                lane.finished.erase(lane.finished.begin());
+                ++lane.next_done;
+
+                if (cancelled_.count(ready.owner)) {
+                    __Leave(ready.owner);
+                    break;
+                }
+
+                lock.unlock();
+                ready.done();
+                ready.done.clear();
+                lock.lock();
+
+                __Leave(ready.owner);
+            }
+
+            lane.delivering = false;
+        }
+    }
+
+    void __Leave(const void* _owner) {
+        std::map<const void*, int>::iterator it = busy_.find(_owner);
+        if (busy_.end() == it) return;
+        if (0 == --it->second) {
+            busy_.erase(it);
+            idle_.notifyAll();
+        }
+    }
+
+  private:
+    TaskCodecPool(const TaskCodecPool&);
+    TaskCodecPool& operator=(const TaskCodecPool&);
+
+  private:
+    Mutex                        config_mutex_;
+    Mutex                        mutex_;
+    Condition                    cond_;
+    Condition                    idle_;
+    bool                         stopping_;
+    int                          thread_count_;
+    std::vector<Thread*>         threads_;
+    std::list<Job>               jobs_;
+    std::map<LaneKey, Lane>      lanes_;
+    std::map<const void*, int>   busy_;    // jobs of an owner queued, running or waiting for their turn
+    std::set<const void*>        cancelled_;
+};
+
+}}
+
+#endif // STN_SRC_TASK_CODEC_POOL_H_
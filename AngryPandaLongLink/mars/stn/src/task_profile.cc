@@ -70,4 +70,20 @@ bool __CompareTask(const TaskProfile& _first, const TaskProfile& _second) {
     return _first.task.priority < _second.task.priority;
 }
 
+// the earliest of the task, first-pkg, pkg-pkg and read-write timeouts that apply now
+uint64_t __NextTimeoutTime(const TaskProfile& _profile) {
+    uint64_t next = _profile.start_task_time + _profile.task_timeout;
+    const TransferProfile& transfer = _profile.transfer_profile;
+
+    if (!_profile.running_id || 0 == transfer.start_send_time) return next;
+
+    uint64_t pkg_timeout = 0 == transfer.last_receive_pkg_time ? transfer.start_send_time + transfer.first_pkg_timeout
+        : transfer.last_receive_pkg_time + ((kMobile != getNetInfo()) ? kWifiPackageInterval : kGPRSPackageInterval);
+    uint64_t rw_timeout = transfer.start_send_time + transfer.read_write_timeout;
+
+    if (pkg_timeout < next) next = pkg_timeout;
+    if (rw_timeout < next) next = rw_timeout;
+    return next;
+}
+
 }}
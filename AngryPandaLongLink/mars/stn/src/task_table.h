@@ -0,0 +1,234 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * task_table.h
+ *
+ * tasks of a task manager. one list ordered by priority and first in first out within a priority, as
+ * lst_cmd_.sort(__CompareTask) after every push_back kept it, with the last task of every priority
+ * remembered so a task goes to its place without sorting. taskid and running_id are indexed by open
+ * addressing hash maps, so finding a task does not walk the list either.
+ */
+
+#ifndef STN_SRC_TASK_TABLE_H_
+#define STN_SRC_TASK_TABLE_H_
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+
+#include "mars/stn/task_profile.h"
+
+namespace mars {
+namespace stn {
+
+// linear probing with backward shift deletion, key 0 is an empty slot
+template <class V>
+class IdHashMap {
+  public:
+    IdHashMap(): size_(0), shift_(64) {}
+
+    const V* Find(uint64_t _key) const {
+        if (0 == _key || slots_.empty()) return NULL;
+
+        for (size_t i = __Home(_key); ; i = (i + 1) & (slots_.size() - 1)) {
+            if (_key == slots_[i].key) return &slots_[i].value;
+            if (0 == slots_[i].key) return NULL;
+        }
+    }
+
+    void Set(uint64_t _key, const V& _value) {
+        if (0 == _key) return;
+        if ((size_ + 1) * 2 > slots_.size()) __Grow();
+
+        size_t i = __Home(_key);
+        while (0 != slots_[i].key && _key != slots_[i].key) i = (i + 1) & (slots_.size() - 1);
+
+        if (0 == slots_[i].key) ++size_;
+        slots_[i].key = _key;
+        slots_[i].value = _value;
+    }
+
+    bool Erase(uint64_t _key) {
+        if (0 == _key || slots_.empty()) return false;
+
+        size_t mask = slots_.size() - 1;
+        size_t i = __Home(_key);
+        while (_key != slots_[i].key) {
+            if (0 == slots_[i].key) return false;
+            i = (i + 1) & mask;
+        }
+
+        // move back every following entry that would not be found across the hole
+        for (size_t j = (i + 1) & mask; 0 != slots_[j].key; j = (j + 1) & mask) {
+            size_t home = __Home(slots_[j].key);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+
+        slots_[i].key = 0;
+        slots_[i].value = V();
+        --size_;
+        return true;
+    }
+
+    void Clear() {
+        slots_.clear();
+        size_ = 0;
+        shift_ = 64;
+    }
+
+    size_t Size() const { return size_; }
+
+  private:
+    struct Slot {
+        Slot(): key(0), value() {}
+        uint64_t key;
+        V        value;
+    };
+
+    size_t __Home(uint64_t _key) const {
+        return (size_t)((_key * 0x9E3779B97F4A7C15ULL) >> shift_);
+    }
+
+    void __Grow() {
+        std::vector<Slot> old;
+        old.swap(slots_);
+
+        slots_.resize(old.empty() ? 16 : old.size() * 2);
+        shift_ = 64;
+        for (size_t n = slots_.size(); 1 < n; n >>= 1) --shift_;
+        size_ = 0;
+
+        for (typename std::vector<Slot>::iterator it = old.begin(); it != old.end(); ++it) {
+            if (0 != it->key) Set(it->key, it->value);
+        }
+    }
+
+  private:
+    std::vector<Slot> slots_;
+    size_t            size_;
+    int               shift_;
+};
+
+class TaskTable {
+  public:
+    typedef std::list<TaskProfile>::iterator iterator;
+    typedef std::list<TaskProfile>::const_iterator const_iterator;
+
+    static const int kPriorityCount = Task::kTaskPriorityLowest + 1;
+
+  public:
+    TaskTable() {
+        for (int i = 0; i < kPriorityCount; ++i) last_[i] = list_.end();
+    }
+
+    iterator begin() { return list_.begin(); }
+    iterator end() { return list_.end(); }
+    const_iterator begin() const { return list_.begin(); }
+    const_iterator end() const { return list_.end(); }
+    bool empty() const { return list_.empty(); }
+    size_t size() const { return list_.size(); }
+
+    // behind the tasks of the same or a higher priority
+    iterator insert(const TaskProfile& _task) {
+        int priority = __Priority(_task);
+
+        iterator pos = list_.begin();
+        for (int p = priority; p >= 0; --p) {
+            if (list_.end() != last_[p]) {
+                pos = last_[p];
+                ++pos;
+                break;
+            }
+        }
+
+        iterator it = list_.insert(pos, _task);
+        last_[priority] = it;
+        index_.Set(it->task.taskid, it);
+        return it;
+    }
+
+    iterator find(uint32_t _taskid) {
+        const iterator* it = index_.Find(_taskid);
+        return NULL == it ? list_.end() : *it;
+    }
+
+    const_iterator find(uint32_t _taskid) const {
+        const iterator* it = index_.Find(_taskid);
+        return NULL == it ? list_.end() : const_iterator(*it);
+    }
+
+    // running_id has to be indexed after it is set and unindexed before the task drops it
+    void index_running(iterator _it) {
+        running_index_.Set((uint64_t)_it->running_id, _it->task.taskid);
+    }
+
+    void unindex_running(intptr_t _running_id) {
+        running_index_.Erase((uint64_t)_running_id);
+    }
+
+    iterator find_running(intptr_t _running_id) {
+        const uint32_t* taskid = running_index_.Find((uint64_t)_running_id);
+        if (NULL == taskid) return list_.end();
+
+        iterator it = find(*taskid);
+        return (list_.end() != it && _running_id == it->running_id) ? it : list_.end();
+    }
+
+    iterator erase(iterator _it) {
+        int priority = __Priority(*_it);
+
+        if (last_[priority] == _it) {
+            iterator prev = _it;
+            last_[priority] = (list_.begin() != _it && priority == __Priority(*--prev)) ? prev : list_.end();
+        }
+
+        const uint32_t* running = running_index_.Find((uint64_t)_it->running_id);
+        if (NULL != running && *running == _it->task.taskid) running_index_.Erase((uint64_t)_it->running_id);
+        index_.Erase(_it->task.taskid);
+
+        return list_.erase(_it);
+    }
+
+    void clear() {
+        list_.clear();
+        index_.Clear();
+        running_index_.Clear();
+        for (int i = 0; i < kPriorityCount; ++i) last_[i] = list_.end();
+    }
+
+  private:
+    // out of range priorities go to the nearest end
+    static int __Priority(const TaskProfile& _task) {
+        if (Task::kTaskPriorityHighest > _task.task.priority) return 0;
+        if (Task::kTaskPriorityLowest < _task.task.priority) return kPriorityCount - 1;
+        return _task.task.priority - Task::kTaskPriorityHighest;
+    }
+
+  private:
+    TaskTable(const TaskTable&);
+    TaskTable& operator=(const TaskTable&);
+
+  private:
+    std::list<TaskProfile>  list_;
+    iterator                last_[kPriorityCount];  // end() when there is no task of that priority
+    IdHashMap<iterator>     index_;                 // taskid
+    IdHashMap<uint32_t>     running_index_;         // running_id to taskid
+};
+
+}}
+
+#endif // STN_SRC_TASK_TABLE_H_
@@ -167,8 +167,10 @@ enum {
 
     kEctHttpSplitHttpHeadAndBody = -10194,
     kEctHttpParseStatusLine = -10195,
+    kEctHttpContentDecode = -10196,
 
     kEctNetMsgXPHandleBufferErr = -10504,
+    kEctNetMsgXPDecompressErr = -10505,
 
     kEctDnsMakeSocketPrepared = -10606,
 };
@@ -188,6 +190,32 @@ enum IdentifyMode {
     kCheckNext,
     kCheckNever
 };
+
+// how tasks without a channel_id are spread over the pooled long links
+enum LongLinkShardPolicy {
+    kLongLinkShardLeastOutstanding = 0,    // the connected link with the fewest bytes in flight
+    kLongLinkShardCmdId,                   // one link per cmdid, keeps a cmdid's order
+};
+
+// bits, a set of them is offered to the server
+enum PayloadCompressMode {
+    kPayloadCompressNone = 0,
+    kPayloadCompressZlib = 1,
+    kPayloadCompressZstd = 2,    // needs STN_WITH_ZSTD
+    kPayloadCompressLz4 = 4,     // needs STN_WITH_LZ4, long link only
+};
+
+struct PayloadCompressStats {
+    PayloadCompressStats(): compressed_count(0), raw_bytes(0), compressed_bytes(0), compress_cpu_us(0), decompressed_count(0), decompressed_bytes(0), decompress_cpu_us(0) {}
+
+    uint64_t compressed_count;
+    uint64_t raw_bytes;            // of the bodies compressed
+    uint64_t compressed_bytes;     // what went out instead
+    uint64_t compress_cpu_us;
+    uint64_t decompressed_count;
+    uint64_t decompressed_bytes;   // what came out of the received ones
+    uint64_t decompress_cpu_us;
+};
         
 enum IPSourceType {
     kIPSourceNULL = 0,
@@ -38,7 +38,11 @@
 #include "stn/src/net_core.h"//一定要放这里，Mac os 编译
 #include "stn/src/net_source.h"
 #include "stn/src/signalling_keeper.h"
+#include "stn/src/longlink.h"
 #include "stn/src/proxy_test.h"
+#include "stn/src/task_codec_pool.h"
+#include "stn/src/payload_compress.h"
+#include "stn/src/shortlink_pool.h"
 
 namespace mars {
 namespace stn {
@@ -226,6 +230,67 @@ void (*SetSignallingStrategy)(long _period, long _keepTime)
     SignallingKeeper::SetStrategy((unsigned int)_period, (unsigned int)_keepTime);
 };
 
+void (*SetLonglinkSendCoalesce)(size_t _length, uint32_t _ms)
+= [](size_t _length, uint32_t _ms) {
+    LongLink::SetSendCoalesce(_length, _ms);
+};
+
+void (*SetLonglinkStreamFrame)(size_t _frame_length, uint32_t _window)
+= [](size_t _frame_length, uint32_t _window) {
+    LongLink::SetStreamFrame(_frame_length, _window);
+};
+
+void (*SetTaskCodecThreads)(int _count)
+= [](int _count) {
+    TaskCodecPool::Instance().SetThreads(_count);
+};
+
+void (*SetLonglinkPool)(int _count, int _policy)
+= [](int _count, int _policy) {
+#ifdef USE_LONG_LINK
+    STN_WEAK_CALL(SetLongLinkPool(_count, _policy));
+#endif
+};
+
+void (*SetShortlinkKeepAlive)(unsigned int _idle_ms)
+= [](unsigned int _idle_ms) {
+    xinfo2(TSF"shortlink keep alive idle:%_ms", _idle_ms);
+    ShortLinkConnectionPool::Instance().SetKeepAlive(_idle_ms);
+};
+
+void (*SetLonglinkSpeedTest)(unsigned int _period_ms, bool _standby)
+= [](unsigned int _period_ms, bool _standby) {
+#ifdef USE_LONG_LINK
+    LongLinkBackgroundSpeedTest::SetStrategy(_period_ms, _standby);
+#endif
+};
+
+void (*SetPayloadCompress)(int _modes, size_t _min_length)
+= [](int _modes, size_t _min_length) {
+    xinfo2(TSF"payload compress modes:%_, min length:%_", _modes, _min_length);
+    PayloadCompress::Instance().SetModes(_modes, _min_length);
+};
+
+void (*SetPayloadCompressCmdId)(uint32_t _cmdid, size_t _min_length)
+= [](uint32_t _cmdid, size_t _min_length) {
+    PayloadCompress::Instance().SetCmdIdMinLength(_cmdid, _min_length);
+};
+
+bool (*SetPayloadCompressDict)(const void* _dict, size_t _length)
+= [](const void* _dict, size_t _length) {
+    return PayloadCompress::Instance().SetDict(_dict, _length);
+};
+
+bool (*TrainPayloadCompressDict)(const std::vector<std::string>& _samples, size_t _length, std::string& _dict)
+= [](const std::vector<std::string>& _samples, size_t _length, std::string& _dict) {
+    return PayloadCompress::TrainDict(_samples, _length, _dict);
+};
+
+PayloadCompressStats (*GetPayloadCompressStats)()
+= []() {
+    return PayloadCompress::Instance().Stats();
+};
+
 void (*KeepSignalling)()
 = []() {
 #ifdef USE_LONG_LINK
@@ -116,6 +116,56 @@ namespace stn{
     //if you did not call this function, stn will use default value: period:  5s, keeptime: 20s
 	extern void (*SetSignallingStrategy)(long period, long keeptime);
 
+    // lets small longlink packets wait up to 'ms' until 'length' bytes can go out in one write.
+    // if you did not call this function, or either is 0, every packet is written at once.
+	extern void (*SetLonglinkSendCoalesce)(size_t length, uint32_t ms);
+
+    // sends longlink request bodies longer than 'frame_length' in frames of that size, taken in turn with other
+    // requests, so small ones do not wait behind a big one. 'window' bytes of a request or a response may be
+    // in flight before the peer grants more, 0 is unlimited. the server has to understand the frames, see longlink_pack_frame.
+    // takes effect on the next connection. if you did not call this function, or frame_length is 0, bodies are sent whole.
+	extern void (*SetLonglinkStreamFrame)(size_t frame_length, uint32_t window);
+
+    // runs Req2Buf and Buf2Resp on 'count' worker threads instead of the network thread, results are taken
+    // back in the order they were started within a priority. both callbacks must then be thread safe.
+    // if you did not call this function, or count is 0, they are called on the network thread.
+	extern void (*SetTaskCodecThreads)(int count);
+
+    // keeps 'count' long links to the server instead of one, tasks are spread over them by 'policy', a LongLinkShardPolicy.
+    // signalling and the long link status reported stay on the first one. tasks on links taken away by a smaller count end with kEctLocalReset.
+    // if you did not call this function, there is only the one long link.
+	extern void (*SetLonglinkPool)(int count, int policy);
+
+    // keeps short link sockets the server left open for up to 'idle_ms' after a response, at most a few to a host,
+    // so the next task to the host sends on one of them instead of connecting. short links ask for Connection: keep-alive
+    // and follow Connection: close and Keep-Alive: timeout of the server. if you did not call this function, or idle_ms is 0,
+    // every socket is closed after its response.
+	extern void (*SetShortlinkKeepAlive)(unsigned int idle_ms);
+
+    // connects to every long link candidate once every 'period_ms' while the app is active and the long link is up,
+    // so the next connect knows which addresses are fast and which are down. with 'standby' it also keeps one more
+    // connection to the server, checked with a noop every period, which the long link takes over when it drops on the
+    // same network instead of connecting. if you did not call this function, or period_ms is 0, nothing is tested.
+	extern void (*SetLonglinkSpeedTest)(unsigned int period_ms, bool standby);
+
+    // compresses request and response bodies of at least 'min_length' bytes with one of 'modes', a set of PayloadCompressMode.
+    // a long link offers them to the server when it connects, see longlink_compress_cmdid, and compresses once the server picked one.
+    // short links send Accept-Encoding and compress request bodies to a host once it answered compressed.
+    // takes effect on the next connection. if you did not call this function, or modes is 0, nothing is compressed.
+	extern void (*SetPayloadCompress)(int modes, size_t min_length);
+
+    // 'min_length' for the bodies of 'cmdid' instead, (size_t)-1 never compresses them.
+	extern void (*SetPayloadCompressCmdId)(uint32_t cmdid, size_t min_length);
+
+    // a zstd dictionary the server has too, the long link uses it when the server says so. false if zstd is not built in.
+	extern bool (*SetPayloadCompressDict)(const void* dict, size_t length);
+
+    // makes a zstd dictionary of about 'length' bytes out of typical bodies, for SetPayloadCompressDict on both ends.
+	extern bool (*TrainPayloadCompressDict)(const std::vector<std::string>& samples, size_t length, std::string& dict);
+
+    // bytes in and out and cpu time spent since start
+	extern PayloadCompressStats (*GetPayloadCompressStats)();
+
     // used to keep longlink active
     // keep signnaling once 'period' and last 'keeptime'
 	extern void (*KeepSignalling)();
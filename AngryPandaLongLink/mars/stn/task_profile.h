@@ -33,6 +33,8 @@
 namespace mars {
 namespace stn  {
 
+struct TaskCodecJob;
+
 struct ProfileExtension {
 
 	ProfileExtension() {}
@@ -231,11 +233,24 @@ struct TaskProfile {
 
         err_type = kEctOK;
         err_code = 0;
+
+        timeout_check_time = 0;
+
+        encoding = false;
+        encode_seq = 0;
+        decode_seq = 0;
     }
     
     void InitSendParam() {
         transfer_profile.Reset();
         running_id = 0;
+
+        // a request still being made on the codec pool is for the send given up here
+        encoding = false;
+        ++encode_seq;
+        encoded.reset();
+        // and a response still being decoded is for it too
+        ++decode_seq;
     }
     
     void PushHistory() {
@@ -265,6 +280,13 @@ struct TaskProfile {
     int err_code;
     int link_type;
 
+    uint64_t timeout_check_time;    // ms, when the task manager's timeout wheel looks at it next, 0 none
+
+    bool encoding;                  // Req2Buf is running on the codec pool
+    uint32_t encode_seq;            // the result of an older run is dropped
+    uint32_t decode_seq;            // Buf2Resp on the codec pool, the same for responses
+    boost::shared_ptr<TaskCodecJob> encoded;    // made on the codec pool, not sent yet
+
     std::vector<TransferProfile> history_transfer_profiles;
 };
         
@@ -273,6 +295,7 @@ void __SetLastFailedStatus(std::list<TaskProfile>::iterator _it);
 uint64_t __ReadWriteTimeout(uint64_t  _first_pkg_timeout);
 uint64_t  __FirstPkgTimeout(int64_t  _init_first_pkg_timeout, size_t _sendlen, int _send_count, int _dynamictimeout_status);
 bool __CompareTask(const TaskProfile& _first, const TaskProfile& _second);
+uint64_t __NextTimeoutTime(const TaskProfile& _profile);
 }}
 
 #endif
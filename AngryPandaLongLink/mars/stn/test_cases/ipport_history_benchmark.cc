@@ -0,0 +1,283 @@
+/*
+* ipport_history_benchmark.cc
+*
+* IPPortHistory kept across a reopen, a record cut short ignored, compaction and eviction, and the
+* cost of one connect result: the whole ipportrecords2.xml saved as SimpleIPPortSort did, against one
+* record appended to the mmaped file.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/tinyxml2.h"
+#include "mars/comm/time_utils.h"
+
+#include "../src/ipport_history.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const char* const kPath = "/tmp/ipport_history_benchmark.bin";
+static const char* const kXmlPath = "/tmp/ipport_history_benchmark.xml";
+static const int kAddressCount = 200;
+static const int kUpdateCount = 2000;
+
+static std::string __Ip(int _i)
+{
+	char ip[32];
+	snprintf(ip, sizeof(ip), "10.0.%d.%d", _i / 250, _i % 250 + 1);
+	return ip;
+}
+
+static IPPortHistory::Item __Item(int _i, time_t _time)
+{
+	IPPortHistory::Item item;
+	item.ip = __Ip(_i);
+	item.port = 80;
+	IPPortHistory::Add(item, 0 == _i % 3, _time);
+	return item;
+}
+
+}
+
+TEST(ipport_history_benchmark, Reopen)
+{
+	unlink(kPath);
+	time_t now = time(NULL);
+	{
+		IPPortHistory history;
+		ASSERT_TRUE(history.Open(kPath));
+		for (int i = 0; i < 10; ++i) history.Put("wifi", __Item(i, now));
+
+		IPPortHistory::Item item = __Item(0, now);
+		IPPortHistory::Add(item, false, now);
+		history.Put("wifi", item);
+		history.Put("4g", __Item(0, now));
+		EXPECT_EQ(11u, history.Size());
+		EXPECT_EQ(12u, history.Appended());
+	}
+
+	IPPortHistory history;
+	ASSERT_TRUE(history.Open(kPath));
+	EXPECT_EQ(11u, history.Size());
+	EXPECT_EQ(11u, history.Appended());  // compacted on open
+
+	IPPortHistory::Item item;
+	ASSERT_TRUE(history.Get("wifi", __Ip(0), 80, item));
+	EXPECT_EQ(1u, item.history);
+	EXPECT_EQ(now, item.time);
+	ASSERT_TRUE(history.Get("4g", __Ip(0), 80, item));
+	EXPECT_EQ(0u, item.history);
+	EXPECT_FALSE(history.Get("wifi", __Ip(0), 443, item));
+
+	std::vector<IPPortHistory::Item> items;
+	history.Items("wifi", items);
+	EXPECT_EQ(10u, items.size());
+	history.Close();
+	unlink(kPath);
+}
+
+TEST(ipport_history_benchmark, TornRecord)
+{
+	unlink(kPath);
+	time_t now = time(NULL);
+	{
+		IPPortHistory history;
+		ASSERT_TRUE(history.Open(kPath));
+		history.Put("wifi", __Item(0, now));
+		history.Put("wifi", __Item(1, now));
+	}
+
+	// as if the process died between writing the second record and marking it valid
+	FILE* file = fopen(kPath, "r+b");
+	ASSERT_TRUE(NULL != file);
+	uint8_t valid = 0;
+	fseek(file, 16 + 64 + 22, SEEK_SET);
+	fwrite(&valid, 1, 1, file);
+	fclose(file);
+
+	IPPortHistory history;
+	ASSERT_TRUE(history.Open(kPath));
+	IPPortHistory::Item item;
+	EXPECT_TRUE(history.Get("wifi", __Ip(0), 80, item));
+	EXPECT_FALSE(history.Get("wifi", __Ip(1), 80, item));
+	EXPECT_EQ(1u, history.Size());
+	history.Close();
+	unlink(kPath);
+}
+
+TEST(ipport_history_benchmark, CompactAndEvict)
+{
+	unlink(kPath);
+	time_t now = time(NULL);
+	IPPortHistory history;
+	ASSERT_TRUE(history.Open(kPath));
+
+	// expired ones go on Compact
+	history.Put("wifi", __Item(0, now - IPPortHistory::kRecordTimeoutS - 1));
+	history.Put("wifi", __Item(1, now));
+	history.Compact(now);
+	EXPECT_EQ(1u, history.Size());
+	EXPECT_EQ(1u, history.Appended());
+
+	// updating the same address over and over only fills the file until the next compaction
+	for (uint32_t i = 0; i < 3 * IPPortHistory::kCapacity; ++i) history.Put("wifi", __Item(1, now));
+	EXPECT_EQ(1u, history.Size());
+	EXPECT_GE((uint32_t)IPPortHistory::kCapacity, history.Appended());
+
+	// every slot live: the oldest quarter goes, the one updated just now stays
+	for (uint32_t i = 0; i < IPPortHistory::kCapacity; ++i) history.Put("wifi", __Item(i + 2, now - IPPortHistory::kCapacity + i));
+	history.Put("wifi", __Item(0, now));
+	EXPECT_EQ((size_t)(IPPortHistory::kCapacity - IPPortHistory::kCapacity / 4 + 2), history.Size());
+
+	IPPortHistory::Item item;
+	EXPECT_FALSE(history.Get("wifi", __Ip(2), 80, item));
+	EXPECT_TRUE(history.Get("wifi", __Ip(IPPortHistory::kCapacity + 1), 80, item));
+	EXPECT_TRUE(history.Get("wifi", __Ip(1), 80, item));
+	EXPECT_TRUE(history.Get("wifi", __Ip(0), 80, item));
+	history.Close();
+	unlink(kPath);
+}
+
+TEST(ipport_history_benchmark, ImportXml)
+{
+	time_t now = time(NULL);
+	char fresh[32], old[32];
+	snprintf(fresh, sizeof(fresh), "%ld", (long)(now - 60 * 60));
+	snprintf(old, sizeof(old), "%ld", (long)(now - IPPortHistory::kRecordTimeoutS - 1));
+
+	// as SimpleIPPortSort wrote it before IPPortHistory
+	tinyxml2::XMLDocument doc;
+	tinyxml2::XMLElement* record = doc.NewElement("record");
+	record->SetAttribute("netinfo", "wifi");
+	record->SetAttribute("time", fresh);
+	doc.InsertEndChild(record);
+	tinyxml2::XMLElement* element = doc.NewElement("item");
+	element->SetAttribute("ip", "10.0.0.1");
+	element->SetAttribute("port", 80);
+	element->SetAttribute("historyresult", (int64_t)0x5);
+	record->InsertEndChild(element);
+	element = doc.NewElement("item");
+	element->SetAttribute("ip", "10.0.0.2");
+	element->SetAttribute("port", 80);
+	element->SetAttribute("historyresult", (int64_t)0x1);
+	record->InsertEndChild(element);
+
+	record = doc.NewElement("record");
+	record->SetAttribute("netinfo", "mobile");
+	record->SetAttribute("time", old);
+	doc.InsertEndChild(record);
+	element = doc.NewElement("item");
+	element->SetAttribute("ip", "10.0.0.3");
+	element->SetAttribute("port", 80);
+	element->SetAttribute("historyresult", (int64_t)0x1);
+	record->InsertEndChild(element);
+	ASSERT_EQ(tinyxml2::XML_SUCCESS, doc.SaveFile(kXmlPath));
+
+	remove(kPath);
+	IPPortHistory history;
+	history.Open(kPath);
+
+	// a result of its own is not overwritten
+	IPPortHistory::Item own = __Item(1, now);
+	own.ip = "10.0.0.2";
+	history.Put("wifi", own);
+
+	EXPECT_EQ(1, history.ImportXml(kXmlPath, now));
+
+	IPPortHistory::Item item;
+	ASSERT_TRUE(history.Get("wifi", "10.0.0.1", 80, item));
+	EXPECT_EQ(0x5u, item.history);
+	EXPECT_EQ(now - 60 * 60, item.time);
+	EXPECT_EQ(0.0f, item.score);
+
+	ASSERT_TRUE(history.Get("wifi", "10.0.0.2", 80, item));
+	EXPECT_EQ(own.history, item.history);
+	EXPECT_FALSE(history.Get("mobile", "10.0.0.3", 80, item));
+
+	EXPECT_EQ(0, history.ImportXml("/tmp/ipport_history_benchmark.missing.xml", now));
+
+	history.Close();
+	remove(kPath);
+	remove(kXmlPath);
+}
+
+TEST(ipport_history_benchmark, ScoreDecay)
+{
+	time_t now = 1000000;
+	IPPortHistory::Item item;
+	for (int i = 0; i < 20; ++i) IPPortHistory::Add(item, true, now);
+	EXPECT_LT(0.99f, item.score);
+	EXPECT_NEAR(item.score / 2, IPPortHistory::Decay(item.score, now, now + IPPortHistory::kScoreHalfLifeS), 0.001);
+
+	// a failure long after the successes outweighs them
+	IPPortHistory::Add(item, false, now + 4 * IPPortHistory::kScoreHalfLifeS);
+	EXPECT_GT(0.0f, item.score);
+	EXPECT_EQ(1u, item.history & 1);
+}
+
+TEST(ipport_history_benchmark, UpdateCost)
+{
+	srand(1);
+	time_t now = time(NULL);
+
+	// as SimpleIPPortSort did: the item found by a scan, then the whole document saved
+	tinyxml2::XMLDocument doc;
+	tinyxml2::XMLElement* net = doc.NewElement("netinfo");
+	net->SetAttribute("netinfo", "wifi");
+	doc.InsertEndChild(net);
+	for (int i = 0; i < kAddressCount; ++i) {
+		tinyxml2::XMLElement* item = doc.NewElement("item");
+		item->SetAttribute("ip", __Ip(i).c_str());
+		item->SetAttribute("port", 80);
+		item->SetAttribute("historyresult", 0);
+		item->SetAttribute("time", (int64_t)now);
+		net->InsertEndChild(item);
+	}
+
+	uint64_t xml_start = gettickcount();
+	for (int i = 0; i < kUpdateCount; ++i) {
+		std::string ip = __Ip(rand() % kAddressCount);
+		for (tinyxml2::XMLElement* item = net->FirstChildElement(); item; item = item->NextSiblingElement()) {
+			if (ip != item->Attribute("ip")) continue;
+			item->SetAttribute("historyresult", (int64_t)((item->Int64Attribute("historyresult") << 1) | 1));
+			item->SetAttribute("time", (int64_t)now);
+			break;
+		}
+		doc.SaveFile(kXmlPath);
+	}
+	uint64_t xml_cost = gettickcount() - xml_start;
+
+	unlink(kPath);
+	IPPortHistory history;
+	ASSERT_TRUE(history.Open(kPath));
+	uint64_t mmap_start = gettickcount();
+	for (int i = 0; i < kUpdateCount; ++i) {
+		std::string ip = __Ip(rand() % kAddressCount);
+		IPPortHistory::Item item;
+		if (!history.Get("wifi", ip, 80, item)) {
+			item.ip = ip;
+			item.port = 80;
+		}
+		IPPortHistory::Add(item, false, now);
+		history.Put("wifi", item);
+	}
+	uint64_t mmap_cost = gettickcount() - mmap_start;
+	EXPECT_EQ((size_t)kAddressCount, history.Size());
+
+	printf("%d connect results over %d addresses: xml saved each time %llu ms, mmaped record appended %llu ms\n",
+		kUpdateCount, kAddressCount, (unsigned long long)xml_cost, (unsigned long long)mmap_cost);
+	EXPECT_GT(xml_cost, mmap_cost);
+
+	history.Close();
+	unlink(kPath);
+	unlink(kXmlPath);
+}
@@ -0,0 +1,290 @@
+/*
+* longlink_readwrite_benchmark.cc
+*
+* the read/write loop of LongLink::__RunReadWrite against a loopback echo server: a sender thread
+* queues packets and breaks the loop like LongLink::Send, the loop writes them out and reads the echo.
+* reports messages/sec, cpu of the loop thread per message and wakeups, for a new SocketSelect every
+* round and for the persistent edge-triggered SocketEpoll.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <list>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+#include "thread/thread.h"
+#include "thread/lock.h"
+#include "thread/condition.h"
+#include "time_utils.h"
+#include "autobuffer.h"
+
+#include "../../comm/socket/unix_socket.h"
+#include "../../comm/socket/socketselect.h"
+#include "../../comm/socket/socketbreaker.h"
+#include "../../comm/socket/socketepoll.h"
+
+#ifdef __linux__
+
+namespace
+{
+
+static const int kMessageCount = 200 * 1000;
+static const size_t kMessageLength = 128;
+static const int kWindow = 16;  // packets in flight, a busy long link
+static const size_t kRecvLength = 64 * 1024;
+
+struct EchoLink
+{
+	EchoLink(): sock(INVALID_SOCKET), front_pos(0), queued(0), echoed(0), wakeups(0) {}
+
+	SOCKET sock;
+	Mutex mutex;
+	Condition cond;
+	SocketBreaker breaker;
+	std::list<std::string> lstsenddata;  // front may be partly sent
+	size_t front_pos;
+
+	int queued;
+	int echoed;
+	int wakeups;
+};
+
+static uint64_t __ThreadCpuNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void __EchoServer(SOCKET _listen)
+{
+	SOCKET sock = accept(_listen, NULL, NULL);
+	if (INVALID_SOCKET == sock) return;
+	socket_disable_nagle(sock, 1);
+
+	char buf[kRecvLength];
+	while (true) {
+		ssize_t len = recv(sock, buf, sizeof(buf), 0);
+		if (len <= 0) break;
+
+		ssize_t sent = 0;
+		while (sent < len) {
+			ssize_t ret = send(sock, buf + sent, len - sent, 0);
+			if (ret <= 0) break;
+			sent += ret;
+		}
+	}
+	close(sock);
+}
+
+// LongLink::Send: queue under the lock and break the loop
+static void __Sender(EchoLink* _link)
+{
+	std::string packet(kMessageLength, 'm');
+
+	for (int i = 0; i < kMessageCount; ++i) {
+		ScopedLock lock(_link->mutex);
+		while (_link->queued - _link->echoed >= kWindow) _link->cond.wait(lock);
+
+		_link->lstsenddata.push_back(packet);
+		++_link->queued;
+		lock.unlock();
+
+		_link->breaker.Break();
+	}
+}
+
+// writes as much of lstsenddata as the socket takes, the caller holds the lock. false on error.
+static bool __WriteQueued(EchoLink& _link, bool& _blocked)
+{
+	struct iovec iov[kWindow];
+	int count = 0;
+	size_t pos = _link.front_pos;
+	for (std::list<std::string>::iterator it = _link.lstsenddata.begin(); it != _link.lstsenddata.end() && count < kWindow; ++it) {
+		iov[count].iov_base = (void*)(it->data() + pos);
+		iov[count].iov_len = it->size() - pos;
+		pos = 0;
+		++count;
+	}
+
+	ssize_t writelen = writev(_link.sock, iov, count);
+	if (0 == writelen || (0 > writelen && !IS_NOBLOCK_SEND_ERRNO(socket_errno))) return false;
+	if (0 > writelen) writelen = 0;
+
+	while (!_link.lstsenddata.empty() && 0 < writelen) {
+		size_t left = _link.lstsenddata.front().size() - _link.front_pos;
+		if ((size_t)writelen >= left) {
+			writelen -= left;
+			_link.lstsenddata.pop_front();
+			_link.front_pos = 0;
+		} else {
+			_link.front_pos += writelen;
+			writelen = 0;
+		}
+	}
+
+	_blocked = !_link.lstsenddata.empty();
+	return true;
+}
+
+static bool __ReadEcho(EchoLink& _link, AutoBuffer& _bufrecv, size_t& _received, bool& _drained)
+{
+	_bufrecv.AllocWrite(kRecvLength, false);
+	ssize_t recvlen = recv(_link.sock, _bufrecv.PosPtr(), kRecvLength, 0);
+	_drained = ((size_t)recvlen != kRecvLength);
+
+	if (0 == recvlen || (0 > recvlen && !IS_NOBLOCK_READ_ERRNO(socket_errno))) return false;
+	if (0 > recvlen) return true;
+
+	_received += recvlen;
+	int echoed = (int)(_received / kMessageLength);
+
+	ScopedLock lock(_link.mutex);
+	if (echoed != _link.echoed) {
+		_link.echoed = echoed;
+		_link.cond.notifyAll(lock);
+	}
+	return true;
+}
+
+// the loop as it was: a new SocketSelect every round, the lock to decide on write interest
+static bool __RunSelect(EchoLink& _link)
+{
+	AutoBuffer bufrecv;
+	size_t received = 0;
+
+	while (received < kMessageCount * kMessageLength) {
+		SocketSelect sel(_link.breaker, true);
+		sel.PreSelect();
+		sel.Read_FD_SET(_link.sock);
+		sel.Exception_FD_SET(_link.sock);
+
+		ScopedLock lock(_link.mutex);
+		if (!_link.lstsenddata.empty()) sel.Write_FD_SET(_link.sock);
+		lock.unlock();
+
+		if (0 > sel.Select(10 * 1000) || sel.IsException() || sel.Exception_FD_ISSET(_link.sock)) return false;
+		++_link.wakeups;
+
+		socket_nwrite(_link.sock);
+
+		lock.lock();
+		bool blocked = false;
+		if (sel.Write_FD_ISSET(_link.sock) && !_link.lstsenddata.empty() && !__WriteQueued(_link, blocked)) return false;
+		lock.unlock();
+
+		bool drained = false;
+		if (sel.Read_FD_ISSET(_link.sock) && !__ReadEcho(_link, bufrecv, received, drained)) return false;
+	}
+
+	return true;
+}
+
+// registered once, the lock only when the breaker or EPOLLOUT says there is something to send
+static bool __RunEpoll(EchoLink& _link)
+{
+	SocketEpoll epoll(_link.breaker, true);
+	if (!epoll.IsCreateSuc() || !epoll.AddSocket(_link.sock, false)) return false;
+
+	AutoBuffer bufrecv;
+	size_t received = 0;
+	bool readable = false;
+	bool writable = true;
+
+	while (received < kMessageCount * kMessageLength) {
+		if (0 > epoll.Wait(readable ? 0 : 10 * 1000) || epoll.IsException()) return false;
+		++_link.wakeups;
+
+		readable = readable || epoll.Readable();
+		writable = writable || epoll.Writable();
+		bool check_send = epoll.IsBreak() || (epoll.IsWriteActive() && epoll.Writable());
+
+		socket_nwrite(_link.sock);
+
+		if (check_send) {
+			ScopedLock lock(_link.mutex);
+			bool blocked = false;
+			if (writable && !_link.lstsenddata.empty() && !__WriteQueued(_link, blocked)) return false;
+			if (blocked) writable = false;
+			if (!epoll.WriteEvent(!_link.lstsenddata.empty())) return false;
+		}
+
+		bool drained = false;
+		if (readable && !__ReadEcho(_link, bufrecv, received, drained)) return false;
+		if (readable) readable = !drained;
+	}
+
+	return true;
+}
+
+static void __RunBenchmark(const char* _name, bool (*_run)(EchoLink&), double& _ns_per_message)
+{
+	SOCKET listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_NE(INVALID_SOCKET, listen_sock);
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = 0;
+	ASSERT_EQ(0, bind(listen_sock, (sockaddr*)&addr, sizeof(addr)));
+	ASSERT_EQ(0, listen(listen_sock, 1));
+	socklen_t addr_len = sizeof(addr);
+	ASSERT_EQ(0, getsockname(listen_sock, (sockaddr*)&addr, &addr_len));
+
+	Thread server(boost::bind(&__EchoServer, listen_sock));
+	server.start();
+
+	EchoLink link;
+	link.sock = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_EQ(0, connect(link.sock, (sockaddr*)&addr, sizeof(addr)));
+	socket_disable_nagle(link.sock, 1);
+	socket_set_nobio(link.sock);
+
+	Thread sender(boost::bind(&__Sender, &link));
+	sender.start();
+
+	uint64_t start = ::gettickcount();
+	uint64_t cpu_start = __ThreadCpuNs();
+	bool ok = _run(link);
+	uint64_t cpu_ns = __ThreadCpuNs() - cpu_start;
+	uint64_t cost = ::gettickspan(start);
+
+	EXPECT_TRUE(ok);
+	if (!ok) {
+		ScopedLock lock(link.mutex);
+		link.echoed = kMessageCount;  // let the sender finish
+		link.cond.notifyAll(lock);
+	}
+
+	sender.join();
+	close(link.sock);
+	server.join();
+	close(listen_sock);
+
+	_ns_per_message = (double)cpu_ns / kMessageCount;
+	printf("%-28s %d x %u bytes: %.0f msg/s, loop cpu %.2f us/msg, %.2f wakeups/msg\n", _name, kMessageCount, (unsigned int)kMessageLength,
+		kMessageCount * 1000.0 / (cost ? cost : 1), _ns_per_message / 1000, (double)link.wakeups / kMessageCount);
+}
+
+}
+
+TEST(longlink_readwrite_benchmark, EchoSelectVsEpoll)
+{
+	double select_ns = 0;
+	double epoll_ns = 0;
+	__RunBenchmark("SocketSelect every round", &__RunSelect, select_ns);
+	__RunBenchmark("SocketEpoll edge triggered", &__RunEpoll, epoll_ns);
+
+	EXPECT_LT(epoll_ns, select_ns);
+}
+
+#endif
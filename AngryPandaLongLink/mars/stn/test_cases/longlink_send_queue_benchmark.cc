@@ -0,0 +1,244 @@
+/*
+* longlink_send_queue_benchmark.cc
+*
+* bursts of small requests through the long link send path: a std::list of Task and packed AutoBuffer
+* with a calloc'ed iovec per write as it was, and LongLinkSendQueue. both write into a socketpair
+* drained by another thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+#include "thread/thread.h"
+#include "autobuffer.h"
+#include "move_wrapper.h"
+
+#include "../proto/longlink_packer.h"
+#include "../src/longlink_send_queue.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kBurstCount = 2000;
+static const int kBurstSize = 50;
+static const size_t kBodyLength = 100;
+
+static uint64_t __ThreadCpuNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void __Drain(int _fd)
+{
+	char buf[64 * 1024];
+	while (0 < read(_fd, buf, sizeof(buf))) {}
+}
+
+static Task __MakeTask(uint32_t _taskid)
+{
+	Task task(_taskid);
+	task.cmdid = 10001;
+	task.cgi = "/cgi-bin/micromsg-bin/newsync";
+	task.shortlink_host_list.push_back("short.weixin.qq.com");
+	task.report_arg = "newsync";
+	return task;
+}
+
+static void __Report(uint64_t _cpu_ns, const char* _name)
+{
+	int count = kBurstCount * kBurstSize;
+	printf("%-32s %d requests of %u bytes: %.0f req/s of loop cpu, %.2f us/req\n", _name, count, (unsigned int)kBodyLength,
+		count * 1000000000.0 / (_cpu_ns ? _cpu_ns : 1), _cpu_ns / 1000.0 / count);
+}
+
+// as it was: every Send packs into its own AutoBuffer next to a copy of the Task
+static uint64_t __RunList(int _fd, const AutoBuffer& _body)
+{
+	std::list<std::pair<Task, move_wrapper<AutoBuffer> > > lstsenddata;
+	uint32_t taskid = 0;
+
+	uint64_t begin = __ThreadCpuNs();
+	for (int i = 0; i < kBurstCount; ++i) {
+		for (int j = 0; j < kBurstSize; ++j) {
+			Task task = __MakeTask(++taskid);
+			lstsenddata.push_back(std::make_pair(task, move_wrapper<AutoBuffer>(AutoBuffer())));
+			longlink_pack(task.cmdid, task.taskid, _body, KNullAtuoBuffer, lstsenddata.back().second, NULL);
+			lstsenddata.back().second->Seek(0, AutoBuffer::ESeekStart);
+		}
+
+		while (!lstsenddata.empty()) {
+			iovec* vecwrite = (iovec*)calloc(lstsenddata.size(), sizeof(iovec));
+			unsigned int offset = 0;
+			for (std::list<std::pair<Task, move_wrapper<AutoBuffer> > >::iterator it = lstsenddata.begin(); it != lstsenddata.end(); ++it) {
+				vecwrite[offset].iov_base = it->second->PosPtr();
+				vecwrite[offset].iov_len = it->second->PosLength();
+				++offset;
+			}
+			ssize_t writelen = writev(_fd, vecwrite, (int)lstsenddata.size());
+			free(vecwrite);
+			if (0 >= writelen) return 0;
+
+			std::list<std::pair<Task, move_wrapper<AutoBuffer> > >::iterator it = lstsenddata.begin();
+			while (it != lstsenddata.end() && 0 < writelen) {
+				if ((size_t)writelen >= it->second->PosLength()) {
+					writelen -= it->second->PosLength();
+					it = lstsenddata.erase(it);
+				} else {
+					it->second->Seek(writelen, AutoBuffer::ESeekCur);
+					writelen = 0;
+				}
+			}
+		}
+	}
+	return __ThreadCpuNs() - begin;
+}
+
+static void __NoopPacket(const LongLinkSendQueue::Packet&, size_t, bool, bool) {}
+
+static uint64_t __RunQueue(int _fd, const AutoBuffer& _body)
+{
+	LongLinkSendQueue lstsenddata;
+	uint32_t taskid = 0;
+
+	uint64_t begin = __ThreadCpuNs();
+	for (int i = 0; i < kBurstCount; ++i) {
+		for (int j = 0; j < kBurstSize; ++j) {
+			Task task = __MakeTask(++taskid);
+			longlink_pack(task.cmdid, task.taskid, _body, KNullAtuoBuffer, lstsenddata.PackBuffer(), NULL);
+			lstsenddata.PushPacked(LongLinkSendTask(task), 0);
+		}
+
+		while (!lstsenddata.Empty()) {
+			int iovcnt = 0;
+			const iovec* vecwrite = lstsenddata.Iov(iovcnt);
+			ssize_t writelen = writev(_fd, vecwrite, iovcnt);
+			if (0 >= writelen) return 0;
+			lstsenddata.Consume((size_t)writelen, &__NoopPacket);
+		}
+	}
+	return __ThreadCpuNs() - begin;
+}
+
+struct Sent {
+	uint32_t taskid;
+	size_t sent;
+	bool first;
+	bool last;
+};
+
+static std::vector<Sent> sg_sent;
+
+static void __RecordPacket(const LongLinkSendQueue::Packet& _packet, size_t _sent, bool _first, bool _last)
+{
+	Sent sent = {_packet.task.taskid, _sent, _first, _last};
+	sg_sent.push_back(sent);
+}
+
+static void __Push(LongLinkSendQueue& _queue, uint32_t _taskid, size_t _len, uint64_t _now)
+{
+	AutoBuffer& buf = _queue.PackBuffer();
+	std::vector<char> data(_len, (char)_taskid);
+	buf.Write(&data[0], data.size());
+	_queue.PushPacked(LongLinkSendTask(Task(_taskid)), _now);
+}
+
+}
+
+TEST(longlink_send_queue_benchmark, CoalescesAndConsumes)
+{
+	LongLinkSendQueue queue;
+	__Push(queue, 1, 100, 0);
+	__Push(queue, 2, 200, 0);
+	__Push(queue, 3, 10 * 1024, 0);  // big, keeps its own chunk
+	__Push(queue, 4, 50, 0);  // small ones go behind whatever chunk has room
+
+	int iovcnt = 0;
+	const iovec* iov = queue.Iov(iovcnt);
+	ASSERT_EQ(2, iovcnt);
+	EXPECT_EQ(300u, iov[0].iov_len);
+	EXPECT_EQ(10u * 1024 + 50, iov[1].iov_len);
+	EXPECT_EQ(0, memcmp("\x01\x01", iov[0].iov_base, 2));
+	EXPECT_EQ(0, memcmp("\x02\x02", (char*)iov[0].iov_base + 100, 2));
+
+	sg_sent.clear();
+	queue.Consume(150, &__RecordPacket);
+	ASSERT_EQ(2u, sg_sent.size());
+	EXPECT_TRUE(1 == sg_sent[0].taskid && 100 == sg_sent[0].sent && sg_sent[0].first && sg_sent[0].last);
+	EXPECT_TRUE(2 == sg_sent[1].taskid && 50 == sg_sent[1].sent && sg_sent[1].first && !sg_sent[1].last);
+	EXPECT_EQ(3u, queue.Count());
+
+	// started packets stay, the rest can go
+	EXPECT_FALSE(queue.Remove(2));
+	EXPECT_TRUE(queue.Remove(4));
+	EXPECT_EQ(150u + 10 * 1024, queue.UnsentLength());
+
+	iov = queue.Iov(iovcnt);
+	ASSERT_EQ(2, iovcnt);
+	EXPECT_EQ(150u, iov[0].iov_len);
+	EXPECT_EQ(0, memcmp("\x02\x02", iov[0].iov_base, 2));
+
+	sg_sent.clear();
+	queue.Consume(150 + 10 * 1024, &__RecordPacket);
+	ASSERT_EQ(2u, sg_sent.size());
+	EXPECT_TRUE(2 == sg_sent[0].taskid && 150 == sg_sent[0].sent && !sg_sent[0].first && sg_sent[0].last);
+	EXPECT_TRUE(3 == sg_sent[1].taskid && sg_sent[1].first && sg_sent[1].last);
+	EXPECT_TRUE(queue.Empty());
+	EXPECT_EQ(0u, queue.UnsentLength());
+}
+
+TEST(longlink_send_queue_benchmark, HoldTime)
+{
+	LongLinkSendQueue queue;
+	__Push(queue, 1, 100, 1000);
+	EXPECT_EQ(0u, queue.HoldTime(1000));  // off by default
+
+	queue.SetCoalesce(1000, 20);
+	EXPECT_EQ(15u, queue.HoldTime(1005));
+	__Push(queue, 2, 100, 1010);
+	EXPECT_EQ(10u, queue.HoldTime(1010));  // the oldest packet counts
+	EXPECT_EQ(0u, queue.HoldTime(1020));
+
+	__Push(queue, 3, 1000, 1010);
+	EXPECT_EQ(0u, queue.HoldTime(1010));  // enough bytes
+}
+
+TEST(longlink_send_queue_benchmark, BurstsOfSmallRequests)
+{
+	int fds[2];
+	ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	Thread reader(boost::bind(&__Drain, fds[1]));
+	reader.start();
+
+	AutoBuffer body;
+	std::vector<char> data(kBodyLength, 'b');
+	body.Write(&data[0], data.size());
+
+	uint64_t list_ns = __RunList(fds[0], body);
+	uint64_t queue_ns = __RunQueue(fds[0], body);
+
+	close(fds[0]);
+	reader.join();
+	close(fds[1]);
+
+	ASSERT_NE(0u, list_ns);
+	ASSERT_NE(0u, queue_ns);
+	__Report(list_ns, "list of Task + AutoBuffer");
+	__Report(queue_ns, "LongLinkSendQueue");
+
+	EXPECT_LT(queue_ns, list_ns);
+}
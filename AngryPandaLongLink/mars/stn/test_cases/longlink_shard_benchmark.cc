@@ -0,0 +1,164 @@
+/*
+* longlink_shard_benchmark.cc
+*
+* mixed small and large responses over one long link and over a pool of four picked by PickLongLink.
+* every link is modelled as a first in first out pipe whose throughput is held down by its window over
+* the rtt, the path itself has room for more, so a large response holds up what queues behind it on
+* the same link only.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../src/longlink_shard.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kTaskCount = 20 * 1000;
+static const double kArriveEveryMs = 8.0;
+static const double kLinkBytesPerMs = 1000.0;   // 64KB window over 64ms rtt
+static const double kRttMs = 64.0;
+static const uint64_t kSmallBytes = 1024;
+static const uint64_t kLargeBytes = 256 * 1024;
+static const int kLargeEvery = 50;
+
+struct Result
+{
+	double small_p50;
+	double small_p99;
+	double large_p50;
+	double bytes_per_ms;
+};
+
+struct SimTask
+{
+	double arrive;
+	uint32_t cmdid;
+	uint64_t bytes;
+};
+
+static std::vector<SimTask> __MakeTasks()
+{
+	srand(5);
+	std::vector<SimTask> tasks(kTaskCount);
+	double now = 0;
+	for (int i = 0; i < kTaskCount; ++i) {
+		now += kArriveEveryMs * 2 * (rand() / (RAND_MAX + 1.0));
+		tasks[i].arrive = now;
+		bool large = 0 == rand() % kLargeEvery;
+		tasks[i].cmdid = large ? 1000 : 1 + rand() % 30;
+		tasks[i].bytes = large ? kLargeBytes : kSmallBytes;
+	}
+	return tasks;
+}
+
+static double __Percentile(std::vector<double>& _values, double _p)
+{
+	if (_values.empty()) return 0;
+	std::sort(_values.begin(), _values.end());
+	return _values[std::min(_values.size() - 1, (size_t)(_values.size() * _p))];
+}
+
+static Result __Run(const std::vector<SimTask>& _tasks, size_t _link_count, int _policy)
+{
+	std::vector<double> busy_until(_link_count, 0);
+	std::vector<LongLinkLoad> links(_link_count);
+	for (size_t i = 0; i < _link_count; ++i) {
+		links[i].start_time = 1000 + i;
+		links[i].connected = true;
+	}
+
+	std::vector<double> small, large;
+	uint64_t total_bytes = 0;
+	double last_finish = 0;
+
+	for (size_t i = 0; i < _tasks.size(); ++i) {
+		const SimTask& sim = _tasks[i];
+		for (size_t l = 0; l < _link_count; ++l) {
+			links[l].outstanding_bytes = busy_until[l] > sim.arrive ? (uint64_t)((busy_until[l] - sim.arrive) * kLinkBytesPerMs) : 0;
+		}
+
+		Task task(i + 1);
+		task.cmdid = sim.cmdid;
+		size_t pick = PickLongLink(_policy, task, links);
+
+		double finish = std::max(sim.arrive, busy_until[pick]) + sim.bytes / kLinkBytesPerMs;
+		busy_until[pick] = finish;
+		last_finish = std::max(last_finish, finish + kRttMs);
+		total_bytes += sim.bytes;
+
+		(kSmallBytes == sim.bytes ? small : large).push_back(finish - sim.arrive + kRttMs);
+	}
+
+	Result result;
+	result.small_p50 = __Percentile(small, 0.5);
+	result.small_p99 = __Percentile(small, 0.99);
+	result.large_p50 = __Percentile(large, 0.5);
+	result.bytes_per_ms = total_bytes / last_finish;
+	return result;
+}
+
+static void __Report(const char* _name, const Result& _result)
+{
+	printf("%-30s small p50 %8.1f ms, p99 %8.1f ms, large p50 %8.1f ms, %6.0f KB/s\n", _name,
+		_result.small_p50, _result.small_p99, _result.large_p50, _result.bytes_per_ms * 1000 / 1024);
+}
+
+}
+
+TEST(longlink_shard_benchmark, Pick)
+{
+	std::vector<LongLinkLoad> links(3);
+	for (int i = 0; i < 3; ++i) links[i].start_time = 100 + i;
+	links[0].outstanding_bytes = 500;
+	links[1].outstanding_bytes = 10;
+	links[2].outstanding_bytes = 0;
+
+	Task task(1);
+	task.cmdid = 7;
+
+	// none connected, the main link waits for its connection
+	EXPECT_EQ(0u, PickLongLink(kLongLinkShardLeastOutstanding, task, links));
+
+	links[0].connected = links[1].connected = true;
+	EXPECT_EQ(1u, PickLongLink(kLongLinkShardLeastOutstanding, task, links));
+
+	// a channel_id names its connection whatever the policy
+	task.channel_id = 102;
+	EXPECT_EQ(2u, PickLongLink(kLongLinkShardLeastOutstanding, task, links));
+	EXPECT_EQ(2u, PickLongLink(kLongLinkShardCmdId, task, links));
+	task.channel_id = 99;
+	EXPECT_EQ(0u, PickLongLink(kLongLinkShardCmdId, task, links));
+
+	task.channel_id = 0;
+	size_t first = PickLongLink(kLongLinkShardCmdId, task, links);
+	links[first].outstanding_bytes = 1 << 30;
+	EXPECT_EQ(first, PickLongLink(kLongLinkShardCmdId, task, links));
+
+	EXPECT_EQ(0u, PickLongLink(kLongLinkShardCmdId, task, std::vector<LongLinkLoad>(1)));
+}
+
+TEST(longlink_shard_benchmark, MixedPayloads)
+{
+	std::vector<SimTask> tasks = __MakeTasks();
+
+	Result one = __Run(tasks, 1, kLongLinkShardLeastOutstanding);
+	Result least = __Run(tasks, 4, kLongLinkShardLeastOutstanding);
+	Result cmdid = __Run(tasks, 4, kLongLinkShardCmdId);
+
+	printf("%d tasks, 1 in %d of %u KB, the rest %u KB\n", kTaskCount, kLargeEvery, (unsigned int)(kLargeBytes / 1024), (unsigned int)(kSmallBytes / 1024));
+	__Report("1 long link", one);
+	__Report("4, least outstanding bytes", least);
+	__Report("4, by cmdid", cmdid);
+
+	EXPECT_LT(least.small_p99 * 4, one.small_p99);
+	EXPECT_LT(cmdid.small_p99, one.small_p99);
+	EXPECT_GT(least.bytes_per_ms, one.bytes_per_ms);
+}
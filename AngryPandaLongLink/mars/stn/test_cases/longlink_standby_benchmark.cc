@@ -0,0 +1,355 @@
+/*
+* longlink_standby_benchmark.cc
+*
+* a loopback long link server answering every package after kServerDelay, and a second listener whose accept
+* queue is full so its syns are dropped, as the server the long link was on when it went away. reconnect to the
+* first response: the connect, then the identify and the first request, as LongLink does without a standby, and
+* with the standby LongLinkBackgroundSpeedTest keeps, which needs the two round trips only.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/autobuffer.h"
+#include "mars/comm/time_utils.h"
+#include "mars/comm/socket/complexconnect.h"
+#include "mars/comm/socket/connect_rtt.h"
+#include "mars/comm/socket/socketselect.h"
+#include "mars/comm/thread/thread.h"
+#include "mars/stn/proto/longlink_packer.h"
+
+#include "../src/longlink_speed_test.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kServerDelay = 30;   // ms, the rtt of the path
+static const uint32_t kCmdId = 1000;
+static const int kTimeout = 3000;
+
+class Server
+{
+  public:
+	Server(): listen_(INVALID_SOCKET), port_(0), thread_(boost::bind(&Server::__Run, this)) {
+		listen_ = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(listen_, (sockaddr*)&addr, sizeof(addr));
+		listen(listen_, 128);
+
+		socklen_t len = sizeof(addr);
+		getsockname(listen_, (sockaddr*)&addr, &len);
+		port_ = ntohs(addr.sin_port);
+		thread_.start();
+	}
+
+	~Server() {
+		breaker_.Break();
+		thread_.join();
+		for (size_t i = 0; i < clients_.size(); ++i) socket_close(clients_[i]);
+		socket_close(listen_);
+	}
+
+	uint16_t Port() const { return port_; }
+
+	// the server closes every connection it has
+	void CloseAll() {
+		ScopedLock lock(mutex_);
+		for (size_t i = 0; i < clients_.size(); ++i) shutdown(clients_[i], SHUT_RDWR);
+	}
+
+  private:
+	void __Run() {
+		std::vector<AutoBuffer*> bufs;
+		while (true) {
+			SocketSelect sel(breaker_);
+			sel.PreSelect();
+			sel.Read_FD_SET(listen_);
+			ScopedLock lock(mutex_);
+			for (size_t i = 0; i < clients_.size(); ++i) sel.Read_FD_SET(clients_[i]);
+			lock.unlock();
+
+			if (0 > sel.Select(1000) || sel.IsBreak()) break;
+
+			if (sel.Read_FD_ISSET(listen_)) {
+				lock.lock();
+				clients_.push_back(accept(listen_, NULL, NULL));
+				lock.unlock();
+				bufs.push_back(new AutoBuffer);
+			}
+
+			for (size_t i = 0; i < bufs.size(); ++i) {
+				if (!sel.Read_FD_ISSET(clients_[i])) continue;
+
+				char data[4096];
+				ssize_t n = recv(clients_[i], data, sizeof(data), 0);
+				if (0 >= n) continue;
+				bufs[i]->Write(data, n);
+
+				uint32_t cmdid = 0, seq = 0;
+				size_t package_len = 0;
+				AutoBuffer body, extension;
+				while (LONGLINK_UNPACK_OK == longlink_unpack(*bufs[i], cmdid, seq, package_len, body, extension, NULL)) {
+					usleep(kServerDelay * 1000);
+					AutoBuffer resp;
+					longlink_pack(cmdid, seq, body, extension, resp, NULL);
+					send(clients_[i], resp.Ptr(), resp.Length(), 0);
+
+					bufs[i]->Move(-(int)package_len);
+					body.Reset();
+				}
+			}
+		}
+		for (size_t i = 0; i < bufs.size(); ++i) delete bufs[i];
+	}
+
+  private:
+	SOCKET                  listen_;
+	uint16_t                port_;
+	Mutex                   mutex_;
+	std::vector<SOCKET>     clients_;
+	SocketBreaker           breaker_;
+	Thread                  thread_;
+};
+
+// a listener that never accepts, its queue filled so syns to it are dropped
+class Lossy
+{
+  public:
+	Lossy() {
+		listen_ = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(listen_, (sockaddr*)&addr, sizeof(addr));
+		listen(listen_, 0);
+
+		socklen_t len = sizeof(addr);
+		getsockname(listen_, (sockaddr*)&addr, &len);
+		port_ = ntohs(addr.sin_port);
+
+		for (int i = 0; i < 4; ++i) {
+			SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+			fcntl(sock, F_SETFL, O_NONBLOCK);
+			connect(sock, (sockaddr*)&addr, sizeof(addr));
+			fillers_.push_back(sock);
+		}
+		usleep(50 * 1000);
+	}
+
+	~Lossy() {
+		for (size_t i = 0; i < fillers_.size(); ++i) socket_close(fillers_[i]);
+		socket_close(listen_);
+	}
+
+	uint16_t Port() const { return port_; }
+
+  private:
+	SOCKET                  listen_;
+	uint16_t                port_;
+	std::vector<SOCKET>     fillers_;
+};
+
+static IPPortItem __Item(uint16_t _port)
+{
+	IPPortItem item;
+	item.str_ip = "127.0.0.1";
+	item.port = _port;
+	item.str_host = "localhost";
+	item.source_type = kIPSourceDNS;
+	return item;
+}
+
+// one package out and its answer back
+static bool __RoundTrip(SOCKET _sock, uint32_t _seq)
+{
+	AutoBuffer body, extension, req;
+	body.Write("hello", 5);
+	longlink_pack(kCmdId, _seq, body, extension, req, NULL);
+	if ((ssize_t)req.Length() != send(_sock, req.Ptr(), req.Length(), 0)) return false;
+
+	SocketBreaker breaker;
+	AutoBuffer resp;
+	while (true) {
+		SocketSelect sel(breaker);
+		sel.PreSelect();
+		sel.Read_FD_SET(_sock);
+		if (0 >= sel.Select(kTimeout)) return false;
+
+		char data[1024];
+		ssize_t n = recv(_sock, data, sizeof(data), 0);
+		if (0 >= n) return false;
+		resp.Write(data, n);
+
+		uint32_t cmdid = 0, seq = 0;
+		size_t package_len = 0;
+		AutoBuffer resp_body, resp_extension;
+		int ret = longlink_unpack(resp, cmdid, seq, package_len, resp_body, resp_extension, NULL);
+		if (LONGLINK_UNPACK_CONTINUE == ret) continue;
+		return LONGLINK_UNPACK_OK == ret && _seq == seq;
+	}
+}
+
+// the identify check and the first task
+static bool __FirstResponse(SOCKET _sock)
+{
+	return __RoundTrip(_sock, 1) && __RoundTrip(_sock, 2);
+}
+
+}
+
+TEST(longlink_standby_benchmark, Probe)
+{
+	Server server;
+	Lossy lossy;
+
+	// a port nobody listens on refuses at once
+	SOCKET closed = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(closed, (sockaddr*)&addr, sizeof(addr));
+	socklen_t len = sizeof(addr);
+	getsockname(closed, (sockaddr*)&addr, &len);
+	socket_close(closed);
+
+	std::vector<IPPortItem> items;
+	items.push_back(__Item(server.Port()));
+	items.push_back(__Item(ntohs(addr.sin_port)));
+	items.push_back(__Item(lossy.Port()));
+
+	SocketBreaker breaker;
+	std::vector<int> rtts;
+	uint64_t start = gettickcount();
+	ASSERT_TRUE(LongLinkBackgroundSpeedTest::Probe(items, rtts, breaker, 300));
+	uint64_t cost = gettickcount() - start;
+
+	ASSERT_EQ(3u, rtts.size());
+	EXPECT_LE(0, rtts[0]);
+	EXPECT_EQ(-1, rtts[1]);
+	EXPECT_EQ(-1, rtts[2]);
+	EXPECT_LE(300u, cost);
+	EXPECT_GT(1000u, cost);
+
+	// a break ends it at once
+	breaker.Break();
+	EXPECT_FALSE(LongLinkBackgroundSpeedTest::Probe(items, rtts, breaker, 300));
+}
+
+TEST(longlink_standby_benchmark, Standby)
+{
+	Server server;
+	SocketBreaker breaker;
+	LongLinkStandby standby;
+	IPPortItem item;
+	unsigned long rtt = 0;
+
+	EXPECT_EQ(INVALID_SOCKET, standby.Take("wifi", item, rtt));
+
+	LongLinkSpeedTestItem verify("127.0.0.1", server.Port());
+	ASSERT_TRUE(LongLinkBackgroundSpeedTest::Run(verify, breaker, kTimeout));
+	ASSERT_EQ(kLongLinkSpeedTestSuc, verify.GetState());
+	standby.Put(verify.DetachSocket(), __Item(server.Port()), "wifi", verify.GetConnectTime());
+
+	// of another network
+	EXPECT_EQ(INVALID_SOCKET, standby.Take("4g", item, rtt));
+
+	LongLinkSpeedTestItem again("127.0.0.1", server.Port());
+	ASSERT_TRUE(LongLinkBackgroundSpeedTest::Run(again, breaker, kTimeout));
+	standby.Put(again.DetachSocket(), __Item(server.Port()), "wifi", again.GetConnectTime());
+
+	// a noop keeps it
+	SOCKET sock = standby.Take("wifi", item, rtt);
+	ASSERT_NE(INVALID_SOCKET, sock);
+	EXPECT_EQ(server.Port(), item.port);
+	LongLinkSpeedTestItem noop(sock, item.str_ip, item.port);
+	ASSERT_TRUE(LongLinkBackgroundSpeedTest::Run(noop, breaker, kTimeout));
+	ASSERT_EQ(kLongLinkSpeedTestSuc, noop.GetState());
+	standby.Put(noop.DetachSocket(), item, "wifi", rtt);
+
+	// closed by the server
+	server.CloseAll();
+	usleep(50 * 1000);
+	EXPECT_EQ(INVALID_SOCKET, standby.Take("wifi", item, rtt));
+}
+
+TEST(longlink_standby_benchmark, ReconnectToFirstResponse)
+{
+	Server server;
+	Lossy lossy;
+	ConnectRttTable& table = ConnectRttTable::Instance();
+	table.Clear();
+
+	std::vector<socket_address> addrs;
+	addrs.push_back(socket_address("127.0.0.1", lossy.Port()));
+	addrs.push_back(socket_address("127.0.0.1", server.Port()));
+
+	// the link was on the one that went away, which connected fast then
+	table.OnConnected(addrs[0], 20);
+
+	uint64_t start = gettickcount();
+	SocketBreaker breaker;
+	ComplexConnect connect(10 * 1000, 4000, 4000, 3);
+	SOCKET sock = connect.ConnectImpatient(addrs, breaker);
+	ASSERT_NE(INVALID_SOCKET, sock);
+	ASSERT_TRUE(__FirstResponse(sock));
+	uint64_t cold_cost = gettickcount() - start;
+	socket_close(sock);
+
+	// with the background test run before the link dropped
+	table.Clear();
+	table.OnConnected(addrs[0], 20);
+	std::vector<IPPortItem> items;
+	items.push_back(__Item(lossy.Port()));
+	items.push_back(__Item(server.Port()));
+	std::vector<int> rtts;
+	ASSERT_TRUE(LongLinkBackgroundSpeedTest::Probe(items, rtts, breaker, 300));
+	ASSERT_EQ(-1, rtts[0]);
+	ASSERT_LE(0, rtts[1]);
+
+	LongLinkStandby standby;
+	LongLinkSpeedTestItem verify(items[1].str_ip, items[1].port);
+	ASSERT_TRUE(LongLinkBackgroundSpeedTest::Run(verify, breaker, kTimeout));
+	standby.Put(verify.DetachSocket(), items[1], "wifi", verify.GetConnectTime());
+
+	start = gettickcount();
+	IPPortItem item;
+	unsigned long rtt = 0;
+	sock = standby.Take("wifi", item, rtt);
+	ASSERT_NE(INVALID_SOCKET, sock);
+	ASSERT_TRUE(__FirstResponse(sock));
+	uint64_t standby_cost = gettickcount() - start;
+	socket_close(sock);
+
+	// and without a standby, the connect after the probe knows the lost one failed
+	for (size_t i = 0; i < items.size(); ++i) {
+		if (0 <= rtts[i]) table.OnConnected(addrs[i], rtts[i]);
+		else table.OnFailed(addrs[i]);
+	}
+	start = gettickcount();
+	ComplexConnect learnt(10 * 1000, 4000, 4000, 3);
+	sock = learnt.ConnectImpatient(addrs, breaker);
+	ASSERT_NE(INVALID_SOCKET, sock);
+	ASSERT_TRUE(__FirstResponse(sock));
+	uint64_t probed_cost = gettickcount() - start;
+	socket_close(sock);
+
+	printf("reconnect to first response, the server it was on dropping syns, rtt %d ms: connect %llu ms, after a probe %llu ms, standby %llu ms\n",
+		kServerDelay, (unsigned long long)cold_cost, (unsigned long long)probed_cost, (unsigned long long)standby_cost);
+	EXPECT_GT(cold_cost, probed_cost);
+	EXPECT_GT(cold_cost, standby_cost);
+	EXPECT_GT((uint64_t)(3 * kServerDelay), standby_cost);
+	table.Clear();
+}
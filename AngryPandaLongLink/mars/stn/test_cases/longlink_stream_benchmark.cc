@@ -0,0 +1,275 @@
+/*
+* longlink_stream_benchmark.cc
+*
+* 1KB requests sent while 1MB uploads are going out on the same long link, with every body sent whole
+* as the long link did and with the big ones cut into 16KB frames by LongLinkStreamSender. the socket
+* buffer takes 64KB and the path 1000 bytes a ms, what waits for room stays in LongLinkSendQueue.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/autobuffer.h"
+
+#include "../proto/longlink_packer.h"
+#include "../src/longlink_send_queue.h"
+#include "../src/longlink_stream_sender.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const size_t kFrameLength = 16 * 1024;
+static const size_t kSocketBuffer = 64 * 1024;
+static const size_t kBytesPerMs = 1000;
+static const size_t kSmallBytes = 1024;
+static const size_t kBulkBytes = 1024 * 1024;
+static const int kSmallEveryMs = 20;
+static const int kBulkEveryMs = 3000;
+static const int kRunMs = 60 * 1000;
+
+struct Result
+{
+	double small_p50;
+	double small_p99;
+	double bulk_p50;
+};
+
+struct Sent
+{
+	uint64_t start;
+	bool     bulk;
+};
+
+static void __Fill(AutoBuffer& _body, size_t _length, uint32_t _seed)
+{
+	_body.AllocWrite(_length);
+	for (size_t i = 0; i < _length; ++i) ((char*)_body.Ptr())[i] = (char)(_seed + i * 7);
+	_body.Length(0, _length);
+}
+
+// LongLink::__FeedStreams
+static void __Feed(LongLinkStreamSender& _streams, LongLinkSendQueue& _queue, uint64_t _now)
+{
+	while (!_streams.Empty() && _queue.UnsentLength() < _streams.FrameLength()) {
+		LongLinkSendTask task;
+		if (!_streams.PackNext(_queue.PackBuffer(), task, NULL)) break;
+		_queue.PushPacked(task, _now);
+	}
+}
+
+static double __Percentile(std::vector<double>& _values, double _p)
+{
+	if (_values.empty()) return 0;
+	std::sort(_values.begin(), _values.end());
+	return _values[std::min(_values.size() - 1, (size_t)(_values.size() * _p))];
+}
+
+static Result __Run(size_t _frame_length)
+{
+	LongLinkSendQueue queue;
+	LongLinkStreamSender streams;
+	streams.SetFrame(_frame_length, 0);
+
+	AutoBuffer small_body, bulk_body, extension;
+	__Fill(small_body, kSmallBytes, 1);
+	__Fill(bulk_body, kBulkBytes, 2);
+
+	std::map<uint32_t, Sent> sent;
+	std::vector<std::pair<uint64_t, uint32_t> > in_socket;  // offset of the last byte of a request, taskid
+	uint64_t written = 0;
+	uint64_t delivered = 0;
+	uint32_t taskid = 0;
+
+	std::vector<double> small, bulk;
+
+	for (uint64_t now = 0; now < (uint64_t)kRunMs || !sent.empty(); ++now) {
+		if (now < (uint64_t)kRunMs && 0 == now % kSmallEveryMs) {
+			Task task(++taskid);
+			task.cmdid = 1;
+			Sent s = {now, false};
+			sent[taskid] = s;
+			longlink_pack(task.cmdid, task.taskid, small_body, extension, queue.PackBuffer(), NULL);
+			queue.PushPacked(LongLinkSendTask(task), now);
+		}
+
+		if (now < (uint64_t)kRunMs && 7 == now % kBulkEveryMs) {
+			Task task(++taskid);
+			task.cmdid = 2;
+			Sent s = {now, true};
+			sent[taskid] = s;
+			if (streams.Split(bulk_body.Length())) {
+				streams.Push(LongLinkSendTask(task), bulk_body, extension);
+				__Feed(streams, queue, now);
+			} else {
+				longlink_pack(task.cmdid, task.taskid, bulk_body, extension, queue.PackBuffer(), NULL);
+				queue.PushPacked(LongLinkSendTask(task), now);
+			}
+		}
+
+		size_t room = (size_t)(kSocketBuffer - (written - delivered));
+		queue.Consume(std::min(room, queue.UnsentLength()), [&](const LongLinkSendQueue::Packet& _packet, size_t _sent, bool _first, bool _last) {
+			written += _sent;
+			if (_last && !_packet.task.more_frames) in_socket.push_back(std::make_pair(written, _packet.task.taskid));
+		});
+		__Feed(streams, queue, now);
+
+		delivered = std::min(written, delivered + kBytesPerMs);
+		size_t done = 0;
+		for (; done < in_socket.size() && in_socket[done].first <= delivered; ++done) {
+			Sent& s = sent[in_socket[done].second];
+			(s.bulk ? bulk : small).push_back((double)(now + 1 - s.start));
+			sent.erase(in_socket[done].second);
+		}
+		in_socket.erase(in_socket.begin(), in_socket.begin() + done);
+	}
+
+	Result result;
+	result.small_p50 = __Percentile(small, 0.5);
+	result.small_p99 = __Percentile(small, 0.99);
+	result.bulk_p50 = __Percentile(bulk, 0.5);
+	return result;
+}
+
+static void __Report(const char* _name, const Result& _result)
+{
+	printf("%-22s 1KB p50 %8.1f ms, p99 %8.1f ms, 1MB p50 %8.1f ms\n", _name, _result.small_p50, _result.small_p99, _result.bulk_p50);
+}
+
+}
+
+TEST(longlink_stream_benchmark, FramesInterleave)
+{
+	LongLinkStreamSender streams;
+	streams.SetFrame(kFrameLength, 0);
+	EXPECT_FALSE(streams.Split(kFrameLength));
+	EXPECT_TRUE(streams.Split(kFrameLength + 1));
+
+	AutoBuffer first, second, extension;
+	__Fill(first, 40 * 1024, 3);
+	__Fill(second, 20 * 1024, 4);
+
+	Task task1(101), task2(102), task3(103);
+	task1.cmdid = 11;
+	task2.cmdid = 12;
+	streams.Push(LongLinkSendTask(task1), first, extension);
+	streams.Push(LongLinkSendTask(task2), second, extension);
+	streams.Push(LongLinkSendTask(task3), second, extension);
+	EXPECT_TRUE(streams.Remove(103));
+
+	AutoBuffer wire;
+	std::vector<uint32_t> order;
+	LongLinkSendTask task;
+	AutoBuffer packed;
+	while (streams.PackNext(packed, task, NULL)) {
+		order.push_back(task.taskid);
+		wire.Write(AutoBuffer::ESeekEnd, packed.Ptr(), packed.Length());
+		// nothing to take out once a frame was packed
+		EXPECT_FALSE(streams.Remove(task.taskid));
+		packed.Reset();
+	}
+	longlink_pack_window(101, 4096, packed, NULL);
+	wire.Write(AutoBuffer::ESeekEnd, packed.Ptr(), packed.Length());
+	EXPECT_TRUE(streams.Empty());
+
+	const uint32_t expect_order[] = {101, 102, 101, 102, 101};
+	ASSERT_EQ(sizeof(expect_order) / sizeof(expect_order[0]), order.size());
+	for (size_t i = 0; i < order.size(); ++i) EXPECT_EQ(expect_order[i], order[i]);
+
+	// the receiving side puts the frames of a seq back together as LongLink does with sent_taskids
+	std::map<uint32_t, std::string> bodies;
+	std::vector<uint32_t> ended;
+	uint32_t window = 0;
+	wire.Seek(0, AutoBuffer::ESeekStart);
+	while (0 < wire.PosLength()) {
+		AutoBuffer view;
+		view.Attach(wire.PosPtr(), wire.PosLength());
+		uint32_t cmdid = 0, seq = 0;
+		size_t packlen = 0;
+		AutoBuffer body, ext;
+		int ret = longlink_unpack(view, cmdid, seq, packlen, body, ext, NULL);
+		view.Detach();
+		ASSERT_NE(LONGLINK_UNPACK_FALSE, ret);
+		ASSERT_NE(LONGLINK_UNPACK_CONTINUE, ret);
+		wire.Seek(packlen, AutoBuffer::ESeekCur);
+
+		if (LONGLINK_UNPACK_STREAM_WINDOW == ret) {
+			ASSERT_EQ(sizeof(window), body.Length());
+			memcpy(&window, body.Ptr(), sizeof(window));
+			EXPECT_EQ(101u, seq);
+			continue;
+		}
+
+		EXPECT_EQ(101 == seq ? 11u : 12u, cmdid);
+		bodies[seq].append((const char*)body.Ptr(), body.Length());
+		if (LONGLINK_UNPACK_STREAM_END == ret) ended.push_back(seq);
+		else EXPECT_EQ(LONGLINK_UNPACK_STREAM_PACKAGE, ret);
+	}
+
+	EXPECT_EQ(4096u, window);
+	ASSERT_EQ(2u, ended.size());
+	EXPECT_EQ(102u, ended[0]);
+	EXPECT_EQ(101u, ended[1]);
+	EXPECT_EQ(std::string((const char*)first.Ptr(), first.Length()), bodies[101]);
+	EXPECT_EQ(std::string((const char*)second.Ptr(), second.Length()), bodies[102]);
+
+	// a body sent whole still unpacks as before
+	packed.Reset();
+	longlink_pack(1, 104, second, extension, packed, NULL);
+	uint32_t cmdid = 0, seq = 0;
+	size_t packlen = 0;
+	AutoBuffer body, ext;
+	EXPECT_EQ(LONGLINK_UNPACK_OK, longlink_unpack(packed, cmdid, seq, packlen, body, ext, NULL));
+	EXPECT_EQ(second.Length(), body.Length());
+}
+
+TEST(longlink_stream_benchmark, Window)
+{
+	LongLinkStreamSender streams;
+	streams.SetFrame(kFrameLength, 24 * 1024);
+
+	AutoBuffer body, extension;
+	__Fill(body, 64 * 1024, 5);
+	Task task(201);
+	streams.Push(LongLinkSendTask(task), body, extension);
+
+	LongLinkSendTask sent;
+	AutoBuffer packed;
+	ASSERT_TRUE(streams.PackNext(packed, sent, NULL));
+	EXPECT_EQ(0u, sent.frame_offset);
+	EXPECT_TRUE(sent.more_frames);
+	packed.Reset();
+	ASSERT_TRUE(streams.PackNext(packed, sent, NULL));
+	EXPECT_EQ(kFrameLength, sent.frame_offset);
+	EXPECT_EQ(8 * 1024 + sizeof(uint32_t) * 7, packed.Length());  // cut down to what is left of the window
+
+	EXPECT_FALSE(streams.PackNext(packed, sent, NULL));
+	streams.Grant(202, 64 * 1024);
+	EXPECT_FALSE(streams.PackNext(packed, sent, NULL));
+
+	streams.Grant(201, 64 * 1024);
+	size_t frames = 0;
+	while (streams.PackNext(packed, sent, NULL)) ++frames;
+	EXPECT_EQ(3u, frames);
+	EXPECT_FALSE(sent.more_frames);
+	EXPECT_TRUE(streams.Empty());
+}
+
+TEST(longlink_stream_benchmark, SmallBehindBulk)
+{
+	Result whole = __Run(0);
+	Result framed = __Run(kFrameLength);
+
+	printf("1KB every %d ms, 1MB every %d ms, %u KB/s\n", kSmallEveryMs, kBulkEveryMs, (unsigned int)(kBytesPerMs * 1000 / 1024));
+	__Report("sent whole", whole);
+	__Report("16KB frames", framed);
+
+	EXPECT_LT(framed.small_p99 * 5, whole.small_p99);
+	EXPECT_LT(framed.bulk_p50, whole.bulk_p50 * 1.2);
+}
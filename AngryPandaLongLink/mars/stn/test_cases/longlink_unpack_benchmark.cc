@@ -0,0 +1,175 @@
+/*
+* longlink_unpack_benchmark.cc
+*
+* cpu of unpacking 100k small packets that arrive 64k per recv, with the receive buffer moved to
+* the front after every packet and with LongLinkRecvBuffer.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "autobuffer.h"
+
+#include "../proto/longlink_packer.h"
+#include "../src/longlink_recv_buffer.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kPacketCount = 100 * 1000;
+static const size_t kBodyLength = 48;
+static const size_t kRecvLength = 64 * 1024;
+
+static uint64_t __ThreadCpuNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void __PackStream(AutoBuffer& _stream)
+{
+	AutoBuffer body;
+	std::vector<char> data(kBodyLength, 'p');
+	body.Write(&data[0], data.size());
+
+	for (int i = 0; i < kPacketCount; ++i) {
+		AutoBuffer packed;
+		longlink_pack(10001, (uint32_t)(i + 1), body, KNullAtuoBuffer, packed, NULL);
+		_stream.Write(packed);
+	}
+}
+
+// the loop as it was: unpack from the front and move the rest back after each packet
+static int __UnpackMove(const AutoBuffer& _stream, size_t& _body_total)
+{
+	AutoBuffer bufrecv;
+	size_t offset = 0;
+	int count = 0;
+
+	while (offset < _stream.Length()) {
+		size_t recvlen = std::min(kRecvLength, _stream.Length() - offset);
+		bufrecv.AllocWrite(kRecvLength, false);
+		memcpy(bufrecv.PosPtr(), _stream.Ptr(offset), recvlen);
+		bufrecv.Length(bufrecv.Pos() + recvlen, bufrecv.Length() + recvlen);
+		offset += recvlen;
+
+		while (0 < bufrecv.Length()) {
+			uint32_t cmdid = 0;
+			uint32_t taskid = 0;
+			size_t packlen = 0;
+			AutoBuffer body;
+			AutoBuffer extension;
+
+			int ret = longlink_unpack(bufrecv, cmdid, taskid, packlen, body, extension, NULL);
+			if (LONGLINK_UNPACK_CONTINUE == ret) break;
+			if (LONGLINK_UNPACK_OK != ret) return -1;
+
+			_body_total += body.Length();
+			++count;
+			bufrecv.Move(-(int)(packlen));
+		}
+	}
+
+	return count;
+}
+
+static int __UnpackRecvBuffer(const AutoBuffer& _stream, size_t& _body_total)
+{
+	LongLinkRecvBuffer bufrecv;
+	size_t offset = 0;
+	int count = 0;
+
+	while (offset < _stream.Length()) {
+		size_t recvlen = std::min(kRecvLength, _stream.Length() - offset);
+		memcpy(bufrecv.PrepareWrite(kRecvLength), _stream.Ptr(offset), recvlen);
+		bufrecv.CommitWrite(recvlen);
+		offset += recvlen;
+
+		while (0 < bufrecv.Length()) {
+			uint32_t cmdid = 0;
+			uint32_t taskid = 0;
+			size_t packlen = 0;
+			AutoBuffer body;
+			AutoBuffer extension;
+
+			int ret = longlink_unpack(bufrecv.View(), cmdid, taskid, packlen, body, extension, NULL);
+			if (LONGLINK_UNPACK_CONTINUE == ret) break;
+			if (LONGLINK_UNPACK_OK != ret) return -1;
+
+			_body_total += body.Length();
+			++count;
+			bufrecv.Consume(packlen);
+		}
+	}
+
+	return count;
+}
+
+}
+
+TEST(longlink_unpack_benchmark, RecvBufferKeepsPartialPacket)
+{
+	AutoBuffer stream;
+	__PackStream(stream);
+	size_t packet_len = stream.Length() / kPacketCount;
+
+	LongLinkRecvBuffer bufrecv;
+	// one and a half packets, the half stays for the next recv
+	memcpy(bufrecv.PrepareWrite(kRecvLength), stream.Ptr(), packet_len + packet_len / 2);
+	bufrecv.CommitWrite(packet_len + packet_len / 2);
+
+	uint32_t cmdid = 0;
+	uint32_t taskid = 0;
+	size_t packlen = 0;
+	AutoBuffer body;
+	AutoBuffer extension;
+	ASSERT_EQ(LONGLINK_UNPACK_OK, longlink_unpack(bufrecv.View(), cmdid, taskid, packlen, body, extension, NULL));
+	EXPECT_EQ(1u, taskid);
+	EXPECT_EQ(packet_len, packlen);
+	EXPECT_EQ(kBodyLength, body.Length());
+	bufrecv.Consume(packlen);
+
+	AutoBuffer body2;
+	EXPECT_EQ(LONGLINK_UNPACK_CONTINUE, longlink_unpack(bufrecv.View(), cmdid, taskid, packlen, body2, extension, NULL));
+	EXPECT_EQ(packet_len / 2, bufrecv.Length());
+
+	// the rest does not fit behind, the unread half moves to the front
+	memcpy(bufrecv.PrepareWrite(kRecvLength), stream.Ptr(packet_len + packet_len / 2), packet_len - packet_len / 2);
+	bufrecv.CommitWrite(packet_len - packet_len / 2);
+	ASSERT_EQ(LONGLINK_UNPACK_OK, longlink_unpack(bufrecv.View(), cmdid, taskid, packlen, body2, extension, NULL));
+	EXPECT_EQ(2u, taskid);
+	bufrecv.Consume(packlen);
+	EXPECT_EQ(0u, bufrecv.Length());
+}
+
+TEST(longlink_unpack_benchmark, CpuPer100kSmallPackets)
+{
+	AutoBuffer stream;
+	__PackStream(stream);
+
+	size_t move_total = 0;
+	uint64_t begin = __ThreadCpuNs();
+	EXPECT_EQ(kPacketCount, __UnpackMove(stream, move_total));
+	uint64_t move_ns = __ThreadCpuNs() - begin;
+
+	size_t view_total = 0;
+	begin = __ThreadCpuNs();
+	EXPECT_EQ(kPacketCount, __UnpackRecvBuffer(stream, view_total));
+	uint64_t view_ns = __ThreadCpuNs() - begin;
+
+	EXPECT_EQ(move_total, view_total);
+
+	printf("%d packets of %u bytes body, %u bytes per recv\n", kPacketCount, (unsigned int)kBodyLength, (unsigned int)kRecvLength);
+	printf("%-28s %.1f ms cpu\n", "Move after every packet", move_ns / 1000000.0);
+	printf("%-28s %.1f ms cpu\n", "LongLinkRecvBuffer", view_ns / 1000000.0);
+
+	EXPECT_LT(view_ns, move_ns);
+}
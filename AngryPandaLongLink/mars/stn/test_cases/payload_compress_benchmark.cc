@@ -0,0 +1,219 @@
+/*
+* payload_compress_benchmark.cc
+*
+* bodies through PayloadCompress as LongLink and ShortLink put them: the tag on the long link, the
+* offer and answer of a new connection, Content-Encoding on the short link, and chatty json bodies
+* with the bytes saved against the cpu time it took.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/autobuffer.h"
+
+#include "../src/payload_compress.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kBodyCount = 2000;
+
+static std::string __Json(int _index)
+{
+	char item[256];
+	std::string json = "{\"ret\":0,\"items\":[";
+	for (int i = 0; i < 12; ++i) {
+		snprintf(item, sizeof(item), "%s{\"id\":%d,\"name\":\"user_%d\",\"avatar\":\"https://img.example.com/avatar/%d.png\",\"online\":%s}",
+			0 == i ? "" : ",", _index * 100 + i, _index + i, (_index * 7 + i) % 1000, 0 == i % 3 ? "true" : "false");
+		json += item;
+	}
+	return json + "]}";
+}
+
+static std::string __String(const AutoBuffer& _buffer)
+{
+	return std::string((const char*)_buffer.Ptr(), _buffer.Length());
+}
+
+}
+
+TEST(payload_compress_benchmark, Tag)
+{
+	PayloadCompress compress;
+	compress.SetModes(kPayloadCompressZlib, 256);
+	compress.SetCmdIdMinLength(9, (size_t)-1);
+
+	std::string json = __Json(1);
+	AutoBuffer tagged, out;
+	compress.Encode(kPayloadCompressZlib, 0, 1, json.data(), json.size(), tagged);
+	EXPECT_EQ(kPayloadCompressZlib, ((const unsigned char*)tagged.Ptr())[0]);
+	EXPECT_LT(tagged.Length(), json.size());
+	ASSERT_TRUE(compress.Decode(tagged, out));
+	EXPECT_EQ(json, __String(out));
+
+	// short ones and the cmdid that never compresses go stored
+	const char* small = "{\"ret\":0}";
+	tagged.Reset();
+	out.Reset();
+	compress.Encode(kPayloadCompressZlib, 0, 1, small, strlen(small), tagged);
+	EXPECT_EQ(strlen(small) + 1, tagged.Length());
+	EXPECT_EQ(kPayloadCompressNone, ((const unsigned char*)tagged.Ptr())[0]);
+	ASSERT_TRUE(compress.Decode(tagged, out));
+	EXPECT_EQ(std::string(small), __String(out));
+
+	tagged.Reset();
+	compress.Encode(kPayloadCompressZlib, 0, 9, json.data(), json.size(), tagged);
+	EXPECT_EQ(json.size() + 1, tagged.Length());
+
+	// an empty body still carries its tag
+	tagged.Reset();
+	out.Reset();
+	compress.Encode(kPayloadCompressZlib, 0, 1, NULL, 0, tagged);
+	EXPECT_EQ(1u, tagged.Length());
+	EXPECT_TRUE(compress.Decode(tagged, out));
+	EXPECT_EQ(0u, out.Length());
+
+	// broken ones fail instead of passing on garbage
+	tagged.Reset();
+	compress.Encode(kPayloadCompressZlib, 0, 1, json.data(), json.size(), tagged);
+	AutoBuffer cut;
+	cut.Write(tagged.Ptr(), tagged.Length() / 2);
+	out.Reset();
+	EXPECT_FALSE(compress.Decode(cut, out));
+
+	((unsigned char*)tagged.Ptr())[4] ^= 0x1;   // says a different length
+	out.Reset();
+	EXPECT_FALSE(compress.Decode(tagged, out));
+
+	const unsigned char unknown[] = {0x80, 0, 0, 0, 1, 0};
+	AutoBuffer bad;
+	bad.Write(unknown, sizeof(unknown));
+	out.Reset();
+	EXPECT_FALSE(compress.Decode(bad, out));
+	EXPECT_FALSE(compress.Decode(AutoBuffer(), out));
+}
+
+TEST(payload_compress_benchmark, Agree)
+{
+	PayloadCompress client, server;
+	AutoBuffer offer;
+	EXPECT_FALSE(client.MakeOffer(offer));
+
+	client.SetModes(kPayloadCompressZlib | kPayloadCompressZstd | kPayloadCompressLz4, 0);
+	ASSERT_TRUE(client.MakeOffer(offer));
+	EXPECT_EQ((size_t)PayloadCompress::kAgreeLength, offer.Length());
+
+	// a server with nothing to offer answers none, the connection goes on untagged
+	AutoBuffer answer;
+	ASSERT_TRUE(server.MakeAnswer(offer, answer));
+	int mode = -1;
+	uint32_t dict_id = 1;
+	ASSERT_TRUE(PayloadCompress::ParseAnswer(answer, mode, dict_id));
+	EXPECT_EQ(kPayloadCompressNone, mode);
+	EXPECT_EQ(0u, dict_id);
+
+	server.SetModes(kPayloadCompressZlib, 0);
+	answer.Reset();
+	ASSERT_TRUE(server.MakeAnswer(offer, answer));
+	ASSERT_TRUE(PayloadCompress::ParseAnswer(answer, mode, dict_id));
+	EXPECT_EQ(kPayloadCompressZlib, mode);
+
+	// the client's confirm, its bodies carry the tag after it
+	AutoBuffer confirm;
+	PayloadCompress::MakeConfirm(mode, dict_id, confirm);
+	EXPECT_EQ((size_t)PayloadCompress::kAgreeLength, confirm.Length());
+	mode = -1;
+	ASSERT_TRUE(PayloadCompress::ParseAnswer(confirm, mode, dict_id));
+	EXPECT_EQ(kPayloadCompressZlib, mode);
+
+	AutoBuffer broken;
+	broken.Write(offer.Ptr(), offer.Length() - 1);
+	EXPECT_FALSE(PayloadCompress::ParseAnswer(broken, mode, dict_id));
+	((unsigned char*)offer.Ptr())[0] = PayloadCompress::kAgreeVersion + 1;
+	EXPECT_FALSE(PayloadCompress::ParseAnswer(offer, mode, dict_id));
+
+	// no zstd in this build, a dictionary is turned down
+	if (!(PayloadCompress::Built() & kPayloadCompressZstd)) {
+		EXPECT_FALSE(client.SetDict("dict", 4));
+		EXPECT_EQ(0u, client.DictID());
+	}
+}
+
+TEST(payload_compress_benchmark, ContentEncoding)
+{
+	PayloadCompress compress;
+	EXPECT_EQ(std::string(), compress.AcceptEncoding());
+	compress.SetModes(kPayloadCompressZlib, 128);
+	EXPECT_NE(std::string::npos, compress.AcceptEncoding().find("deflate"));
+
+	EXPECT_EQ(kPayloadCompressZlib, PayloadCompress::ContentEncodingMode("deflate"));
+	EXPECT_EQ(kPayloadCompressNone, PayloadCompress::ContentEncodingMode("br"));
+	EXPECT_EQ(kPayloadCompressNone, PayloadCompress::ContentEncodingMode(NULL));
+
+	EXPECT_EQ(kPayloadCompressNone, compress.HostMode("a.example.com"));
+	compress.LearnHost("a.example.com", kPayloadCompressZlib);
+	EXPECT_EQ(kPayloadCompressZlib, compress.HostMode("a.example.com"));
+	EXPECT_EQ(kPayloadCompressNone, compress.HostMode("b.example.com"));
+
+	std::string json = __Json(2);
+	AutoBuffer body, packed, out;
+	body.Write(json.data(), json.size());
+	ASSERT_TRUE(compress.EncodeContent(kPayloadCompressZlib, 1, body, packed));
+	EXPECT_LT(packed.Length(), body.Length());
+	ASSERT_TRUE(compress.DecodeContent(kPayloadCompressZlib, packed, out));
+	EXPECT_EQ(json, __String(out));
+
+	AutoBuffer small, unused;
+	small.Write("{}", 2);
+	EXPECT_FALSE(compress.EncodeContent(kPayloadCompressZlib, 1, small, unused));
+	out.Reset();
+	EXPECT_FALSE(compress.DecodeContent(kPayloadCompressZlib, small, out));
+
+	// turned off, what was learnt is not used
+	compress.SetModes(kPayloadCompressNone, 0);
+	EXPECT_EQ(kPayloadCompressNone, compress.HostMode("a.example.com"));
+}
+
+TEST(payload_compress_benchmark, ChattyJson)
+{
+	int modes[] = {kPayloadCompressZlib, kPayloadCompressZstd, kPayloadCompressLz4};
+	const char* names[] = {"zlib", "zstd", "lz4"};
+
+	uint64_t raw_bytes = 0;
+	for (int i = 0; i < kBodyCount; ++i) raw_bytes += __Json(i).size();
+	printf("%d json bodies, %llu bytes\n", kBodyCount, (unsigned long long)raw_bytes);
+
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+		if (!(PayloadCompress::Built() & modes[m])) {
+			printf("%-5s not built\n", names[m]);
+			continue;
+		}
+
+		PayloadCompress compress;
+		compress.SetModes(modes[m], 256);
+
+		uint64_t wire_bytes = 0;
+		for (int i = 0; i < kBodyCount; ++i) {
+			std::string json = __Json(i);
+			AutoBuffer tagged, out;
+			compress.Encode(modes[m], 0, 1, json.data(), json.size(), tagged);
+			wire_bytes += tagged.Length();
+			ASSERT_TRUE(compress.Decode(tagged, out));
+			ASSERT_EQ(json, __String(out));
+		}
+
+		PayloadCompressStats stats = compress.Stats();
+		printf("%-5s %llu bytes on the wire, %.1f%% saved, compress %llu us, decompress %llu us\n", names[m],
+			(unsigned long long)wire_bytes, 100.0 * (raw_bytes - wire_bytes) / raw_bytes,
+			(unsigned long long)stats.compress_cpu_us, (unsigned long long)stats.decompress_cpu_us);
+
+		EXPECT_EQ((uint64_t)kBodyCount, stats.compressed_count);
+		EXPECT_EQ(raw_bytes, stats.raw_bytes);
+		EXPECT_LT(wire_bytes * 2, raw_bytes);
+	}
+}
@@ -0,0 +1,333 @@
+/*
+* shortlink_pool_benchmark.cc
+*
+* short link requests to an http server on loopback, each on a new connection closed after its response
+* as ShortLink did, and on sockets kept in ShortLinkConnectionPool. loopback has next to no rtt, on a real
+* path every connect saved is one rtt more.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mars/comm/http.h"
+#include "mars/comm/thread/thread.h"
+#include "mars/comm/time_utils.h"
+
+#include "../src/shortlink_pool.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kRequestCount = 500;
+
+class HttpServer
+{
+  public:
+	HttpServer(int _keepalive_timeout_s)
+	: keepalive_timeout_s_(_keepalive_timeout_s), accepted_(0), listen_(INVALID_SOCKET), port_(0), thread_(boost::bind(&HttpServer::__Accept, this), "http_server") {
+		listen_ = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(listen_, (sockaddr*)&addr, sizeof(addr));
+		listen(listen_, 128);
+
+		socklen_t len = sizeof(addr);
+		getsockname(listen_, (sockaddr*)&addr, &len);
+		port_ = ntohs(addr.sin_port);
+
+		thread_.start();
+	}
+
+	~HttpServer() {
+		shutdown(listen_, SHUT_RDWR);
+		thread_.join();
+		socket_close(listen_);
+	}
+
+	uint16_t Port() const { return port_; }
+
+	int Accepted() {
+		ScopedLock lock(mutex_);
+		return accepted_;
+	}
+
+  private:
+	void __Accept() {
+		while (true) {
+			SOCKET sock = accept(listen_, NULL, NULL);
+			if (INVALID_SOCKET == sock) return;
+
+			ScopedLock lock(mutex_);
+			++accepted_;
+			lock.unlock();
+
+			Thread thread(boost::bind(&HttpServer::__Serve, sock, keepalive_timeout_s_), "http_conn");
+			thread.start();
+		}
+	}
+
+	// answers every request of a connection until the client closes it or asks to
+	static void __Serve(SOCKET _sock, int _keepalive_timeout_s) {
+		char buffer[4096];
+		while (true) {
+			http::Parser parser;
+			while (http::Parser::kEnd != parser.RecvStatus()) {
+				ssize_t n = recv(_sock, buffer, sizeof(buffer), 0);
+				if (0 >= n || parser.Error()) {
+					socket_close(_sock);
+					return;
+				}
+				parser.Recv(buffer, (size_t)n);
+			}
+
+			bool closing = parser.Fields().IsConnectionClose();
+			char response[256];
+			int len = 0;
+			if (closing) {
+				len = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok");
+			} else {
+				len = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: Keep-Alive\r\nKeep-Alive: timeout=%d, max=1000\r\n\r\nok", _keepalive_timeout_s);
+			}
+			send(_sock, response, len, 0);
+
+			if (closing) {
+				socket_close(_sock);
+				return;
+			}
+		}
+	}
+
+  private:
+	int      keepalive_timeout_s_;
+	Mutex    mutex_;
+	int      accepted_;
+	SOCKET   listen_;
+	uint16_t port_;
+	Thread   thread_;
+};
+
+static SOCKET __Connect(uint16_t _port)
+{
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(_port);
+	if (0 != connect(sock, (sockaddr*)&addr, sizeof(addr))) {
+		socket_close(sock);
+		return INVALID_SOCKET;
+	}
+	return sock;
+}
+
+// one request and its response as ShortLink::__RunReadWrite sends and parses them, the Keep-Alive timeout
+// of the response or -2 if it said close
+static bool __Request(SOCKET _sock, bool _keepalive, int& _timeout_s)
+{
+	std::string request = "POST /cgi HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 4\r\n";
+	request += _keepalive ? "Connection: Keep-Alive\r\n\r\nbody" : "Connection: close\r\n\r\nbody";
+	if ((ssize_t)request.size() != send(_sock, request.data(), request.size(), 0)) return false;
+
+	char buffer[4096];
+	http::Parser parser;
+	while (http::Parser::kEnd != parser.RecvStatus()) {
+		ssize_t n = recv(_sock, buffer, sizeof(buffer), 0);
+		if (0 >= n || parser.Error()) return false;
+		parser.Recv(buffer, (size_t)n);
+	}
+
+	_timeout_s = parser.Fields().IsConnectionClose() ? -2 : parser.Fields().KeepAliveTimeout();
+	return 200 == parser.Status().StatusCode();
+}
+
+static uint64_t __NowUs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double __Median(std::vector<double>& _values)
+{
+	std::sort(_values.begin(), _values.end());
+	return _values[_values.size() / 2];
+}
+
+static void __Sleep(int _ms)
+{
+	ThreadUtil::usleep(_ms * 1000);
+}
+
+static ShortLinkConnection __Connection(SOCKET _sock, uint16_t _port)
+{
+	ShortLinkConnection conn;
+	conn.sock = _sock;
+	conn.host = "127.0.0.1";
+	conn.ip = "127.0.0.1";
+	conn.port = _port;
+	return conn;
+}
+
+}
+
+TEST(shortlink_pool_benchmark, KeepAliveHeaders)
+{
+	const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nconnection: Keep-Alive\r\nkeep-alive: Timeout=5, max=100\r\n\r\n";
+	http::Parser parser;
+	EXPECT_EQ(http::Parser::kEnd, parser.Recv(response, strlen(response)));
+	EXPECT_FALSE(parser.Fields().IsConnectionClose());
+	EXPECT_EQ(5, parser.Fields().KeepAliveTimeout());
+
+	const char close[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: Close\r\n\r\n";
+	http::Parser close_parser;
+	EXPECT_EQ(http::Parser::kEnd, close_parser.Recv(close, strlen(close)));
+	EXPECT_TRUE(close_parser.Fields().IsConnectionClose());
+	EXPECT_EQ(-1, close_parser.Fields().KeepAliveTimeout());
+
+	ShortLinkConnectionPool pool;
+	EXPECT_EQ(0u, pool.KeepAliveMs(-1));
+	pool.SetKeepAlive(30 * 1000);
+	EXPECT_EQ(30u * 1000, pool.KeepAliveMs(-1));
+	EXPECT_EQ(4u * 1000, pool.KeepAliveMs(5));
+	EXPECT_EQ(30u * 1000, pool.KeepAliveMs(120));
+	EXPECT_EQ(0u, pool.KeepAliveMs(1));
+}
+
+TEST(shortlink_pool_benchmark, Pool)
+{
+	HttpServer server(60);
+	ShortLinkConnectionPool pool;
+	pool.SetKeepAlive(10 * 1000);
+	ShortLinkConnection conn;
+	int timeout_s = 0;
+
+	EXPECT_FALSE(pool.Get("127.0.0.1", server.Port(), 0, conn));
+
+	SOCKET sock = __Connect(server.Port());
+	ASSERT_NE(INVALID_SOCKET, sock);
+	ASSERT_TRUE(__Request(sock, true, timeout_s));
+	pool.Put(__Connection(sock, server.Port()), pool.KeepAliveMs(timeout_s), 1000);
+	EXPECT_EQ(1u, pool.IdleCount());
+
+	// another host or port does not get it
+	EXPECT_FALSE(pool.Get("localhost", server.Port(), 1000, conn));
+	EXPECT_FALSE(pool.Get("127.0.0.1", server.Port() + 1, 1000, conn));
+
+	ASSERT_TRUE(pool.Get("127.0.0.1", server.Port(), 2000, conn));
+	EXPECT_EQ(sock, conn.sock);
+	EXPECT_EQ(0u, pool.IdleCount());
+	ASSERT_TRUE(__Request(conn.sock, true, timeout_s));
+	EXPECT_EQ(1, server.Accepted());
+
+	// expired ones are closed instead of handed out
+	pool.Put(conn, pool.KeepAliveMs(timeout_s), 3000);
+	EXPECT_FALSE(pool.Get("127.0.0.1", server.Port(), 3000 + 10 * 1000, conn));
+	EXPECT_EQ(0u, pool.IdleCount());
+
+	// one the server closed while it sat in the pool is not handed out either
+	sock = __Connect(server.Port());
+	ASSERT_TRUE(__Request(sock, false, timeout_s));
+	EXPECT_EQ(-2, timeout_s);
+	pool.Put(__Connection(sock, server.Port()), 10 * 1000, 0);
+	__Sleep(50);
+	EXPECT_FALSE(pool.Get("127.0.0.1", server.Port(), 0, conn));
+
+	// a few to a host, the oldest go
+	std::vector<SOCKET> socks;
+	for (size_t i = 0; i < ShortLinkConnectionPool::kMaxPerHost + 2; ++i) {
+		socks.push_back(__Connect(server.Port()));
+		pool.Put(__Connection(socks.back(), server.Port()), 10 * 1000, i);
+	}
+	EXPECT_EQ((size_t)ShortLinkConnectionPool::kMaxPerHost, pool.IdleCount());
+	ASSERT_TRUE(pool.Get("127.0.0.1", server.Port(), 10, conn));
+	EXPECT_EQ(socks.back(), conn.sock);
+	socket_close(conn.sock);
+
+	pool.Clear();
+	EXPECT_EQ(0u, pool.IdleCount());
+
+	// turned off, nothing is kept
+	pool.SetKeepAlive(0);
+	sock = __Connect(server.Port());
+	pool.Put(__Connection(sock, server.Port()), 10 * 1000, 0);
+	EXPECT_EQ(0u, pool.IdleCount());
+}
+
+TEST(shortlink_pool_benchmark, Workers)
+{
+	ShortLinkWorkers& workers = ShortLinkWorkers::Instance();
+	int started = workers.Started();
+
+	// one after the other, the thread of the last one takes the next
+	int owners[64];
+	for (int i = 0; i < 64; ++i) {
+		EXPECT_TRUE(workers.Run(&owners[i], boost::bind(&__Sleep, 1)));
+		workers.Wait(&owners[i]);
+		__Sleep(1);
+	}
+	EXPECT_GE(2, workers.Started() - started);
+
+	// all at once, nobody waits for another's thread
+	started = workers.Started();
+	uint64_t begin = gettickcount();
+	for (int i = 0; i < 16; ++i) EXPECT_TRUE(workers.Run(&owners[i], boost::bind(&__Sleep, 200)));
+	for (int i = 0; i < 16; ++i) EXPECT_TRUE(workers.Running(&owners[i]));
+	for (int i = 0; i < 16; ++i) {
+		workers.Wait(&owners[i]);
+		EXPECT_FALSE(workers.Running(&owners[i]));
+	}
+	EXPECT_GT(400u, gettickcount() - begin);
+	EXPECT_LE(16 - ShortLinkWorkers::kMaxIdle, workers.Started() - started);
+}
+
+TEST(shortlink_pool_benchmark, Latency)
+{
+	HttpServer server(60);
+	ShortLinkConnectionPool pool;
+	pool.SetKeepAlive(60 * 1000);
+
+	std::vector<double> fresh, pooled;
+	int timeout_s = 0;
+
+	for (int i = 0; i < kRequestCount; ++i) {
+		uint64_t begin = __NowUs();
+		SOCKET sock = __Connect(server.Port());
+		ASSERT_NE(INVALID_SOCKET, sock);
+		ASSERT_TRUE(__Request(sock, false, timeout_s));
+		socket_close(sock);
+		fresh.push_back((double)(__NowUs() - begin));
+	}
+	int fresh_accepted = server.Accepted();
+
+	for (int i = 0; i < kRequestCount; ++i) {
+		uint64_t begin = __NowUs();
+		ShortLinkConnection conn;
+		if (!pool.Get("127.0.0.1", server.Port(), gettickcount(), conn)) conn = __Connection(__Connect(server.Port()), server.Port());
+		ASSERT_NE(INVALID_SOCKET, conn.sock);
+		ASSERT_TRUE(__Request(conn.sock, true, timeout_s));
+		pool.Put(conn, pool.KeepAliveMs(timeout_s), gettickcount());
+		pooled.push_back((double)(__NowUs() - begin));
+	}
+	int pooled_accepted = server.Accepted() - fresh_accepted;
+	pool.Clear();
+
+	double fresh_p50 = __Median(fresh);
+	double pooled_p50 = __Median(pooled);
+	printf("%d requests on loopback\n", kRequestCount);
+	printf("connect each      p50 %8.1f us, %d connections\n", fresh_p50, fresh_accepted);
+	printf("keep-alive pool   p50 %8.1f us, %d connections\n", pooled_p50, pooled_accepted);
+
+	EXPECT_EQ(kRequestCount, fresh_accepted);
+	EXPECT_EQ(1, pooled_accepted);
+	EXPECT_LT(pooled_p50, fresh_p50);
+}
@@ -0,0 +1,177 @@
+/*
+* task_codec_pool_benchmark.cc
+*
+* requests whose encoding costs ~200us of cpu: made one after another on the calling thread as the task
+* managers did, and on TaskCodecPool with 1, 2 and 4 workers. callbacks have to come back in submit order
+* within a lane however the workers finish.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "boost/bind.hpp"
+#include "thread/condition.h"
+#include "thread/lock.h"
+
+#include "../src/task_codec_pool.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kJobCount = 2000;
+static const int kLaneCount = 3;
+static const int kEncodeRounds = 100 * 1000;
+
+static uint64_t __WallNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// stands in for protobuf plus encryption
+static void __Encode(uint32_t* _out, uint32_t _seed, int _rounds)
+{
+	uint32_t h = _seed;
+	for (int i = 0; i < _rounds; ++i) h = (h ^ (uint32_t)i) * 16777619u;
+	*_out = h;
+}
+
+struct Delivered
+{
+	Delivered(): count(0) {}
+
+	Mutex mutex;
+	Condition cond;
+	std::vector<int> order[kLaneCount];
+	int count;
+};
+
+static void __Done(Delivered* _delivered, int _lane, int _index)
+{
+	ScopedLock lock(_delivered->mutex);
+	_delivered->order[_lane].push_back(_index);
+	++_delivered->count;
+	_delivered->cond.notifyAll(lock);
+}
+
+static uint64_t __RunInline(std::vector<uint32_t>& _out)
+{
+	uint64_t begin = __WallNs();
+	for (int i = 0; i < kJobCount; ++i) __Encode(&_out[i], (uint32_t)i, kEncodeRounds);
+	return __WallNs() - begin;
+}
+
+static uint64_t __RunPool(TaskCodecPool& _pool, std::vector<uint32_t>& _out, Delivered& _delivered)
+{
+	uint64_t begin = __WallNs();
+	for (int i = 0; i < kJobCount; ++i) {
+		int lane = i % kLaneCount;
+		// every 7th is cheap, so it is done before the ones submitted ahead of it
+		int rounds = 0 == i % 7 ? 10 : kEncodeRounds;
+		EXPECT_TRUE(_pool.Submit(&_delivered, TaskCodecPool::EncodeLane(lane), boost::bind(&__Encode, &_out[i], (uint32_t)i, rounds),
+			boost::bind(&__Done, &_delivered, lane, i)));
+	}
+
+	ScopedLock lock(_delivered.mutex);
+	while (kJobCount != _delivered.count) _delivered.cond.wait(lock, 1000);
+	return __WallNs() - begin;
+}
+
+static void __Report(const char* _name, uint64_t _ns)
+{
+	printf("%-24s %d requests: %8.0f req/s, %.1f ms\n", _name, kJobCount, kJobCount * 1000000000.0 / (_ns ? _ns : 1), _ns / 1000000.0);
+}
+
+}
+
+TEST(task_codec_pool_benchmark, SubmitOrderPerLane)
+{
+	TaskCodecPool pool;
+	Delivered delivered;
+	std::vector<uint32_t> out(kJobCount);
+
+	EXPECT_FALSE(pool.Submit(&delivered, 0, boost::bind(&__Encode, &out[0], 0u, 1), boost::bind(&__Done, &delivered, 0, 0)));  // off
+
+	pool.SetThreads(4);
+	EXPECT_TRUE(pool.Enabled());
+	__RunPool(pool, out, delivered);
+
+	for (int lane = 0; lane < kLaneCount; ++lane) {
+		ASSERT_EQ((size_t)(kJobCount / kLaneCount + (lane < kJobCount % kLaneCount ? 1 : 0)), delivered.order[lane].size());
+		for (size_t i = 0; i < delivered.order[lane].size(); ++i) EXPECT_EQ(lane + (int)i * kLaneCount, delivered.order[lane][i]);
+	}
+
+	pool.SetThreads(0);
+	EXPECT_FALSE(pool.Enabled());
+}
+
+TEST(task_codec_pool_benchmark, CancelAndWait)
+{
+	TaskCodecPool pool;
+	pool.SetThreads(2);
+
+	Delivered delivered;
+	std::vector<uint32_t> out(200);
+	for (int i = 0; i < 200; ++i) {
+		pool.Submit(&delivered, 0, boost::bind(&__Encode, &out[i], (uint32_t)i, kEncodeRounds), boost::bind(&__Done, &delivered, 0, i));
+	}
+
+	pool.CancelAndWait(&delivered);
+	int count = delivered.count;
+	EXPECT_GT(200, count);
+
+	// nothing comes back once it returned, and the owner can submit again
+	usleep(50 * 1000);
+	EXPECT_EQ(count, delivered.count);
+	for (int i = 0; i < count; ++i) EXPECT_EQ(i, delivered.order[0][i]);
+
+	Delivered again;
+	pool.Submit(&again, 0, boost::bind(&__Encode, &out[0], 0u, 1), boost::bind(&__Done, &again, 0, 0));
+	ScopedLock lock(again.mutex);
+	while (1 != again.count) again.cond.wait(lock, 1000);
+}
+
+TEST(task_codec_pool_benchmark, CpuHeavyEncode)
+{
+	std::vector<uint32_t> expect(kJobCount);
+	uint64_t inline_ns = __RunInline(expect);
+	__Report("inline", inline_ns);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	const int threads[] = {1, 2, 4};
+	uint64_t pool_ns[3] = {0};
+
+	for (int t = 0; t < 3; ++t) {
+		TaskCodecPool pool;
+		pool.SetThreads(threads[t]);
+
+		Delivered delivered;
+		std::vector<uint32_t> out(kJobCount);
+		pool_ns[t] = __RunPool(pool, out, delivered);
+
+		for (int i = 0; i < kJobCount; ++i) {
+			if (0 != i % 7) {
+				ASSERT_EQ(expect[i], out[i]);
+			}
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "TaskCodecPool, %d thread%s", threads[t], 1 == threads[t] ? "" : "s");
+		__Report(name, pool_ns[t]);
+	}
+
+	printf("%ld cpus online\n", cpus);
+	if (4 <= cpus) {
+		EXPECT_LT(pool_ns[2] * 2, pool_ns[0]);
+	} else if (2 <= cpus) {
+		EXPECT_LT(pool_ns[1] * 3, pool_ns[0] * 2);
+	}
+}
@@ -0,0 +1,178 @@
+/*
+* task_table_benchmark.cc
+*
+* 50k queued tasks of random priorities: start, locate and stop through a std::list sorted after every
+* push_back as the task managers kept it, and through TaskTable.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <list>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../src/task_table.h"
+
+using namespace mars::stn;
+
+namespace
+{
+
+static const int kTaskCount = 50 * 1000;
+static const int kListStartCount = 5 * 1000;  // sorting after every push_back, 50k would take minutes
+static const int kListLocateCount = 500;
+
+static uint64_t __ThreadCpuNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static Task __MakeTask(uint32_t _taskid)
+{
+	Task task(_taskid);
+	task.priority = rand() % (Task::kTaskPriorityLowest + 1);
+	return task;
+}
+
+struct find_task {
+  public:
+	bool operator()(const TaskProfile& value) {return taskid == value.task.taskid;}
+
+  public:
+	uint32_t taskid;
+};
+
+static std::list<TaskProfile>::iterator __ListLocate(std::list<TaskProfile>& _list, uint32_t _taskid)
+{
+	find_task find_functor;
+	find_functor.taskid = _taskid;
+	return std::find_if(_list.begin(), _list.end(), find_functor);
+}
+
+static void __Report(const char* _name, int _count, uint64_t _ns)
+{
+	printf("%-34s %6d ops, %10.2f us/op\n", _name, _count, _ns / 1000.0 / _count);
+}
+
+}
+
+TEST(task_table_benchmark, OrderAndIndex)
+{
+	srand(3);
+	TaskTable table;
+	std::list<TaskProfile> list;
+
+	for (uint32_t i = 1; i <= 2000; ++i) {
+		TaskProfile task(__MakeTask(i));
+		table.insert(task);
+		list.push_back(task);
+		list.sort(__CompareTask);
+	}
+
+	// stop every third, in the list too
+	for (uint32_t i = 1; i <= 2000; i += 3) {
+		TaskTable::iterator it = table.find(i);
+		ASSERT_TRUE(table.end() != it);
+		EXPECT_EQ(i, it->task.taskid);
+		table.erase(it);
+		list.erase(__ListLocate(list, i));
+		EXPECT_TRUE(table.end() == table.find(i));
+	}
+
+	for (uint32_t i = 2001; i <= 2500; ++i) {
+		TaskProfile task(__MakeTask(i));
+		table.insert(task);
+		list.push_back(task);
+		list.sort(__CompareTask);
+	}
+
+	ASSERT_EQ(list.size(), table.size());
+	std::list<TaskProfile>::iterator expect = list.begin();
+	for (TaskTable::iterator it = table.begin(); it != table.end(); ++it, ++expect) {
+		ASSERT_EQ(expect->task.taskid, it->task.taskid);
+	}
+
+	TaskTable::iterator it = table.find(2002);
+	it->running_id = 0x1000;
+	table.index_running(it);
+	EXPECT_TRUE(it == table.find_running(0x1000));
+
+	// dropped without unindexing, the stale entry must not find it
+	it->running_id = 0;
+	EXPECT_TRUE(table.end() == table.find_running(0x1000));
+
+	it->running_id = 0x2000;
+	table.index_running(it);
+	table.erase(it);
+	EXPECT_TRUE(table.end() == table.find_running(0x2000));
+	EXPECT_TRUE(table.end() == table.find(2002));
+
+	table.clear();
+	EXPECT_TRUE(table.empty());
+	EXPECT_TRUE(table.end() == table.find(2003));
+}
+
+TEST(task_table_benchmark, Queued50kTasks)
+{
+	srand(4);
+	std::vector<Task> tasks;
+	for (uint32_t i = 1; i <= kTaskCount; ++i) tasks.push_back(__MakeTask(i));
+
+	std::vector<uint32_t> order;
+	for (uint32_t i = 1; i <= kTaskCount; ++i) order.push_back(i);
+	std::random_shuffle(order.begin(), order.end());
+
+	// as it was
+	std::list<TaskProfile> list;
+	uint64_t begin = __ThreadCpuNs();
+	for (int i = 0; i < kListStartCount; ++i) {
+		list.push_back(TaskProfile(tasks[i]));
+		list.sort(__CompareTask);
+	}
+	uint64_t list_start_ns = __ThreadCpuNs() - begin;
+
+	for (int i = kListStartCount; i < kTaskCount; ++i) list.push_back(TaskProfile(tasks[i]));
+	list.sort(__CompareTask);
+
+	begin = __ThreadCpuNs();
+	size_t found = 0;
+	for (int i = 0; i < kListLocateCount; ++i) found += list.end() != __ListLocate(list, order[i]);
+	uint64_t list_locate_ns = __ThreadCpuNs() - begin;
+	EXPECT_EQ((size_t)kListLocateCount, found);
+
+	begin = __ThreadCpuNs();
+	for (int i = 0; i < kListLocateCount; ++i) list.erase(__ListLocate(list, order[i]));
+	uint64_t list_stop_ns = __ThreadCpuNs() - begin;
+
+	// TaskTable
+	TaskTable table;
+	begin = __ThreadCpuNs();
+	for (int i = 0; i < kTaskCount; ++i) table.insert(TaskProfile(tasks[i]));
+	uint64_t table_start_ns = __ThreadCpuNs() - begin;
+
+	begin = __ThreadCpuNs();
+	found = 0;
+	for (int i = 0; i < kTaskCount; ++i) found += table.end() != table.find(order[i]);
+	uint64_t table_locate_ns = __ThreadCpuNs() - begin;
+	EXPECT_EQ((size_t)kTaskCount, found);
+
+	begin = __ThreadCpuNs();
+	for (int i = 0; i < kTaskCount; ++i) table.erase(table.find(order[i]));
+	uint64_t table_stop_ns = __ThreadCpuNs() - begin;
+	EXPECT_TRUE(table.empty());
+
+	printf("%d queued tasks\n", kTaskCount);
+	__Report("list push_back + sort, first 5k", kListStartCount, list_start_ns);
+	__Report("list find_if", kListLocateCount, list_locate_ns);
+	__Report("list find_if + erase", kListLocateCount, list_stop_ns);
+	__Report("TaskTable insert", kTaskCount, table_start_ns);
+	__Report("TaskTable find", kTaskCount, table_locate_ns);
+	__Report("TaskTable find + erase", kTaskCount, table_stop_ns);
+
+	EXPECT_LT(table_locate_ns / kTaskCount, list_locate_ns / kListLocateCount);
+}